@@ -0,0 +1,334 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <cyu3os.h>
+#include <cyu3usb.h>
+#include <cyu3dma.h>
+#include <cyu3error.h>
+#include "include/debug.h"
+#include "include/uvc.h"
+#include "include/ctrl_async.h"
+
+#define CTRL_STATUS_HEADER  5   // UVC status packet up to bAttribute, bValue follows
+
+struct ctrl_latency {
+  uint32_t bucket[CTRL_LATENCY_BUCKETS];
+  uint32_t max;
+};
+
+/* Setup packets, written by the USB setup callback and taken by the EP0 thread. */
+static struct {
+  uint32_t setupdat0;
+  uint32_t setupdat1;
+  uint32_t time;
+} ctrl_setup[CTRL_SETUP_SLOTS];
+static volatile uint8_t setup_head = 0, setup_tail = 0;
+
+/* Jobs, submitted by the EP0 thread and run by the control worker. */
+static struct {
+  ctrl_job_fn fn;
+  uint8_t op;
+  uint16_t seq;
+  uint16_t len;
+  uint32_t time;
+  uint8_t data[CTRL_JOB_DATA];
+} ctrl_job[CTRL_JOB_SLOTS];
+static volatile uint8_t job_head = 0, job_tail = 0;
+
+static struct {
+  uint16_t submitted;
+  uint16_t completed;
+  uint8_t last_op;
+  uint8_t last_status;     // enum CTRL_JOB_STATUS
+  uint8_t errors;
+  uint32_t requests;
+  uint32_t dropped;
+  struct ctrl_latency ep0;
+  struct ctrl_latency job;
+} ctrl_stat;
+
+static CyU3PDmaChannel glStatusHandle;    /* CPU to status interrupt endpoint channel handle */
+static CyU3PMutex glStatusLock;           /* worker and data thread both send status packets */
+
+/**
+ *  @brief      create the DMA channel of the status interrupt endpoint, configured by the caller.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void ctrl_async_init(void) {
+  CyU3PDmaChannelConfig_t dmaConfig;
+  CyU3PReturnStatus_t apiRetStatus;
+
+  CyU3PMemSet((uint8_t *)&dmaConfig, 0, sizeof(dmaConfig));
+  dmaConfig.size           = 16;
+  dmaConfig.count          = 2;
+  dmaConfig.prodSckId      = CY_U3P_CPU_SOCKET_PROD;
+  dmaConfig.consSckId      = (CyU3PDmaSocketId_t)(CY_U3P_UIB_SOCKET_CONS_0 |
+                                                  CY_FX_EP_CONTROL_STATUS_SOCKET);
+  dmaConfig.dmaMode        = CY_U3P_DMA_MODE_BYTE;
+  apiRetStatus = CyU3PDmaChannelCreate(&glStatusHandle, CY_U3P_DMA_TYPE_MANUAL_OUT, &dmaConfig);
+  if (apiRetStatus != CY_U3P_SUCCESS) {
+    sensor_err("status channel creation failed, Error Code = %d\r\n", apiRetStatus);
+    CyFxAppErrorHandler(apiRetStatus);
+  }
+  CyU3PDmaChannelSetXfer(&glStatusHandle, 0);
+  CyU3PMutexCreate(&glStatusLock, CYU3P_NO_INHERIT);
+}
+
+/**
+ *  @brief      queue a setup packet for the EP0 thread, called from the USB setup callback.
+ *              The slot of the oldest packet is reused once all are taken, ctrl_setup_get
+ *              skips it anyway.
+ *  @param[in]  setupdat0    SETUP Data 0.
+ *  @param[in]  setupdat1    SETUP Data 1.
+ *  @return     NULL.
+ */
+void ctrl_setup_put(uint32_t setupdat0, uint32_t setupdat1) {
+  uint8_t slot = setup_head & (CTRL_SETUP_SLOTS - 1);
+
+  ctrl_stat.requests++;
+  ctrl_setup[slot].setupdat0 = setupdat0;
+  ctrl_setup[slot].setupdat1 = setupdat1;
+  ctrl_setup[slot].time = CyU3PGetTime();
+  setup_head++;
+}
+
+/**
+ *  @brief      take the latest queued setup packet. A new SETUP aborts the control transfers
+ *              before it on the host, so older packets were aborted or timed out and are dropped.
+ *  @param[out] setupdat0    SETUP Data 0.
+ *  @param[out] setupdat1    SETUP Data 1.
+ *  @param[out] time         arrival time, for ctrl_setup_done.
+ *  @return     CyFalse if the queue is empty.
+ */
+CyBool_t ctrl_setup_get(uint32_t *setupdat0, uint32_t *setupdat1, uint32_t *time) {
+  uint8_t head = setup_head;
+  uint8_t slot = (head - 1) & (CTRL_SETUP_SLOTS - 1);
+
+  if (setup_tail == head)
+    return CyFalse;
+  ctrl_stat.dropped += (uint8_t)(head - setup_tail) - 1;
+  *setupdat0 = ctrl_setup[slot].setupdat0;
+  *setupdat1 = ctrl_setup[slot].setupdat1;
+  *time = ctrl_setup[slot].time;
+  setup_tail = head;
+  return CyTrue;
+}
+
+static void ctrl_latency_add(struct ctrl_latency *lat, uint32_t ms) {
+  uint8_t bucket = 0;
+
+  if (ms > lat->max)
+    lat->max = ms;
+  while (ms && bucket < CTRL_LATENCY_BUCKETS - 1) {
+    ms >>= 1;
+    bucket++;
+  }
+  lat->bucket[bucket]++;
+}
+
+/**
+ *  @brief      upper bound of the bucket holding a percentile.
+ *  @param[in]  lat     latencies.
+ *  @param[in]  pct     percentile.
+ *  @return     ms, 0 if nothing was recorded.
+ */
+static uint32_t ctrl_latency_pct(const struct ctrl_latency *lat, uint8_t pct) {
+  uint32_t total = 0, sum = 0, target;
+  uint8_t i;
+
+  for (i = 0; i < CTRL_LATENCY_BUCKETS; i++)
+    total += lat->bucket[i];
+  target = (total * pct + 99) / 100;
+  for (i = 0; i < CTRL_LATENCY_BUCKETS && total; i++) {
+    sum += lat->bucket[i];
+    if (sum >= target)
+      return i == CTRL_LATENCY_BUCKETS - 1 ? lat->max : (1UL << i) - 1;
+  }
+  return 0;
+}
+
+static void ctrl_latency_put(uint8_t *buffer, const struct ctrl_latency *lat) {
+  uint32_t value[4];
+  uint8_t i;
+
+  value[0] = ctrl_latency_pct(lat, 50);
+  value[1] = ctrl_latency_pct(lat, 90);
+  value[2] = ctrl_latency_pct(lat, 99);
+  value[3] = lat->max;
+  for (i = 0; i < 4; i++) {
+    if (value[i] > 0xFFFF)
+      value[i] = 0xFFFF;
+    buffer[2 * i] = value[i] >> 8;
+    buffer[2 * i + 1] = value[i] & 0xFF;
+  }
+}
+
+/**
+ *  @brief      record the latency of a handled setup packet.
+ *  @param[in]  time    arrival time from ctrl_setup_get.
+ *  @return     NULL.
+ */
+void ctrl_setup_done(uint32_t time) {
+  ctrl_latency_add(&ctrl_stat.ep0, CyU3PGetTime() - time);
+}
+
+/**
+ *  @brief      whether ctrl_async_submit would fail, checked before taking the data of a request.
+ *  @param[out] NULL.
+ *  @return     CyTrue if all job slots are taken.
+ */
+CyBool_t ctrl_async_full(void) {
+  return (uint8_t)(job_head - job_tail) >= CTRL_JOB_SLOTS;
+}
+
+/**
+ *  @brief      hand slow work of a control request to the control worker, EP0 thread only.
+ *  @param[in]  op      enum CTRL_OP, reported back in the async status.
+ *  @param[in]  fn      job.
+ *  @param[in]  data    job data, copied.
+ *  @param[in]  len     up to CTRL_JOB_DATA bytes.
+ *  @return     CyFalse if all job slots are taken, the host polls the async status then.
+ */
+CyBool_t ctrl_async_submit(uint8_t op, ctrl_job_fn fn, const uint8_t *data, uint16_t len) {
+  uint8_t slot = job_head & (CTRL_JOB_SLOTS - 1);
+
+  if (ctrl_async_full() || len > CTRL_JOB_DATA) {
+    sensor_err("control job %d not queued\r\n", op);
+    return CyFalse;
+  }
+  ctrl_job[slot].fn = fn;
+  ctrl_job[slot].op = op;
+  ctrl_job[slot].seq = ++ctrl_stat.submitted;
+  ctrl_job[slot].len = len;
+  ctrl_job[slot].time = CyU3PGetTime();
+  if (len)
+    CyU3PMemCopy(ctrl_job[slot].data, (uint8_t *)data, len);
+  job_head++;
+  CyU3PEventSet(&glFxUVCEvent, CY_FX_UVC_CTRL_JOB_EVENT, CYU3P_EVENT_OR);
+  return CyTrue;
+}
+
+/**
+ *  @brief      fill in the async status XU payload.
+ *  @param[out] buffer  CTRL_ASYNC_LEN bytes.
+ *  @return     NULL.
+ */
+void ctrl_async_status(uint8_t *buffer) {
+  CyU3PMemSet(buffer, 0, CTRL_ASYNC_LEN);
+  buffer[0] = ctrl_stat.submitted >> 8;
+  buffer[1] = ctrl_stat.submitted & 0xFF;
+  buffer[2] = ctrl_stat.completed >> 8;
+  buffer[3] = ctrl_stat.completed & 0xFF;
+  buffer[4] = (uint8_t)(job_head - job_tail);
+  buffer[5] = ctrl_stat.last_op;
+  buffer[6] = ctrl_stat.last_status;
+  buffer[7] = ctrl_stat.errors;
+  ctrl_latency_put(&buffer[8], &ctrl_stat.ep0);
+  ctrl_latency_put(&buffer[16], &ctrl_stat.job);
+  buffer[24] = ctrl_stat.requests >> 24;
+  buffer[25] = ctrl_stat.requests >> 16;
+  buffer[26] = ctrl_stat.requests >> 8;
+  buffer[27] = ctrl_stat.requests & 0xFF;
+  buffer[28] = ctrl_stat.dropped >> 24;
+  buffer[29] = ctrl_stat.dropped >> 16;
+  buffer[30] = ctrl_stat.dropped >> 8;
+  buffer[31] = ctrl_stat.dropped & 0xFF;
+}
+
+/**
+ *  @brief      clear counters and latencies, sequence numbers keep counting.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void ctrl_async_clear(void) {
+  ctrl_stat.errors = 0;
+  ctrl_stat.requests = 0;
+  ctrl_stat.dropped = 0;
+  CyU3PMemSet((uint8_t *)&ctrl_stat.ep0, 0, sizeof(ctrl_stat.ep0));
+  CyU3PMemSet((uint8_t *)&ctrl_stat.job, 0, sizeof(ctrl_stat.job));
+}
+
+/**
+ *  @brief      send a UVC control change status packet of an extension unit control.
+ *  @param[in]  selector  CY_FX_UVC_XU_* control selector.
+ *  @param[in]  value     bValue of the packet.
+ *  @param[in]  len       value bytes, up to CTRL_STATUS_VALUE_MAX.
+ *  @return     NULL.
+ */
+void ctrl_status_send(uint16_t selector, const uint8_t *value, uint8_t len) {
+  CyU3PDmaBuffer_t buf;
+
+  if (len > CTRL_STATUS_VALUE_MAX)
+    len = CTRL_STATUS_VALUE_MAX;
+  CyU3PMutexGet(&glStatusLock, CYU3P_WAIT_FOREVER);
+  /* Nobody polls the endpoint while the device is not open, the XU keeps the status anyway. */
+  if (CyU3PDmaChannelGetBuffer(&glStatusHandle, &buf, CYU3P_NO_WAIT) == CY_U3P_SUCCESS) {
+    buf.buffer[0] = 0x01;                             // VideoControl interface
+    buf.buffer[1] = CY_FX_UVC_EXTENSION_UNIT_ID;
+    buf.buffer[2] = 0x00;                             // control change
+    buf.buffer[3] = selector >> 8;
+    buf.buffer[4] = 0x00;                             // value change
+    CyU3PMemCopy(&buf.buffer[CTRL_STATUS_HEADER], (uint8_t *)value, len);
+    CyU3PDmaChannelCommitBuffer(&glStatusHandle, CTRL_STATUS_HEADER + len, 0);
+  }
+  CyU3PMutexPut(&glStatusLock);
+}
+
+/**
+ *  @brief      send the status packet of the async status XU for a completed job.
+ *  @param[in]  seq     completed job.
+ *  @param[in]  op      its enum CTRL_OP.
+ *  @param[in]  status  its enum CTRL_JOB_STATUS.
+ *  @return     NULL.
+ */
+static void ctrl_status_notify(uint16_t seq, uint8_t op, uint8_t status) {
+  uint8_t value[4];
+
+  value[0] = seq >> 8;
+  value[1] = seq & 0xFF;
+  value[2] = op;
+  value[3] = status;
+  ctrl_status_send(CY_FX_UVC_XU_CTRL_ASYNC_RW, value, sizeof(value));
+}
+
+/*
+ * Entry function for the control worker thread, runs the jobs of ctrl_async_submit in order.
+ */
+void Ctrl_Worker_Thread_Entry(uint32_t input) {
+  uint32_t flag;
+  uint8_t slot, status;
+
+  sensor_dbg("start control worker thread\r\n");
+  for (;;) {
+    if (CyU3PEventGet(&glFxUVCEvent, CY_FX_UVC_CTRL_JOB_EVENT, CYU3P_EVENT_OR_CLEAR, &flag,
+                      CYU3P_WAIT_FOREVER) != CY_U3P_SUCCESS)
+      continue;
+    while (job_tail != job_head) {
+      slot = job_tail & (CTRL_JOB_SLOTS - 1);
+      status = ctrl_job[slot].fn(ctrl_job[slot].data, ctrl_job[slot].len) ? CTRL_JOB_OK :
+               CTRL_JOB_ERROR;
+      ctrl_latency_add(&ctrl_stat.job, CyU3PGetTime() - ctrl_job[slot].time);
+      ctrl_stat.completed = ctrl_job[slot].seq;
+      ctrl_stat.last_op = ctrl_job[slot].op;
+      ctrl_stat.last_status = status;
+      if (status == CTRL_JOB_ERROR && ctrl_stat.errors < 0xFF)
+        ctrl_stat.errors++;
+      job_tail++;
+      ctrl_status_notify(ctrl_stat.completed, ctrl_stat.last_op, status);
+    }
+  }
+}
@@ -33,6 +33,8 @@
 #include "include/fx3_bsp.h"
 #include "include/debug.h"
 #include "include/extension_unit.h"
+#include "include/vendor_bulk.h"
+#include "include/device_info.h"
 
 // Standard Device Descriptor
 const uint8_t CyFxUSBDeviceDscr[] = {
@@ -101,8 +103,8 @@ uint8_t CyFxUSBHSConfigDscr[] = {
     // Configuration Descriptor Type
     0x09,                           // Descriptor Size
     CY_U3P_USB_CONFIG_DESCR,        // Configuration Descriptor Type
-    0xCD, 0x00,                     // Length of this descriptor and all sub descriptors
-    0x02,                           // Number of interfaces
+    0x03, 0x01,                     // Length of this descriptor and all sub descriptors
+    0x03,                           // Number of interfaces
     0x01,                           // Configuration number
     0x00,                           // COnfiguration string index
     0x80,                           // Config characteristics - Bus powered
@@ -134,7 +136,7 @@ uint8_t CyFxUSBHSConfigDscr[] = {
     0x24,                           // Class Specific I/f Header Descriptor type
     0x01,                           // Descriptor Sub type : VC_HEADER
     0x00, 0x01,                     // Revision of class spec : 1.0
-    0x50, 0x00,                     // Total Size of class specific descriptors
+    0x51, 0x00,                     // Total Size of class specific descriptors
     0x00, 0x6C, 0xDC, 0x02,         // Clock frequency : 48MHz(Deprecated)
     0x01,                           // Number of streaming interfaces
     0x01,                           // Video streaming I/f 1 belongs to VC i/f
@@ -178,7 +180,7 @@ uint8_t CyFxUSBHSConfigDscr[] = {
     0x00,                           // String desc index : Not used
 
     // Extension Unit Descriptor
-    0x1C,                           // Descriptor size
+    0x1D,                           // Descriptor size
     0x24,                           // Class specific interface desc type
     0x06,                           // Extension Unit Descriptor type
     0x03,                           // ID of this terminal
@@ -189,8 +191,8 @@ uint8_t CyFxUSBHSConfigDscr[] = {
     0x03,                           // Number of controls in this terminal
     0x01,                           // Number of input pins in this terminal
     0x02,                           // Source ID : 2 : Connected to Proc Unit
-    0x03,                           // Size of controls field for this terminal : 3 bytes
-    0xFF, 0xFF, 0xFF,
+    0x04,                           // Size of controls field for this terminal : 4 bytes
+    0xFF, 0xFF, 0xFF, 0xFF,         // Controls 1 ~ 32
     0x00,                           // String desc index : Not used
 
     // Output Terminal Descriptor
@@ -233,7 +235,7 @@ uint8_t CyFxUSBHSConfigDscr[] = {
     0x24,                           // Class-specific VS I/f Type
     0x01,                           // Descriptotor Subtype : Input Header
     0x01,                           // 1 format desciptor follows
-    0x29, 0x00,                     // Total size of Class specific VS descr: 41 Bytes
+    0x65, 0x00,                     // Total size of Class specific VS descr: 101 Bytes
     CY_FX_EP_BULK_VIDEO,            // EP address for BULK video data
     0x00,                           // No dynamic format change supported
     0x04,                           // Output terminal ID : 4
@@ -249,7 +251,7 @@ uint8_t CyFxUSBHSConfigDscr[] = {
     0x24,                           // Class-specific VS I/f Type
     0x04,                           // Subtype : uncompressed format I/F
     0x01,                           // Format desciptor index (only one format is supported)
-    0x01,                           // number of frame descriptor followed
+    RES_NUM,                        // number of frame descriptor followed
     0x59, 0x55, 0x59, 0x32,         // GUID used to identify streaming-encoding format: YUY2
     0x00, 0x00, 0x10, 0x00,
     0x80, 0x00, 0x00, 0xAA,
@@ -280,6 +282,22 @@ uint8_t CyFxUSBHSConfigDscr[] = {
                                     // supported
     0x2A, 0x2C, 0x0A, 0x00,         // Shortest Frame Interval
 
+    // Class specific Uncompressed VS Frame descriptor: 2x2 binned (MT9V034) or skipped (AR0141)
+    0x1E,                           // Descriptor size
+    0x24,                           // Descriptor type*/
+    0x05,                           // Subtype: uncompressed frame I/F
+    0x02,                           // Frame Descriptor Index
+    0x03,                           // Still image capture method 1 supported, fixed frame rate
+    0x40, 0x01,                     // Width in pixel: 320-QVGA
+    0xF0, 0x00,                     // Height in pixel 240-QVGA
+    0x00, 0x40, 0x19, 0x01,         // Min bit rate bits/s.
+    0x00, 0x40, 0x19, 0x01,         // Max bit rate bits/s.
+    0x00, 0x58, 0x02, 0x00,         // Maximum video or still frame size in bytes(Deprecated)
+    0x2A, 0x2C, 0x0A, 0x00,         // Default Frame Interval
+    0x01,                           // Frame interval(Frame Rate) types: Only one frame interval
+                                    // supported
+    0x2A, 0x2C, 0x0A, 0x00,         // Shortest Frame Interval
+
     // Endpoint Descriptor for BULK Streaming Video Data
     0x07,                           // Descriptor size
     CY_U3P_USB_ENDPNT_DESCR,        // Endpoint Descriptor Type
@@ -287,7 +305,36 @@ uint8_t CyFxUSBHSConfigDscr[] = {
     0x02,                           // BULK End point
     (uint8_t)(512 & 0x00FF),        // High speed max packet size is always 512 bytes.
     (uint8_t)((512 & 0xFF00)>>8),
-    0x01                            // Servicing interval for data transfers
+    0x01,                           // Servicing interval for data transfers
+
+    // Vendor Bulk Interface Descriptor, flash, calibration and register transfers
+    0x09,                           // Descriptor size
+    CY_U3P_USB_INTRFC_DESCR,        // Interface Descriptor type
+    0x02,                           // Interface number
+    0x00,                           // Alternate setting number
+    0x02,                           // Number of end points
+    0xFF,                           // Interface class : Vendor specific
+    0x00,                           // Interface sub class
+    0x00,                           // Interface protocol code
+    0x00,                           // Interface descriptor string index
+
+    // Endpoint Descriptor for Vendor Bulk commands and data from host
+    0x07,                           // Descriptor size
+    CY_U3P_USB_ENDPNT_DESCR,        // Endpoint Descriptor Type
+    CY_FX_EP_PRODUCER,              // Endpoint address and description
+    CY_U3P_USB_EP_BULK,             // BULK End point
+    (uint8_t)(512 & 0x00FF),        // High speed max packet size is always 512 bytes.
+    (uint8_t)((512 & 0xFF00)>>8),
+    0x00,                           // Servicing interval for data transfers
+
+    // Endpoint Descriptor for Vendor Bulk status and data to host
+    0x07,                           // Descriptor size
+    CY_U3P_USB_ENDPNT_DESCR,        // Endpoint Descriptor Type
+    CY_FX_EP_CONSUMER,              // Endpoint address and description
+    CY_U3P_USB_EP_BULK,             // BULK End point
+    (uint8_t)(512 & 0x00FF),        // High speed max packet size is always 512 bytes.
+    (uint8_t)((512 & 0xFF00)>>8),
+    0x00                            // Servicing interval for data transfers
 };
 
 // BOS for SS
@@ -332,8 +379,8 @@ uint8_t CyFxUSBSSConfigDscr[] = {
     0x09,                           // Descriptor Size
     CY_U3P_USB_CONFIG_DESCR,        // Configuration Descriptor Type
     // 0x57, 0x01,
-    0xE4, 0x00,
-    0x02,
+    0x32, 0x01,
+    0x03,
     0x01,                           // Configuration number
     0x00,                           // Configuration string index
     0x80,                           // Config characteristics - Bus powered
@@ -366,7 +413,7 @@ uint8_t CyFxUSBSSConfigDscr[] = {
     0x01,                           // Descriptor Sub type : VC_HEADER
     0x00, 0x01,                     // org,0x00,0x10,kg USB30CV, CAN NOT be changed,ERROR FX3,
                                     // Revision of class spec : 1.0
-    0x4F, 0x00,
+    0x50, 0x00,
     0x00, 0x6C, 0xDC, 0x02,         // Clock frequency : 48MHz(Deprecated)
     0x01,                           // Number of streaming interfaces
     0x01,                           // Video streaming I/f 1 belongs to VC i/f
@@ -410,7 +457,7 @@ uint8_t CyFxUSBSSConfigDscr[] = {
     0x00,                           // String desc index : Not used
 
     // Extension Unit Descriptor
-    0x1C,                           // Descriptor size
+    0x1D,                           // Descriptor size
     0x24,                           // Class specific interface desc type
     0x06,                           // Extension Unit Descriptor type
     0x03,                           // ID of this terminal
@@ -421,8 +468,8 @@ uint8_t CyFxUSBSSConfigDscr[] = {
     0x03,                           // Number of controls in this terminal
     0x01,                           // Number of input pins in this terminal
     0x02,                           // Source ID : 2 : Connected to Proc Unit
-    0x03,                           // Size of controls field for this terminal : 3 bytes
-    0xFF, 0xFF, 0xFF,               // No controls supported
+    0x04,                           // Size of controls field for this terminal : 4 bytes
+    0xFF, 0xFF, 0xFF, 0xFF,         // Controls 1 ~ 32
     0x00,                           // String desc index : Not used
 
     // Output Terminal Descriptor
@@ -475,7 +522,7 @@ uint8_t CyFxUSBSSConfigDscr[] = {
     0x24,                           // Class-specific VS I/f Type
     0x01,                           // Descriptotor Subtype : Input Header
     0x01,                           // 1 format desciptor follows  support more resolutions*/
-    0x53, 0x00,
+    0x7D, 0x00,
     CY_FX_EP_BULK_VIDEO,            // EP address for BULK video data
     0x00,                           // No dynamic format change supported
     0x04,                           // Output terminal ID : 4
@@ -521,6 +568,24 @@ uint8_t CyFxUSBSSConfigDscr[] = {
     0x2A, 0x2C, 0x0A, 0x00,         // Maximum Frame interval
     0x40, 0x42, 0x0F, 0x00,         // Frame interval STEP
 
+    // Class specific Uncompressed VS frame descriptor: 2x2 binned (MT9V034) or skipped (AR0141)
+    0x2a,                           // Descriptor size
+    0x24,                           // Descriptor type*/
+    0x05,                           // Subtype: uncompressed frame I/F
+    0x02,                           // Frame Descriptor Index
+    0x01,                           // Still image capture method 1 supported
+    0x40, 0x01,                     // Width in pixel: 320
+    0xF0, 0x00,                     // Height in pixel: 240
+    0x00, 0x00, 0x65, 0x04,         // Min bit rate bits/s.
+    0x00, 0x00, 0x65, 0x04,         // Max bit rate bits/s.
+    0x00, 0x58, 0x02, 0x00,         // Maximum video or still frame size in bytes(Deprecated)
+    0x0A, 0x8B, 0x02, 0x00,         // Default frame interval, follows the binned frame rate
+    SUPPORTED_FRAMERATE_NUM,
+    0x0A, 0x8B, 0x02, 0x00,         // Shortest frame interval, follows the binned frame rate
+    0x15, 0x16, 0x05, 0x00,         // 30, 15 and 10 fps stretch the vertical blanking
+    0x2A, 0x2C, 0x0A, 0x00,
+    0x40, 0x42, 0x0F, 0x00,
+
     // Endpoint Descriptor for BULK Streaming Video Data
     0x07,                           // Descriptor size
     CY_U3P_USB_ENDPNT_DESCR,        // Endpoint Descriptor Type
@@ -537,6 +602,51 @@ uint8_t CyFxUSBSSConfigDscr[] = {
     0x0F,                           // Max number of packets per burst: 16
     0x00,                           // Attribute: Streams not defined
     0x00,                           // No meaning for bulk
+    0x00,
+
+    // Vendor Bulk Interface Descriptor, flash, calibration and register transfers
+    0x09,                           // Descriptor size
+    CY_U3P_USB_INTRFC_DESCR,        // Interface Descriptor type
+    0x02,                           // Interface number
+    0x00,                           // Alternate setting number
+    0x02,                           // Number of end points
+    0xFF,                           // Interface class : Vendor specific
+    0x00,                           // Interface sub class
+    0x00,                           // Interface protocol code
+    0x00,                           // Interface descriptor string index
+
+    // Endpoint Descriptor for Vendor Bulk commands and data from host
+    0x07,                           // Descriptor size
+    CY_U3P_USB_ENDPNT_DESCR,        // Endpoint Descriptor Type
+    CY_FX_EP_PRODUCER,              // Endpoint address and description
+    CY_U3P_USB_EP_BULK,             // BULK End point
+    (uint8_t)(VENDOR_BULK_PKT_SIZE & 0x00FF),  // EP MaxPcktSize: 1024B
+    (uint8_t)((VENDOR_BULK_PKT_SIZE & 0xFF00) >> 8),
+    0x00,                           // Servicing interval for data transfers
+
+    // Super Speed Endpoint Companion Descriptor
+    0x06,                           // Descriptor size
+    CY_U3P_SS_EP_COMPN_DESCR,       // SS Endpoint Companion Descriptor Type
+    VENDOR_BULK_BURST - 1,          // Max number of packets per burst: 4
+    0x00,                           // Attribute: Streams not defined
+    0x00,                           // No meaning for bulk
+    0x00,
+
+    // Endpoint Descriptor for Vendor Bulk status and data to host
+    0x07,                           // Descriptor size
+    CY_U3P_USB_ENDPNT_DESCR,        // Endpoint Descriptor Type
+    CY_FX_EP_CONSUMER,              // Endpoint address and description
+    CY_U3P_USB_EP_BULK,             // BULK End point
+    (uint8_t)(VENDOR_BULK_PKT_SIZE & 0x00FF),  // EP MaxPcktSize: 1024B
+    (uint8_t)((VENDOR_BULK_PKT_SIZE & 0xFF00) >> 8),
+    0x00,                           // Servicing interval for data transfers
+
+    // Super Speed Endpoint Companion Descriptor
+    0x06,                           // Descriptor size
+    CY_U3P_SS_EP_COMPN_DESCR,       // SS Endpoint Companion Descriptor Type
+    VENDOR_BULK_BURST - 1,          // Max number of packets per burst: 4
+    0x00,                           // Attribute: Streams not defined
+    0x00,                           // No meaning for bulk
     0x00
 };
 
@@ -601,17 +711,12 @@ void update_serial_number_dscr(void) {
   char *version_info = FIRMWARE_VERSION;
   const char *error_info = "device ID NULL or too long";
   int version_len = strlen(version_info);
-  struct flash_struct_t flash_store;
-  uint16_t flash_len = sizeof (struct flash_struct_t);
-  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
-
-  CyU3PMemSet((uint8_t *)(&flash_store), 0, flash_len);
-  apiRetStatus = CyFxFlashProgSpiTransfer(DEVICE_MSG_ADDR, flash_len, (uint8_t *)(&flash_store),
-                                            CyTrue);
-  if (apiRetStatus != CY_U3P_SUCCESS) {
-    sensor_err("read Flash error\r\n");
-  }
-  uint16_t deviceID_len = strlen((char *)(&(flash_store.Sensor_ID)));
+  const uint8_t *serial;
+  uint8_t deviceID_len = 0;
+
+  serial = device_info_get(DEVINFO_TAG_SERIAL, &deviceID_len);
+  if (serial == NULL)
+    deviceID_len = 0;
   memset(CyFxUSBSerialNumberDscr, 0, sizeof(CyFxUSBSerialNumberDscr));
   CyFxUSBSerialNumberDscr[1] = CY_U3P_USB_STRING_DESCR;
 
@@ -622,7 +727,7 @@ void update_serial_number_dscr(void) {
   if ((version_len + deviceID_len + 1) <= (256 - 2) >> 2) {
     CyFxUSBSerialNumberDscr[0] = 2 + (version_len + deviceID_len + 1) * 2;
     for (i = 0; i < deviceID_len; i++) {
-      CyFxUSBSerialNumberDscr[2 + version_len * 2 + 2 + i * 2] = flash_store.Sensor_ID[i];
+      CyFxUSBSerialNumberDscr[2 + version_len * 2 + 2 + i * 2] = serial[i];
     }
   } else {
     CyFxUSBSerialNumberDscr[0] = 2 + (version_len + strlen(error_info) + 1) * 2;
@@ -655,49 +760,85 @@ void update_hard_version_dscr(void) {
     CyFxUSBProductDscr[2 + i * 2] = *(hard_version_info + i);
   }
 }
+/* wWidth offsets of the frame descriptors in the configuration descriptors */
+#define HS_FRAME_FULL_DSCR_OFFSET     174
+#define HS_FRAME_BINNED_DSCR_OFFSET   204
+#define SS_FRAME_FULL_DSCR_OFFSET     179
+#define SS_FRAME_BINNED_DSCR_OFFSET   221
+
+/**
+ *  @brief      write a 32 bit little endian field of a descriptor.
+ *  @param[out] dscr    field in descriptor.
+ *  @param[in]  value   field value.
+ *  @return     NULL.
+ */
+static void dscr_set_dword(uint8_t *dscr, uint32_t value) {
+  dscr[0] = value & 0xFF;
+  dscr[1] = (value >> 8) & 0xFF;
+  dscr[2] = (value >> 16) & 0xFF;
+  dscr[3] = (value >> 24) & 0xFF;
+}
+
+/**
+ *  @brief      update sensor window to an uncompressed frame descriptor.
+ *  @param[out] frame_dscr    wWidth field of the frame descriptor.
+ *  @param[in]  width         frame width.
+ *  @param[in]  height        frame height.
+ *  @param[in]  fps           frame rate of the window, 0 keeps the descriptor frame intervals.
+ *  @return     NULL.
+ */
+static void update_frame_dscr(uint8_t *frame_dscr, uint16_t width, uint16_t height, uint8_t fps) {
+  uint32_t frame_size = (uint32_t)width * height * 2;
+  uint32_t interval;
+  uint8_t *last;
+
+  // wWidth, wHeight, dwMinBitRate, dwMaxBitRate, dwMaxVideoFrameBufferSize,
+  // dwDefaultFrameInterval, bFrameIntervalType, dwFrameInterval[0]
+  frame_dscr[0] = width & 0xFF;
+  frame_dscr[1] = width >> 8;
+  frame_dscr[2] = height & 0xFF;
+  frame_dscr[3] = height >> 8;
+  if (fps) {
+    // the shortest interval is listed first, it is the rate the sensor runs at
+    interval = 10000000 / fps;
+    dscr_set_dword(frame_dscr + 16, interval);
+    dscr_set_dword(frame_dscr + 21, interval);
+  }
+  interval = frame_dscr[16] | frame_dscr[17] << 8 | frame_dscr[18] << 16 | frame_dscr[19] << 24;
+  dscr_set_dword(frame_dscr + 8, frame_size * 8 * (10000000 / interval));
+  // the longest listed interval gives the minimum bit rate
+  last = frame_dscr + 21 + 4 * (frame_dscr[20] - 1);
+  interval = last[0] | last[1] << 8 | last[2] << 16 | (uint32_t)last[3] << 24;
+  dscr_set_dword(frame_dscr + 4, frame_size * 8 * (10000000 / interval));
+  dscr_set_dword(frame_dscr + 12, frame_size);
+}
+
 /**
  *  @brief      update sensor Resolution to usb2.0 Configuration Descriptor.
  *  @param[out] NULL.
  *  @return     NULL.
  */
-void update_HS_config_dscr(enum SensorType sensor_type) {
-  uint16_t width = 0;
-  uint16_t height = 0;
-  if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
-    width = 1280;
-    height = 720;
-  } else {
-    width = 640;
-    height = 480;
-  }
-  CyFxUSBHSConfigDscr[173] = width & 0xFF;
-  CyFxUSBHSConfigDscr[174] = width >> 8;
-  CyFxUSBHSConfigDscr[175] = height & 0xFF;
-  CyFxUSBHSConfigDscr[176] = height >> 8;
+void update_HS_config_dscr(void) {
+  uint8_t *frame_dscr = &CyFxUSBHSConfigDscr[HS_FRAME_FULL_DSCR_OFFSET];
+
+  // usb2.0 keeps its single 15 fps interval, the bus can not carry more
+  update_frame_dscr(frame_dscr, sensor_roi.width, sensor_roi.height, 0);
+  update_frame_dscr(&CyFxUSBHSConfigDscr[HS_FRAME_BINNED_DSCR_OFFSET],
+                    sensor_roi.width / 2, sensor_roi.height / 2, 0);
   sensor_dbg("HS config width: %d height: %d \r\n",
-             CyFxUSBHSConfigDscr[173] | CyFxUSBHSConfigDscr[174] << 8,
-             CyFxUSBHSConfigDscr[175] | CyFxUSBHSConfigDscr[176] << 8);
+             frame_dscr[0] | frame_dscr[1] << 8, frame_dscr[2] | frame_dscr[3] << 8);
 }
 /**
  *  @brief      update sensor Resolution to usb3.0 Configuration Descriptor.
  *  @param[out] NULL.
  *  @return     NULL.
  */
-void update_SS_config_dscr(enum SensorType sensor_type) {
-  uint16_t width = 0;
-  uint16_t height = 0;
-  if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
-    width = 1280;
-    height = 720;
-  } else {
-    width = 640;
-    height = 480;
-  }
-  CyFxUSBSSConfigDscr[178] = width & 0xFF;
-  CyFxUSBSSConfigDscr[179] = width >> 8;
-  CyFxUSBSSConfigDscr[180] = height & 0xFF;
-  CyFxUSBSSConfigDscr[181] = height >> 8;
+void update_SS_config_dscr(void) {
+  uint8_t *frame_dscr = &CyFxUSBSSConfigDscr[SS_FRAME_FULL_DSCR_OFFSET];
+
+  update_frame_dscr(frame_dscr, sensor_roi.width, sensor_roi.height, sensor_roi.fps);
+  update_frame_dscr(&CyFxUSBSSConfigDscr[SS_FRAME_BINNED_DSCR_OFFSET],
+                    sensor_roi.width / 2, sensor_roi.height / 2, sensor_roi.bin_fps);
   sensor_dbg("SS config width: %d height: %d \r\n",
-             CyFxUSBSSConfigDscr[178] | CyFxUSBSSConfigDscr[179] << 8,
-             CyFxUSBSSConfigDscr[180] | CyFxUSBSSConfigDscr[181] << 8);
+             frame_dscr[0] | frame_dscr[1] << 8, frame_dscr[2] | frame_dscr[3] << 8);
 }
@@ -0,0 +1,195 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <cyu3os.h>
+#include <cyu3error.h>
+#include <cyu3utils.h>
+#include "include/debug.h"
+#include "include/uvc.h"
+#include "include/extension_unit.h"
+#include "include/cyfxuvcdscr.h"
+#include "include/device_info.h"
+
+/* RAM copy of the record, always in the current format, also after reading an old page. */
+static uint8_t devinfo[DEVINFO_LEN];
+
+static uint16_t devinfo_tlv_len(const uint8_t *record) {
+  return record[4] << 8 | record[5];
+}
+
+/**
+ *  @brief      check the tlv framing of a record, each entry has to end inside tlv len.
+ *  @param[in]  record  record.
+ *  @return     CyTrue if header, crc and framing are fine.
+ */
+static CyBool_t device_info_valid(const uint8_t *record) {
+  uint16_t len = devinfo_tlv_len(record);
+  uint16_t offset = 0, crc;
+
+  if (((record[0] << 8) | record[1]) != DEVINFO_MAGIC || record[2] == 0 || len > DEVINFO_TLV_MAX)
+    return CyFalse;
+  crc = flash_crc16(&record[DEVINFO_HEADER_LEN], len);
+  if (record[6] != (crc & 0xFF) || record[7] != (crc >> 8))
+    return CyFalse;
+  while (offset < len) {
+    if (offset + 2 > len || offset + 2 + record[DEVINFO_HEADER_LEN + offset + 1] > len)
+      return CyFalse;
+    offset += 2 + record[DEVINFO_HEADER_LEN + offset + 1];
+  }
+  return CyTrue;
+}
+
+/**
+ *  @brief      fill in the header of a record for len bytes of tlv.
+ *  @param[out] record  record, tlv already in place.
+ *  @param[in]  len     tlv bytes.
+ *  @return     NULL.
+ */
+static void device_info_header(uint8_t *record, uint16_t len) {
+  uint16_t crc = flash_crc16(&record[DEVINFO_HEADER_LEN], len);
+
+  record[0] = DEVINFO_MAGIC >> 8;
+  record[1] = DEVINFO_MAGIC & 0xFF;
+  record[2] = DEVINFO_VERSION;
+  record[3] = 0;
+  record[4] = len >> 8;
+  record[5] = len & 0xFF;
+  record[6] = crc & 0xFF;
+  record[7] = crc >> 8;
+}
+
+/**
+ *  @brief      read the record from flash into RAM, converting an old flash_struct_t page.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void device_info_load(void) {
+  uint8_t id[sizeof(((struct flash_struct_t *)0)->Sensor_ID)];
+  uint8_t len = 0;
+
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  if (CyFxFlashProgSpiTransfer(DEVICE_MSG_ADDR, DEVINFO_LEN, devinfo, CyTrue) != CY_U3P_SUCCESS)
+    CyU3PMemSet(devinfo, 0xFF, DEVINFO_LEN);
+  CyU3PMutexPut(&glSpiLock);
+  if (device_info_valid(devinfo)) {
+    sensor_info("device info: version %d, %d bytes\r\n", devinfo[2], devinfo_tlv_len(devinfo));
+    return;
+  }
+
+  /* Sensor_ID of the old layout, up to the first NUL or erased byte. */
+  CyU3PMemCopy(id, devinfo, sizeof(id));
+  while (len < sizeof(id) && id[len] >= ' ' && id[len] < 0x7F)
+    len++;
+  CyU3PMemSet(devinfo, 0, DEVINFO_LEN);
+  if (len) {
+    devinfo[DEVINFO_HEADER_LEN] = DEVINFO_TAG_SERIAL;
+    devinfo[DEVINFO_HEADER_LEN + 1] = len;
+    CyU3PMemCopy(&devinfo[DEVINFO_HEADER_LEN + 2], id, len);
+    len += 2;
+  }
+  device_info_header(devinfo, len);
+  sensor_info("device info: no record, %d bytes of old device ID\r\n", len ? len - 2 : 0);
+}
+
+/**
+ *  @brief      find an entry of the RAM record.
+ *  @param[in]  tag     DEVINFO_TAG.
+ *  @param[out] len     value length.
+ *  @return     value, NULL if the record has no such entry.
+ */
+const uint8_t *device_info_get(uint8_t tag, uint8_t *len) {
+  uint16_t end = DEVINFO_HEADER_LEN + devinfo_tlv_len(devinfo);
+  uint16_t offset = DEVINFO_HEADER_LEN;
+
+  for (; offset < end; offset += 2 + devinfo[offset + 1]) {
+    if (devinfo[offset] == tag) {
+      *len = devinfo[offset + 1];
+      return &devinfo[offset + 2];
+    }
+  }
+  return NULL;
+}
+
+/**
+ *  @brief      copy the RAM record.
+ *  @param[out] record  DEVINFO_LEN bytes.
+ *  @return     NULL.
+ */
+void device_info_record(uint8_t *record) {
+  CyU3PMemCopy(record, devinfo, DEVINFO_LEN);
+}
+
+/**
+ *  @brief      write a complete record to flash and reload it, the serial number descriptor
+ *              follows on the next enumeration.
+ *  @param[in]  record  DEVINFO_LEN bytes.
+ *  @return     CyTrue if the record is valid and written.
+ */
+CyBool_t device_info_write(const uint8_t *record) {
+  uint8_t page[DEVINFO_LEN];
+  CyBool_t ok;
+
+  if (!device_info_valid(record)) {
+    sensor_err("device info: invalid record\r\n");
+    return CyFalse;
+  }
+  /* Bytes past the tlv are written erased, so a shorter record leaves no stale tail. */
+  CyU3PMemSet(page, 0xFF, DEVINFO_LEN);
+  CyU3PMemCopy(page, (uint8_t *)record, DEVINFO_HEADER_LEN + devinfo_tlv_len(record));
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  ok = CyFxFlashProgEraseSectorWait(DEVICE_MSG_ADDR * SPI_FLASH_PAGE_SIZE /
+                                    SPI_FLASH_SECTOR_SIZE) == CY_U3P_SUCCESS &&
+       CyFxFlashProgSpiTransfer(DEVICE_MSG_ADDR, DEVINFO_LEN, page, CyFalse) == CY_U3P_SUCCESS;
+  device_info_load();
+  CyU3PMutexPut(&glSpiLock);
+  if (!ok || CyU3PMemCmp(devinfo, page, DEVINFO_HEADER_LEN + devinfo_tlv_len(page))) {
+    sensor_err("device info: write failed\r\n");
+    return CyFalse;
+  }
+  update_serial_number_dscr();
+  return CyTrue;
+}
+
+/**
+ *  @brief      replace one entry of the record and write it, other entries are kept.
+ *  @param[in]  tag     DEVINFO_TAG.
+ *  @param[in]  value   value.
+ *  @param[in]  len     value length, 0 removes the entry.
+ *  @return     CyTrue if written.
+ */
+CyBool_t device_info_set(uint8_t tag, const uint8_t *value, uint8_t len) {
+  uint8_t record[DEVINFO_LEN];
+  uint16_t end = DEVINFO_HEADER_LEN + devinfo_tlv_len(devinfo);
+  uint16_t offset, out = DEVINFO_HEADER_LEN;
+
+  CyU3PMemSet(record, 0, DEVINFO_LEN);
+  for (offset = DEVINFO_HEADER_LEN; offset < end; offset += 2 + devinfo[offset + 1]) {
+    if (devinfo[offset] == tag)
+      continue;
+    CyU3PMemCopy(&record[out], &devinfo[offset], 2 + devinfo[offset + 1]);
+    out += 2 + devinfo[offset + 1];
+  }
+  if (len) {
+    if (out + 2 + len > DEVINFO_LEN)
+      return CyFalse;
+    record[out] = tag;
+    record[out + 1] = len;
+    CyU3PMemCopy(&record[out + 2], (uint8_t *)value, len);
+    out += 2 + len;
+  }
+  device_info_header(record, out - DEVINFO_HEADER_LEN);
+  return device_info_write(record);
+}
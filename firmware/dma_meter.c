@@ -0,0 +1,176 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#include <cyu3os.h>
+#include <cyu3vic.h>
+#include <cyu3utils.h>
+#include "include/uvc.h"
+#include "include/fx3_bsp.h"
+#include "include/dma_meter.h"
+#include "include/byte_order.h"
+
+struct meter_sample {
+  uint32_t frame;
+  uint32_t bytes;
+  uint32_t interval_us;
+  uint32_t full_us;
+  uint16_t gap_us;
+  uint8_t inflight;
+};
+
+static struct meter_sample samples[METER_SAMPLES];
+static uint32_t sample_head = 0;
+/* Current frame in ticks, the UVC thread and the DMA callback both update it. */
+static uint32_t cur_bytes, cur_full, cur_gap;
+static uint8_t cur_inflight;
+/* Ticks | 1 since all buffers are in flight, of the last consumer event and frame end. */
+static uint32_t full_since, last_cons, last_frame;
+static uint32_t total_frames, total_full_us, total_gap_us;
+static uint8_t total_inflight;
+
+/**
+ *  @brief      forget the partial frame and the last event times, at stream start.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void meter_start(void) {
+  uint32_t mask = CyU3PVicDisableAllInterrupts();
+
+  cur_bytes = cur_full = cur_gap = 0;
+  cur_inflight = 0;
+  full_since = last_cons = last_frame = 0;
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      count a buffer committed to the USB consumer.
+ *  @param[in]  bytes     bytes committed.
+ *  @param[in]  inflight  buffers committed and not yet consumed, this one included.
+ *  @param[in]  ticks     fx3_ticks() of the commit.
+ *  @return     NULL.
+ */
+void meter_commit(uint16_t bytes, uint8_t inflight, uint32_t ticks) {
+  uint32_t mask = CyU3PVicDisableAllInterrupts();
+
+  cur_bytes += bytes;
+  if (inflight > cur_inflight)
+    cur_inflight = inflight;
+  if (inflight >= CY_FX_UVC_STREAM_BUF_TOTAL && !full_since)
+    full_since = ticks | 1;
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      count a USB consumer event, the gap starts at the commit of the buffer or
+ *              at the consumer event before, whichever is later.
+ *  @param[in]  commit_ticks  fx3_ticks() of the commit of the consumed buffer.
+ *  @param[in]  ticks         fx3_ticks() of the consumer event.
+ *  @return     NULL.
+ */
+void meter_consume(uint32_t commit_ticks, uint32_t ticks) {
+  uint32_t mask = CyU3PVicDisableAllInterrupts();
+  uint32_t start = commit_ticks;
+
+  if (last_cons && (int32_t)(last_cons - commit_ticks) > 0)
+    start = last_cons;
+  if (ticks - start > cur_gap)
+    cur_gap = ticks - start;
+  last_cons = ticks | 1;
+  if (full_since) {
+    cur_full += ticks - full_since;
+    full_since = 0;
+  }
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      close the sample of a frame once all its buffers are consumed.
+ *  @param[in]  frame   frame count.
+ *  @return     NULL.
+ */
+void meter_frame(uint32_t frame) {
+  uint32_t ticks = fx3_ticks(), mask;
+  struct meter_sample *s = &samples[sample_head % METER_SAMPLES];
+
+  mask = CyU3PVicDisableAllInterrupts();
+  s->frame = frame;
+  s->bytes = cur_bytes;
+  s->interval_us = last_frame ? TICKS_TO_US(ticks - last_frame) : 0;
+  s->full_us = TICKS_TO_US(cur_full);
+  s->gap_us = TICKS_TO_US(cur_gap) > 0xFFFF ? 0xFFFF : TICKS_TO_US(cur_gap);
+  s->inflight = cur_inflight;
+  sample_head++;
+  total_frames++;
+  total_full_us += s->full_us;
+  if (TICKS_TO_US(cur_gap) > total_gap_us)
+    total_gap_us = TICKS_TO_US(cur_gap);
+  if (cur_inflight > total_inflight)
+    total_inflight = cur_inflight;
+  last_frame = ticks | 1;
+  cur_bytes = cur_full = cur_gap = 0;
+  cur_inflight = 0;
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      meter as laid out in dma_meter.h.
+ *  @param[out] buffer  METER_XU_LEN bytes.
+ *  @return     NULL.
+ */
+void meter_read(uint8_t *buffer) {
+  uint32_t mask, head;
+  uint8_t i, count;
+  struct meter_sample *s;
+
+  CyU3PMemSet(buffer, 0, METER_XU_LEN);
+  /* A few hundred stores, under one lock so the totals and the samples agree. */
+  mask = CyU3PVicDisableAllInterrupts();
+  head = sample_head;
+  count = head < METER_SAMPLES ? head : METER_SAMPLES;
+  put_be32(&buffer[0], total_frames);
+  put_be32(&buffer[4], total_full_us);
+  put_be32(&buffer[8], total_gap_us);
+  buffer[12] = total_inflight;
+  buffer[13] = CY_FX_UVC_STREAM_BUF_TOTAL;
+  buffer[14] = count;
+  for (i = 0; i < count; i++) {
+    s = &samples[(head - count + i) % METER_SAMPLES];
+    put_be32(&buffer[METER_HEADER_LEN + i * METER_SAMPLE_LEN], s->frame);
+    put_be32(&buffer[METER_HEADER_LEN + i * METER_SAMPLE_LEN + 4], s->bytes);
+    put_be32(&buffer[METER_HEADER_LEN + i * METER_SAMPLE_LEN + 8], s->interval_us);
+    put_be32(&buffer[METER_HEADER_LEN + i * METER_SAMPLE_LEN + 12], s->full_us);
+    buffer[METER_HEADER_LEN + i * METER_SAMPLE_LEN + 16] = s->gap_us >> 8;
+    buffer[METER_HEADER_LEN + i * METER_SAMPLE_LEN + 17] = s->gap_us & 0xFF;
+    buffer[METER_HEADER_LEN + i * METER_SAMPLE_LEN + 18] = s->inflight;
+  }
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      clear the totals and samples.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void meter_clear(void) {
+  uint32_t mask = CyU3PVicDisableAllInterrupts();
+
+  CyU3PMemSet((uint8_t *)samples, 0, sizeof(samples));
+  sample_head = 0;
+  total_frames = total_full_us = total_gap_us = 0;
+  total_inflight = 0;
+  CyU3PVicEnableInterrupts(mask);
+}
@@ -20,6 +20,7 @@
 ## ===========================
 */
 
+#include <cyu3os.h>
 #include <cyu3usb.h>
 #include <cyu3error.h>
 #include <cyu3spi.h>
@@ -33,6 +34,14 @@
 #include "include/tlc59116.h"
 #include "include/tlc59108.h"
 #include "include/sensor_ar0141.h"
+#include "include/cyfxuvcdscr.h"
+#include "include/kv_store.h"
+#include "include/device_info.h"
+#include "include/lz4_stream.h"
+#include "include/ctrl_async.h"
+#include "include/thread_prof.h"
+#include "include/histogram.h"
+#include "include/dma_meter.h"
 
   /* FLASH sector Memory Map
   --------------------------------------
@@ -55,18 +64,23 @@
   |   7    | 0007 0000h | 0007 FFFFh   |
   --------------------------------------
   Every sector size = 64KB, All sector is 512KB
-  Sector 0 - 3 [0 - 256KB] is boot flash.
-  Secotr 4 is Device message, include: Device ID
-  Sector 5 is Device calib file, 
-  Secotr 6 - 7 is not used now.
+  Sector 0 - 3 [0 - 256KB] is boot flash, 0 - 1 hold the boot image and 2 - 3 stage
+  firmware updates, see fw_update.h.
+  Secotr 4 is Device message, the device info record of device_info.h
+  Sector 5 is Device calib file, plain or LZ4 compressed, see calib_struct_t
+  Secotr 6 - 7 is the key-value settings store, see kv_store.h.
   */
 uint16_t glSpiPageSize = 0x100;  /* SPI Page size to be used for transfers. */
 
 /* Give a timeout value of 5s for any flash programming. */
 #define CY_FX_FLASH_PROG_TIMEOUT                (5000)
+/* SPI clock, fast read (0x0B) is specified well above it on the SPI flash. */
+#define CY_FX_FLASH_SPI_CLOCK                   (25000000)
+/* Bytes per DMA buffer of a contiguous read, a multiple of 16 below the 64 KB descriptor limit. */
+#define CY_FX_FLASH_READ_CHUNK                  (0x8000)
 CyU3PDmaChannel glSpiTxHandle;   /* SPI Tx channel handle */
 CyU3PDmaChannel glSpiRxHandle;   /* SPI Rx channel handle */
-static CyU3PReturnStatus_t CyFxFlashProgSpiWaitForStatus(void);
+CyU3PMutex glSpiLock;            /* EP0 and vendor bulk threads share the flash */
 
 /* Array to hold sensor data */
 volatile char last_imu[IMU_BURST_LEN] = {' '};
@@ -146,6 +160,7 @@ void EU_Rqts_imu_burst(uint8_t bRequest) {
   switch (bRequest) {
   case CY_FX_USB_UVC_GET_CUR_REQ:
     // sensor_dbg("EU request IMU burst get cur xu\r\n");
+    imu_keep_awake();
     #ifndef IMU_LOOP_SAMPLE
     status = icm_get_sensor_reg(raw_IMU_data, 0);
     if (status != CY_U3P_SUCCESS) {
@@ -185,6 +200,47 @@ void EU_Rqts_imu_burst(uint8_t bRequest) {
   }
 }
 
+/**
+ *  @brief      control job, store a kv entry, data is key, len and value.
+ *  @param[in]  data    job data.
+ *  @param[in]  len     job data length.
+ *  @return     CyTrue if stored.
+ */
+static CyBool_t kv_set_job(uint8_t *data, uint16_t len) {
+  return kv_set(data[0], &data[2], data[1]) == KV_OK;
+}
+
+/**
+ *  @brief      store a kv entry on the control worker, the caller checked ctrl_async_full
+ *              before taking the request data.
+ *  @param[in]  key     enum KV_KEY.
+ *  @param[in]  value   value.
+ *  @param[in]  len     up to KV_VALUE_MAX bytes.
+ *  @return     NULL.
+ */
+static void kv_set_async(uint8_t key, const uint8_t *value, uint8_t len) {
+  uint8_t job[2 + KV_VALUE_MAX];
+
+  job[0] = key;
+  job[1] = len;
+  CyU3PMemCopy(&job[2], (uint8_t *)value, len);
+  ctrl_async_submit(CTRL_OP_KV_SET, kv_set_job, job, 2 + len);
+}
+
+/**
+ *  @brief      control job, erase the device info sector and reload the record.
+ *  @param[in]  data    unused.
+ *  @param[in]  len     unused.
+ *  @return     CyTrue if erased.
+ */
+static CyBool_t device_erase_job(uint8_t *data, uint16_t len) {
+  CyBool_t ok = CyFxFlashProgEraseSectorWait(DEVICE_MSG_ADDR * SPI_FLASH_PAGE_SIZE /
+                                             SPI_FLASH_SECTOR_SIZE) == CY_U3P_SUCCESS;
+
+  device_info_load();
+  return ok;
+}
+
 /**
  *  @brief      handle spi flash action of extension unit request.
  *  @param[out] bRequest    bRequst value of uvc.
@@ -200,6 +256,12 @@ void EU_Rqts_spi_flash(uint8_t bRequest) {
     CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
     break;
   case CY_FX_USB_UVC_SET_CUR_REQ:
+    // 'D' runs on the control worker, a full queue stalls until the host sends it again
+    if (ctrl_async_full()) {
+      sensor_err("control jobs busy\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
     apiRetStatus = CyU3PUsbGetEP0Data(1, Ep0Buffer, &readCount);
     if (apiRetStatus != CY_U3P_SUCCESS) {
       sensor_err("CyU3 get Ep0 data failed\r\n");
@@ -210,7 +272,7 @@ void EU_Rqts_spi_flash(uint8_t bRequest) {
       CyFxFlashProgEraseSector(CyTrue, 0, Ep0Buffer);
     } else if (Ep0Buffer[0] == 'D') {
       sensor_dbg("Device ID erase\r\n");
-      CyFxFlashProgEraseSector(CyTrue, 4, Ep0Buffer);
+      ctrl_async_submit(CTRL_OP_DEVICE_ERASE, device_erase_job, NULL, 0);
     }
     break;
   case CY_FX_USB_UVC_GET_LEN_REQ:
@@ -409,6 +471,12 @@ void EU_Rqts_firmware_flag(uint8_t bRequest) {
     CyU3PUsbSendEP0Data(4, Ep0Buffer);
     break;
   case CY_FX_USB_UVC_SET_CUR_REQ:
+    // the flag is stored on the control worker, a full queue stalls the request
+    if (ctrl_async_full()) {
+      sensor_err("control jobs busy\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
     apiRetStatus = CyU3PUsbGetEP0Data(4, Ep0Buffer, &readCount);
     if (apiRetStatus != CY_U3P_SUCCESS) {
       sensor_err("CyU3 get Ep0 data failed\r\n");
@@ -423,6 +491,7 @@ void EU_Rqts_firmware_flag(uint8_t bRequest) {
     debug_level = firmware_ctrl_flag.log_dbg | firmware_ctrl_flag.log_info << 1 \
                 | firmware_ctrl_flag.log_dump << 2;
     sensor_dbg("EU firmware flag set firmware_ctrl_flag: 0x%x\r\n", firmware_ctrl_flag);
+    kv_set_async(KV_KEY_FIRMWARE_FLAG, Ep0Buffer, 4);
     break;
   case CY_FX_USB_UVC_GET_LEN_REQ:
     Ep0Buffer[0] = 4;
@@ -466,6 +535,12 @@ void EU_Rqts_IR_control(uint8_t bRequest) {
     CyU3PUsbSendEP0Data(4, Ep0Buffer);
     break;
   case CY_FX_USB_UVC_SET_CUR_REQ:
+    // the IR mode is stored on the control worker, a full queue stalls the request
+    if (ctrl_async_full()) {
+      sensor_err("control jobs busy\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
     apiRetStatus = CyU3PUsbGetEP0Data(4, Ep0Buffer, &readCount);
     if (apiRetStatus != CY_U3P_SUCCESS) {
       sensor_err("CyU3 get Ep0 data failed\r\n");
@@ -481,6 +556,7 @@ void EU_Rqts_IR_control(uint8_t bRequest) {
       CyU3PMemCopy((uint8_t *)(&XPIRLx_IR_ctrl), (uint8_t *)(&XPIRL2_IR_ctrl_tmp),
                     sizeof(XPIRLx_IR_ctrl));
       sensor_dbg("EU IR control set : 0x%x\r\n", XPIRLx_IR_ctrl);
+      kv_set_async(KV_KEY_IR_CTRL, Ep0Buffer, 4);
       if (sensor_type == XPIRL2)
         xpril2_proc_ir_ctl(&XPIRLx_IR_ctrl);
       else if (sensor_type == XPIRL3)
@@ -509,6 +585,26 @@ void EU_Rqts_IR_control(uint8_t bRequest) {
   }
 }
 
+/**
+ *  @brief      control job, replace the serial number of the device info record.
+ *  @param[in]  data    serial number.
+ *  @param[in]  len     its length, 0 removes it.
+ *  @return     CyTrue if written.
+ */
+static CyBool_t device_serial_job(uint8_t *data, uint16_t len) {
+  return device_info_set(DEVINFO_TAG_SERIAL, data, len);
+}
+
+/**
+ *  @brief      control job, write a complete device info record.
+ *  @param[in]  data    record.
+ *  @param[in]  len     DEVINFO_LEN.
+ *  @return     CyTrue if written.
+ */
+static CyBool_t device_info_job(uint8_t *data, uint16_t len) {
+  return device_info_write(data);
+}
+
 /**
  *  @brief      handle flash Read/Write action of extension unit request.
  *  @param[out] bRequest    bRequst value of uvc.
@@ -519,33 +615,40 @@ void EU_Rqts_flash_RW(uint8_t bRequest) {
   struct flash_struct_t flash_store;
   uint16_t flash_len = sizeof (struct flash_struct_t);
   uint16_t readCount;
+  const uint8_t *serial;
+  uint8_t serial_len;
   CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
 
   switch (bRequest) {
   case CY_FX_USB_UVC_GET_CUR_REQ:
-    sensor_dbg("read flash\r\n");
     CyU3PMemSet ((uint8_t *)(&flash_store), 0, flash_len);
-    apiRetStatus = CyFxFlashProgSpiTransfer(DEVICE_MSG_ADDR, flash_len, (uint8_t *)(&flash_store),
-                                            CyTrue);
+    serial = device_info_get(DEVINFO_TAG_SERIAL, &serial_len);
+    if (serial != NULL)
+      CyU3PMemCopy(flash_store.Sensor_ID, (uint8_t *)serial,
+                   serial_len < sizeof(flash_store.Sensor_ID) ? serial_len :
+                   sizeof(flash_store.Sensor_ID));
     sensor_info("read device ID: %s\n", flash_store.Sensor_ID);
     CyU3PUsbSendEP0Data(flash_len, (uint8_t *)(&flash_store));
     break;
   case CY_FX_USB_UVC_SET_CUR_REQ:
     sensor_dbg("write flash\r\n");
+    if (ctrl_async_full()) {
+      sensor_err("control jobs busy\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
     apiRetStatus = CyU3PUsbGetEP0Data(flash_len, (uint8_t *)(&flash_store), &readCount);
     if (apiRetStatus != CY_U3P_SUCCESS) {
       sensor_err("CyU3 get Ep0 data failed\r\n");
       CyFxAppErrorHandler(apiRetStatus);
       break;
     }
-    // write flash
-    sensor_info("write device ID: %s\n", flash_store.Sensor_ID);
-    CyFxFlashProgEraseSector(CyTrue, 4, Ep0Buffer);
-    apiRetStatus = CyFxFlashProgSpiTransfer(DEVICE_MSG_ADDR, flash_len, (uint8_t *)(&flash_store),
-                                            CyFalse);
-    if (apiRetStatus != CY_U3P_SUCCESS) {
-      sensor_err("Write Flash error\r\n");
-    }
+    // Only the serial entry changes, the rest of the device info record is kept
+    serial_len = 0;
+    while (serial_len < sizeof(flash_store.Sensor_ID) && flash_store.Sensor_ID[serial_len])
+      serial_len++;
+    sensor_info("write device ID: %.32s\n", flash_store.Sensor_ID);
+    ctrl_async_submit(CTRL_OP_DEVICE_INFO, device_serial_job, flash_store.Sensor_ID, serial_len);
     break;
   case CY_FX_USB_UVC_GET_LEN_REQ:
     Ep0Buffer[0] = 255;
@@ -563,6 +666,54 @@ void EU_Rqts_flash_RW(uint8_t bRequest) {
   }
 }
 
+/**
+ *  @brief      read or write the whole device info record.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_device_info(uint8_t bRequest) {
+  uint8_t record[DEVINFO_LEN];
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  /* Layout of the record is in device_info.h. GET_CUR returns the RAM copy, SET_CUR takes a
+   * complete record and writes it on the control worker, one failing the header, CRC or tlv
+   * check is logged and dropped, the async status reports the job as failed. */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    device_info_record(record);
+    CyU3PUsbSendEP0Data(DEVINFO_LEN, record);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    if (ctrl_async_full()) {
+      sensor_err("control jobs busy\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    apiRetStatus = CyU3PUsbGetEP0Data(DEVINFO_LEN, record, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    ctrl_async_submit(CTRL_OP_DEVICE_INFO, device_info_job, record, DEVINFO_LEN);
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    record[0] = DEVINFO_LEN & 0xFF;
+    record[1] = DEVINFO_LEN >> 8;
+    CyU3PUsbSendEP0Data(2, record);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    record[0] = 3;
+    CyU3PUsbSendEP0Data(1, record);
+    break;
+  default:
+    sensor_err("unknown device info cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
 /**
  *  @brief      handle debug some variable value from driver.
  *  @param[out] bRequest    bRequst value of uvc.
@@ -611,6 +762,244 @@ void EU_Rqts_debug_RW(uint8_t bRequest) {
   }
 }
 
+/* RAM copy of the calibration sector, loaded and CRC checked at boot and after every rewrite.
+ * Packet i sits at data + i * SPI_FLASH_PAGE_SIZE like in flash, generation changes on every
+ * load so the host can tell a calibration read across a rewrite. A compressed file is kept
+ * compressed, packets of the inflated file are decoded from it as the host reads them. */
+static struct {
+  uint8_t *data;
+  uint8_t packet_total;
+  uint8_t state;           // enum CALIB_CACHE_STATE
+  uint8_t flags;           // enum CALIB_INFO_FLAG
+  uint32_t generation;
+  uint32_t raw_len;        // size of a compressed file once inflated
+} calib_cache = {NULL, 0, CALIB_CACHE_EMPTY, 0, 0, 0};
+static uint8_t calib_read_id = 0;
+static lz4_stream_t calib_lz;
+
+/**
+ *  @brief      CRC16 of flash records, same as make_crc16 of host_bin/calib_file_test.c.
+ *  @param[in]  data    record.
+ *  @param[in]  len     bytes to check.
+ *  @return     CRC16.
+ */
+uint16_t flash_crc16(const uint8_t *data, uint16_t len) {
+  return flash_crc16_update(0, data, len);
+}
+
+/**
+ *  @brief      continue a CRC16 of flash_crc16 over more bytes.
+ *  @param[in]  crc     CRC16 of the bytes so far, 0 at the start.
+ *  @param[in]  data    next bytes.
+ *  @param[in]  len     bytes to add.
+ *  @return     CRC16.
+ */
+uint16_t flash_crc16_update(uint16_t crc, const uint8_t *data, uint16_t len) {
+  uint8_t bit;
+
+  while (len--) {
+    crc ^= *data++;
+    for (bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+/**
+ *  @brief      check one calibration packet of the cache.
+ *  @param[in]  packet  packet.
+ *  @param[in]  id      expected packet id.
+ *  @param[in]  total   expected packet total.
+ *  @return     CyTrue if header, id and CRC match.
+ */
+static CyBool_t calib_packet_valid(const calib_struct_t *packet, uint8_t id, uint8_t total) {
+  const uint8_t *raw = (const uint8_t *)packet;
+  uint16_t crc;
+
+  if (packet->header[0] != 0xAA || packet->header[1] != 0x55 || packet->id != id ||
+      packet->packet_total != total || packet->packet_len < 7 || packet->packet_len > CALIB_RW_LEN)
+    return CyFalse;
+  crc = flash_crc16(raw, packet->packet_len - 2);
+  return raw[packet->packet_len - 2] == (crc & 0xFF) && raw[packet->packet_len - 1] == (crc >> 8);
+}
+
+/**
+ *  @brief      byte of the calibration file as stored, payloads of the cached packets in a row.
+ *  @param[in]  pos     offset in the file.
+ *  @return     byte.
+ */
+static uint8_t calib_stream_byte(uint32_t pos) {
+  return ((calib_struct_t *)&calib_cache.data[(pos / PAYLOAD_LEN) * SPI_FLASH_PAGE_SIZE])->
+      data[pos % PAYLOAD_LEN];
+}
+
+static uint32_t calib_stream_u32(uint32_t pos) {
+  return (calib_stream_byte(pos) << 24) | (calib_stream_byte(pos + 1) << 16) |
+         (calib_stream_byte(pos + 2) << 8) | calib_stream_byte(pos + 3);
+}
+
+/**
+ *  @brief      check a compressed file in the cache by inflating it once.
+ *  @param[in]  total   packets in the cache.
+ *  @return     CyFalse if the file is compressed and does not inflate to its size and crc16.
+ */
+static CyBool_t calib_lz_check(uint8_t total) {
+  uint8_t chunk[PAYLOAD_LEN];
+  uint32_t lz_len, n;
+  uint16_t crc = 0;
+
+  if (calib_stream_u32(0) != CALIB_LZ_MAGIC)
+    return CyTrue;
+  calib_cache.flags = CALIB_FLAG_COMPRESSED;
+  calib_cache.raw_len = calib_stream_u32(4);
+  lz_len = calib_stream_u32(8);
+  if (calib_cache.raw_len == 0 || lz_len > total * PAYLOAD_LEN - CALIB_LZ_HEADER_LEN)
+    return CyFalse;
+  lz4_stream_init(&calib_lz, calib_stream_byte, CALIB_LZ_HEADER_LEN, lz_len);
+  while ((n = lz4_stream_read(&calib_lz, chunk, sizeof(chunk))) != 0)
+    crc = flash_crc16_update(crc, chunk, n);
+  if (calib_lz.error || calib_lz.out_pos != calib_cache.raw_len ||
+      calib_stream_byte(12) != (crc & 0xFF) || calib_stream_byte(13) != (crc >> 8))
+    return CyFalse;
+  if (calib_cache.raw_len > CALIB_INFLATE_MAX)
+    calib_cache.flags |= CALIB_FLAG_READ_COMPRESSED;
+  sensor_info("calib file compressed, %d -> %d bytes\r\n", calib_cache.raw_len, lz_len);
+  return CyTrue;
+}
+
+/**
+ *  @brief      packet of the inflated file, decoding on from the last packet read.
+ *  @param[in]  id      packet id.
+ *  @param[out] packet  packet, CRC filled in.
+ *  @return     CyTrue if decoded.
+ */
+static CyBool_t calib_lz_packet(uint8_t id, calib_struct_t *packet) {
+  uint32_t start = id * PAYLOAD_LEN;
+  uint16_t crc;
+
+  /* Going back means decoding from the start again, reads in order never do. */
+  if (calib_lz.out_pos > start || calib_lz.error)
+    lz4_stream_init(&calib_lz, calib_stream_byte, CALIB_LZ_HEADER_LEN, calib_stream_u32(8));
+  lz4_stream_read(&calib_lz, NULL, start - calib_lz.out_pos);
+  if (calib_lz.out_pos != start)
+    return CyFalse;
+  CyU3PMemSet(packet->data, 0, PAYLOAD_LEN);
+  lz4_stream_read(&calib_lz, packet->data, PAYLOAD_LEN);
+  if (calib_lz.error)
+    return CyFalse;
+  packet->header[0] = 0xAA;
+  packet->header[1] = 0x55;
+  packet->packet_total = (calib_cache.raw_len + PAYLOAD_LEN - 1) / PAYLOAD_LEN;
+  packet->packet_len = CALIB_RW_LEN;
+  packet->id = id;
+  crc = flash_crc16((uint8_t *)packet, CALIB_RW_LEN - 2);
+  packet->check_sum[0] = crc & 0xFF;
+  packet->check_sum[1] = crc >> 8;
+  return CyTrue;
+}
+
+/**
+ *  @brief      packets EU_Rqts_calib_RW serves, inflated or as stored.
+ *  @param[out] NULL.
+ *  @return     packet total.
+ */
+static uint8_t calib_read_total(void) {
+  if (calib_cache.flags == CALIB_FLAG_COMPRESSED)
+    return (calib_cache.raw_len + PAYLOAD_LEN - 1) / PAYLOAD_LEN;
+  return calib_cache.packet_total;
+}
+
+/**
+ *  @brief      load the calibration sector into RAM and verify every packet.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void calib_cache_load(void) {
+  uint8_t page[SPI_FLASH_PAGE_SIZE];
+  calib_struct_t *first = (calib_struct_t *)page;
+  uint8_t i, total;
+
+  /* Readers copy packets under the flash lock, hold it while the cache is replaced. */
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  calib_cache.generation++;
+  calib_cache.state = CALIB_CACHE_EMPTY;
+  calib_cache.packet_total = 0;
+  calib_cache.flags = 0;
+  calib_cache.raw_len = 0;
+  calib_read_id = 0;
+  if (calib_cache.data != NULL) {
+    CyU3PDmaBufferFree(calib_cache.data);
+    calib_cache.data = NULL;
+  }
+
+  if (CyFxFlashProgSpiTransfer(DEVICE_CALIB_ADDR, SPI_FLASH_PAGE_SIZE, page, CyTrue) !=
+      CY_U3P_SUCCESS || first->header[0] != 0xAA || first->header[1] != 0x55 ||
+      first->packet_total == 0) {
+    sensor_info("no calib file in flash\r\n");
+    CyU3PMutexPut(&glSpiLock);
+    return;
+  }
+  total = first->packet_total;
+  calib_cache.data = (uint8_t *)CyU3PDmaBufferAlloc(total * SPI_FLASH_PAGE_SIZE);
+  if (calib_cache.data == NULL ||
+      CyFxFlashProgSpiTransfer(DEVICE_CALIB_ADDR, total * SPI_FLASH_PAGE_SIZE, calib_cache.data,
+                               CyTrue) != CY_U3P_SUCCESS) {
+    sensor_err("calib cache load failed\r\n");
+    calib_cache.state = CALIB_CACHE_ERROR;
+    CyU3PMutexPut(&glSpiLock);
+    return;
+  }
+  for (i = 0; i < total; i++) {
+    if (!calib_packet_valid((calib_struct_t *)&calib_cache.data[i * SPI_FLASH_PAGE_SIZE], i,
+                            total)) {
+      sensor_err("calib packet %d of %d CRC check failed\r\n", i, total);
+      calib_cache.state = CALIB_CACHE_ERROR;
+      CyU3PMutexPut(&glSpiLock);
+      return;
+    }
+  }
+  if (!calib_lz_check(total)) {
+    sensor_err("compressed calib file does not inflate\r\n");
+    calib_cache.flags = 0;
+    calib_cache.state = CALIB_CACHE_ERROR;
+    CyU3PMutexPut(&glSpiLock);
+    return;
+  }
+  calib_cache.packet_total = total;
+  calib_cache.state = CALIB_CACHE_VALID;
+  sensor_info("calib cache: %d packets, generation %d\r\n", total, calib_cache.generation);
+  CyU3PMutexPut(&glSpiLock);
+}
+
+/**
+ *  @brief      control job, program one calibration packet, packet 0 erases the sector first
+ *              and the last one reloads the cache.
+ *  @param[in]  data    packet, one flash page.
+ *  @param[in]  len     SPI_FLASH_PAGE_SIZE.
+ *  @return     CyTrue if programmed.
+ */
+static CyBool_t calib_write_job(uint8_t *data, uint16_t len) {
+  calib_struct_t *calib_packet = (calib_struct_t *)data;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  if (calib_packet->id == 0) {
+    apiRetStatus = CyFxFlashProgEraseSectorWait(DEVICE_CALIB_ADDR * SPI_FLASH_PAGE_SIZE /
+                                                SPI_FLASH_SECTOR_SIZE);
+    sensor_info("Erase the %dth sector(begin from 0)\r\n", 5);
+  }
+  if (apiRetStatus == CY_U3P_SUCCESS)
+    apiRetStatus = CyFxFlashProgSpiTransfer(DEVICE_CALIB_ADDR + calib_packet->id,
+                                            SPI_FLASH_PAGE_SIZE, data, CyFalse);
+  sensor_info("write flash addr:0x%x len:%d\r\n",
+              (DEVICE_CALIB_ADDR + calib_packet->id) * glSpiPageSize, sizeof(calib_struct_t));
+  if (apiRetStatus != CY_U3P_SUCCESS) {
+    sensor_err("Write Flash error\r\n");
+  }
+  if (calib_packet->id + 1 >= calib_packet->packet_total)
+    calib_cache_load();
+  return apiRetStatus == CY_U3P_SUCCESS;
+}
+
 /**
  *  @brief      read or write calibration file from/to spi flash.
  *  @param[out] bRequest    bRequst value of uvc.
@@ -618,67 +1007,65 @@ void EU_Rqts_debug_RW(uint8_t bRequest) {
  */
 void EU_Rqts_calib_RW(uint8_t bRequest) {
   uint8_t Ep0Buffer[32] = {0};
-  calib_struct_t calib_store;
+  uint8_t page[SPI_FLASH_PAGE_SIZE];
+  calib_struct_t *calib_packet = (calib_struct_t *)page;
   uint16_t calib_len = sizeof (calib_struct_t);
   uint16_t readCount;
   CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
-  static uint8_t read_loop = 0;
   static uint8_t write_loop = 0;
 
   switch (bRequest) {
   case CY_FX_USB_UVC_GET_CUR_REQ:
-    sensor_dbg("read calib file\r\n");
-    CyU3PMemSet ((uint8_t *)(&calib_store), 0, calib_len);
-    apiRetStatus = CyFxFlashProgSpiTransfer(DEVICE_CALIB_ADDR + read_loop, calib_len, (uint8_t *)(&calib_store),
-                                            CyTrue);
-    sensor_info("header: 0x%x 0x%x, total: 0x%x, id: 0x%x, readCount:%d\r\n", 
-                calib_store.header[0], calib_store.header[1], calib_store.packet_total, calib_store.id, readCount);
-    if (read_loop == calib_store.id) {
-      sensor_info("read device calib info: 0x%x 0x%x %d %d\r\n", 
-                  calib_store.header[0], 
-                  calib_store.header[1],
-                  calib_store.packet_total,
-                  calib_store.id);
-      CyU3PUsbSendEP0Data(calib_len, (uint8_t *)(&calib_store));
-      sensor_info("read done!\r\n");
-      if (++read_loop >= calib_store.packet_total) {
-        read_loop = 0;
+    /* Served from the RAM copy, flash is only read if the cache did not load. */
+    CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+    if (calib_cache.state == CALIB_CACHE_VALID && calib_cache.flags == CALIB_FLAG_COMPRESSED) {
+      if (!calib_lz_packet(calib_read_id, calib_packet))
+        apiRetStatus = CY_U3P_ERROR_FAILURE;
+    } else if (calib_cache.state == CALIB_CACHE_VALID) {
+      CyU3PMemCopy(page, &calib_cache.data[calib_read_id * SPI_FLASH_PAGE_SIZE], calib_len);
+    } else {
+      apiRetStatus = CyFxFlashProgSpiTransfer(DEVICE_CALIB_ADDR + calib_read_id,
+                                              SPI_FLASH_PAGE_SIZE, page, CyTrue);
+    }
+    CyU3PMutexPut(&glSpiLock);
+    sensor_dbg("read calib packet %d of %d\r\n", calib_packet->id, calib_packet->packet_total);
+    if (apiRetStatus == CY_U3P_SUCCESS && calib_read_id == calib_packet->id) {
+      CyU3PUsbSendEP0Data(calib_len, page);
+      if (++calib_read_id >= calib_packet->packet_total) {
+        calib_read_id = 0;
       }
     } else {
       // go to original loop status
-      read_loop = 0;
-    } 
+      calib_read_id = 0;
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+    }
     break;
   case CY_FX_USB_UVC_SET_CUR_REQ:
     sensor_dbg("write calib file\r\n");
-    CyU3PMemSet ((uint8_t *)(&calib_store), 0, calib_len);
-    apiRetStatus = CyU3PUsbGetEP0Data(calib_len, (uint8_t *)(&calib_store), &readCount);
+    /* Erase and programming run on the control worker, a full queue stalls the packet and the
+     * host sends it again once the async status shows a free slot. */
+    if (ctrl_async_full()) {
+      sensor_err("control jobs busy\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    /* The last byte of the page is not part of the packet, keep it erased. */
+    CyU3PMemSet(page, 0xFF, SPI_FLASH_PAGE_SIZE);
+    apiRetStatus = CyU3PUsbGetEP0Data(calib_len, page, &readCount);
     if (apiRetStatus != CY_U3P_SUCCESS) {
       sensor_err("CyU3 get Ep0 data failed\r\n");
       CyFxAppErrorHandler(apiRetStatus);
       break;
     }
-    sensor_info("header: 0x%x 0x%x, total: 0x%x, id: 0x%x, readCount:%d\r\n", 
-                calib_store.header[0], calib_store.header[1], calib_store.packet_total, calib_store.id, readCount);
-    // write flash
-    //sensor_info("write device ID: %s\n", flash_store.Sensor_ID);
-    // Only erase sector the first time in loop
-    if (write_loop == 0) {
-      CyFxFlashProgEraseSector(CyTrue, 5, Ep0Buffer);
-      sensor_info("Erase the %dth sector(begin from 0)\r\n", 5);
-    }
-    if (write_loop == calib_store.id) {
-      apiRetStatus = CyFxFlashProgSpiTransfer(DEVICE_CALIB_ADDR + write_loop, 
-                                              calib_len, 
-                                              (uint8_t *)(&calib_store),
-                                              CyFalse);
-      sensor_info("write flash addr:0x%x len:%d\r\n", 
-                  (DEVICE_CALIB_ADDR + write_loop)*glSpiPageSize,
-                  calib_len);
-      if (apiRetStatus != CY_U3P_SUCCESS) {
-        sensor_err("Write Flash error\r\n");
-      }
-      if (++write_loop >= calib_store.packet_total) {
+    sensor_info("header: 0x%x 0x%x, total: 0x%x, id: 0x%x, readCount:%d\r\n",
+                calib_packet->header[0], calib_packet->header[1], calib_packet->packet_total,
+                calib_packet->id, readCount);
+    // Packets have to come in order, packet 0 starts over
+    if (calib_packet->id == 0)
+      write_loop = 0;
+    if (write_loop == calib_packet->id) {
+      ctrl_async_submit(CTRL_OP_CALIB_WRITE, calib_write_job, page, SPI_FLASH_PAGE_SIZE);
+      if (++write_loop >= calib_packet->packet_total) {
         write_loop = 0;
       }
     } else {
@@ -702,88 +1089,930 @@ void EU_Rqts_calib_RW(uint8_t bRequest) {
   }
 }
 
-/* SPI initialization for flash programmer application. */
-CyU3PReturnStatus_t CyFxFlashProgSpiInit(uint16_t pageLen) {
-  CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
-  CyU3PSpiConfig_t spiConfig;
-  CyU3PDmaChannelConfig_t dmaConfig;
+/**
+ *  @brief      state of the calibration RAM copy, and read position of EU_Rqts_calib_RW.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_calib_info(uint8_t bRequest) {
+  uint8_t Ep0Buffer[32] = {0};
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
 
-  /* Start the SPI module and configure the master. */
-  status = CyU3PSpiInit();
-  if (status != CY_U3P_SUCCESS) {
-    sensor_err("CyU3 spi module int failed!\r\n");
-    return status;
+  /* Calibration cache info
+  ------------------------------------------------------------------------
+  |Byte location| generation | state | packet_total | next packet | flags |
+  ------------------------------------------------------------------------
+  |   Byte num  |   4(MSB)   |   1   |      1       |      1      |   1   |
+  ------------------------------------------------------------------------
+  state: enum CALIB_CACHE_STATE, flags: enum CALIB_INFO_FLAG, packet_total: packets calib
+  GET_CUR serves. SET_CUR only takes next packet, the packet the next calib GET_CUR returns,
+  so a host can restart or resume a read, and CALIB_FLAG_READ_COMPRESSED.
+  */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    Ep0Buffer[0] = calib_cache.generation >> 24;
+    Ep0Buffer[1] = calib_cache.generation >> 16;
+    Ep0Buffer[2] = calib_cache.generation >> 8;
+    Ep0Buffer[3] = calib_cache.generation & 0xFF;
+    Ep0Buffer[4] = calib_cache.state;
+    Ep0Buffer[5] = calib_read_total();
+    Ep0Buffer[6] = calib_read_id;
+    Ep0Buffer[7] = calib_cache.flags;
+    CyU3PUsbSendEP0Data(CALIB_INFO_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(CALIB_INFO_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+    if (calib_cache.flags & CALIB_FLAG_COMPRESSED) {
+      if ((Ep0Buffer[7] & CALIB_FLAG_READ_COMPRESSED) || calib_cache.raw_len > CALIB_INFLATE_MAX)
+        calib_cache.flags |= CALIB_FLAG_READ_COMPRESSED;
+      else
+        calib_cache.flags &= ~CALIB_FLAG_READ_COMPRESSED;
+    }
+    CyU3PMutexPut(&glSpiLock);
+    if (calib_cache.state == CALIB_CACHE_VALID && Ep0Buffer[6] < calib_read_total())
+      calib_read_id = Ep0Buffer[6];
+    else
+      calib_read_id = 0;
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = CALIB_INFO_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, (uint8_t *)Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown calib info cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
   }
+}
 
-  /* Start the SPI master block. Run the SPI clock at 8MHz
-   * and configure the word length to 8 bits. Also configure
-   * the slave select using FW. */
-  CyU3PMemSet ((uint8_t *)&spiConfig, 0, sizeof(spiConfig));
-  spiConfig.isLsbFirst = CyFalse;
-  spiConfig.cpol       = CyTrue;
-  spiConfig.ssnPol     = CyFalse;
-  spiConfig.cpha       = CyTrue;
-  spiConfig.leadTime   = CY_U3P_SPI_SSN_LAG_LEAD_HALF_CLK;
-  spiConfig.lagTime    = CY_U3P_SPI_SSN_LAG_LEAD_HALF_CLK;
-  spiConfig.ssnCtrl    = CY_U3P_SPI_SSN_CTRL_FW;
-  spiConfig.clock      = 8000000;
-  spiConfig.wordLen    = 8;
+/**
+ *  @brief      async status of the control worker and control latency telemetry.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_ctrl_async(uint8_t bRequest) {
+  uint8_t Ep0Buffer[CTRL_ASYNC_LEN];
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
 
-  status = CyU3PSpiSetConfig(&spiConfig, NULL);
-  if (status != CY_U3P_SUCCESS) {
-    return status;
+  /* Layout is in ctrl_async.h. */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    ctrl_async_status(Ep0Buffer);
+    CyU3PUsbSendEP0Data(CTRL_ASYNC_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(CTRL_ASYNC_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    if (Ep0Buffer[0] == 1)
+      ctrl_async_clear();
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = CTRL_ASYNC_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown ctrl async cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
   }
+}
 
-  /* Create the DMA channels for SPI write and read. */
-  CyU3PMemSet ((uint8_t *)&dmaConfig, 0, sizeof(dmaConfig));
-  dmaConfig.size           = pageLen;
-  /* No buffers need to be allocated as this channel
-   * will be used only in override mode. */
-  dmaConfig.count          = 0;
-  dmaConfig.prodAvailCount = 0;
-  dmaConfig.dmaMode        = CY_U3P_DMA_MODE_BYTE;
-  dmaConfig.prodHeader     = 0;
-  dmaConfig.prodFooter     = 0;
-  dmaConfig.consHeader     = 0;
-  dmaConfig.notification   = 0;
-  dmaConfig.cb             = NULL;
+/**
+ *  @brief      read or clear the thread profile.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_profile(uint8_t bRequest) {
+  uint8_t Ep0Buffer[PROF_LEN];
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
 
-  /* Channel to write to SPI flash. */
-  dmaConfig.prodSckId = CY_U3P_CPU_SOCKET_PROD;
-  dmaConfig.consSckId = CY_U3P_LPP_SOCKET_SPI_CONS;
-  status = CyU3PDmaChannelCreate(&glSpiTxHandle, CY_U3P_DMA_TYPE_MANUAL_OUT, &dmaConfig);
-  if (status != CY_U3P_SUCCESS) {
-    return status;
+  /* Layout is in thread_prof.h. */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    prof_status(Ep0Buffer);
+    CyU3PUsbSendEP0Data(PROF_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(PROF_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    if (Ep0Buffer[0] == 1)
+      prof_clear();
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = PROF_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown profile cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
   }
+}
 
-  /* Channel to read from SPI flash. */
-  dmaConfig.prodSckId = CY_U3P_LPP_SOCKET_SPI_PROD;
-  dmaConfig.consSckId = CY_U3P_CPU_SOCKET_CONS;
-  status = CyU3PDmaChannelCreate(&glSpiRxHandle, CY_U3P_DMA_TYPE_MANUAL_IN, &dmaConfig);
-  if (status == CY_U3P_SUCCESS) {
-    glSpiPageSize = pageLen;
+static uint8_t hist_selected = HIST_FRAME_INTERVAL;
+
+/**
+ *  @brief      read, select or clear the latency histograms.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_hist(uint8_t bRequest) {
+  uint8_t Ep0Buffer[HIST_XU_LEN];
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  /* Layout is in histogram.h. */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    hist_read(hist_selected, Ep0Buffer);
+    CyU3PUsbSendEP0Data(HIST_XU_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(HIST_XU_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    if (Ep0Buffer[0] < HIST_COUNT)
+      hist_selected = Ep0Buffer[0];
+    if (Ep0Buffer[1] == 1)
+      hist_clear(Ep0Buffer[0]);
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = HIST_XU_LEN & 0xFF;
+    Ep0Buffer[1] = HIST_XU_LEN >> 8;
+    CyU3PUsbSendEP0Data(2, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown histogram cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
+/**
+ *  @brief      read or clear the DMA occupancy meter.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_dma_meter(uint8_t bRequest) {
+  uint8_t Ep0Buffer[METER_XU_LEN];
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  /* Layout is in dma_meter.h. */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    meter_read(Ep0Buffer);
+    CyU3PUsbSendEP0Data(METER_XU_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(METER_XU_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    if (Ep0Buffer[0] == 1)
+      meter_clear();
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = METER_XU_LEN & 0xFF;
+    Ep0Buffer[1] = METER_XU_LEN >> 8;
+    CyU3PUsbSendEP0Data(2, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown DMA meter cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
+static uint8_t kv_xu[KV_XU_LEN];
+
+/**
+ *  @brief      whether the kv extension unit may set or delete a key. Keys the firmware owns
+ *              are written by their own requests only, the update journal by fw_update.
+ *  @param[in]  key     enum KV_KEY.
+ *  @return     CyTrue if the host owns the key.
+ */
+static CyBool_t kv_key_host(uint8_t key) {
+  return key == KV_KEY_EXPOSURE_PROFILE || key == KV_KEY_IMU_CONFIG ||
+         (key >= KV_KEY_HOST && key < KV_KEY_HOST + 0x10);
+}
+
+/**
+ *  @brief      control job, run a kv extension unit request, a set may compact the store.
+ *  @param[in]  data    request as laid out in kv_store.h.
+ *  @param[in]  len     KV_XU_LEN.
+ *  @return     CyTrue unless the store failed.
+ */
+static CyBool_t kv_xu_job(uint8_t *data, uint16_t len) {
+  uint8_t status;
+
+  switch (data[0]) {
+  case KV_OP_GET:
+    status = kv_get(data[1], &data[4], &data[2]);
+    if (status != KV_OK)
+      data[2] = 0;
+    break;
+  case KV_OP_SET:
+    status = kv_key_host(data[1]) ? kv_set(data[1], &data[4], data[2]) : KV_BAD_ARG;
+    break;
+  case KV_OP_DELETE:
+    status = kv_key_host(data[1]) ? kv_delete(data[1]) : KV_BAD_ARG;
+    break;
+  default:
+    status = KV_BAD_ARG;
+    break;
+  }
+  sensor_dbg("EU kv op %d key %d len %d: %d\r\n", data[0], data[1], data[2], status);
+  // GET_CUR may send kv_xu meanwhile, the status goes last
+  data[3] = KV_PENDING;
+  CyU3PMemCopy(kv_xu, data, KV_XU_LEN);
+  kv_xu[3] = status;
+  return status != KV_IO_ERROR;
+}
+
+/**
+ *  @brief      get, set or delete a setting of the key-value store.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_kv_RW(uint8_t bRequest) {
+  uint8_t Ep0Buffer[KV_XU_LEN] = {0};
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  /* Layout of the request is in kv_store.h */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    CyU3PUsbSendEP0Data(KV_XU_LEN, kv_xu);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    /* Flash access runs on the control worker, a set may erase a sector for seconds. */
+    if (ctrl_async_full()) {
+      sensor_err("control jobs busy\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    apiRetStatus = CyU3PUsbGetEP0Data(KV_XU_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    kv_xu[3] = KV_PENDING;
+    ctrl_async_submit(CTRL_OP_KV_XU, kv_xu_job, Ep0Buffer, KV_XU_LEN);
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = KV_XU_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, (uint8_t *)Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown kv cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
+/**
+ *  @brief      control HDR alternating exposure of V034 sensors.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_hdr_RW(uint8_t bRequest) {
+  #define CMD_HDR_RW_LEN 5
+
+  uint8_t Ep0Buffer[32] = {0};
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
+    sensor_err("hdr mode is not supported by AR0141\r\n");
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    return;
+  }
+  /* HDR command
+  ------------------------------------------------------
+  |Byte location| enable | short exposure | long exposure |
+  ------------------------------------------------------
+  |   Byte num  |   1    |   2 (MSB)      |   2 (MSB)     |
+  ------------------------------------------------------
+  exposure is in rows, context A uses short exposure and context B uses long exposure.
+  */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    Ep0Buffer[0] = v034_hdr.enable;
+    Ep0Buffer[1] = v034_hdr.short_exposure >> 8;
+    Ep0Buffer[2] = v034_hdr.short_exposure & 0xff;
+    Ep0Buffer[3] = v034_hdr.long_exposure >> 8;
+    Ep0Buffer[4] = v034_hdr.long_exposure & 0xff;
+    CyU3PUsbSendEP0Data(CMD_HDR_RW_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(CMD_HDR_RW_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    V034_hdr_config(Ep0Buffer[0] ? 1 : 0,
+                    (Ep0Buffer[1] << 8) | Ep0Buffer[2],
+                    (Ep0Buffer[3] << 8) | Ep0Buffer[4]);
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = CMD_HDR_RW_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, (uint8_t *)Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown hdr cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
+/**
+ *  @brief      control hardware triggered snapshot mode and multi-device sync.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_trigger_RW(uint8_t bRequest) {
+  #define CMD_TRIGGER_RW_LEN 17
+
+  uint8_t Ep0Buffer[32] = {0};
+  uint16_t readCount;
+  struct trigger_ctl_t ctrl;
+  uint32_t seq;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
+    sensor_err("trigger mode is not supported by AR0141\r\n");
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    return;
+  }
+  /* Trigger command
+  ---------------------------------------------------------------------
+  |Byte location| mode | period  | window  | phase   | trigger seq       |
+  ---------------------------------------------------------------------
+  |   Byte num  |  1   | 4 (MSB) | 4 (MSB) | 4 (MSB) | 4 (MSB, GET only) |
+  ---------------------------------------------------------------------
+  mode: 0 -> off(free run), 1 -> master(drive exposure pulse), 2 -> external(follow pulse),
+        3 -> low power master(sensors in standby between frames).
+  period, window and phase are in us, phase only applies to the master. period is at most
+  TRIGGER_MAX_PERIOD_US. trigger seq is the same on all units of a sync group, see
+  TRIGGER_SYNC_GAP, 0 until the unit saw the first pulse of a master.
+  */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    seq = trigger_seq;
+    Ep0Buffer[0] = trigger_ctrl.mode;
+    Ep0Buffer[1] = trigger_ctrl.period_us >> 24;
+    Ep0Buffer[2] = trigger_ctrl.period_us >> 16;
+    Ep0Buffer[3] = trigger_ctrl.period_us >> 8;
+    Ep0Buffer[4] = trigger_ctrl.period_us & 0xff;
+    Ep0Buffer[5] = trigger_ctrl.window_us >> 24;
+    Ep0Buffer[6] = trigger_ctrl.window_us >> 16;
+    Ep0Buffer[7] = trigger_ctrl.window_us >> 8;
+    Ep0Buffer[8] = trigger_ctrl.window_us & 0xff;
+    Ep0Buffer[9] = trigger_ctrl.phase_us >> 24;
+    Ep0Buffer[10] = trigger_ctrl.phase_us >> 16;
+    Ep0Buffer[11] = trigger_ctrl.phase_us >> 8;
+    Ep0Buffer[12] = trigger_ctrl.phase_us & 0xff;
+    Ep0Buffer[13] = seq >> 24;
+    Ep0Buffer[14] = seq >> 16;
+    Ep0Buffer[15] = seq >> 8;
+    Ep0Buffer[16] = seq & 0xff;
+    CyU3PUsbSendEP0Data(CMD_TRIGGER_RW_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(CMD_TRIGGER_RW_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    ctrl.mode = Ep0Buffer[0];
+    ctrl.period_us = ((uint32_t)Ep0Buffer[1] << 24) | ((uint32_t)Ep0Buffer[2] << 16) |
+                     ((uint32_t)Ep0Buffer[3] << 8) | Ep0Buffer[4];
+    ctrl.window_us = ((uint32_t)Ep0Buffer[5] << 24) | ((uint32_t)Ep0Buffer[6] << 16) |
+                     ((uint32_t)Ep0Buffer[7] << 8) | Ep0Buffer[8];
+    ctrl.phase_us = ((uint32_t)Ep0Buffer[9] << 24) | ((uint32_t)Ep0Buffer[10] << 16) |
+                    ((uint32_t)Ep0Buffer[11] << 8) | Ep0Buffer[12];
+    if (ctrl.mode > TRIGGER_LOW_POWER) {
+      sensor_err("invalid trigger mode: %d\r\n", ctrl.mode);
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    if (ctrl.mode != TRIGGER_OFF && ctrl.period_us > TRIGGER_MAX_PERIOD_US) {
+      sensor_err("trigger period %d us too long\r\n", ctrl.period_us);
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    if (ctrl.mode != TRIGGER_OFF) {
+      if (ctrl.window_us < TRIGGER_MIN_WINDOW_US ||
+          ctrl.period_us < V034_snapshot_min_period_us(ctrl.window_us)) {
+        sensor_err("trigger period %d us too short for window %d us\r\n",
+                   ctrl.period_us, ctrl.window_us);
+        CyU3PUsbStall(0, CyTrue, CyFalse);
+        break;
+      }
+    }
+    if (ctrl.mode == TRIGGER_LOW_POWER &&
+        ctrl.period_us < V034_snapshot_min_period_us(ctrl.window_us) + LOW_POWER_WAKE_US +
+                         LOW_POWER_MIN_SLEEP_US) {
+      sensor_err("trigger period %d us leaves no time for standby\r\n", ctrl.period_us);
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    // sensors wait for the first pulse before the pin starts toggling
+    V034_set_snapshot_mode(ctrl.mode != TRIGGER_OFF, ctrl.window_us);
+    if (fx3_trigger_config(&ctrl) != CY_U3P_SUCCESS) {
+      ctrl.mode = TRIGGER_OFF;
+      V034_set_snapshot_mode(0, 0);
+      fx3_trigger_config(&ctrl);
+    }
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = CMD_TRIGGER_RW_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, (uint8_t *)Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown trigger cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
+/**
+ *  @brief      set the sensor readout window, per eye or shared by both eyes.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_roi_RW(uint8_t bRequest) {
+  #define CMD_ROI_RW_LEN 14
+
+  uint8_t Ep0Buffer[32] = {0};
+  uint16_t readCount;
+  uint32_t flag;
+  struct roi_t roi;
+  int eye, ret;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  /* ROI command
+  ------------------------------------------------------------------------------------------
+  |Byte location| mode | width | height | left col | left row | right col | right row | fps |
+  ------------------------------------------------------------------------------------------
+  |   Byte num  |  1   | 2(MSB)| 2(MSB) |  2(MSB)  |  2(MSB)  |  2(MSB)   |  2(MSB)   |  1  |
+  ------------------------------------------------------------------------------------------
+  mode: 0 -> stereo, right eye uses the left window, 1 -> per eye start position.
+  fps is read only, the frame rate of the window, 0 for the compile time timing.
+  The device re-enumerates after a new window is set, so the host reads the new frame size.
+  */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    Ep0Buffer[0] = sensor_roi.mode;
+    Ep0Buffer[1] = sensor_roi.width >> 8;
+    Ep0Buffer[2] = sensor_roi.width & 0xff;
+    Ep0Buffer[3] = sensor_roi.height >> 8;
+    Ep0Buffer[4] = sensor_roi.height & 0xff;
+    for (eye = ROI_LEFT; eye <= ROI_RIGHT; eye++) {
+      Ep0Buffer[5 + eye * 4] = sensor_roi.col_start[eye] >> 8;
+      Ep0Buffer[6 + eye * 4] = sensor_roi.col_start[eye] & 0xff;
+      Ep0Buffer[7 + eye * 4] = sensor_roi.row_start[eye] >> 8;
+      Ep0Buffer[8 + eye * 4] = sensor_roi.row_start[eye] & 0xff;
+    }
+    Ep0Buffer[13] = sensor_roi.fps;
+    CyU3PUsbSendEP0Data(CMD_ROI_RW_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(CMD_ROI_RW_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    if (CyU3PEventGet(&glFxUVCEvent, CY_FX_UVC_STREAM_EVENT, CYU3P_EVENT_AND, &flag,
+                      CYU3P_NO_WAIT) == CY_U3P_SUCCESS) {
+      sensor_err("stop stream before changing roi\r\n");
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    roi.mode = Ep0Buffer[0] ? ROI_MODE_PER_EYE : ROI_MODE_STEREO;
+    roi.width = (Ep0Buffer[1] << 8) | Ep0Buffer[2];
+    roi.height = (Ep0Buffer[3] << 8) | Ep0Buffer[4];
+    for (eye = ROI_LEFT; eye <= ROI_RIGHT; eye++) {
+      roi.col_start[eye] = (Ep0Buffer[5 + eye * 4] << 8) | Ep0Buffer[6 + eye * 4];
+      roi.row_start[eye] = (Ep0Buffer[7 + eye * 4] << 8) | Ep0Buffer[8 + eye * 4];
+    }
+    if (roi.mode == ROI_MODE_STEREO) {
+      roi.col_start[ROI_RIGHT] = roi.col_start[ROI_LEFT];
+      roi.row_start[ROI_RIGHT] = roi.row_start[ROI_LEFT];
+    }
+    // GPIF pushes whole 16 bit words and ends lines on DMA buffer alignment
+    if (roi.width < ROI_MIN_WIDTH || roi.height < ROI_MIN_HEIGHT ||
+        (roi.width * 2) % CY_FX_GPIF_LINE_ALIGN) {
+      sensor_err("roi %dx%d is not supported by GPIF\r\n", roi.width, roi.height);
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A)
+      ret = AR0141_set_roi(&roi);
+    else
+      ret = V034_set_roi(&roi);
+    if (ret) {
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    sensor_roi = roi;
+    CyFxUVCUpdateProbeCtrl();
+    update_HS_config_dscr();
+    update_SS_config_dscr();
+    CyU3PEventSet(&glFxUVCEvent, CY_FX_UVC_REENUM_EVENT_FLAG, CYU3P_EVENT_OR);
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = CMD_ROI_RW_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, (uint8_t *)Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown roi cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
+/**
+ *  @brief      stream a sensor test pattern for throughput and link benchmarks.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_test_pattern_RW(uint8_t bRequest) {
+  #define CMD_TEST_PATTERN_RW_LEN 3
+
+  static uint8_t pattern = TEST_PATTERN_OFF;
+  static uint16_t value = 0;
+  uint8_t Ep0Buffer[32] = {0};
+  uint16_t readCount;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  /* Test pattern command
+  -------------------------------------
+  |Byte location| pattern |  value    |
+  -------------------------------------
+  |   Byte num  |    1    |  2 (MSB)  |
+  -------------------------------------
+  pattern: enum TEST_PATTERN, value is the pixel value of TEST_PATTERN_FLAT.
+  */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    Ep0Buffer[0] = pattern;
+    Ep0Buffer[1] = value >> 8;
+    Ep0Buffer[2] = value & 0xff;
+    CyU3PUsbSendEP0Data(CMD_TEST_PATTERN_RW_LEN, Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(CMD_TEST_PATTERN_RW_LEN, Ep0Buffer, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    if (Ep0Buffer[0] > TEST_PATTERN_GRADIENT) {
+      sensor_err("unknown test pattern: %d\r\n", Ep0Buffer[0]);
+      CyU3PUsbStall(0, CyTrue, CyFalse);
+      break;
+    }
+    pattern = Ep0Buffer[0];
+    value = (Ep0Buffer[1] << 8) | Ep0Buffer[2];
+    if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A)
+      AR0141_set_test_pattern(pattern, value);
+    else
+      V034_set_test_pattern(pattern, value);
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = CMD_TEST_PATTERN_RW_LEN;
+    Ep0Buffer[1] = 0;
+    CyU3PUsbSendEP0Data(2, (uint8_t *)Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown test pattern cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
   }
+}
 
+/**
+ *  @brief      read or write one sensor register of one eye or both eyes.
+ *  @param[in]  dev     REG_DEV_SENSOR, REG_DEV_SENSOR_LEFT or REG_DEV_SENSOR_RIGHT.
+ *  @param[in]  write   1: write, 0: read.
+ *  @param[in]  addr    register address.
+ *  @param[in,out]  value   value to write or value read.
+ *  @return     CY_U3P_SUCCESS if successful.
+ */
+static CyU3PReturnStatus_t reg_batch_sensor(uint8_t dev, uint8_t write, uint16_t addr,
+                                            uint16_t *value) {
+  CyU3PReturnStatus_t status;
+  uint8_t is_ar0141 = (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A);
+  uint8_t slave, buf[2];
+
+  if (dev == REG_DEV_SENSOR) {
+    if (!write) {
+      *value = is_ar0141 ? AR0141_RegisterRead(addr >> 8, addr & 0xff) :
+               V034_RegisterRead(addr >> 8, addr & 0xff);
+      return CY_U3P_SUCCESS;
+    }
+    if (is_ar0141)
+      return AR0141_RegisterWrite(addr >> 8, addr & 0xff, *value >> 8, *value & 0xff);
+    return V034_RegisterWrite(addr >> 8, addr & 0xff, *value >> 8, *value & 0xff);
+  }
+  if (is_ar0141)
+    slave = dev == REG_DEV_SENSOR_LEFT ? L_AR0141_ADDR_WR : R_AR0141_ADDR_WR;
+  else
+    slave = dev == REG_DEV_SENSOR_LEFT ? L_SENSOR_ADDR_WR : R_SENSOR_ADDR_WR;
+  // the right eye only answers on its own address in split address mode
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
+  v034_set_split_addr();
+  if (write) {
+    if (is_ar0141)
+      status = AR0141_SensorWrite2B(slave, addr >> 8, addr & 0xff, *value >> 8, *value & 0xff);
+    else
+      status = V034_SensorWrite2B(slave, addr >> 8, addr & 0xff, *value >> 8, *value & 0xff);
+  } else {
+    if (is_ar0141)
+      status = AR0141_SensorRead2B(slave + 1, addr >> 8, addr & 0xff, buf);
+    else
+      status = V034_SensorRead2B(slave + 1, addr >> 8, addr & 0xff, buf);
+    *value = (buf[0] << 8) | buf[1];
+  }
+  v034_set_unified_addr();
+  CyU3PMutexPut(&glSensorLock);
   return status;
 }
 
-/* Wait for the status response from the SPI flash. */
-static CyU3PReturnStatus_t CyFxFlashProgSpiWaitForStatus(void) {
-  uint8_t buf[2], rd_buf[2];
-  CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
+/**
+ *  @brief      execute one entry of a register batch.
+ *  @param[in,out]  entry   device, op, address(MSB), value(MSB), read value is filled in.
+ *  @return     0 if successful.
+ */
+int reg_batch_exec(uint8_t *entry) {
+  uint8_t dev = entry[0];
+  uint8_t op = entry[1];
+  uint16_t addr = (entry[2] << 8) | entry[3];
+  uint16_t value = (entry[4] << 8) | entry[5];
+  uint8_t regval;
+  int ret = 0;
+
+  if (op == REG_OP_DELAY) {
+    if (value > REG_DELAY_MAX_MS)
+      return -1;
+    CyU3PThreadSleep(value);
+    return 0;
+  }
+  if (op != REG_OP_READ && op != REG_OP_WRITE)
+    return -1;
+  switch (dev) {
+  case REG_DEV_SENSOR:
+  case REG_DEV_SENSOR_LEFT:
+  case REG_DEV_SENSOR_RIGHT:
+    ret = reg_batch_sensor(dev, op == REG_OP_WRITE, addr, &value);
+    break;
+  case REG_DEV_IMU:
+    if (op == REG_OP_WRITE) {
+      ret = icm_write_reg(addr, value);
+    } else {
+      ret = icm_read_reg(addr, &regval);
+      value = regval;
+    }
+    break;
+  case REG_DEV_LED:
+    if (sensor_type == XPIRL2) {
+      if (op == REG_OP_WRITE)
+        tlc59116_reg_write(addr, value);
+      else
+        value = tlc59116_reg_read(addr);
+    } else if (sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
+      if (op == REG_OP_WRITE)
+        tlc59108_reg_write(addr, value);
+      else
+        value = tlc59108_reg_read(addr);
+    } else {
+      ret = -1;
+    }
+    break;
+  default:
+    ret = -1;
+    break;
+  }
+  entry[4] = value >> 8;
+  entry[5] = value & 0xff;
+  return ret;
+}
 
-  /* Wait for status response from SPI flash device. */
-  do {
-    buf[0] = 0x06;  /* Write enable command. */
+/**
+ *  @brief      execute a list of register accesses in one control transfer.
+ *  @param[out] bRequest    bRequst value of uvc.
+ *  @return     NULL.
+ */
+void EU_Rqts_reg_batch_RW(uint8_t bRequest) {
+  static uint8_t batch[REG_BATCH_LEN];
+  uint8_t Ep0Buffer[32] = {0};
+  uint16_t readCount;
+  uint8_t i, count;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
 
-    CyU3PSpiSetSsnLine(CyFalse);
-    status = CyU3PSpiTransmitWords(buf, 1);
-    CyU3PSpiSetSsnLine(CyTrue);
-    if (status != CY_U3P_SUCCESS) {
-      sensor_err("SPI WR_ENABLE command failed\n\r");
-      return status;
+  /* Register batch command
+  ------------------------------------------------------------------
+  |Byte location| count | failed | entry 0 | entry 1 | ... | entry 39 |
+  ------------------------------------------------------------------
+  |   Byte num  |   1   |   1    |    6    |    6    | ... |    6     |
+  ------------------------------------------------------------------
+  entry: device(enum REG_BATCH_DEV), op(enum REG_BATCH_OP), address 2(MSB), value 2(MSB).
+  SET_CUR executes the entries in order, GET_CUR returns the list with read values filled in,
+  failed is the number of entries with REG_OP_ERROR set in op.
+  */
+  switch (bRequest) {
+  case CY_FX_USB_UVC_GET_CUR_REQ:
+    CyU3PUsbSendEP0Data(REG_BATCH_LEN, batch);
+    break;
+  case CY_FX_USB_UVC_SET_CUR_REQ:
+    apiRetStatus = CyU3PUsbGetEP0Data(REG_BATCH_LEN, batch, &readCount);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      sensor_err("CyU3 get Ep0 data failed\r\n");
+      CyFxAppErrorHandler(apiRetStatus);
+      break;
+    }
+    count = batch[0];
+    if (count > REG_BATCH_MAX)
+      count = REG_BATCH_MAX;
+    batch[1] = 0;
+    for (i = 0; i < count; i++) {
+      if (reg_batch_exec(&batch[2 + i * REG_BATCH_ENTRY_LEN])) {
+        batch[2 + i * REG_BATCH_ENTRY_LEN + 1] |= REG_OP_ERROR;
+        batch[1]++;
+      }
     }
+    if (batch[1])
+      sensor_err("reg batch: %d of %d entries failed\r\n", batch[1], count);
+    break;
+  case CY_FX_USB_UVC_GET_LEN_REQ:
+    Ep0Buffer[0] = REG_BATCH_LEN & 0xff;
+    Ep0Buffer[1] = REG_BATCH_LEN >> 8;
+    CyU3PUsbSendEP0Data(2, (uint8_t *)Ep0Buffer);
+    break;
+  case CY_FX_USB_UVC_GET_INFO_REQ:
+    Ep0Buffer[0] = 3;
+    CyU3PUsbSendEP0Data(1, (uint8_t *)Ep0Buffer);
+    break;
+  default:
+    sensor_err("unknown reg batch cmd: 0x%x\r\n", bRequest);
+    CyU3PUsbStall(0, CyTrue, CyFalse);
+    break;
+  }
+}
+
+/* SPI initialization for flash programmer application. */
+CyU3PReturnStatus_t CyFxFlashProgSpiInit(uint16_t pageLen) {
+  CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
+  CyU3PSpiConfig_t spiConfig;
+  CyU3PDmaChannelConfig_t dmaConfig;
+
+  status = CyU3PMutexCreate(&glSpiLock, CYU3P_NO_INHERIT);
+  if (status != CY_U3P_SUCCESS) {
+    sensor_err("spi flash lock create failed!\r\n");
+    return status;
+  }
+
+  /* Start the SPI module and configure the master. */
+  status = CyU3PSpiInit();
+  if (status != CY_U3P_SUCCESS) {
+    sensor_err("CyU3 spi module int failed!\r\n");
+    return status;
+  }
+
+  /* Start the SPI master block. Run the SPI clock at CY_FX_FLASH_SPI_CLOCK
+   * and configure the word length to 8 bits. Also configure
+   * the slave select using FW. */
+  CyU3PMemSet ((uint8_t *)&spiConfig, 0, sizeof(spiConfig));
+  spiConfig.isLsbFirst = CyFalse;
+  spiConfig.cpol       = CyTrue;
+  spiConfig.ssnPol     = CyFalse;
+  spiConfig.cpha       = CyTrue;
+  spiConfig.leadTime   = CY_U3P_SPI_SSN_LAG_LEAD_HALF_CLK;
+  spiConfig.lagTime    = CY_U3P_SPI_SSN_LAG_LEAD_HALF_CLK;
+  spiConfig.ssnCtrl    = CY_U3P_SPI_SSN_CTRL_FW;
+  spiConfig.clock      = CY_FX_FLASH_SPI_CLOCK;
+  spiConfig.wordLen    = 8;
+
+  status = CyU3PSpiSetConfig(&spiConfig, NULL);
+  if (status != CY_U3P_SUCCESS) {
+    return status;
+  }
+
+  /* Create the DMA channels for SPI write and read. */
+  CyU3PMemSet ((uint8_t *)&dmaConfig, 0, sizeof(dmaConfig));
+  dmaConfig.size           = pageLen;
+  /* No buffers need to be allocated as this channel
+   * will be used only in override mode. */
+  dmaConfig.count          = 0;
+  dmaConfig.prodAvailCount = 0;
+  dmaConfig.dmaMode        = CY_U3P_DMA_MODE_BYTE;
+  dmaConfig.prodHeader     = 0;
+  dmaConfig.prodFooter     = 0;
+  dmaConfig.consHeader     = 0;
+  dmaConfig.notification   = 0;
+  dmaConfig.cb             = NULL;
+
+  /* Channel to write to SPI flash. */
+  dmaConfig.prodSckId = CY_U3P_CPU_SOCKET_PROD;
+  dmaConfig.consSckId = CY_U3P_LPP_SOCKET_SPI_CONS;
+  status = CyU3PDmaChannelCreate(&glSpiTxHandle, CY_U3P_DMA_TYPE_MANUAL_OUT, &dmaConfig);
+  if (status != CY_U3P_SUCCESS) {
+    return status;
+  }
 
+  /* Channel to read from SPI flash. */
+  dmaConfig.prodSckId = CY_U3P_LPP_SOCKET_SPI_PROD;
+  dmaConfig.consSckId = CY_U3P_CPU_SOCKET_CONS;
+  status = CyU3PDmaChannelCreate(&glSpiRxHandle, CY_U3P_DMA_TYPE_MANUAL_IN, &dmaConfig);
+  if (status == CY_U3P_SUCCESS) {
+    glSpiPageSize = pageLen;
+  }
+
+  return status;
+}
+
+/* Poll the WIP bit of the SPI flash status register until the last program or erase is done. */
+static CyU3PReturnStatus_t CyFxFlashProgSpiWaitForWip(void) {
+  uint8_t buf[1], rd_buf[2];
+  uint32_t start = CyU3PGetTime();
+  CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
+
+  do {
     buf[0] = 0x05;  /* Read status command */
 
     CyU3PSpiSetSsnLine(CyFalse);
@@ -800,120 +2029,168 @@ static CyU3PReturnStatus_t CyFxFlashProgSpiWaitForStatus(void) {
       sensor_err("SPI status read failed\n\r");
       return status;
     }
-  } while ((rd_buf[0] & 1) || (!(rd_buf[0] & 0x2)));
+    if ((CyU3PGetTime() - start) > CY_FX_FLASH_PROG_TIMEOUT) {
+      sensor_err("SPI flash busy timeout\n\r");
+      return CY_U3P_ERROR_TIMEOUT;
+    }
+  } while (rd_buf[0] & 1);
 
   return CY_U3P_SUCCESS;
 }
 
-/* SPI read / write for programmer application. */
-CyU3PReturnStatus_t CyFxFlashProgSpiTransfer(uint16_t pageAddress, uint16_t  byteCount,
-                                             uint8_t  *buffer, CyBool_t  isRead) {
+/* Wait for the SPI flash to be idle and set its write enable latch. */
+static CyU3PReturnStatus_t CyFxFlashProgSpiWriteEnable(void) {
+  uint8_t buf[1];
+  CyU3PReturnStatus_t status;
+
+  status = CyFxFlashProgSpiWaitForWip();
+  if (status != CY_U3P_SUCCESS)
+    return status;
+
+  buf[0] = 0x06;  /* Write enable command. */
+
+  CyU3PSpiSetSsnLine(CyFalse);
+  status = CyU3PSpiTransmitWords(buf, 1);
+  CyU3PSpiSetSsnLine(CyTrue);
+  if (status != CY_U3P_SUCCESS)
+    sensor_err("SPI WR_ENABLE command failed\n\r");
+  return status;
+}
+
+/* Contiguous read with a single fast read command, DMA in chunks of CY_FX_FLASH_READ_CHUNK. */
+static CyU3PReturnStatus_t CyFxFlashProgSpiRead(uint32_t byteAddress, uint16_t byteCount,
+                                                uint8_t *buffer) {
   CyU3PDmaBuffer_t buf_p;
-  uint8_t location[4];
-  uint32_t byteAddress = 0;
-  uint16_t pageCount = (byteCount / glSpiPageSize);
-  CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
+  uint8_t location[5];
+  uint32_t remain;
+  CyU3PReturnStatus_t status;
 
-  if (byteCount == 0) {
-    return CY_U3P_SUCCESS;
-  }
-  if ((byteCount % glSpiPageSize) != 0) {
-    pageCount++;
+  /* Reads are done in 16 byte units, callers size their buffers in pages. */
+  remain = (byteCount + 15) & ~15;
+
+  status = CyFxFlashProgSpiWaitForWip();
+  if (status != CY_U3P_SUCCESS)
+    return status;
+
+  location[0] = 0x0B; /* Fast read command, one dummy byte after the address. */
+  location[1] = (byteAddress >> 16) & 0xFF;       /* MS byte */
+  location[2] = (byteAddress >> 8) & 0xFF;
+  location[3] = byteAddress & 0xFF;               /* LS byte */
+  location[4] = 0;
+
+  CyU3PSpiSetSsnLine(CyFalse);
+  status = CyU3PSpiTransmitWords(location, 5);
+  if (status != CY_U3P_SUCCESS) {
+    sensor_err("SPI READ command failed\r\n");
+    CyU3PSpiSetSsnLine(CyTrue);
+    return status;
   }
 
+  CyU3PSpiSetBlockXfer(0, remain);
   buf_p.buffer = buffer;
   buf_p.status = 0;
+  while (remain != 0) {
+    buf_p.size  = remain > CY_FX_FLASH_READ_CHUNK ? CY_FX_FLASH_READ_CHUNK : remain;
+    buf_p.count = buf_p.size;
+    status = CyU3PDmaChannelSetupRecvBuffer(&glSpiRxHandle, &buf_p);
+    if (status == CY_U3P_SUCCESS)
+      status = CyU3PDmaChannelWaitForCompletion(&glSpiRxHandle, CY_FX_FLASH_PROG_TIMEOUT);
+    if (status != CY_U3P_SUCCESS)
+      break;
+    buf_p.buffer += buf_p.size;
+    remain -= buf_p.size;
+  }
 
-  byteAddress  = pageAddress * glSpiPageSize;
-  sensor_dbg("SPI access - addr: 0x%x, size: 0x%x, pages: 0x%x.\r\n",
-            byteAddress, byteCount, pageCount);
+  CyU3PSpiSetSsnLine(CyTrue);
+  CyU3PSpiDisableBlockXfer(CyFalse, CyTrue);
+  return status;
+}
 
-  while (pageCount != 0) {
-    location[1] = (byteAddress >> 16) & 0xFF;       /* MS byte */
-    location[2] = (byteAddress >> 8) & 0xFF;
-    location[3] = byteAddress & 0xFF;               /* LS byte */
-
-    if (isRead) {
-      location[0] = 0x03; /* Read command. */
-
-      buf_p.size  = glSpiPageSize;
-      buf_p.count = glSpiPageSize;
-
-      status = CyFxFlashProgSpiWaitForStatus();
-      if (status != CY_U3P_SUCCESS)
-        return status;
-
-      CyU3PSpiSetSsnLine(CyFalse);
-      status = CyU3PSpiTransmitWords(location, 4);
-      if (status != CY_U3P_SUCCESS) {
-        sensor_err("SPI READ command failed\r\n");
-        CyU3PSpiSetSsnLine(CyTrue);
-        return status;
-      }
+/* Program one page, the WIP bit is polled instead of waiting a fixed time. */
+static CyU3PReturnStatus_t CyFxFlashProgSpiWritePage(uint32_t byteAddress, uint8_t *buffer) {
+  CyU3PDmaBuffer_t buf_p;
+  uint8_t location[4];
+  CyU3PReturnStatus_t status;
 
-      CyU3PSpiSetBlockXfer(0, glSpiPageSize);
+  status = CyFxFlashProgSpiWriteEnable();
+  if (status != CY_U3P_SUCCESS)
+    return status;
 
-      status = CyU3PDmaChannelSetupRecvBuffer(&glSpiRxHandle, &buf_p);
-      if (status != CY_U3P_SUCCESS) {
-        CyU3PSpiSetSsnLine(CyTrue);
-        return status;
-      }
-      status = CyU3PDmaChannelWaitForCompletion(&glSpiRxHandle, CY_FX_FLASH_PROG_TIMEOUT);
-      if (status != CY_U3P_SUCCESS) {
-        CyU3PSpiSetSsnLine(CyTrue);
-        return status;
-      }
+  location[0] = 0x02; /* Write command */
+  location[1] = (byteAddress >> 16) & 0xFF;       /* MS byte */
+  location[2] = (byteAddress >> 8) & 0xFF;
+  location[3] = byteAddress & 0xFF;               /* LS byte */
 
-      CyU3PSpiSetSsnLine(CyTrue);
-      CyU3PSpiDisableBlockXfer(CyFalse, CyTrue);
-    } else { /* Write */
-      location[0] = 0x02; /* Write command */
-
-      buf_p.size  = glSpiPageSize;
-      buf_p.count = glSpiPageSize;
-
-      status = CyFxFlashProgSpiWaitForStatus();
-      if (status != CY_U3P_SUCCESS)
-        return status;
-
-      CyU3PSpiSetSsnLine(CyFalse);
-      status = CyU3PSpiTransmitWords(location, 4);
-      if (status != CY_U3P_SUCCESS) {
-        sensor_err("SPI WRITE command failed\r\n");
-        CyU3PSpiSetSsnLine(CyTrue);
-        return status;
-      }
+  CyU3PSpiSetSsnLine(CyFalse);
+  status = CyU3PSpiTransmitWords(location, 4);
+  if (status != CY_U3P_SUCCESS) {
+    sensor_err("SPI WRITE command failed\r\n");
+    CyU3PSpiSetSsnLine(CyTrue);
+    return status;
+  }
 
-      CyU3PSpiSetBlockXfer(glSpiPageSize, 0);
+  CyU3PSpiSetBlockXfer(glSpiPageSize, 0);
 
-      status = CyU3PDmaChannelSetupSendBuffer(&glSpiTxHandle, &buf_p);
-      if (status != CY_U3P_SUCCESS) {
-        CyU3PSpiSetSsnLine(CyTrue);
-        return status;
-      }
-      status = CyU3PDmaChannelWaitForCompletion(&glSpiTxHandle,
-               CY_FX_FLASH_PROG_TIMEOUT);
-      if (status != CY_U3P_SUCCESS) {
-        CyU3PSpiSetSsnLine(CyTrue);
-        return status;
-      }
+  buf_p.buffer = buffer;
+  buf_p.status = 0;
+  buf_p.size  = glSpiPageSize;
+  buf_p.count = glSpiPageSize;
+  status = CyU3PDmaChannelSetupSendBuffer(&glSpiTxHandle, &buf_p);
+  if (status == CY_U3P_SUCCESS)
+    status = CyU3PDmaChannelWaitForCompletion(&glSpiTxHandle, CY_FX_FLASH_PROG_TIMEOUT);
 
-      CyU3PSpiSetSsnLine(CyTrue);
-      CyU3PSpiDisableBlockXfer(CyTrue, CyFalse);
-    }
+  CyU3PSpiSetSsnLine(CyTrue);
+  CyU3PSpiDisableBlockXfer(CyTrue, CyFalse);
+  if (status != CY_U3P_SUCCESS)
+    return status;
 
-    /* Update the parameters */
-    byteAddress  += glSpiPageSize;
-    buf_p.buffer += glSpiPageSize;
-    pageCount--;
+  /* Page program takes about 1 ms, poll for it so the next page can start right away. */
+  return CyFxFlashProgSpiWaitForWip();
+}
 
-    CyU3PThreadSleep(10);
+/* SPI read / write for programmer application, glSpiLock is held by the caller. */
+static CyU3PReturnStatus_t CyFxFlashProgSpiPages(uint16_t pageAddress, uint16_t  byteCount,
+                                                 uint8_t  *buffer, CyBool_t  isRead) {
+  uint32_t byteAddress = pageAddress * glSpiPageSize;
+  uint16_t pageCount = (byteCount / glSpiPageSize);
+  CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
+
+  if (byteCount == 0) {
+    return CY_U3P_SUCCESS;
+  }
+  if ((byteCount % glSpiPageSize) != 0) {
+    pageCount++;
+  }
+  sensor_dbg("SPI access - addr: 0x%x, size: 0x%x, pages: 0x%x.\r\n",
+            byteAddress, byteCount, pageCount);
+
+  if (isRead)
+    return CyFxFlashProgSpiRead(byteAddress, byteCount, buffer);
+
+  while (pageCount != 0) {
+    status = CyFxFlashProgSpiWritePage(byteAddress, buffer);
+    if (status != CY_U3P_SUCCESS)
+      return status;
+    byteAddress += glSpiPageSize;
+    buffer      += glSpiPageSize;
+    pageCount--;
   }
   return CY_U3P_SUCCESS;
 }
 
-/* Function to erase SPI flash sectors. */
-CyU3PReturnStatus_t CyFxFlashProgEraseSector(CyBool_t isErase, uint8_t sector, uint8_t *wip) {
+/* SPI read / write for programmer application. */
+CyU3PReturnStatus_t CyFxFlashProgSpiTransfer(uint16_t pageAddress, uint16_t  byteCount,
+                                             uint8_t  *buffer, CyBool_t  isRead) {
+  CyU3PReturnStatus_t status;
+
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  status = CyFxFlashProgSpiPages(pageAddress, byteCount, buffer, isRead);
+  CyU3PMutexPut(&glSpiLock);
+  return status;
+}
+
+/* Function to erase SPI flash sectors, glSpiLock is held by the caller. */
+static CyU3PReturnStatus_t CyFxFlashProgSpiErase(CyBool_t isErase, uint8_t sector, uint8_t *wip) {
   uint32_t temp = 0;
   uint8_t  location[4], rdBuf[2];
   CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
@@ -922,15 +2199,12 @@ CyU3PReturnStatus_t CyFxFlashProgEraseSector(CyBool_t isErase, uint8_t sector, u
     return CY_U3P_ERROR_BAD_ARGUMENT;
   }
 
-  location[0] = 0x06;  /* Write enable. */
-
-  CyU3PSpiSetSsnLine(CyFalse);
-  status = CyU3PSpiTransmitWords(location, 1);
-  CyU3PSpiSetSsnLine(CyTrue);
-  if (status != CY_U3P_SUCCESS)
-    return status;
-
   if (isErase) {
+    /* Waits for a previous erase, a write enable sent while busy would be ignored. */
+    status = CyFxFlashProgSpiWriteEnable();
+    if (status != CY_U3P_SUCCESS)
+      return status;
+
     location[0] = 0xD8; /* Sector erase. */
     temp        = sector * 0x10000;
     location[1] = (temp >> 16) & 0xFF;
@@ -957,3 +2231,28 @@ CyU3PReturnStatus_t CyFxFlashProgEraseSector(CyBool_t isErase, uint8_t sector, u
 
   return status;
 }
+
+/* Function to erase SPI flash sectors. */
+CyU3PReturnStatus_t CyFxFlashProgEraseSector(CyBool_t isErase, uint8_t sector, uint8_t *wip) {
+  CyU3PReturnStatus_t status;
+
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  status = CyFxFlashProgSpiErase(isErase, sector, wip);
+  CyU3PMutexPut(&glSpiLock);
+  return status;
+}
+
+/* Erase one sector and sleep until it is done, other threads keep running meanwhile. */
+CyU3PReturnStatus_t CyFxFlashProgEraseSectorWait(uint8_t sector) {
+  CyU3PReturnStatus_t status;
+  uint8_t wip;
+
+  status = CyFxFlashProgEraseSector(CyTrue, sector, NULL);
+  while (status == CY_U3P_SUCCESS) {
+    CyU3PThreadSleep(10);
+    status = CyFxFlashProgEraseSector(CyFalse, 0, &wip);
+    if (!wip)
+      break;
+  }
+  return status;
+}
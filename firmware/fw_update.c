@@ -0,0 +1,362 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <cyu3system.h>
+#include <cyu3os.h>
+#include <cyu3error.h>
+#include <cyu3utils.h>
+#include "include/debug.h"
+#include "include/uvc.h"
+#include "include/extension_unit.h"
+#include "include/kv_store.h"
+#include "include/vendor_bulk.h"
+#include "include/fw_update.h"
+
+#define FW_JOURNAL_LEN  9
+#define FW_IMAGE_TYPE   0xB0   // bImageType of a normal FX3 image with checksum
+
+static struct {
+  uint8_t state;       // enum FW_UPDATE_STATE
+  uint32_t size;
+  uint32_t crc;
+} fw_journal = {FW_STATE_IDLE, 0, 0};
+
+/* Flash read buffer, chunk_addr is the flash address it holds, ~0 if none. */
+static uint8_t fw_chunk[FW_CHUNK];
+static uint32_t fw_chunk_addr = ~0;
+
+/**
+ *  @brief      store the journal in the kv store.
+ *  @param[out] NULL.
+ *  @return     CY_U3P_SUCCESS if successful.
+ */
+static CyU3PReturnStatus_t fw_journal_save(void) {
+  uint8_t value[FW_JOURNAL_LEN];
+
+  value[0] = fw_journal.state;
+  value[1] = fw_journal.size >> 24;
+  value[2] = fw_journal.size >> 16;
+  value[3] = fw_journal.size >> 8;
+  value[4] = fw_journal.size & 0xFF;
+  value[5] = fw_journal.crc >> 24;
+  value[6] = fw_journal.crc >> 16;
+  value[7] = fw_journal.crc >> 8;
+  value[8] = fw_journal.crc & 0xFF;
+  return kv_set(KV_KEY_FW_UPDATE, value, FW_JOURNAL_LEN) == KV_OK ?
+         CY_U3P_SUCCESS : CY_U3P_ERROR_FAILURE;
+}
+
+/**
+ *  @brief      load the journal from the kv store, IDLE if there is none.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+static void fw_journal_load(void) {
+  uint8_t value[KV_VALUE_MAX];
+  uint8_t len;
+
+  fw_journal.state = FW_STATE_IDLE;
+  if (kv_get(KV_KEY_FW_UPDATE, value, &len) != KV_OK || len != FW_JOURNAL_LEN)
+    return;
+  fw_journal.state = value[0];
+  fw_journal.size = (uint32_t)value[1] << 24 | value[2] << 16 | value[3] << 8 | value[4];
+  fw_journal.crc = (uint32_t)value[5] << 24 | value[6] << 16 | value[7] << 8 | value[8];
+}
+
+/**
+ *  @brief      read the flash chunk holding addr into fw_chunk.
+ *  @param[in]  addr    flash byte address.
+ *  @return     offset of addr in fw_chunk, negative on error.
+ */
+static int32_t fw_chunk_load(uint32_t addr) {
+  uint32_t base = addr - addr % FW_CHUNK;
+
+  if (base != fw_chunk_addr) {
+    fw_chunk_addr = ~0;
+    if (CyFxFlashProgSpiTransfer(base / SPI_FLASH_PAGE_SIZE, FW_CHUNK, fw_chunk, CyTrue) !=
+        CY_U3P_SUCCESS)
+      return -1;
+    fw_chunk_addr = base;
+  }
+  return addr - base;
+}
+
+/**
+ *  @brief      CRC32 (IEEE 802.3) of a flash range, the same as zlib crc32.
+ *  @param[in]  addr    flash byte address.
+ *  @param[in]  len     bytes.
+ *  @param[out] crc     CRC32.
+ *  @return     CY_U3P_SUCCESS if successful.
+ */
+static CyU3PReturnStatus_t fw_crc32(uint32_t addr, uint32_t len, uint32_t *crc) {
+  uint32_t value = 0xFFFFFFFF;
+  int32_t offset;
+  uint8_t bit;
+
+  while (len) {
+    offset = fw_chunk_load(addr);
+    if (offset < 0)
+      return CY_U3P_ERROR_FAILURE;
+    for (; offset < FW_CHUNK && len; offset++, addr++, len--) {
+      value ^= fw_chunk[offset];
+      for (bit = 0; bit < 8; bit++)
+        value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+    }
+  }
+  *crc = ~value;
+  return CY_U3P_SUCCESS;
+}
+
+/**
+ *  @brief      read a little endian word of an image in flash.
+ *  @param[in]  addr    word aligned flash byte address.
+ *  @param[out] word    value.
+ *  @return     CyTrue if successful.
+ */
+static CyBool_t fw_word(uint32_t addr, uint32_t *word) {
+  int32_t offset = fw_chunk_load(addr);
+
+  if (offset < 0)
+    return CyFalse;
+  *word = fw_chunk[offset] | fw_chunk[offset + 1] << 8 | fw_chunk[offset + 2] << 16 |
+          (uint32_t)fw_chunk[offset + 3] << 24;
+  return CyTrue;
+}
+
+/**
+ *  @brief      walk an FX3 boot image: "CY", bImageCTL, bImageType, then sections of length
+ *              in words, address and data, closed by a zero length section with the entry
+ *              point and the checksum, the sum of all section data words.
+ *  @param[in]  base    flash byte address of the image.
+ *  @param[in]  max     bytes the image may take.
+ *  @param[out] size    image size in bytes.
+ *  @return     CyTrue if the image is complete and its checksum matches.
+ */
+static CyBool_t fw_image_check(uint32_t base, uint32_t max, uint32_t *size) {
+  uint32_t offset = 4, words, word, sum = 0;
+
+  if (!fw_word(base, &word) || (word & 0xFFFF) != ('C' | 'Y' << 8) ||
+      (word >> 24) != FW_IMAGE_TYPE)
+    return CyFalse;
+  while (offset + 12 <= max) {
+    if (!fw_word(base + offset, &words))
+      return CyFalse;
+    offset += 8;
+    if (words == 0) {
+      if (!fw_word(base + offset, &word))
+        return CyFalse;
+      *size = offset + 4;
+      return word == sum;
+    }
+    if (words > (max - offset) / 4)
+      return CyFalse;
+    for (; words; words--, offset += 4) {
+      if (!fw_word(base + offset, &word))
+        return CyFalse;
+      sum += word;
+    }
+  }
+  return CyFalse;
+}
+
+/**
+ *  @brief      copy the staged image into the boot slot, the first page goes last. No image
+ *              boots from flash between the first erase and the signature page, see the brick
+ *              window in fw_update.h.
+ *  @param[out] NULL.
+ *  @return     VB_STATUS.
+ */
+static uint8_t fw_copy(void) {
+  uint32_t len = (fw_journal.size + SPI_FLASH_PAGE_SIZE - 1) & ~(SPI_FLASH_PAGE_SIZE - 1);
+  uint32_t offset, count, crc;
+  uint8_t sector, sectors = (len + SPI_FLASH_SECTOR_SIZE - 1) / SPI_FLASH_SECTOR_SIZE;
+
+  if (fw_crc32(FW_BOOT_ADDR, fw_journal.size, &crc) == CY_U3P_SUCCESS && crc == fw_journal.crc)
+    return VB_STATUS_OK;
+  sensor_info("fw update: copy %d bytes into the boot slot\r\n", fw_journal.size);
+  // the end section closes the image, a stale tail of the old one is never read
+  for (sector = 0; sector < sectors; sector++) {
+    if (CyFxFlashProgEraseSectorWait(FW_BOOT_ADDR / SPI_FLASH_SECTOR_SIZE + sector) !=
+        CY_U3P_SUCCESS)
+      return VB_STATUS_IO_ERROR;
+  }
+  for (offset = SPI_FLASH_PAGE_SIZE; offset < len; offset += count) {
+    count = FW_CHUNK - offset % FW_CHUNK;
+    if (count > len - offset)
+      count = len - offset;
+    if (fw_chunk_load(FW_STAGING_ADDR + offset) < 0 ||
+        CyFxFlashProgSpiTransfer((FW_BOOT_ADDR + offset) / SPI_FLASH_PAGE_SIZE, count,
+                                 &fw_chunk[offset % FW_CHUNK], CyFalse) != CY_U3P_SUCCESS)
+      return VB_STATUS_IO_ERROR;
+  }
+  /* Signature page last, the ROM only takes the image from here on. */
+  if (fw_chunk_load(FW_STAGING_ADDR) < 0 ||
+      CyFxFlashProgSpiTransfer(FW_BOOT_ADDR / SPI_FLASH_PAGE_SIZE, SPI_FLASH_PAGE_SIZE,
+                               fw_chunk, CyFalse) != CY_U3P_SUCCESS)
+    return VB_STATUS_IO_ERROR;
+  fw_chunk_addr = ~0;
+  if (fw_crc32(FW_BOOT_ADDR, fw_journal.size, &crc) != CY_U3P_SUCCESS || crc != fw_journal.crc) {
+    sensor_err("fw update: boot slot verify failed\r\n");
+    return VB_STATUS_VERIFY;
+  }
+  return VB_STATUS_OK;
+}
+
+/**
+ *  @brief      start an update, erase the staging slot.
+ *  @param[in]  size    image size in bytes.
+ *  @param[in]  crc     CRC32 of the image.
+ *  @return     VB_STATUS.
+ */
+uint8_t fw_update_begin(uint32_t size, uint32_t crc) {
+  uint32_t boot_size;
+  uint8_t sector;
+
+  if (size < 16 || size > FW_SLOT_SIZE)
+    return VB_STATUS_BAD_ARG;
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  fw_journal_load();
+  fw_chunk_addr = ~0;
+  /* The staging slot follows the boot slot, a longer boot image would lose its tail. */
+  if (fw_journal.state == FW_STATE_COPY ||
+      (fw_image_check(FW_BOOT_ADDR, SPI_FLASH_SIZE, &boot_size) && boot_size > FW_SLOT_SIZE)) {
+    sensor_err("fw update: boot slot busy or image too large\r\n");
+    CyU3PMutexPut(&glSpiLock);
+    return VB_STATUS_BAD_ARG;
+  }
+  fw_journal.state = FW_STATE_STAGING;
+  fw_journal.size = size;
+  fw_journal.crc = crc;
+  if (fw_journal_save() != CY_U3P_SUCCESS) {
+    CyU3PMutexPut(&glSpiLock);
+    return VB_STATUS_IO_ERROR;
+  }
+  CyU3PMutexPut(&glSpiLock);
+  sensor_info("fw update: stage %d bytes, crc 0x%x\r\n", size, crc);
+  for (sector = 0; sector < FW_SLOT_SIZE / SPI_FLASH_SECTOR_SIZE; sector++) {
+    if (CyFxFlashProgEraseSectorWait(FW_STAGING_ADDR / SPI_FLASH_SECTOR_SIZE + sector) !=
+        CY_U3P_SUCCESS)
+      return VB_STATUS_IO_ERROR;
+  }
+  return VB_STATUS_OK;
+}
+
+/**
+ *  @brief      check a FW_WRITE range against the update in progress.
+ *  @param[in]  offset  offset in the image.
+ *  @param[in]  len     bytes.
+ *  @return     CyTrue if the range may be written at FW_STAGING_ADDR + offset.
+ */
+CyBool_t fw_update_write_ok(uint32_t offset, uint32_t len) {
+  return fw_journal.state == FW_STATE_STAGING && (offset % SPI_FLASH_PAGE_SIZE) == 0 &&
+         offset <= fw_journal.size && len <= fw_journal.size - offset;
+}
+
+/**
+ *  @brief      verify the staged image and copy it into the boot slot.
+ *  @param[in]  ack     FW_COMMIT_ACK, the host accepts the brick window of the copy.
+ *  @return     VB_STATUS.
+ */
+uint8_t fw_update_commit(uint32_t ack) {
+  uint32_t crc, size;
+  uint8_t status;
+
+  if (ack != FW_COMMIT_ACK) {
+    sensor_err("fw update: commit without brick window ack 0x%x\r\n", ack);
+    return VB_STATUS_BAD_ARG;
+  }
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  fw_chunk_addr = ~0;
+  if (fw_journal.state != FW_STATE_STAGING && fw_journal.state != FW_STATE_COPY) {
+    status = VB_STATUS_BAD_ARG;
+  } else if (fw_crc32(FW_STAGING_ADDR, fw_journal.size, &crc) != CY_U3P_SUCCESS ||
+             crc != fw_journal.crc || !fw_image_check(FW_STAGING_ADDR, fw_journal.size, &size) ||
+             size != fw_journal.size) {
+    sensor_err("fw update: staged image check failed, crc 0x%x\r\n", crc);
+    status = VB_STATUS_VERIFY;
+  } else {
+    fw_journal.state = FW_STATE_COPY;
+    status = fw_journal_save() == CY_U3P_SUCCESS ? fw_copy() : VB_STATUS_IO_ERROR;
+    if (status == VB_STATUS_OK) {
+      fw_journal.state = FW_STATE_DONE;
+      fw_journal_save();
+    }
+  }
+  CyU3PMutexPut(&glSpiLock);
+  return status;
+}
+
+/**
+ *  @brief      fill the FW_STATUS data.
+ *  @param[out] buffer  FW_STATUS_LEN bytes.
+ *  @return     NULL.
+ */
+void fw_update_status(uint8_t *buffer) {
+  CyU3PMemSet(buffer, 0, FW_STATUS_LEN);
+  buffer[0] = fw_journal.state;
+  buffer[4] = fw_journal.size >> 24;
+  buffer[5] = fw_journal.size >> 16;
+  buffer[6] = fw_journal.size >> 8;
+  buffer[7] = fw_journal.size & 0xFF;
+  buffer[8] = fw_journal.crc >> 24;
+  buffer[9] = fw_journal.crc >> 16;
+  buffer[10] = fw_journal.crc >> 8;
+  buffer[11] = fw_journal.crc & 0xFF;
+}
+
+/**
+ *  @brief      finish a copy into the boot slot cut short by a reset, runs after kv_init.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void fw_update_resume(void) {
+  uint32_t crc, boot_crc;
+
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  fw_journal_load();
+  if (fw_journal.state != FW_STATE_COPY) {
+    CyU3PMutexPut(&glSpiLock);
+    return;
+  }
+  fw_chunk_addr = ~0;
+  if (fw_crc32(FW_STAGING_ADDR, fw_journal.size, &crc) != CY_U3P_SUCCESS ||
+      crc != fw_journal.crc) {
+    sensor_err("fw update: staged image lost, update abandoned\r\n");
+    fw_journal.state = FW_STATE_IDLE;
+    fw_journal_save();
+    CyU3PMutexPut(&glSpiLock);
+    return;
+  }
+  if (fw_crc32(FW_BOOT_ADDR, fw_journal.size, &boot_crc) == CY_U3P_SUCCESS &&
+      boot_crc == fw_journal.crc) {
+    // Reset came after the copy, the new image is what is running
+    fw_journal.state = FW_STATE_DONE;
+    fw_journal_save();
+    CyU3PMutexPut(&glSpiLock);
+    return;
+  }
+  sensor_info("fw update: resume copy into the boot slot\r\n");
+  if (fw_copy() == VB_STATUS_OK) {
+    fw_journal.state = FW_STATE_DONE;
+    fw_journal_save();
+    CyU3PMutexPut(&glSpiLock);
+    /* Boot the image just written instead of whatever is running now. */
+    CyU3PThreadSleep(10);
+    CyU3PDeviceReset(CyFalse);
+    return;
+  }
+  CyU3PMutexPut(&glSpiLock);
+}
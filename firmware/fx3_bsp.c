@@ -14,14 +14,39 @@
  * limitations under the License.
  *****************************************************************************/
 
+#include <cyu3os.h>
+#include <cyu3vic.h>
 #include <cyu3error.h>
 #include <cyu3gpio.h>
 #include "include/fx3_bsp.h"
 #include "include/debug.h"
 #include "include/uvc.h"
 #include "include/tlc59116.h"
+#include "include/thread_prof.h"
+#include "include/histogram.h"
+#include "include/trace.h"
+#include "include/sensor_v034_raw.h"
 
 int hardware_version_num = 0x00;
+struct trigger_ctl_t trigger_ctrl = {TRIGGER_OFF, 0, 0, 0};
+volatile uint32_t trigger_seq = 0;
+/* Sensor I2C and the split address mode, EP0, vendor bulk and streaming threads all write
+ * sensor registers. Owners are allowed to nest, as ThreadX mutexes count. */
+CyU3PMutex glSensorLock;
+/* Trigger pulse period and width in ticks, whether the next pulse is the first one of a master,
+ * and CyU3PGetTime() of the last pulse for gaps past the wrap of fx3_ticks(). */
+static uint32_t trigger_period = 0, trigger_threshold = 0;
+static volatile CyBool_t trigger_starting = CyFalse;
+static volatile uint32_t trigger_ms = 0;
+/* TRIGGER_LOW_POWER state, the wake timer and the trigger interrupt both move it. */
+enum SENSOR_SLEEP {
+  SLEEP_IDLE    = 0,    // sensors active, no wake pending
+  SLEEP_STANDBY = 1,    // sensors in standby, wake timer running
+  SLEEP_WOKEN   = 2     // woken by the timer, waiting for the pulse
+};
+static CyU3PTimer sleepTimer;
+static volatile uint8_t sleep_state = SLEEP_IDLE;
+static volatile uint32_t trigger_ticks = 0, wake_ticks = 0;
 
 char *Baidu_ProductDscr[16] = {
   "Baidu_Robotics_vision_XP/XP2",
@@ -81,6 +106,13 @@ void fx3_gpio_module_init(void) {
   gpioClock.clkSrc     = CY_U3P_SYS_CLK;
   gpioClock.halfDiv    = 0;
 
+  // the streaming thread waits on it, inherit keeps a low priority owner from stalling it
+  apiRetStatus = CyU3PMutexCreate(&glSensorLock, CYU3P_INHERIT);
+  if (apiRetStatus != CY_U3P_SUCCESS) {
+    sensor_err("sensor lock create failed, Error Code = 0x%x\r\n", apiRetStatus);
+    CyFxAppErrorHandler(apiRetStatus);
+  }
+
   /* Initialize Gpio interface */
   apiRetStatus = CyU3PGpioInit(&gpioClock, CyFx_GpioIntrCb);
   if (apiRetStatus != CY_U3P_SUCCESS) {
@@ -98,13 +130,12 @@ void fx3_gpio_module_init(void) {
                  CyU3PDeviceGpioOverride(SENSOR_LED_GPIO, CyTrue) | \
                  CyU3PDeviceGpioOverride(IMU_AD0_GPIO, CyTrue) | \
                  CyU3PDeviceGpioOverride(IMU_NCS_GPIO, CyTrue) | \
+                 CyU3PDeviceGpioOverride(IMU_INT_GPIO, CyTrue) | \
                  CyU3PDeviceGpioOverride(CAMPWR_CONTROL_GPIO, CyTrue) | \
                  CyU3PDeviceGpioOverride(HARD_VERSION_A0, CyTrue) | \
                  CyU3PDeviceGpioOverride(HARD_VERSION_A1, CyTrue) | \
                  CyU3PDeviceGpioOverride(HARD_VERSION_A2, CyTrue) | \
                  CyU3PDeviceGpioOverride(HARD_VERSION_A3, CyTrue) | \
-                 CyU3PDeviceGpioOverride(UNUSED_GPIO1, CyTrue) | \
-                 CyU3PDeviceGpioOverride(UNUSED_GPIO2, CyTrue) | \
                  CyU3PDeviceGpioOverride(UNUSED_GPIO3, CyTrue) | \
                  CyU3PDeviceGpioOverride(UNUSED_GPIO4, CyTrue) | \
                  CyU3PDeviceGpioOverride(UNUSED_GPIO5, CyTrue) | \
@@ -162,15 +193,14 @@ void fx3_gpio_module_init(void) {
     sensor_err("hardware version detect GPIO Set Error, Error = 0x%x\r\n", apiRetStatus);
     CyFxAppErrorHandler(apiRetStatus);
   }
+  fx3_imu_int_enable(CyFalse);
   sensor_dbg("FX3 GPIO init finish\r\n");
   hardware_version_num = hadrware_version_detect();
   sensor_type = (enum SensorType)hardware_version_num;
   sensor_info("hardware_version_num: 0x%x \r\n", hardware_version_num);
 
   gpioConfig.inputEn     = CyTrue;
-  apiRetStatus           = CyU3PGpioSetSimpleConfig(UNUSED_GPIO1, &gpioConfig) | \
-                           CyU3PGpioSetSimpleConfig(UNUSED_GPIO2, &gpioConfig) | \
-                           CyU3PGpioSetSimpleConfig(UNUSED_GPIO3, &gpioConfig) | \
+  apiRetStatus           = CyU3PGpioSetSimpleConfig(UNUSED_GPIO3, &gpioConfig) | \
                            CyU3PGpioSetSimpleConfig(UNUSED_GPIO4, &gpioConfig) | \
                            CyU3PGpioSetSimpleConfig(UNUSED_GPIO5, &gpioConfig) | \
                            CyU3PGpioSetSimpleConfig(UNUSED_GPIO6, &gpioConfig) | \
@@ -198,6 +228,26 @@ void fx3_gpio_module_init(void) {
   if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A)
     fx3_LIMA_GPIO_init();
 }
+/**
+ *  @brief      configure the IMU interrupt input, its edges only count while the IMU is idle in
+ *              wake on motion mode, otherwise the pin pulses with every data ready.
+ *  @param[in]  enable  CyTrue to raise CY_FX_UVC_IMU_MOTION_EVENT on a rising edge.
+ *  @return     NULL.
+ */
+void fx3_imu_int_enable(CyBool_t enable) {
+  CyU3PGpioSimpleConfig_t      gpioConfig;
+  CyU3PReturnStatus_t          apiRetStatus;
+
+  gpioConfig.outValue    = CyFalse;
+  gpioConfig.inputEn     = CyTrue;
+  gpioConfig.driveLowEn  = CyFalse;
+  gpioConfig.driveHighEn = CyFalse;
+  gpioConfig.intrMode    = enable ? CY_U3P_GPIO_INTR_POS_EDGE : CY_U3P_GPIO_NO_INTR;
+  apiRetStatus = CyU3PGpioSetSimpleConfig(IMU_INT_GPIO, &gpioConfig);
+  if (apiRetStatus != CY_U3P_SUCCESS)
+    sensor_err("IMU INT GPIO Set Config Error, Error Code = 0x%x\r\n", apiRetStatus);
+}
+
 /**
  *  @brief      FX3 LIMA GPIO Init For XPIRL2/3.
  *  @param[]    NULL.
@@ -244,6 +294,187 @@ void fx3_LIMA_GPIO_init(void) {
   }
 }
 
+/**
+ *  @brief      configure the snapshot trigger pin, the sensors must be set up by the caller.
+ *  @param[in]  ctrl    trigger mode, period, pulse window and phase.
+ *  @return     CY_U3P_SUCCESS or GPIO error code.
+ */
+CyU3PReturnStatus_t fx3_trigger_config(struct trigger_ctl_t *ctrl) {
+  CyU3PGpioSimpleConfig_t      gpioConfig;
+  CyU3PGpioComplexConfig_t     gpioComplexConfig;
+  CyU3PReturnStatus_t          apiRetStatus;
+  uint32_t period, threshold, phase;
+
+  if (ctrl->mode != TRIGGER_OFF && ctrl->period_us > TRIGGER_MAX_PERIOD_US)
+    return CY_U3P_ERROR_BAD_ARGUMENT;
+  CyU3PGpioDisable(CAMERA_EXPOSURE_GPIO);
+  sensor_sleep_stop();
+  // sequence 0 until the sync pulse, see TRIGGER_SYNC_GAP
+  trigger_seq = 0;
+  trigger_period = (uint64_t)ctrl->period_us * GPIO_FAST_CLK_HZ / 1000000;
+  trigger_threshold = (uint64_t)ctrl->window_us * GPIO_FAST_CLK_HZ / 1000000;
+  trigger_ticks = fx3_ticks();
+  trigger_ms = CyU3PGetTime();
+
+  if (ctrl->mode == TRIGGER_MASTER || ctrl->mode == TRIGGER_LOW_POWER) {
+    period = trigger_period;
+    threshold = trigger_threshold;
+    phase = (uint64_t)(ctrl->phase_us % ctrl->period_us) * GPIO_FAST_CLK_HZ / 1000000;
+    // PWM drives the pin high while the timer is below threshold, so the pulse rises when the
+    // timer wraps. The first cycle starts at threshold and lasts TRIGGER_SYNC_GAP plus phase,
+    // the interrupt of its wrap sets the period of the following ones.
+    // CTL pins have no IO matrix entry, the override selects the complex GPIO block.
+    trigger_starting = CyTrue;
+    apiRetStatus = CyU3PDeviceGpioOverride(CAMERA_EXPOSURE_GPIO, CyFalse);
+    gpioComplexConfig.outValue    = CyFalse;
+    gpioComplexConfig.driveLowEn  = CyTrue;
+    gpioComplexConfig.driveHighEn = CyTrue;
+    gpioComplexConfig.inputEn     = CyFalse;
+    gpioComplexConfig.pinMode     = CY_U3P_GPIO_MODE_PWM;
+    gpioComplexConfig.intrMode    = CY_U3P_GPIO_INTR_TIMER_ZERO;
+    gpioComplexConfig.timerMode   = CY_U3P_GPIO_TIMER_HIGH_FREQ;
+    gpioComplexConfig.timer       = threshold;
+    gpioComplexConfig.period      = threshold + TRIGGER_SYNC_GAP(period) + phase;
+    gpioComplexConfig.threshold   = threshold;
+    apiRetStatus |= CyU3PGpioSetComplexConfig(CAMERA_EXPOSURE_GPIO, &gpioComplexConfig);
+  } else {
+    apiRetStatus = CyU3PDeviceGpioOverride(CAMERA_EXPOSURE_GPIO, CyTrue);
+    gpioConfig.outValue    = CyFalse;
+    gpioConfig.intrMode    = CY_U3P_GPIO_NO_INTR;
+    if (ctrl->mode == TRIGGER_EXTERNAL) {
+      // the master's pulse also reaches our sensors directly, only count it here
+      gpioConfig.inputEn     = CyTrue;
+      gpioConfig.driveLowEn  = CyFalse;
+      gpioConfig.driveHighEn = CyFalse;
+      gpioConfig.intrMode    = CY_U3P_GPIO_INTR_POS_EDGE;
+    } else {
+      gpioConfig.inputEn     = CyFalse;
+      gpioConfig.driveLowEn  = CyTrue;
+      gpioConfig.driveHighEn = CyTrue;
+    }
+    apiRetStatus |= CyU3PGpioSetSimpleConfig(CAMERA_EXPOSURE_GPIO, &gpioConfig);
+  }
+
+  if (apiRetStatus != CY_U3P_SUCCESS) {
+    sensor_err("Trigger GPIO Set Config Error, Error Code = 0x%x\r\n", apiRetStatus);
+    return apiRetStatus;
+  }
+  trigger_ctrl = *ctrl;
+  sensor_info("trigger mode %d, period %d us, window %d us, phase %d us\r\n", ctrl->mode,
+              ctrl->period_us, ctrl->window_us, ctrl->phase_us);
+  return CY_U3P_SUCCESS;
+}
+
+/**
+ *  @brief      start the free running timer behind fx3_ticks().
+ *  @param[]    NULL.
+ *  @return     NULL.
+ */
+void fx3_timestamp_init(void) {
+  CyU3PGpioComplexConfig_t     gpioComplexConfig;
+  CyU3PReturnStatus_t          apiRetStatus;
+
+  // timer only, the pin is left undriven and raises no interrupt
+  gpioComplexConfig.outValue    = CyFalse;
+  gpioComplexConfig.driveLowEn  = CyFalse;
+  gpioComplexConfig.driveHighEn = CyFalse;
+  gpioComplexConfig.inputEn     = CyFalse;
+  gpioComplexConfig.pinMode     = CY_U3P_GPIO_MODE_STATIC;
+  gpioComplexConfig.intrMode    = CY_U3P_GPIO_NO_INTR;
+  gpioComplexConfig.timerMode   = CY_U3P_GPIO_TIMER_HIGH_FREQ;
+  gpioComplexConfig.timer       = 0;
+  gpioComplexConfig.period      = 0xFFFFFFFF;
+  gpioComplexConfig.threshold   = 0;
+  apiRetStatus = CyU3PDeviceGpioOverride(TIMESTAMP_GPIO, CyFalse) |
+                 CyU3PGpioSetComplexConfig(TIMESTAMP_GPIO, &gpioComplexConfig);
+  if (apiRetStatus != CY_U3P_SUCCESS)
+    sensor_err("timestamp timer config error, Error Code = 0x%x\r\n", apiRetStatus);
+}
+
+/**
+ *  @brief      timestamp in GPIO_FAST_CLK_HZ ticks, also usable in interrupt callbacks.
+ *  @param[]    NULL.
+ *  @return     ticks, only differences are meaningful.
+ */
+uint32_t fx3_ticks(void) {
+  uint32_t ticks = 0;
+
+  CyU3PGpioComplexSampleNow(TIMESTAMP_GPIO, &ticks);
+  return ticks;
+}
+
+/* Wake timer of TRIGGER_LOW_POWER, runs in the timer thread. */
+static void sensor_wake_cb(uint32_t input) {
+  uint32_t mask = CyU3PVicDisableAllInterrupts();
+
+  // the trigger interrupt may have woken the sensors already
+  if (sleep_state == SLEEP_STANDBY) {
+    CyU3PGpioSetValue(CAMERA_STANDBY_GPIO, SENSOR_ACTIVE);
+    wake_ticks = fx3_ticks();
+    sleep_state = SLEEP_WOKEN;
+  }
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      create the wake timer of TRIGGER_LOW_POWER.
+ *  @param[]    NULL.
+ *  @return     NULL.
+ */
+void sensor_sleep_init(void) {
+  CyU3PReturnStatus_t apiRetStatus;
+
+  apiRetStatus = CyU3PTimerCreate(&sleepTimer, sensor_wake_cb, 0, 1, 0, CYU3P_NO_ACTIVATE);
+  if (apiRetStatus != CY_U3P_SUCCESS)
+    sensor_err("sensor wake timer create error, Error Code = 0x%x\r\n", apiRetStatus);
+}
+
+/**
+ *  @brief      TRIGGER_LOW_POWER: put the sensors in standby once a frame is delivered and
+ *              start the timer that wakes them LOW_POWER_WAKE_US before the next pulse.
+ *              Called by the UVC thread at frame end.
+ *  @param[]    NULL.
+ *  @return     NULL.
+ */
+void sensor_sleep_frame_end(void) {
+  uint32_t since_us, sleep_us, mask;
+
+  if (trigger_ctrl.mode != TRIGGER_LOW_POWER || sleep_state != SLEEP_IDLE)
+    return;
+  since_us = TICKS_TO_US(fx3_ticks() - trigger_ticks);
+  // a late frame end may come after the next pulse, that exposure must not be cut
+  if (since_us < V034_snapshot_min_period_us(trigger_ctrl.window_us) ||
+      since_us + LOW_POWER_WAKE_US + LOW_POWER_MIN_SLEEP_US > trigger_ctrl.period_us)
+    return;
+  sleep_us = trigger_ctrl.period_us - since_us - LOW_POWER_WAKE_US;
+  CyU3PTimerStop(&sleepTimer);
+  // timer ticks are 1 ms, rounding down wakes early rather than late
+  if (CyU3PTimerModify(&sleepTimer, sleep_us / 1000, 0) != CY_U3P_SUCCESS)
+    return;
+  mask = CyU3PVicDisableAllInterrupts();
+  sleep_state = SLEEP_STANDBY;
+  CyU3PGpioSetValue(CAMERA_STANDBY_GPIO, SENSOR_STANDBY);
+  CyU3PVicEnableInterrupts(mask);
+  CyU3PTimerStart(&sleepTimer);
+}
+
+/**
+ *  @brief      cancel a pending wake and leave the sensors active, on stream stop and
+ *              trigger changes.
+ *  @param[]    NULL.
+ *  @return     NULL.
+ */
+void sensor_sleep_stop(void) {
+  uint32_t mask;
+
+  CyU3PTimerStop(&sleepTimer);
+  mask = CyU3PVicDisableAllInterrupts();
+  if (sleep_state == SLEEP_STANDBY)
+    CyU3PGpioSetValue(CAMERA_STANDBY_GPIO, SENSOR_ACTIVE);
+  sleep_state = SLEEP_IDLE;
+  CyU3PVicEnableInterrupts(mask);
+}
+
 /* Callback for GPIO related interrupts */
 void CyFx_GpioIntrCb(uint8_t gpioId) {
   CyBool_t gpioValue = CyFalse;
@@ -252,6 +483,7 @@ void CyFx_GpioIntrCb(uint8_t gpioId) {
   static uint64_t flash_Rising_count = 0;
   static uint64_t VD_Failing_count = 0;
   static uint64_t VD_Rising_count = 0;
+  uint32_t now;
 
   if (gpioId == LEDOUT1_IN) {
     apiRetStatus = CyU3PGpioGetValue(gpioId, &gpioValue);
@@ -287,6 +519,36 @@ void CyFx_GpioIntrCb(uint8_t gpioId) {
         }
       }
     }
+  } else if (gpioId == CAMERA_EXPOSURE_GPIO) {
+    // timer wrap of the master PWM, or rising edge of an external trigger
+    now = fx3_ticks();
+    if (trigger_starting) {
+      // first pulse of the master, the end of its sync gap
+      CyU3PGpioComplexUpdate(CAMERA_EXPOSURE_GPIO, trigger_threshold, trigger_period);
+      trigger_starting = CyFalse;
+      trigger_seq = 1;
+    } else if (now - trigger_ticks > trigger_period + trigger_period / 2 ||
+               CyU3PGetTime() - trigger_ms > TRIGGER_TICKS_WRAP_MS) {
+      // a master (re)started, all units count from this pulse
+      trigger_seq = 1;
+    } else if (trigger_seq) {
+      trigger_seq++;
+    }
+    trigger_ticks = now;
+    trigger_ms = CyU3PGetTime();
+    if (sleep_state == SLEEP_WOKEN) {
+      hist_add(HIST_SENSOR_WAKE, TICKS_TO_US(trigger_ticks - wake_ticks));
+    } else if (sleep_state == SLEEP_STANDBY) {
+      // the timer was late, this exposure is lost, at least do not lose the next one
+      CyU3PGpioSetValue(CAMERA_STANDBY_GPIO, SENSOR_ACTIVE);
+      trace(TRACE_WAKE_LATE, trigger_seq, 0);
+    }
+    sleep_state = SLEEP_IDLE;
+  } else if (gpioId == PROF_TIMER_GPIO) {
+    prof_sample();
+  } else if (gpioId == IMU_INT_GPIO) {
+    // wake on motion of the idle IMU
+    CyU3PEventSet(&glFxUVCEvent, CY_FX_UVC_IMU_MOTION_EVENT, CYU3P_EVENT_OR);
   } else {
     // Maybe can't output log message success as running in interrupt context.
     sensor_err("unkown gpio interrupt!\r\n");
@@ -337,6 +599,16 @@ void v034_set_unified_addr(void) {
   CyU3PGpioSetValue(CAMERA_SADR_GPIO, CyFalse);
 }
 
+/**
+ *  @brief      v034/v024 Chip set separate left and right I2C Address, as at power on.
+ *              Callers hold glSensorLock until v034_set_unified_addr.
+ *  @param[]    NULL.
+ *  @return     NULL.
+ */
+void v034_set_split_addr(void) {
+  CyU3PGpioSetValue(CAMERA_SADR_GPIO, CyTrue);
+}
+
 /**
  *  @brief      v034/v024 power turn off.
  *  @param[]    NULL.
@@ -0,0 +1,84 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#include <cyu3os.h>
+#include <cyu3utils.h>
+#include "include/histogram.h"
+#include "include/byte_order.h"
+
+static const uint16_t hist_width[HIST_COUNT] = {4000, 100, 100, 100, 100, 100, 10000};
+
+static struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t bucket[HIST_BUCKETS];
+} hist[HIST_COUNT];
+
+/**
+ *  @brief      count one sample, cheap enough for interrupt and DMA callbacks.
+ *  @param[in]  id      HIST_ID.
+ *  @param[in]  us      sample.
+ *  @return     NULL.
+ */
+void hist_add(uint8_t id, uint32_t us) {
+  uint32_t i = us / hist_width[id];
+
+  if (i >= HIST_BUCKETS)
+    i = HIST_BUCKETS - 1;
+  hist[id].bucket[i]++;
+  if (hist[id].count == 0 || us < hist[id].min)
+    hist[id].min = us;
+  if (us > hist[id].max)
+    hist[id].max = us;
+  hist[id].count++;
+}
+
+/**
+ *  @brief      histogram as laid out in histogram.h.
+ *  @param[in]  id      HIST_ID.
+ *  @param[out] buffer  HIST_XU_LEN bytes.
+ *  @return     NULL.
+ */
+void hist_read(uint8_t id, uint8_t *buffer) {
+  uint8_t i;
+
+  CyU3PMemSet(buffer, 0, HIST_XU_LEN);
+  buffer[0] = id;
+  if (id >= HIST_COUNT)
+    return;
+  buffer[1] = HIST_BUCKETS;
+  buffer[2] = hist_width[id] >> 8;
+  buffer[3] = hist_width[id] & 0xFF;
+  put_be32(&buffer[4], hist[id].count);
+  put_be32(&buffer[8], hist[id].min);
+  put_be32(&buffer[12], hist[id].max);
+  for (i = 0; i < HIST_BUCKETS; i++)
+    put_be32(&buffer[HIST_HEADER_LEN + i * 4], hist[id].bucket[i]);
+}
+
+/**
+ *  @brief      clear one histogram or all of them.
+ *  @param[in]  id      HIST_ID or HIST_ALL.
+ *  @return     NULL.
+ */
+void hist_clear(uint8_t id) {
+  if (id == HIST_ALL)
+    CyU3PMemSet((uint8_t *)hist, 0, sizeof(hist));
+  else if (id < HIST_COUNT)
+    CyU3PMemSet((uint8_t *)&hist[id], 0, sizeof(hist[id]));
+}
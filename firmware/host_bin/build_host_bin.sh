@@ -7,6 +7,17 @@ if [ $# -eq 0 ]; then
     gcc -o version_test version_test.c
     gcc -o deviceID_test device_id.c
     gcc -o calib_file_test calib_file_test.c
+    gcc -o test_pattern_test test_pattern_test.c -lm
+    gcc -o reg_batch_test reg_batch_test.c
+    gcc -o vendor_bulk_test vendor_bulk_test.c
+    gcc -o kv_test kv_test.c
+    gcc -o device_info_test device_info_test.c
+    gcc -o ctrl_async_test ctrl_async_test.c
+    gcc -o trace_test trace_test.c
+    gcc -o prof_test prof_test.c
+    gcc -o hist_test hist_test.c
+    gcc -o timeline_test timeline_test.c
+    gcc -o dma_meter_test dma_meter_test.c
 elif [ $# -eq 1 -a $1 = "clean" ]; then
     rm -rf *_test
 fi
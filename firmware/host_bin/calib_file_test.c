@@ -36,6 +36,15 @@
 
 // Define the Cypress FX USB3.0 camera uvc extension id
 #define CY_FX_UVC_XU_CALIB_RW 0x1400
+#define CY_FX_UVC_XU_CALIB_INFO_RW 0x1a00
+#define CY_FX_UVC_XU_CTRL_ASYNC_RW 0x1d00
+#define CTRL_ASYNC_LEN 32
+#define CTRL_JOB_SLOTS 8
+#define CTRL_JOB_ERROR 2
+#define CALIB_INFO_LEN 8
+#define CALIB_CACHE_VALID 1
+#define CALIB_FLAG_COMPRESSED 0x01
+#define CALIB_FLAG_READ_COMPRESSED 0x02
 #define dbg printf
 typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
@@ -44,6 +53,17 @@ typedef unsigned short uint16_t;
 #define CALIB_RW_LEN  255
 #define PAYLOAD_LEN (CALIB_RW_LEN - 7)
 #define MAX_BUFFER_LEN (1024 * 64)
+// A compressed file is stored in at most 255 packets, inflated it may be much larger
+#define MAX_STORED_LEN (255 * PAYLOAD_LEN)
+#define MAX_FILE_LEN (1024 * 1024)
+
+// Same as extension_unit.h and lz4_stream.h of firmware
+#define CALIB_LZ_MAGIC "CLZ4"
+#define CALIB_LZ_HEADER_LEN 16
+#define LZ4_WINDOW 4096
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_BITS 14
+#define LZ4_CHAIN_DEPTH 64
 
 // TODO(huyuexiang) take care of alignment if using other kind of member!
 typedef struct {
@@ -123,6 +143,203 @@ int verify_crc16(const uint8_t* pDataIn, int iLenIn) {
   }
   return -1;
 }
+
+static int lz4_hash(const uint8_t *p) {
+  unsigned int v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+  return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static int lz4_put_length(uint8_t *out, int pos, int len) {
+  for (; len >= 255; len -= 255)
+    out[pos++] = 255;
+  out[pos++] = len;
+  return pos;
+}
+
+/**
+ *  @brief      append one LZ4 sequence.
+ *  @param[out] out: block, pos: its length so far.
+ *  @param[in]  lit, lit_len: literals.
+ *  @param[in]  offset, match_len: match, match_len 0 for the last sequence.
+ *  @return     block length.
+ */
+static int lz4_sequence(uint8_t *out, int pos, const uint8_t *lit, int lit_len, int offset,
+                        int match_len) {
+  int token = pos++;
+  int ml = match_len - LZ4_MIN_MATCH;
+
+  out[token] = (lit_len < 15 ? lit_len : 15) << 4;
+  if (lit_len >= 15)
+    pos = lz4_put_length(out, pos, lit_len - 15);
+  memcpy(&out[pos], lit, lit_len);
+  pos += lit_len;
+  if (match_len == 0)
+    return pos;
+  out[pos++] = offset & 0xFF;
+  out[pos++] = offset >> 8;
+  out[token] |= ml < 15 ? ml : 15;
+  if (ml >= 15)
+    pos = lz4_put_length(out, pos, ml - 15);
+  return pos;
+}
+
+/**
+ *  @brief      compress to an LZ4 block, matches stay within the LZ4_WINDOW the firmware keeps.
+ *  @param[in]  in, len: data.
+ *  @param[out] out: block, at least len + len / 255 + 16 bytes.
+ *  @return     block length.
+ */
+int lz4_compress(const uint8_t *in, int len, uint8_t *out) {
+  static int head[1 << LZ4_HASH_BITS], chain[LZ4_WINDOW];
+  int pos = 0, anchor = 0, o = 0, i, h;
+
+  for (i = 0; i < (1 << LZ4_HASH_BITS); i++)
+    head[i] = -1;
+  // LZ4 wants the last match to start 12 bytes and end 5 bytes before the end of the data
+  while (pos + 12 < len) {
+    int best_len = 0, best_off = 0, depth = LZ4_CHAIN_DEPTH, cand;
+
+    h = lz4_hash(&in[pos]);
+    for (cand = head[h]; cand >= 0 && pos - cand <= LZ4_WINDOW && depth--;
+         cand = chain[cand % LZ4_WINDOW]) {
+      int l = 0;
+      while (pos + l < len - 5 && in[cand + l] == in[pos + l])
+        l++;
+      if (l > best_len) {
+        best_len = l;
+        best_off = pos - cand;
+      }
+    }
+    chain[pos % LZ4_WINDOW] = head[h];
+    head[h] = pos;
+    if (best_len < LZ4_MIN_MATCH) {
+      pos++;
+      continue;
+    }
+    o = lz4_sequence(out, o, &in[anchor], pos - anchor, best_off, best_len);
+    for (i = pos + 1; i < pos + best_len && i + 4 <= len; i++) {
+      h = lz4_hash(&in[i]);
+      chain[i % LZ4_WINDOW] = head[h];
+      head[h] = i;
+    }
+    pos += best_len;
+    anchor = pos;
+  }
+  return lz4_sequence(out, o, &in[anchor], len - anchor, 0, 0);
+}
+
+/**
+ *  @brief      inflate an LZ4 block.
+ *  @param[in]  in, in_len: block.
+ *  @param[out] out, out_max: data.
+ *  @return     data length, -1 if the block is malformed or too large.
+ */
+int lz4_decompress(const uint8_t *in, int in_len, uint8_t *out, int out_max) {
+  int i = 0, o = 0, len, offset;
+  uint8_t token, b;
+
+  while (i < in_len) {
+    token = in[i++];
+    len = token >> 4;
+    if (len == 15) {
+      do {
+        if (i >= in_len)
+          return -1;
+        b = in[i++];
+        len += b;
+      } while (b == 255);
+    }
+    if (i + len > in_len || o + len > out_max)
+      return -1;
+    memcpy(&out[o], &in[i], len);
+    i += len;
+    o += len;
+    if (i == in_len)
+      break;
+    if (i + 2 > in_len)
+      return -1;
+    offset = in[i] | (in[i + 1] << 8);
+    i += 2;
+    if (offset == 0 || offset > o)
+      return -1;
+    len = token & 0x0F;
+    if (len == 15) {
+      do {
+        if (i >= in_len)
+          return -1;
+        b = in[i++];
+        len += b;
+      } while (b == 255);
+    }
+    len += LZ4_MIN_MATCH;
+    if (o + len > out_max)
+      return -1;
+    for (; len > 0; len--, o++)
+      out[o] = out[o - offset];
+  }
+  return o;
+}
+
+/**
+ *  @brief      compress a calibration file into the stored layout of the firmware.
+ *  @param[in]  in, len: file.
+ *  @param[out] out: CALIB_LZ_HEADER_LEN + LZ4 block.
+ *  @return     stored length.
+ */
+int calib_pack(const uint8_t *in, int len, uint8_t *out) {
+  int lz_len = lz4_compress(in, len, &out[CALIB_LZ_HEADER_LEN]);
+  uint16_t crc;
+
+  make_crc16(in, len, &crc);
+  memcpy(out, CALIB_LZ_MAGIC, 4);
+  out[4] = len >> 24;
+  out[5] = len >> 16;
+  out[6] = len >> 8;
+  out[7] = len & 0xFF;
+  out[8] = lz_len >> 24;
+  out[9] = lz_len >> 16;
+  out[10] = lz_len >> 8;
+  out[11] = lz_len & 0xFF;
+  out[12] = crc & 0xFF;
+  out[13] = crc >> 8;
+  out[14] = 0;
+  out[15] = 0;
+  return CALIB_LZ_HEADER_LEN + lz_len;
+}
+
+/**
+ *  @brief      the calibration file out of what the device returned, inflated if compressed.
+ *  @param[in]  in, len: packet payloads, zero padded.
+ *  @param[out] out: file, MAX_FILE_LEN bytes.
+ *  @return     file length, -1 if a compressed file does not inflate to its size and crc.
+ */
+int calib_unpack(const uint8_t *in, int len, uint8_t *out) {
+  int size, lz_len;
+  uint16_t crc;
+
+  if (len < CALIB_LZ_HEADER_LEN || memcmp(in, CALIB_LZ_MAGIC, 4)) {
+    // plain text file, ends at the padding
+    while (len > 0 && in[len - 1] == '\0')
+      len--;
+    memcpy(out, in, len);
+    return len;
+  }
+  size = (in[4] << 24) | (in[5] << 16) | (in[6] << 8) | in[7];
+  lz_len = (in[8] << 24) | (in[9] << 16) | (in[10] << 8) | in[11];
+  if (size > MAX_FILE_LEN || lz_len > len - CALIB_LZ_HEADER_LEN ||
+      lz4_decompress(&in[CALIB_LZ_HEADER_LEN], lz_len, out, size) != size) {
+    printf("compressed calib file does not inflate\n");
+    return -1;
+  }
+  make_crc16(out, size, &crc);
+  if (in[12] != (crc & 0xFF) || in[13] != (crc >> 8)) {
+    printf("inflated calib file CRC check failed\n");
+    return -1;
+  }
+  printf("inflated %d -> %d bytes\n", lz_len + CALIB_LZ_HEADER_LEN, size);
+  return size;
+}
+
 /**
  *  @brief      error handle.
  *  @param[out] NULL.
@@ -182,26 +399,22 @@ int load_calib_file(const char *path, FILE **fp_load) {
  *  @return     read length: positive success and others fail.
  */
 int read_calib_from_file(uint8_t buffer[], FILE *fp) {
-  int pos = 0;
-  while (fgets(buffer + pos, PAYLOAD_LEN, fp) != NULL) {
-    while (buffer[pos] != '\0') {
-      pos++;
-      if (pos > MAX_BUFFER_LEN) {
-        printf("ERR: Input calib file too large!\n");
-        return -1;
-      }
-    }
+  int pos = fread(buffer, 1, MAX_FILE_LEN, fp);
+
+  if (pos == MAX_FILE_LEN && fgetc(fp) != EOF) {
+    printf("ERR: Input calib file too large!\n");
+    return -1;
   }
   return pos;
 }
 
 /**
  *  @brief      write calibration file.
- *  @param[in]  buffer: .
+ *  @param[in]  buffer, size: file.
  *  @param[in]  path: calibration file path
  *  @return     write length: positive success and others fail.
  */
-int write_calib_to_file(uint8_t buffer[], const char *path) {
+int write_calib_to_file(uint8_t buffer[], int size, const char *path) {
   FILE *fp;
   int i = 0;
   if (path == NULL || buffer == NULL) {
@@ -213,19 +426,60 @@ int write_calib_to_file(uint8_t buffer[], const char *path) {
     printf("ERR: Open file failed: %s!\n", path);
     return -2;
   }
-  while (buffer[i] != '\0') {
-    fputc(buffer[i++], fp);
-  }
+  i = fwrite(buffer, 1, size, fp);
   fclose(fp);
   printf("write calib file done, size: %d\n", i);
   return i;
 }
 
+/**
+ *  @brief      query the calibration RAM copy of the device, rewind its read position.
+ *  @param[in]  fd: dev name.
+ *  @param[in]  rewind: 1 to make the next packet read return packet 0.
+ *  @param[in]  flags: CALIB_FLAG_READ_COMPRESSED to read a compressed file as stored.
+ *  @param[out] generation, state: calibration cache info.
+ *  @return     0 if successful.
+ */
+int calib_info(int fd, int rewind, uint8_t flags, unsigned int *generation, uint8_t *state) {
+  uint8_t info[CALIB_INFO_LEN] = {0};
+  struct uvc_xu_control_query query = {
+    .unit       = 3,
+    .selector   = CY_FX_UVC_XU_CALIB_INFO_RW >> 8,
+    .query      = UVC_SET_CUR,
+    .size       = CALIB_INFO_LEN,
+    .data       = info,
+  };
+
+  info[7] = flags;
+  if (rewind && ioctl(fd, UVCIOC_CTRL_QUERY, &query) != 0) {
+    error_handle();
+    return -1;
+  }
+  query.query = UVC_GET_CUR;
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &query) != 0) {
+    error_handle();
+    return -1;
+  }
+  *generation = (info[0] << 24) | (info[1] << 16) | (info[2] << 8) | info[3];
+  *state = info[4];
+  return 0;
+}
+
 void read_calib_from_device(int fd, uint8_t buffer[], int *size) {
   uint8_t packet_num = 1;
   uint8_t packet_id = 0;
   uint16_t check_sum = 0;
   int read_len = 0;
+  unsigned int generation = 0, generation_end = 0;
+  uint8_t state = 0;
+  int cached = 0;
+  struct timespec start, end;
+
+  // Older firmware has no calibration cache and needs a break between packets
+  if (calib_info(fd, 1, CALIB_FLAG_READ_COMPRESSED, &generation, &state) == 0 &&
+      state == CALIB_CACHE_VALID)
+    cached = 1;
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
   xu_query.selector = CY_FX_UVC_XU_CALIB_RW >> 8;
   xu_query.query = UVC_GET_CUR;
@@ -251,17 +505,75 @@ void read_calib_from_device(int fd, uint8_t buffer[], int *size) {
     packet_id = value.id;
     memcpy((uint8_t *)&buffer[packet_id * PAYLOAD_LEN], (uint8_t *)value.data, PAYLOAD_LEN);
     read_len += PAYLOAD_LEN;
-    usleep(300000);
+    if (!cached)
+      usleep(300000);
   } while (packet_id < packet_num - 1);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("read %d packets in %.1f ms%s\n", packet_id + 1,
+         (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0,
+         cached ? " from calibration cache" : "");
+  if (cached && (calib_info(fd, 0, 0, &generation_end, &state) || generation_end != generation)) {
+    printf("calibration changed while reading, generation %u -> %u\n", generation,
+           generation_end);
+    read_len = 0;
+  }
   *size = read_len;
 }
 
+/**
+ *  @brief      query the control worker of the device.
+ *  @param[in]  fd: dev name.
+ *  @param[out] status: CTRL_ASYNC_LEN bytes, see ctrl_async.h of firmware.
+ *  @return     0 if successful, older firmware has no control worker.
+ */
+int ctrl_async_query(int fd, uint8_t status[]) {
+  struct uvc_xu_control_query query = {
+    .unit       = 3,
+    .selector   = CY_FX_UVC_XU_CTRL_ASYNC_RW >> 8,
+    .query      = UVC_GET_CUR,
+    .size       = CTRL_ASYNC_LEN,
+    .data       = status,
+  };
+
+  return ioctl(fd, UVCIOC_CTRL_QUERY, &query);
+}
+
+/**
+ *  @brief      wait for the control worker, until a job slot is free or all jobs are done.
+ *  @param[in]  fd: dev name.
+ *  @param[in]  all: 1 to wait for all jobs.
+ *  @return     0 if successful, -1 on timeout or if a job failed.
+ */
+int ctrl_async_wait(int fd, int all) {
+  uint8_t status[CTRL_ASYNC_LEN];
+  int i;
+
+  for (i = 0; i < 5000; i++) {
+    if (ctrl_async_query(fd, status) != 0)
+      return -1;
+    if (status[6] == CTRL_JOB_ERROR) {
+      printf("control job %d failed on the device\n", (status[2] << 8) | status[3]);
+      return -1;
+    }
+    if (all ? status[4] == 0 : status[4] < CTRL_JOB_SLOTS)
+      return 0;
+    usleep(1000);
+  }
+  printf("timeout waiting for the device to write\n");
+  return -1;
+}
+
 void write_calib_to_device(int fd, uint8_t buffer[], int size) {
   uint8_t i, j; 
   uint8_t packet_num;
   uint8_t packet_id;
   uint16_t check_sum;
+  uint8_t status[CTRL_ASYNC_LEN];
+  // Newer firmware programs flash on a worker, the host only waits for a free job slot
+  int async = ctrl_async_query(fd, status) == 0;
+  struct timespec start, end;
 
+  clock_gettime(CLOCK_MONOTONIC, &start);
   packet_num = size /PAYLOAD_LEN + (size % PAYLOAD_LEN ? 1 : 0);
   packet_id = 0;
   value.header[0] = 0xAA;
@@ -289,19 +601,31 @@ void write_calib_to_device(int fd, uint8_t buffer[], int size) {
     value.check_sum[0] = check_sum & 0xFF;
     value.check_sum[1] = (check_sum >> 8) & 0xFF;
 
+    if (async && ctrl_async_wait(fd, 0))
+      return;
     if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
       error_handle();
     }
     printf("write %dth packet to device\n", value.id);
-    if (packet_id == 0) {
+    if (async) {
+      continue;
+    } else if (packet_id == 0) {
       // The first packet write should wait for a long time.
       sleep(3);
     } else {
       usleep(100000);
     }
   }
+  if (async && ctrl_async_wait(fd, 1) == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("device wrote %d packets in %.1f ms\n", packet_num,
+           (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+  }
 }
 
+static uint8_t buffer[MAX_FILE_LEN];
+static uint8_t buffer_dev[MAX_FILE_LEN + MAX_FILE_LEN / 255 + CALIB_LZ_HEADER_LEN + 16];
+
 /**
  *  @brief      main.
  *  @param[in]  argc: cmd num.
@@ -309,24 +633,26 @@ void write_calib_to_device(int fd, uint8_t buffer[], int size) {
  *  @return     NULL.
  */
 int main(int argc, char** argv) {
-  FILE *fp_calib_file;
-  FILE *fp_ir_calib_file;
+  FILE *fp_calib_file = NULL;
   char *dev_name = "/dev/video1";
-  int ret, len, i;
+  int ret, len, stored;
   int v4l2_dev = 0;
-  uint8_t buffer[MAX_BUFFER_LEN] = {0};
-  uint8_t buffer_dev[MAX_BUFFER_LEN] = {0};
+  int compress = 1;
   const char *calib_file_recovery = "calib_file_recovery.yaml";
 
   // check the arguments
   if (argc < 2) {
-    printf("Usage: ./program  device_name  [calib_file_path]\n\n");
+    printf("Usage: ./program  device_name  [calib_file_path [-n]]\n\n");
     printf(" -- 1) With 'calib_file_path', program will write calib file to device.\n");
     printf(" -- 2) Without 'calib_file_path', program will read calib file from device,\
            and store it as calib_file_recovery.yaml in current dir.\n");
+    printf(" -- 3) The file is written compressed, -n writes it as is for firmware that\
+           can not inflate it.\n");
     printf("NOTICE: The sequence of calib file MUST be as same as above!\n\n");
     exit(0);
   }
+  if (argc > 3 && !strcmp(argv[3], "-n"))
+    compress = 0;
   // open device
   dev_name = argv[1];
   v4l2_dev = open(dev_name, 0);
@@ -336,9 +662,11 @@ int main(int argc, char** argv) {
   }
 
   if (argc == 2) {
-    read_calib_from_device(v4l2_dev, buffer, &ret);
+    read_calib_from_device(v4l2_dev, buffer_dev, &ret);
     printf("read %d bytes from device\n", ret);
-    ret = write_calib_to_file(buffer, calib_file_recovery);
+    ret = calib_unpack(buffer_dev, ret, buffer);
+    if (ret >= 0)
+      write_calib_to_file(buffer, ret, calib_file_recovery);
     goto err;
   }
 
@@ -352,16 +680,29 @@ int main(int argc, char** argv) {
   // read calib file
   // read the 1st calib file
   ret = read_calib_from_file(buffer, fp_calib_file);
-  if (ret >= 0) {
-    len = ret;
-    printf("read %d bytes from file %s\n", ret, argv[2]);
+  if (ret < 0)
+    goto err;
+  len = ret;
+  printf("read %d bytes from file %s\n", ret, argv[2]);
+  stored = compress ? calib_pack(buffer, len, buffer_dev) : len;
+  if (!compress || stored >= len) {
+    memcpy(buffer_dev, buffer, len);
+    stored = len;
+  } else {
+    printf("compressed %d -> %d bytes\n", len, stored);
+  }
+  if (stored > MAX_STORED_LEN) {
+    printf("ERR: calib file takes %d bytes, device stores at most %d\n", stored, MAX_STORED_LEN);
+    goto err;
   }
-  write_calib_to_device(v4l2_dev, buffer, len);
+  write_calib_to_device(v4l2_dev, buffer_dev, stored);
   sleep(1);
-  memset(buffer, '\0', MAX_BUFFER_LEN);
-  read_calib_from_device(v4l2_dev, buffer, &ret);
+  memset(buffer_dev, '\0', sizeof(buffer_dev));
+  read_calib_from_device(v4l2_dev, buffer_dev, &ret);
   printf("read %d bytes from device\n", ret);
-  ret = write_calib_to_file(buffer, calib_file_recovery);
+  ret = calib_unpack(buffer_dev, ret, buffer);
+  if (ret >= 0)
+    write_calib_to_file(buffer, ret, calib_file_recovery);
 
 err:
   // close file
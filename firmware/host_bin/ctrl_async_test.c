@@ -0,0 +1,143 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_CTRL_ASYNC_RW 0x1d00
+
+// Same layout as ctrl_async.h of firmware
+#define CTRL_ASYNC_LEN 32
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+static const char *job_status[] = {"none", "ok", "error"};
+static const char *job_op[] = {"none", "calib write", "device info", "device erase", "kv set",
+                               "kv request"};
+static  __u8 value[CTRL_ASYNC_LEN] = {0};
+struct uvc_xu_control_query xu_query = {
+  .unit       = 3,  // has to be unit 3
+  .selector   = CY_FX_UVC_XU_CTRL_ASYNC_RW >> 8,
+  .query      = UVC_GET_CUR,
+  .size       = CTRL_ASYNC_LEN,
+  .data       = value,
+};
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to query control status: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+static unsigned int be16(const __u8 *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static unsigned int be32(const __u8 *p) {
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, [clear].
+ *  @return     0 if successful.
+ */
+int main(int argc, char** argv) {
+  int fd;
+
+  if (argc < 2) {
+    printf("usage: %s /dev/videoX [clear]\n", argv[0]);
+    printf("       prints control worker status and control latency percentiles\n");
+    return -1;
+  }
+  fd = open(argv[1], 0);
+  if (fd < 0) {
+    dbg("open camera failed,err code:%d\n\r", fd);
+    exit(-1);
+  }
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+    error_handle();
+    close(fd);
+    return -1;
+  }
+  printf("jobs: submitted %u, completed %u, queued %u, errors %u\n", be16(&value[0]),
+         be16(&value[2]), value[4], value[7]);
+  printf("last job: %s, %s\n", value[5] < 6 ? job_op[value[5]] : "unknown",
+         value[6] < 3 ? job_status[value[6]] : "unknown");
+  printf("EP0 latency ms: p50 %u p90 %u p99 %u max %u\n", be16(&value[8]), be16(&value[10]),
+         be16(&value[12]), be16(&value[14]));
+  printf("job latency ms: p50 %u p90 %u p99 %u max %u\n", be16(&value[16]), be16(&value[18]),
+         be16(&value[20]), be16(&value[22]));
+  printf("requests %u, dropped %u\n", be32(&value[24]), be32(&value[28]));
+  if (argc > 2 && !strcmp(argv[2], "clear")) {
+    memset(value, 0, sizeof(value));
+    value[0] = 1;
+    xu_query.query = UVC_SET_CUR;
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+      error_handle();
+      close(fd);
+      return -1;
+    }
+    printf("cleared\n");
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,232 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_DEVICE_INFO_RW 0x1c00
+
+// Same layout as device_info.h of firmware
+#define DEVINFO_MAGIC         0x4449
+#define DEVINFO_VERSION       1
+#define DEVINFO_HEADER_LEN    8
+#define DEVINFO_LEN           256
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+static const char *tag_name[] = {"", "serial", "board rev", "sensor left", "sensor right",
+                                 "calib version", "calib hash", "mfg date"};
+static  __u8 record[DEVINFO_LEN] = {0};
+struct uvc_xu_control_query xu_query = {
+  .unit       = 3,  // has to be unit 3
+  .selector   = CY_FX_UVC_XU_DEVICE_INFO_RW >> 8,
+  .query      = UVC_GET_CUR,
+  .size       = DEVINFO_LEN,
+  .data       = record,
+};
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to run device info request: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+/**
+ *  @brief      crc16 as flash_crc16 of firmware, reflected 0xA001, init 0.
+ *  @param[in]  data, len: bytes.
+ *  @return     crc16.
+ */
+__u16 crc16(const __u8 *data, int len) {
+  __u16 crc = 0;
+  int i, j;
+
+  for (i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (j = 0; j < 8; j++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+/**
+ *  @brief      print the tlv entries of record[], printable values as text, others as hex.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void print_record() {
+  int len = record[4] << 8 | record[5];
+  int offset = DEVINFO_HEADER_LEN, i, text;
+
+  printf("version %d, %d bytes\n", record[2], len);
+  while (offset + 2 <= DEVINFO_HEADER_LEN + len) {
+    __u8 tag = record[offset], n = record[offset + 1];
+    const __u8 *v = &record[offset + 2];
+
+    printf("  %-14s (%3d): ", tag < 8 && tag ? tag_name[tag] : "unknown", tag);
+    for (i = 0, text = n > 0; i < n; i++)
+      text &= v[i] >= ' ' && v[i] < 0x7F;
+    for (i = 0; i < n; i++)
+      printf(text ? "%c" : "%02x", v[i]);
+    printf("\n");
+    offset += 2 + n;
+  }
+}
+
+/**
+ *  @brief      replace or add one entry of record[] and refresh its header.
+ *  @param[in]  tag: tag.
+ *  @param[in]  data, n: value, n 0 removes the entry.
+ *  @return     0 if the entry fits.
+ */
+int record_set(int tag, const __u8 *data, int n) {
+  __u8 out[DEVINFO_LEN] = {0};
+  int end = DEVINFO_HEADER_LEN + (record[4] << 8 | record[5]);
+  int offset, pos = DEVINFO_HEADER_LEN;
+  __u16 crc;
+
+  for (offset = DEVINFO_HEADER_LEN; offset + 2 <= end; offset += 2 + record[offset + 1]) {
+    if (record[offset] == tag)
+      continue;
+    memcpy(&out[pos], &record[offset], 2 + record[offset + 1]);
+    pos += 2 + record[offset + 1];
+  }
+  if (n) {
+    if (pos + 2 + n > DEVINFO_LEN)
+      return -1;
+    out[pos] = tag;
+    out[pos + 1] = n;
+    memcpy(&out[pos + 2], data, n);
+    pos += 2 + n;
+  }
+  crc = crc16(&out[DEVINFO_HEADER_LEN], pos - DEVINFO_HEADER_LEN);
+  out[0] = DEVINFO_MAGIC >> 8;
+  out[1] = DEVINFO_MAGIC & 0xFF;
+  out[2] = DEVINFO_VERSION;
+  out[4] = (pos - DEVINFO_HEADER_LEN) >> 8;
+  out[5] = (pos - DEVINFO_HEADER_LEN) & 0xFF;
+  out[6] = crc & 0xFF;
+  out[7] = crc >> 8;
+  memcpy(record, out, DEVINFO_LEN);
+  return 0;
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, [tag value], value is text or 0x prefixed hex, empty removes.
+ *  @return     0 if successful.
+ */
+int main(int argc, char** argv) {
+  __u8 data[DEVINFO_LEN];
+  int fd, tag, n = 0;
+
+  if (argc != 2 && argc != 4) {
+    printf("usage: %s /dev/videoX [tag value]\n", argv[0]);
+    printf("       %s /dev/videoX 1 XP0123      -> set the serial number\n", argv[0]);
+    printf("       %s /dev/videoX 6 0x1a2b3c4d  -> set a binary value\n", argv[0]);
+    printf("       %s /dev/videoX 2 \"\"          -> remove the board revision\n", argv[0]);
+    return -1;
+  }
+
+  fd = open(argv[1], 0);
+  if (fd < 0) {
+    dbg("open camera failed,err code:%d\n\r", fd);
+    exit(-1);
+  }
+  xu_query.query = UVC_GET_CUR;
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+    error_handle();
+    close(fd);
+    return -1;
+  }
+  if (argc == 4) {
+    tag = strtol(argv[2], NULL, 0);
+    if (!strncmp(argv[3], "0x", 2)) {
+      const char *hex = argv[3] + 2;
+      for (n = 0; n < DEVINFO_LEN && hex[2 * n] && hex[2 * n + 1]; n++)
+        sscanf(&hex[2 * n], "%2hhx", &data[n]);
+    } else {
+      n = strlen(argv[3]);
+      if (n > 255)
+        n = 255;
+      memcpy(data, argv[3], n);
+    }
+    if (tag < 1 || tag > 255 || record_set(tag, data, n)) {
+      printf("tag %s does not fit the record\n", argv[2]);
+      close(fd);
+      return -1;
+    }
+    xu_query.query = UVC_SET_CUR;
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+      error_handle();
+      close(fd);
+      return -1;
+    }
+    xu_query.query = UVC_GET_CUR;
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+      error_handle();
+      close(fd);
+      return -1;
+    }
+  }
+  close(fd);
+  print_record();
+  return 0;
+}
@@ -0,0 +1,255 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_HIST_RW      0x1f00
+#define CY_FX_UVC_XU_DMA_METER_RW 0x2000
+
+// Same layout as dma_meter.h and histogram.h of firmware
+#define METER_SAMPLES     16
+#define METER_HEADER_LEN  16
+#define METER_SAMPLE_LEN  20
+#define METER_XU_LEN      (METER_HEADER_LEN + METER_SAMPLES * METER_SAMPLE_LEN)
+#define HIST_BUCKETS      64
+#define HIST_HEADER_LEN   16
+#define HIST_XU_LEN       (HIST_HEADER_LEN + HIST_BUCKETS * 4)
+#define HIST_FRAME_INTERVAL 0
+#define BAR_WIDTH         30
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+static __u8 meter[METER_XU_LEN] = {0};
+static __u8 hist[HIST_XU_LEN] = {0};
+// newest frame printed, so -f only prints new samples
+static unsigned int last_frame = 0;
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to query control status: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+static unsigned int be16(const __u8 *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static unsigned int be32(const __u8 *p) {
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ *  @brief      query an extension unit control.
+ *  @param[in]  fd: camera fd.
+ *  @param[in]  selector, query: control and UVC_GET_CUR or UVC_SET_CUR.
+ *  @param[in]  data, size: control data.
+ *  @return     0 if successful.
+ */
+int xu_query(int fd, int selector, int query, __u8 *data, int size) {
+  struct uvc_xu_control_query xu = {
+    .unit       = 3,  // has to be unit 3
+    .selector   = selector >> 8,
+    .query      = query,
+    .size       = size,
+    .data       = data,
+  };
+
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu) != 0) {
+    error_handle();
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ *  @brief      read the meter and the frame interval histogram.
+ *  @param[in]  fd: camera fd.
+ *  @return     0 if successful.
+ */
+int meter_read(int fd) {
+  memset(hist, 0, sizeof(hist));
+  hist[0] = HIST_FRAME_INTERVAL;
+  if (xu_query(fd, CY_FX_UVC_XU_HIST_RW, UVC_SET_CUR, hist, HIST_XU_LEN) != 0 ||
+      xu_query(fd, CY_FX_UVC_XU_HIST_RW, UVC_GET_CUR, hist, HIST_XU_LEN) != 0)
+    return -1;
+  return xu_query(fd, CY_FX_UVC_XU_DMA_METER_RW, UVC_GET_CUR, meter, METER_XU_LEN);
+}
+
+/**
+ *  @brief      print the samples newer than last_frame, one row per frame with the in
+ *              flight buffers as a bar.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void print_samples(void) {
+  unsigned int buffers = meter[13], count = meter[14], i;
+  unsigned int frame, bytes, interval, full, gap, inflight;
+  const __u8 *p;
+
+  for (i = 0; i < count && i < METER_SAMPLES; i++) {
+    p = &meter[METER_HEADER_LEN + i * METER_SAMPLE_LEN];
+    frame = be32(&p[0]);
+    if (last_frame && (int)(frame - last_frame) <= 0)
+      continue;
+    last_frame = frame;
+    bytes = be32(&p[4]);
+    interval = be32(&p[8]);
+    full = be32(&p[12]);
+    gap = be16(&p[16]);
+    inflight = p[18];
+    printf("%8u %8.2f %8.1f %8.2f %8.2f  %u/%u |%.*s%.*s|\n", frame,
+           interval ? 1e6 / interval : 0.0, interval ? (double)bytes / interval : 0.0,
+           full / 1000.0, gap / 1000.0, inflight, buffers,
+           buffers ? inflight * BAR_WIDTH / buffers : 0, "##############################",
+           buffers ? BAR_WIDTH - inflight * BAR_WIDTH / buffers : 0,
+           "                              ");
+  }
+}
+
+/**
+ *  @brief      upper bound in ms of the frame interval bucket holding the given share.
+ *  @param[in]  share: 0 - 1.
+ *  @return     ms, 0 if the histogram is empty.
+ */
+static double interval_percentile(double share) {
+  unsigned int count = be32(&hist[4]), width = be16(&hist[2]), i, sum = 0;
+
+  if (!count)
+    return 0;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    sum += be32(&hist[HIST_HEADER_LEN + i * 4]);
+    if (sum >= share * count)
+      break;
+  }
+  return (i >= HIST_BUCKETS - 1 ? be32(&hist[12]) : (i + 1) * width) / 1000.0;
+}
+
+/**
+ *  @brief      print the totals next to the frame interval histogram and where the
+ *              backpressure most likely comes from.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void print_summary(void) {
+  unsigned int frames = be32(&meter[0]), full = be32(&meter[4]), gap = be32(&meter[8]);
+  unsigned int inflight = meter[12], buffers = meter[13];
+  double p50 = interval_percentile(0.5), p99 = interval_percentile(0.99);
+
+  printf("\n%u frames, all buffers in flight %.2f ms, peak consumer gap %.2f ms, "
+         "in flight max %u/%u\n", frames, full / 1000.0, gap / 1000.0, inflight, buffers);
+  printf("frame interval p50 < %.0f ms, p99 < %.0f ms, max %.1f ms, %u samples\n",
+         p50, p99, be32(&hist[12]) / 1000.0, be32(&hist[4]));
+  if (!frames)
+    return;
+  if (full)
+    printf("backpressure: the host or the USB link, all buffers waited for the consumer\n");
+  else if (p99 > 1.5 * p50 && inflight < buffers)
+    printf("backpressure: none on USB, late frames come from the sensor or the GPIF\n");
+  else
+    printf("backpressure: none\n");
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, [-f] to poll every 500 ms | [clear].
+ *  @return     0 if successful.
+ */
+int main(int argc, char** argv) {
+  int fd, follow = 0;
+
+  if (argc < 2) {
+    printf("usage: %s /dev/videoX [-f | clear]\n", argv[0]);
+    printf("       prints DMA buffer occupancy and bandwidth per frame\n");
+    return -1;
+  }
+  follow = argc > 2 && !strcmp(argv[2], "-f");
+  fd = open(argv[1], 0);
+  if (fd < 0) {
+    dbg("open camera failed,err code:%d\n\r", fd);
+    exit(-1);
+  }
+  printf("   frame      fps     MB/s  full ms   gap ms  in flight\n");
+  do {
+    if (meter_read(fd) != 0) {
+      close(fd);
+      return -1;
+    }
+    print_samples();
+    fflush(stdout);
+    if (follow)
+      usleep(500000);
+  } while (follow);
+  print_summary();
+  if (argc > 2 && !strcmp(argv[2], "clear")) {
+    memset(meter, 0, sizeof(meter));
+    meter[0] = 1;
+    if (xu_query(fd, CY_FX_UVC_XU_DMA_METER_RW, UVC_SET_CUR, meter, METER_XU_LEN) != 0) {
+      close(fd);
+      return -1;
+    }
+    printf("cleared\n");
+  }
+  close(fd);
+  return 0;
+}
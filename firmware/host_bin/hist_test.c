@@ -0,0 +1,220 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_HIST_RW 0x1f00
+
+// Same layout as histogram.h of firmware
+#define HIST_BUCKETS     64
+#define HIST_HEADER_LEN  16
+#define HIST_XU_LEN      (HIST_HEADER_LEN + HIST_BUCKETS * 4)
+#define HIST_COUNT       7
+#define HIST_ALL         0xFF
+#define BAR_WIDTH        50
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+// order of enum HIST_ID
+static const char *hist_name[HIST_COUNT] = {
+  "frame interval", "frame valid to commit", "buffer commit to consumer", "IMU interval",
+  "sensor wake to trigger", "suspend entry", "resume to first frame"
+};
+static  __u8 value[HIST_XU_LEN] = {0};
+struct uvc_xu_control_query xu_query = {
+  .unit       = 3,  // has to be unit 3
+  .selector   = CY_FX_UVC_XU_HIST_RW >> 8,
+  .query      = UVC_GET_CUR,
+  .size       = HIST_XU_LEN,
+  .data       = value,
+};
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to query control status: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+static unsigned int be16(const __u8 *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static unsigned int be32(const __u8 *p) {
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ *  @brief      set the histogram GET_CUR returns, and clear it if asked.
+ *  @param[in]  fd: camera fd.
+ *  @param[in]  id: histogram id, HIST_ALL only with clear.
+ *  @param[in]  clear: 1 to clear.
+ *  @return     0 if successful.
+ */
+int hist_select(int fd, int id, int clear) {
+  memset(value, 0, sizeof(value));
+  value[0] = id;
+  value[1] = clear;
+  xu_query.query = UVC_SET_CUR;
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+    error_handle();
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ *  @brief      upper bound in us of the bucket holding the given share of the samples.
+ *  @param[in]  share: 0 - 1.
+ *  @return     us, 0 if the histogram is empty.
+ */
+static unsigned int percentile(double share) {
+  unsigned int count = be32(&value[4]), width = be16(&value[2]);
+  unsigned int i, sum = 0;
+
+  if (!count)
+    return 0;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    sum += be32(&value[HIST_HEADER_LEN + i * 4]);
+    if (sum >= share * count)
+      break;
+  }
+  // samples of the last bucket are only known to be below max
+  return i >= HIST_BUCKETS - 1 ? be32(&value[12]) : (i + 1) * width;
+}
+
+/**
+ *  @brief      print the summary and a bar chart of the histogram in value.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void print_hist(void) {
+  unsigned int width = be16(&value[2]), count = be32(&value[4]);
+  unsigned int i, n, peak = 0, first = HIST_BUCKETS, last = 0;
+
+  printf("%s: %u samples, min %u us, max %u us\n",
+         value[0] < HIST_COUNT ? hist_name[value[0]] : "unknown", count,
+         count ? be32(&value[8]) : 0, be32(&value[12]));
+  if (!count)
+    return;
+  printf("  p50 < %u us, p90 < %u us, p99 < %u us, p99.9 < %u us\n",
+         percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999));
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    n = be32(&value[HIST_HEADER_LEN + i * 4]);
+    if (!n)
+      continue;
+    if (n > peak)
+      peak = n;
+    if (i < first)
+      first = i;
+    last = i;
+  }
+  for (i = first; i <= last; i++) {
+    n = be32(&value[HIST_HEADER_LEN + i * 4]);
+    printf("  %6u%s us %10u |%.*s\n", i * width, i == HIST_BUCKETS - 1 ? "+" : " ", n,
+           (int)((unsigned long long)n * BAR_WIDTH / peak),
+           "##################################################");
+  }
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, [clear].
+ *  @return     0 if successful.
+ */
+int main(int argc, char** argv) {
+  int fd, id;
+
+  if (argc < 2) {
+    printf("usage: %s /dev/videoX [clear]\n", argv[0]);
+    printf("       prints the frame, pipeline and IMU latency histograms of the firmware\n");
+    return -1;
+  }
+  fd = open(argv[1], 0);
+  if (fd < 0) {
+    dbg("open camera failed,err code:%d\n\r", fd);
+    exit(-1);
+  }
+  for (id = 0; id < HIST_COUNT; id++) {
+    if (hist_select(fd, id, 0) != 0) {
+      close(fd);
+      return -1;
+    }
+    xu_query.query = UVC_GET_CUR;
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+      error_handle();
+      close(fd);
+      return -1;
+    }
+    print_hist();
+  }
+  if (argc > 2 && !strcmp(argv[2], "clear")) {
+    if (hist_select(fd, HIST_ALL, 1) != 0) {
+      close(fd);
+      return -1;
+    }
+    printf("cleared\n");
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,188 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+#include <time.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_KV_RW 0x1b00
+
+// Same layout as kv_store.h of firmware
+#define KV_VALUE_MAX    64
+#define KV_XU_LEN       (4 + KV_VALUE_MAX)
+#define KV_OP_GET       0
+#define KV_OP_SET       1
+#define KV_OP_DELETE    2
+#define KV_PENDING      4
+// polls of a pending request, 10 ms apart, a compaction of the store takes seconds
+#define KV_POLL_MAX     1000
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+static const char *kv_status[] = {"ok", "not found", "bad argument", "io error", "pending"};
+static  __u8 value[KV_XU_LEN] = {0};
+struct uvc_xu_control_query xu_query = {
+  .unit       = 3,  // has to be unit 3
+  .selector   = CY_FX_UVC_XU_KV_RW >> 8,
+  .query      = UVC_SET_CUR,
+  .size       = KV_XU_LEN,
+  .data       = value,
+};
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to run kv request: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+/**
+ *  @brief      run one kv request and wait for the firmware to finish it, value[] holds the
+ *              reply afterwards.
+ *  @param[in]  fd: dev name.
+ *  @param[in]  op: KV_OP_*.
+ *  @param[in]  key: key.
+ *  @param[in]  data, len: value for KV_OP_SET.
+ *  @return     kv status, -1 if the transfer failed.
+ */
+int kv_request(int fd, int op, int key, const __u8 *data, int len) {
+  int i;
+
+  memset(value, 0, sizeof(value));
+  value[0] = op;
+  value[1] = key;
+  value[2] = len;
+  if (len)
+    memcpy(&value[4], data, len);
+  xu_query.query = UVC_SET_CUR;
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+    error_handle();
+    return -1;
+  }
+  xu_query.query = UVC_GET_CUR;
+  for (i = 0; i < KV_POLL_MAX; i++) {
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+      error_handle();
+      return -1;
+    }
+    if (value[3] != KV_PENDING)
+      break;
+    usleep(10000);
+  }
+  return value[3];
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, get|set|del, key, hex bytes for set.
+ *  @return     0 if successful.
+ */
+int main(int argc, char** argv) {
+  __u8 data[KV_VALUE_MAX];
+  struct timespec start, end;
+  int fd, key, op, len = 0, status, i;
+
+  if (argc < 4) {
+    printf("usage: %s /dev/videoX get|set|del key [hex bytes for set, MSB first]\n", argv[0]);
+    printf("       %s /dev/videoX set 16 0102  -> store 2 bytes under a host key\n", argv[0]);
+    return -1;
+  }
+  if (!strcmp(argv[2], "get")) {
+    op = KV_OP_GET;
+  } else if (!strcmp(argv[2], "set")) {
+    op = KV_OP_SET;
+  } else if (!strcmp(argv[2], "del")) {
+    op = KV_OP_DELETE;
+  } else {
+    printf("unknown op %s\n", argv[2]);
+    return -1;
+  }
+  key = strtol(argv[3], NULL, 0);
+  if (op == KV_OP_SET) {
+    const char *hex = argc > 4 ? argv[4] : "";
+    for (len = 0; len < KV_VALUE_MAX && hex[2 * len] && hex[2 * len + 1]; len++)
+      sscanf(&hex[2 * len], "%2hhx", &data[len]);
+    if (len == 0) {
+      printf("set needs a value\n");
+      return -1;
+    }
+  }
+
+  fd = open(argv[1], 0);
+  if (fd < 0) {
+    dbg("open camera failed,err code:%d\n\r", fd);
+    exit(-1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  status = kv_request(fd, op, key, data, len);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  close(fd);
+  if (status < 0)
+    return -1;
+
+  printf("key %d: %s, %.1f ms\n", key, status < 5 ? kv_status[status] : "unknown",
+         (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+  if (op == KV_OP_GET && status == 0) {
+    for (i = 0; i < value[2]; i++)
+      printf("%02x", value[4 + i]);
+    printf("\n");
+  }
+  return status;
+}
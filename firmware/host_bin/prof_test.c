@@ -0,0 +1,166 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_PROFILE_RW 0x1e00
+
+// Same layout as thread_prof.h of firmware
+#define PROF_THREADS     6
+#define PROF_HEADER_LEN  16
+#define PROF_THREAD_LEN  12
+#define PROF_LEN         (PROF_HEADER_LEN + PROF_THREADS * PROF_THREAD_LEN)
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+// order of prof_thread_add() in CyFxApplicationDefine
+static const char *thread_name[PROF_THREADS] = {
+  "UVC App", "UVC App EP0", "Data handle", "Vendor bulk", "Control worker", "thread 5"
+};
+static  __u8 value[PROF_LEN] = {0};
+struct uvc_xu_control_query xu_query = {
+  .unit       = 3,  // has to be unit 3
+  .selector   = CY_FX_UVC_XU_PROFILE_RW >> 8,
+  .query      = UVC_GET_CUR,
+  .size       = PROF_LEN,
+  .data       = value,
+};
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to query control status: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+static unsigned int be16(const __u8 *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static unsigned int be32(const __u8 *p) {
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ *  @brief      print CPU share, longest run and stack use of each thread.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void print_profile(void) {
+  unsigned int hz = be16(&value[0]), samples = be32(&value[4]);
+  unsigned int count = value[2] < PROF_THREADS ? value[2] : PROF_THREADS;
+  double total = samples ? samples : 1;
+  unsigned int i, size, used;
+  const __u8 *p;
+
+  printf("%u samples at %u Hz, %.1f s\n", samples, hz, hz ? (double)samples / hz : 0.0);
+  printf("thread            cpu %%  run max ms  stack  used  free\n");
+  for (i = 0; i < count; i++) {
+    p = &value[PROF_HEADER_LEN + i * PROF_THREAD_LEN];
+    size = be16(&p[6]);
+    used = be16(&p[8]);
+    printf("%-16s %6.1f  %10.1f  %5u  %4u  %4u%s\n", thread_name[i], be32(&p[0]) * 100 / total,
+           hz ? be16(&p[4]) * 1000.0 / hz : 0.0, size, used, size - used,
+           used == size ? "  overflowed" : "");
+  }
+  printf("%-16s %6.1f\n", "FX3 library", be32(&value[12]) * 100 / total);
+  printf("%-16s %6.1f\n", "idle", be32(&value[8]) * 100 / total);
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, [clear].
+ *  @return     0 if successful.
+ */
+int main(int argc, char** argv) {
+  int fd;
+
+  if (argc < 2) {
+    printf("usage: %s /dev/videoX [clear]\n", argv[0]);
+    printf("       prints CPU share and stack high-watermark of the firmware threads\n");
+    return -1;
+  }
+  fd = open(argv[1], 0);
+  if (fd < 0) {
+    dbg("open camera failed,err code:%d\n\r", fd);
+    exit(-1);
+  }
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+    error_handle();
+    close(fd);
+    return -1;
+  }
+  print_profile();
+  if (argc > 2 && !strcmp(argv[2], "clear")) {
+    memset(value, 0, sizeof(value));
+    value[0] = 1;
+    xu_query.query = UVC_SET_CUR;
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+      error_handle();
+      close(fd);
+      return -1;
+    }
+    printf("cleared\n");
+  }
+  close(fd);
+  return 0;
+}
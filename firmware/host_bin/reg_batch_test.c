@@ -0,0 +1,176 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+#include <time.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_REG_BATCH_RW 0x1900
+
+// Same layout as extension_unit.h of firmware
+#define REG_BATCH_ENTRY_LEN   6
+#define REG_BATCH_MAX         40
+#define REG_BATCH_LEN         (2 + REG_BATCH_MAX * REG_BATCH_ENTRY_LEN)
+#define REG_DEV_SENSOR_LEFT   1
+#define REG_DEV_SENSOR_RIGHT  2
+#define REG_OP_READ           0
+#define REG_OP_ERROR          0x80
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+static  __u8 value[REG_BATCH_LEN] = {0};
+struct uvc_xu_control_query xu_query = {
+  .unit       = 3,  // has to be unit 3
+  .selector   = CY_FX_UVC_XU_REG_BATCH_RW >> 8,
+  .query      = UVC_SET_CUR,
+  .size       = REG_BATCH_LEN,
+  .data       = value,
+};
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to run reg batch: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+/**
+ *  @brief      read a register range of one eye, REG_BATCH_MAX registers per SET/GET pair.
+ *  @param[in]  fd: dev name.
+ *  @param[in]  dev: REG_DEV_SENSOR_LEFT or REG_DEV_SENSOR_RIGHT.
+ *  @param[in]  first, num: register range.
+ *  @param[out] regval: register values.
+ *  @return     number of transfers.
+ */
+int dump_regs(int fd, int dev, int first, int num, unsigned short *regval) {
+  int done = 0, count, i, transfers = 0;
+  __u8 *entry;
+
+  while (done < num) {
+    count = num - done > REG_BATCH_MAX ? REG_BATCH_MAX : num - done;
+    memset(value, 0, sizeof(value));
+    value[0] = count;
+    for (i = 0; i < count; i++) {
+      entry = &value[2 + i * REG_BATCH_ENTRY_LEN];
+      entry[0] = dev;
+      entry[1] = REG_OP_READ;
+      entry[2] = (first + done + i) >> 8;
+      entry[3] = (first + done + i) & 0xFF;
+    }
+    xu_query.query = UVC_SET_CUR;
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0)
+      error_handle();
+    xu_query.query = UVC_GET_CUR;
+    if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0)
+      error_handle();
+    transfers += 2;
+    for (i = 0; i < count; i++) {
+      entry = &value[2 + i * REG_BATCH_ENTRY_LEN];
+      if (entry[1] & REG_OP_ERROR)
+        printf("reg 0x%x read failed\n", first + done + i);
+      regval[done + i] = (entry[4] << 8) | entry[5];
+    }
+    done += count;
+  }
+  return transfers;
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, first register, register num.
+ *  @return     NULL.
+ */
+int main(int argc, char** argv) {
+  char* dev_name = "/dev/video1";
+  int first = 0x00, num = 100;
+  unsigned short left[256], right[256];
+  struct timespec start, end;
+  int transfers, i;
+
+  if (argc > 1)
+    dev_name = argv[1];
+  if (argc > 2)
+    first = strtol(argv[2], NULL, 0);
+  if (argc > 3)
+    num = atoi(argv[3]);
+  if (num > 256)
+    num = 256;
+  int v4l2_dev = open(dev_name, 0);
+
+  if (v4l2_dev < 0) {
+    dbg("open camera failed,err code:%d\n\r", v4l2_dev);
+    exit(-1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  transfers = dump_regs(v4l2_dev, REG_DEV_SENSOR_LEFT, first, num, left);
+  transfers += dump_regs(v4l2_dev, REG_DEV_SENSOR_RIGHT, first, num, right);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("  reg    left   right\n");
+  for (i = 0; i < num; i++)
+    printf("0x%04x  0x%04x  0x%04x%s\n", first + i, left[i], right[i],
+           left[i] != right[i] ? "  *" : "");
+  printf("%d registers of both eyes in %d transfers, %.1f ms\n", num, transfers,
+         (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+  close(v4l2_dev);
+  return 0;
+}
@@ -0,0 +1,395 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/usb/video.h>
+#include <errno.h>
+#include <linux/uvcvideo.h>
+#include <fcntl.h>
+#include <math.h>
+
+// Define camera uvc extension id
+#define CY_FX_UVC_XU_TEST_PATTERN_RW 0x1800
+
+// enum TEST_PATTERN of firmware
+#define TEST_PATTERN_OFF      0
+#define TEST_PATTERN_FLAT     1
+#define TEST_PATTERN_GRADIENT 2
+
+// IMU burst and frame metadata live in the first 1280 bytes and change every frame
+#define FRAME_META_LEN        16
+#define FRAME_META_OFFSET     (640 * 2 - FRAME_META_LEN)
+#define FRAME_VARIABLE_LEN    (FRAME_META_OFFSET + FRAME_META_LEN)
+
+#define BUFFER_NUM            4
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+static  __u8 value[64] = {0};
+struct uvc_xu_control_query xu_query = {
+  .unit       = 3,  // has to be unit 3
+  .selector   = CY_FX_UVC_XU_TEST_PATTERN_RW >> 8,
+  .query      = UVC_SET_CUR,
+  .size       = 3,
+  .data       = value,
+};
+
+struct mmap_buffer_t {
+  void *start;
+  size_t length;
+};
+
+struct bench_result_t {
+  unsigned int frames;
+  unsigned int missing_frames;
+  unsigned int short_frames;
+  unsigned int corrupted_frames;
+  unsigned int corrupted_lines;
+  unsigned long long bytes;
+  double first_ts;
+  double last_ts;
+  double interval_sum;
+  double interval_sq_sum;
+  double interval_min;
+  double interval_max;
+};
+
+/**
+ *  @brief      error handle.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void error_handle() {
+  int res = errno;
+  const char *err;
+
+  switch (res) {
+  case ENOENT:
+    err = "Extension unit or control not found";
+    break;
+  case ENOBUFS:
+    err = "Buffer size does not match control size";
+    break;
+  case EINVAL:
+    err = "Invalid request code";
+    break;
+  case EBADRQC:
+    err = "Request not supported by control";
+    break;
+  default:
+    err = strerror(res);
+    break;
+  }
+
+  dbg("failed to set test pattern: %s. (System code: %d) \n\r", err, res);
+
+  return;
+}
+
+/**
+ *  @brief      set the sensor test pattern.
+ *  @param[in]  fd: dev name.
+ *  @param[in]  pattern: TEST_PATTERN_*.
+ *  @param[in]  pixel: pixel value of TEST_PATTERN_FLAT.
+ *  @return     0 if successful.
+ */
+int set_test_pattern(int fd, int pattern, int pixel) {
+  xu_query.query = UVC_SET_CUR;
+  value[0] = pattern;
+  value[1] = pixel >> 8;
+  value[2] = pixel & 0xFF;
+  if (ioctl(fd, UVCIOC_CTRL_QUERY, &xu_query) != 0) {
+    error_handle();
+    return -1;
+  }
+  printf("test pattern %d, value 0x%x\n", pattern, pixel);
+  return 0;
+}
+
+/**
+ *  @brief      read the frame count of the frame metadata.
+ *  @param[in]  frame: frame data.
+ *  @param[out] count: frame count.
+ *  @return     0 if the frame holds metadata.
+ */
+static int read_frame_count(const unsigned char *frame, unsigned int *count) {
+  const unsigned char *meta = frame + FRAME_META_OFFSET;
+
+  if (meta[0] != 'M' || meta[1] != 'D')
+    return -1;
+  *count = meta[4] | (meta[5] << 8) | (meta[6] << 16) | ((unsigned int)meta[7] << 24);
+  return 0;
+}
+
+/**
+ *  @brief      10 bit to 8 bit A-law companding of MT9V034 DATA_COMPRESSION, the pixel a flat
+ *              test value shows up as.
+ *  @param[in]  value: 10 bit test value.
+ *  @return     8 bit pixel.
+ */
+static unsigned char v034_compand(unsigned int value) {
+  value &= 0x3FF;
+  if (value < 128)
+    return value;
+  if (value < 256)
+    return 128 + (value - 128) / 2;
+  if (value < 512)
+    return 192 + (value - 256) / 8;
+  return 224 + (value - 512) / 16;
+}
+
+/**
+ *  @brief      check one eye of a gradient line, a diagonal shade (MT9V034) moves one pixel per
+ *              line, color bars (AR0141) repeat the line above.
+ *  @param[in]  line, prev: line and the line above, both eyes interleaved.
+ *  @param[in]  pixels: pixels per eye.
+ *  @param[in]  eye: 0 or 1, byte lane of the eye.
+ *  @return     0 if the line is the line above shifted by -1, 0 or 1 pixel.
+ */
+static int check_gradient(const unsigned char *line, const unsigned char *prev,
+                          unsigned int pixels, unsigned int eye) {
+  unsigned int x;
+  int shift, ok;
+
+  for (shift = -1; shift <= 1; shift++) {
+    ok = 1;
+    for (x = shift < 0 ? 1 : 0; x + (shift > 0 ? 1 : 0) < pixels && ok; x++)
+      ok = line[2 * x + eye] == prev[2 * (x + shift) + eye];
+    if (ok)
+      return 0;
+  }
+  return -1;
+}
+
+/**
+ *  @brief      compare a frame with the pattern the mode produces, line by line.
+ *  @param[in]  frame: frame data.
+ *  @param[in]  size: frame size in bytes.
+ *  @param[in]  line_len: bytes per line, one byte per eye and pixel.
+ *  @param[in]  pattern: TEST_PATTERN_FLAT or TEST_PATTERN_GRADIENT.
+ *  @param[in]  flat: pixel of TEST_PATTERN_FLAT.
+ *  @return     number of lines that differ, a bad gradient line also fails the line below.
+ */
+static unsigned int check_frame(const unsigned char *frame, unsigned int size,
+                                unsigned int line_len, int pattern, unsigned char flat) {
+  unsigned int offset, start, len, i, lines = 0;
+  int bad;
+
+  for (offset = 0; offset < size; offset += line_len) {
+    len = line_len;
+    if (offset + len > size)
+      len = size - offset;
+    // skip the IMU and metadata bytes that share the first lines
+    if (offset + len <= FRAME_VARIABLE_LEN)
+      continue;
+    bad = 0;
+    if (pattern == TEST_PATTERN_FLAT) {
+      start = offset < FRAME_VARIABLE_LEN ? FRAME_VARIABLE_LEN - offset : 0;
+      for (i = start; i < len && !bad; i++)
+        bad = frame[offset + i] != flat;
+    } else {
+      // the line above has to be pattern only
+      if (offset < FRAME_VARIABLE_LEN + line_len || len < line_len)
+        continue;
+      bad = check_gradient(frame + offset, frame + offset - line_len, line_len / 2, 0) ||
+            check_gradient(frame + offset, frame + offset - line_len, line_len / 2, 1);
+    }
+    if (bad)
+      lines++;
+  }
+  return lines;
+}
+
+/**
+ *  @brief      print the benchmark result.
+ *  @param[in]  r: benchmark result.
+ *  @param[in]  lines: lines per frame.
+ *  @return     NULL.
+ */
+static void print_result(const struct bench_result_t *r, unsigned int lines) {
+  double seconds = r->last_ts - r->first_ts;
+  unsigned int intervals = r->frames > 1 ? r->frames - 1 : 1;
+  double mean = r->interval_sum / intervals;
+  double jitter = sqrt(r->interval_sq_sum / intervals - mean * mean);
+
+  printf("frames: %u, missing: %u, short: %u, corrupted: %u (%u of %u lines)\n",
+         r->frames, r->missing_frames, r->short_frames, r->corrupted_frames,
+         r->corrupted_lines, r->frames * lines);
+  if (seconds > 0)
+    printf("throughput: %.0f bytes/s, %.2f fps\n", r->bytes / seconds, intervals / seconds);
+  printf("frame interval: mean %.3f ms, jitter %.3f ms, min %.3f ms, max %.3f ms\n",
+         mean * 1000, jitter * 1000, r->interval_min * 1000, r->interval_max * 1000);
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: dev name, frame num, pattern, flat value, expected flat pixel.
+ *  @return     NULL.
+ */
+int main(int argc, char** argv) {
+  char* dev_name = "/dev/video1";
+  unsigned int frame_num = 1000;
+  int pattern = TEST_PATTERN_GRADIENT;
+  int pixel = 0x155;
+  struct v4l2_format format;
+  struct v4l2_requestbuffers req;
+  struct v4l2_buffer buf;
+  struct mmap_buffer_t buffers[BUFFER_NUM];
+  struct bench_result_t r;
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  unsigned char flat;
+  unsigned int frame_size, line_len, count, last_count = 0, lines;
+  int have_count = 0;
+  double ts, last_ts = 0, interval;
+  int i, fd;
+
+  if (argc > 1)
+    dev_name = argv[1];
+  if (argc > 2)
+    frame_num = strtoul(argv[2], NULL, 0);
+  if (argc > 3)
+    pattern = atoi(argv[3]);
+  if (argc > 4)
+    pixel = strtol(argv[4], NULL, 0);
+  // the 8 bit pixel of a flat value, MT9V034 compands it, AR0141 needs it given
+  flat = argc > 5 ? strtol(argv[5], NULL, 0) : v034_compand(pixel);
+  printf("usage: %s [dev] [frames] [pattern 1:flat 2:gradient] [flat value] [flat pixel]\n",
+         argv[0]);
+  if (pattern != TEST_PATTERN_FLAT && pattern != TEST_PATTERN_GRADIENT) {
+    printf("unknown pattern %d\n", pattern);
+    exit(-1);
+  }
+
+  fd = open(dev_name, O_RDWR);
+  if (fd < 0) {
+    dbg("open camera failed,err code:%d\n\r", fd);
+    exit(-1);
+  }
+  memset(&format, 0, sizeof(format));
+  format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (ioctl(fd, VIDIOC_G_FMT, &format) < 0) {
+    dbg("ioctl(fd, VIDIOC_G_FMT, &format) failed\n");
+    exit(-1);
+  }
+  frame_size = format.fmt.pix.sizeimage;
+  line_len = format.fmt.pix.bytesperline;
+  lines = format.fmt.pix.height;
+  printf("width x height = %d x %d, %u bytes per frame\n",
+         format.fmt.pix.width, format.fmt.pix.height, frame_size);
+
+  if (set_test_pattern(fd, pattern, pixel))
+    exit(-1);
+
+  memset(&req, 0, sizeof(req));
+  req.count = BUFFER_NUM;
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < BUFFER_NUM) {
+    dbg("ioctl(fd, VIDIOC_REQBUFS, &req) failed\n");
+    exit(-1);
+  }
+  for (i = 0; i < BUFFER_NUM; i++) {
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = i;
+    if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
+      dbg("ioctl(fd, VIDIOC_QUERYBUF, &buf) failed\n");
+      exit(-1);
+    }
+    buffers[i].length = buf.length;
+    buffers[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                            buf.m.offset);
+    if (buffers[i].start == MAP_FAILED) {
+      dbg("mmap failed\n");
+      exit(-1);
+    }
+    ioctl(fd, VIDIOC_QBUF, &buf);
+  }
+  if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+    dbg("ioctl(fd, VIDIOC_STREAMON, &type) failed\n");
+    exit(-1);
+  }
+
+  memset(&r, 0, sizeof(r));
+  r.interval_min = 1e9;
+  while (r.frames < frame_num) {
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
+      dbg("ioctl(fd, VIDIOC_DQBUF, &buf) failed\n");
+      break;
+    }
+    ts = buf.timestamp.tv_sec + buf.timestamp.tv_usec / 1000000.0;
+    if (r.frames == 0) {
+      r.first_ts = ts;
+    } else {
+      interval = ts - last_ts;
+      r.interval_sum += interval;
+      r.interval_sq_sum += interval * interval;
+      if (interval < r.interval_min)
+        r.interval_min = interval;
+      if (interval > r.interval_max)
+        r.interval_max = interval;
+    }
+    last_ts = ts;
+    r.last_ts = ts;
+    r.frames++;
+    r.bytes += buf.bytesused;
+
+    if (buf.bytesused < frame_size) {
+      r.short_frames++;
+    } else {
+      count = check_frame(buffers[buf.index].start, frame_size, line_len, pattern, flat);
+      if (count) {
+        r.corrupted_frames++;
+        r.corrupted_lines += count;
+      }
+    }
+    if (read_frame_count(buffers[buf.index].start, &count) == 0) {
+      if (have_count && count != last_count + 1)
+        r.missing_frames += count - last_count - 1;
+      last_count = count;
+      have_count = 1;
+    }
+    ioctl(fd, VIDIOC_QBUF, &buf);
+  }
+  ioctl(fd, VIDIOC_STREAMOFF, &type);
+  set_test_pattern(fd, TEST_PATTERN_OFF, 0);
+
+  print_result(&r, lines);
+  for (i = 0; i < BUFFER_NUM; i++)
+    munmap(buffers[i].start, buffers[i].length);
+  close(fd);
+  return 0;
+}
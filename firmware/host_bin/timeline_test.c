@@ -0,0 +1,335 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#include <linux/usb/ch9.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+// Same as device descriptor, vendor_bulk.h, fx3_bsp.h and timeline.h of firmware
+#define XP_VID                0x04B4
+#define XP_PID                0x00F5
+#define VB_INTERFACE          2
+#define VB_EP_OUT             0x04
+#define VB_EP_IN              0x84
+#define VB_MAGIC              0x5842
+#define VB_HEADER_LEN         16
+#define VB_CMD_TIMELINE_READ  0x0A
+#define VB_STATUS_BAD_CMD     0x01
+#define GPIO_FAST_CLK_HZ      201600000
+#define TIMELINE_RECORDS      64
+#define TIMELINE_HEADER_LEN   8
+#define TL_POINTS             6
+#define TIMELINE_RECORD_LEN   (TIMELINE_HEADER_LEN + TL_POINTS * 4)
+
+// set to 1 for a bit of debug output
+#if 0
+#define dbg printf
+#else
+#define dbg(fmt, ...) do { } while (0)
+#endif
+
+/* enum TL_POINT, each stage ends at its point and starts at the last point passed before. */
+static const char *point_name[TL_POINTS] = {
+  "first commit", "frame valid", "wrap up", "last commit", "USB consumed", "frame done"
+};
+static const char *stage_name[TL_POINTS] = {
+  "", "readout", "wrap up", "commit", "USB drain", "DMA reset"
+};
+
+static int pkt_size = 512;
+static unsigned int tag = 0;
+// per stage sum, max and count of the frames shown
+static double stage_sum[TL_POINTS];
+static double stage_max[TL_POINTS];
+static unsigned int stage_count[TL_POINTS];
+static double total_sum, total_max;
+static unsigned int frames = 0;
+
+static void put_be32(unsigned char *p, unsigned int value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static unsigned int get_be32(const unsigned char *p) {
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ *  @brief      find the camera on usbfs and claim the vendor bulk interface.
+ *  @param[out] NULL.
+ *  @return     usbfs fd, negative if not found.
+ */
+int usb_open(void) {
+  struct usb_device_descriptor desc;
+  char path[600];
+  DIR *bus_dir, *dev_dir;
+  struct dirent *bus, *dev;
+  int fd = -1, intf = VB_INTERFACE;
+
+  bus_dir = opendir("/dev/bus/usb");
+  if (!bus_dir)
+    return -1;
+  while (fd < 0 && (bus = readdir(bus_dir)) != NULL) {
+    if (bus->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "/dev/bus/usb/%s", bus->d_name);
+    dev_dir = opendir(path);
+    if (!dev_dir)
+      continue;
+    while (fd < 0 && (dev = readdir(dev_dir)) != NULL) {
+      if (dev->d_name[0] == '.')
+        continue;
+      snprintf(path, sizeof(path), "/dev/bus/usb/%s/%s", bus->d_name, dev->d_name);
+      fd = open(path, O_RDWR);
+      if (fd < 0)
+        continue;
+      if (read(fd, &desc, sizeof(desc)) != sizeof(desc) ||
+          desc.idVendor != XP_VID || desc.idProduct != XP_PID) {
+        close(fd);
+        fd = -1;
+        continue;
+      }
+      pkt_size = desc.bcdUSB >= 0x0300 ? 1024 : 512;
+    }
+    closedir(dev_dir);
+  }
+  closedir(bus_dir);
+  if (fd >= 0 && ioctl(fd, USBDEVFS_CLAIMINTERFACE, &intf) < 0) {
+    dbg("claim interface failed: %s\n\r", strerror(errno));
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+int bulk(int fd, int ep, unsigned char *data, int len, int timeout) {
+  struct usbdevfs_bulktransfer xfer = {
+    .ep      = ep,
+    .len     = len,
+    .timeout = timeout,
+    .data    = data,
+  };
+  int ret = ioctl(fd, USBDEVFS_BULK, &xfer);
+
+  if (ret < 0)
+    dbg("bulk ep 0x%x len %d failed: %s\n\r", ep, len, strerror(errno));
+  return ret;
+}
+
+/**
+ *  @brief      drain the firmware timeline ring once.
+ *  @param[in]  fd: usbfs device.
+ *  @param[out] data: TIMELINE_RECORDS * TIMELINE_RECORD_LEN + pkt_size bytes.
+ *  @param[out] lost: records overwritten on the device since the last read.
+ *  @return     bytes of records, negative on error.
+ */
+int timeline_read(int fd, unsigned char *data, unsigned int *lost) {
+  unsigned char header[VB_HEADER_LEN] = {0};
+  unsigned char status[VB_HEADER_LEN];
+  int len;
+
+  header[0] = VB_MAGIC >> 8;
+  header[1] = VB_MAGIC & 0xFF;
+  header[2] = VB_CMD_TIMELINE_READ;
+  put_be32(&header[8], TIMELINE_RECORDS * TIMELINE_RECORD_LEN);
+  put_be32(&header[12], ++tag);
+  if (bulk(fd, VB_EP_OUT, header, VB_HEADER_LEN, 1000) != VB_HEADER_LEN ||
+      bulk(fd, VB_EP_IN, status, VB_HEADER_LEN, 1000) != VB_HEADER_LEN)
+    return -1;
+  if (get_be32(&status[12]) != tag || status[3] != 0) {
+    if (status[3] == VB_STATUS_BAD_CMD)
+      printf("firmware is not built with TIMELINE=1\n");
+    else
+      printf("timeline read failed, status %d\n", status[3]);
+    return -1;
+  }
+  *lost = get_be32(&status[4]);
+  len = get_be32(&status[8]);
+  if (len && bulk(fd, VB_EP_IN, data, len + pkt_size, 5000) != len) {
+    printf("timeline data phase short\n");
+    return -1;
+  }
+  return len;
+}
+
+static double ticks_to_us(unsigned int ticks) {
+  return ticks * 1e6 / GPIO_FAST_CLK_HZ;
+}
+
+/**
+ *  @brief      print one line per frame, the time of each point in us after the first
+ *              buffer commit, and add the stages to the summary.
+ *  @param[in]  data, len: records as sent by TIMELINE_READ.
+ *  @return     NULL.
+ */
+void timeline_print(const unsigned char *data, int len) {
+  unsigned int ticks[TL_POINTS], start, prev;
+  double us;
+  int offset, i;
+
+  for (offset = 0; offset + TIMELINE_RECORD_LEN <= len; offset += TIMELINE_RECORD_LEN) {
+    for (i = 0; i < TL_POINTS; i++)
+      ticks[i] = get_be32(&data[offset + TIMELINE_HEADER_LEN + i * 4]);
+    printf("%8u  %3u", get_be32(&data[offset]), (data[offset + 4] << 8) | data[offset + 5]);
+    // a frame without committed buffers is timed from frame valid
+    start = ticks[0] ? ticks[0] : ticks[1];
+    prev = start;
+    for (i = 0; i < TL_POINTS; i++) {
+      if (!ticks[i] || !start) {
+        printf("  %12s", "-");
+        continue;
+      }
+      // the counter wraps every 21 s, unsigned differences stay right across it
+      printf("  %12.1f", ticks_to_us(ticks[i] - start));
+      if (i > 0 && ticks[i] != prev) {
+        us = ticks_to_us(ticks[i] - prev);
+        stage_sum[i] += us;
+        stage_count[i]++;
+        if (us > stage_max[i])
+          stage_max[i] = us;
+      }
+      prev = ticks[i];
+    }
+    printf("\n");
+    if (start && ticks[TL_POINTS - 1]) {
+      us = ticks_to_us(ticks[TL_POINTS - 1] - start);
+      total_sum += us;
+      if (us > total_max)
+        total_max = us;
+      frames++;
+    }
+  }
+}
+
+/**
+ *  @brief      print the column header.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void timeline_header(void) {
+  int i;
+
+  printf("   frame  buf");
+  for (i = 0; i < TL_POINTS; i++)
+    printf("  %12s", point_name[i]);
+  printf("\n%13s", "");
+  for (i = 0; i < TL_POINTS; i++)
+    printf("  %12s", "us");
+  printf("\n");
+}
+
+/**
+ *  @brief      print mean and max of each stage over the frames shown.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void timeline_summary(void) {
+  int i;
+
+  if (!frames)
+    return;
+  printf("\nstage          to point         mean us     max us  frames\n");
+  for (i = 1; i < TL_POINTS; i++) {
+    if (!stage_count[i])
+      continue;
+    printf("%-12s   %-12s  %10.1f %10.1f  %6u\n", stage_name[i], point_name[i],
+           stage_sum[i] / stage_count[i], stage_max[i], stage_count[i]);
+  }
+  printf("%-12s   %-12s  %10.1f %10.1f  %6u\n", "total", "", total_sum / frames, total_max,
+         frames);
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: [-f] to keep draining every 100 ms | -r file to decode a saved dump,
+ *              [-o file] appends the raw records to file.
+ *  @return     NULL.
+ */
+int main(int argc, char** argv) {
+  unsigned char *data = malloc(TIMELINE_RECORDS * TIMELINE_RECORD_LEN + 1024);
+  unsigned int lost;
+  int fd, len, follow = 0, i;
+  FILE *out = NULL, *in = NULL;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-f")) {
+      follow = 1;
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      out = fopen(argv[++i], "ab");
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      in = fopen(argv[++i], "rb");
+      if (!in) {
+        printf("open %s failed\n", argv[i]);
+        exit(-1);
+      }
+    } else {
+      printf("usage: %s [-f] [-o file] | -r file\n", argv[0]);
+      printf("       prints when each frame passes the points of the video path\n");
+      exit(-1);
+    }
+  }
+  timeline_header();
+  if (in) {
+    while ((len = fread(data, 1, TIMELINE_RECORDS * TIMELINE_RECORD_LEN, in)) > 0)
+      timeline_print(data, len);
+    fclose(in);
+    free(data);
+    timeline_summary();
+    return 0;
+  }
+
+  fd = usb_open();
+  if (fd < 0) {
+    printf("open camera vendor interface failed\n");
+    exit(-1);
+  }
+  do {
+    len = timeline_read(fd, data, &lost);
+    if (len < 0)
+      break;
+    if (lost)
+      printf("-- %u frames overwritten on the device\n", lost);
+    timeline_print(data, len);
+    if (out)
+      fwrite(data, 1, len, out);
+    fflush(stdout);
+    if (follow)
+      usleep(100000);
+  } while (follow);
+  timeline_summary();
+
+  if (out)
+    fclose(out);
+  free(data);
+  close(fd);
+  return len < 0 ? -1 : 0;
+}
@@ -0,0 +1,396 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#include <linux/usb/ch9.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+// Same as device descriptor, vendor_bulk.h and trace.h of firmware
+#define XP_VID                0x04B4
+#define XP_PID                0x00F5
+#define VB_INTERFACE          2
+#define VB_EP_OUT             0x04
+#define VB_EP_IN              0x84
+#define VB_MAGIC              0x5842
+#define VB_HEADER_LEN         16
+#define VB_CMD_TRACE_READ     0x09
+#define TRACE_EVENTS          256
+#define TRACE_EVENT_LEN       16
+#define TRACE_LOG_ARGS        0x7FFF
+#define TRACE_LOG             0x8000
+#define LOG_ARGS_MAX          8
+
+// set to 1 for a bit of debug output
+#if 0
+#define dbg printf
+#else
+#define dbg(fmt, ...) do { } while (0)
+#endif
+
+/* Names and argument formats of enum TRACE_EVT, an id missing here is printed raw. */
+static const struct {
+  unsigned short id;
+  const char *name;
+  const char *format;
+} trace_names[] = {
+  {0x0001, "boot",            "sensor type %u"},
+  {0x0010, "frame end",       "frame %u, %u ms since last frame"},
+  {0x0011, "IR image",        "frame %u"},
+  {0x0012, "commit error",    "error %u, %u bytes"},
+  {0x0013, "commit EOF fail", "GPIF state %u"},
+  {0x0014, "wrap up fail",    "error %u, socket %u"},
+  {0x0015, "stream start",    ""},
+  {0x0016, "stream abort",    "frame %u"},
+  {0x0017, "wake late",       "trigger %u"},
+  {0x0018, "IMU idle",        "after %u ms"},
+  {0x0019, "IMU wake",        "motion %u, idle %u ms"},
+  {0x0020, "EP underrun",     "endpoint 0x%x, total %u"},
+  {0x0021, "USB event",       "event %u, data %u"}
+};
+
+static int pkt_size = 512;
+static unsigned int tag = 0;
+static unsigned short last_seq;
+static int have_seq = 0;
+// cyfxuvc.logdict of a make LOG_TOKEN=1 build, entries "level|file|line|format"
+static char *dict = NULL;
+static long dict_len = 0;
+
+static void put_be32(unsigned char *p, unsigned int value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static unsigned int get_be32(const unsigned char *p) {
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ *  @brief      find the camera on usbfs and claim the vendor bulk interface.
+ *  @param[out] NULL.
+ *  @return     usbfs fd, negative if not found.
+ */
+int usb_open(void) {
+  struct usb_device_descriptor desc;
+  char path[600];
+  DIR *bus_dir, *dev_dir;
+  struct dirent *bus, *dev;
+  int fd = -1, intf = VB_INTERFACE;
+
+  bus_dir = opendir("/dev/bus/usb");
+  if (!bus_dir)
+    return -1;
+  while (fd < 0 && (bus = readdir(bus_dir)) != NULL) {
+    if (bus->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "/dev/bus/usb/%s", bus->d_name);
+    dev_dir = opendir(path);
+    if (!dev_dir)
+      continue;
+    while (fd < 0 && (dev = readdir(dev_dir)) != NULL) {
+      if (dev->d_name[0] == '.')
+        continue;
+      snprintf(path, sizeof(path), "/dev/bus/usb/%s/%s", bus->d_name, dev->d_name);
+      fd = open(path, O_RDWR);
+      if (fd < 0)
+        continue;
+      if (read(fd, &desc, sizeof(desc)) != sizeof(desc) ||
+          desc.idVendor != XP_VID || desc.idProduct != XP_PID) {
+        close(fd);
+        fd = -1;
+        continue;
+      }
+      pkt_size = desc.bcdUSB >= 0x0300 ? 1024 : 512;
+    }
+    closedir(dev_dir);
+  }
+  closedir(bus_dir);
+  if (fd >= 0 && ioctl(fd, USBDEVFS_CLAIMINTERFACE, &intf) < 0) {
+    dbg("claim interface failed: %s\n\r", strerror(errno));
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+int bulk(int fd, int ep, unsigned char *data, int len, int timeout) {
+  struct usbdevfs_bulktransfer xfer = {
+    .ep      = ep,
+    .len     = len,
+    .timeout = timeout,
+    .data    = data,
+  };
+  int ret = ioctl(fd, USBDEVFS_BULK, &xfer);
+
+  if (ret < 0)
+    dbg("bulk ep 0x%x len %d failed: %s\n\r", ep, len, strerror(errno));
+  return ret;
+}
+
+/**
+ *  @brief      drain the firmware trace ring once.
+ *  @param[in]  fd: usbfs device.
+ *  @param[out] data: TRACE_EVENTS * TRACE_EVENT_LEN + pkt_size bytes.
+ *  @param[out] lost: events overwritten on the device since the last read.
+ *  @return     bytes of events, negative on error.
+ */
+int trace_read(int fd, unsigned char *data, unsigned int *lost) {
+  unsigned char header[VB_HEADER_LEN] = {0};
+  unsigned char status[VB_HEADER_LEN];
+  int len;
+
+  header[0] = VB_MAGIC >> 8;
+  header[1] = VB_MAGIC & 0xFF;
+  header[2] = VB_CMD_TRACE_READ;
+  put_be32(&header[8], TRACE_EVENTS * TRACE_EVENT_LEN);
+  put_be32(&header[12], ++tag);
+  if (bulk(fd, VB_EP_OUT, header, VB_HEADER_LEN, 1000) != VB_HEADER_LEN ||
+      bulk(fd, VB_EP_IN, status, VB_HEADER_LEN, 1000) != VB_HEADER_LEN)
+    return -1;
+  if (get_be32(&status[12]) != tag || status[3] != 0) {
+    printf("trace read failed, status %d\n", status[3]);
+    return -1;
+  }
+  *lost = get_be32(&status[4]);
+  len = get_be32(&status[8]);
+  if (len && bulk(fd, VB_EP_IN, data, len + pkt_size, 5000) != len) {
+    printf("trace data phase short\n");
+    return -1;
+  }
+  return len;
+}
+
+/**
+ *  @brief      load the log dictionary written by make LOG_TOKEN=1.
+ *  @param[in]  path: cyfxuvc.logdict.
+ *  @return     0 if loaded.
+ */
+int dict_load(const char *path) {
+  FILE *fp = fopen(path, "rb");
+
+  if (!fp)
+    return -1;
+  fseek(fp, 0, SEEK_END);
+  dict_len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  dict = calloc(1, dict_len + 1);
+  if (fread(dict, 1, dict_len, fp) != (size_t)dict_len)
+    dict_len = 0;
+  fclose(fp);
+  return dict_len ? 0 : -1;
+}
+
+/**
+ *  @brief      print a tokenized log message with printf of the host, one argument per
+ *              conversion. Length modifiers are dropped, all arguments are 32 bit on the FX3.
+ *  @param[in]  token: TRACE_LOG token.
+ *  @param[in]  arg, nargs: arguments.
+ *  @return     NULL.
+ */
+void log_print(unsigned int token, const unsigned int *arg, int nargs) {
+  char spec[16], *entry, *file, *line, *format;
+  int used = 0, n;
+
+  if (!dict || token * 4 >= (unsigned int)dict_len) {
+    printf("log token %u, args 0x%x 0x%x (no dictionary entry, see -d)\n", token, arg[0],
+           arg[1]);
+    return;
+  }
+  entry = strdup(&dict[token * 4]);
+  file = strchr(entry, '|');
+  line = file ? strchr(file + 1, '|') : NULL;
+  format = line ? strchr(line + 1, '|') : NULL;
+  if (!format) {
+    printf("log token %u, bad dictionary entry\n", token);
+    free(entry);
+    return;
+  }
+  *file++ = 0;
+  *line++ = 0;
+  *format++ = 0;
+  printf("%s %s:%s  ", entry, file, line);
+  for (; *format; format++) {
+    if (*format == '\r')
+      continue;
+    if (*format != '%' || format[1] == '%') {
+      putchar(*format);
+      format += *format == '%';
+      continue;
+    }
+    n = 0;
+    spec[n++] = *format++;
+    while (*format && strchr("-+ #0123456789.hlz", *format)) {
+      if (!strchr("hlz", *format) && n < (int)sizeof(spec) - 2)
+        spec[n++] = *format;
+      format++;
+    }
+    if (!*format)
+      break;
+    spec[n++] = *format == 's' ? 'x' : *format;
+    spec[n] = 0;
+    if (*format == 's')
+      printf("<str 0x");
+    printf(spec, used < nargs ? arg[used] : 0);
+    if (*format == 's')
+      printf(">");
+    used++;
+  }
+  if (format[-1] != '\n')
+    printf("\n");
+  free(entry);
+}
+
+/**
+ *  @brief      print packed events, one line each.
+ *  @param[in]  data, len: events as sent by TRACE_READ.
+ *  @return     NULL.
+ */
+void trace_print(const unsigned char *data, int len) {
+  unsigned short id, seq;
+  unsigned int i, arg0, arg1, arg[LOG_ARGS_MAX];
+  int offset, nargs;
+
+  for (offset = 0; offset + TRACE_EVENT_LEN <= len; offset += TRACE_EVENT_LEN) {
+    id = (data[offset + 4] << 8) | data[offset + 5];
+    seq = (data[offset + 6] << 8) | data[offset + 7];
+    arg0 = get_be32(&data[offset + 8]);
+    arg1 = get_be32(&data[offset + 12]);
+    if (have_seq && seq != (unsigned short)(last_seq + 1))
+      printf("-- %u events missing\n", (unsigned short)(seq - last_seq - 1));
+    last_seq = seq;
+    have_seq = 1;
+    printf("%10u ms  %5u  ", get_be32(&data[offset]), seq);
+    if (id & TRACE_LOG) {
+      arg[0] = arg0;
+      arg[1] = arg1;
+      /* arguments past the second one follow in TRACE_LOG_ARGS events */
+      for (nargs = 2; nargs < LOG_ARGS_MAX && offset + 2 * TRACE_EVENT_LEN <= len &&
+           ((data[offset + TRACE_EVENT_LEN + 4] << 8) | data[offset + TRACE_EVENT_LEN + 5]) ==
+           TRACE_LOG_ARGS; nargs += 2) {
+        offset += TRACE_EVENT_LEN;
+        arg[nargs] = get_be32(&data[offset + 8]);
+        arg[nargs + 1] = get_be32(&data[offset + 12]);
+        last_seq = (data[offset + 6] << 8) | data[offset + 7];
+      }
+      log_print(id & ~TRACE_LOG, arg, nargs);
+      continue;
+    }
+    if (id == TRACE_LOG_ARGS) {
+      printf("log arguments 0x%x 0x%x of an overwritten message\n", arg0, arg1);
+      continue;
+    }
+    for (i = 0; i < sizeof(trace_names) / sizeof(trace_names[0]); i++) {
+      if (trace_names[i].id == id)
+        break;
+    }
+    if (i == sizeof(trace_names) / sizeof(trace_names[0])) {
+      printf("event 0x%04x  0x%08x 0x%08x\n", id, arg0, arg1);
+      continue;
+    }
+    printf("%-16s", trace_names[i].name);
+    printf(trace_names[i].format, arg0, arg1);
+    printf("\n");
+  }
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: [-f] to keep draining every 100 ms | -r file to decode a saved dump,
+ *              [-o file] appends the raw events to file, [-d dict] decodes tokenized logs.
+ *  @return     NULL.
+ */
+int main(int argc, char** argv) {
+  unsigned char *data = malloc(TRACE_EVENTS * TRACE_EVENT_LEN + 1024);
+  unsigned int lost;
+  int fd, len, follow = 0, i;
+  FILE *out = NULL, *in = NULL;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-f")) {
+      follow = 1;
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      out = fopen(argv[++i], "ab");
+    } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+      if (dict_load(argv[++i])) {
+        printf("load dictionary %s failed\n", argv[i]);
+        exit(-1);
+      }
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      in = fopen(argv[++i], "rb");
+      if (!in) {
+        printf("open %s failed\n", argv[i]);
+        exit(-1);
+      }
+    } else {
+      printf("usage: %s [-d dict] [-f] [-o file] | [-d dict] -r file\n", argv[0]);
+      exit(-1);
+    }
+  }
+  if (in) {
+    // the whole dump at once, a log message may span two device reads
+    fseek(in, 0, SEEK_END);
+    len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    data = realloc(data, len + 1);
+    len = fread(data, 1, len, in);
+    trace_print(data, len);
+    fclose(in);
+    free(data);
+    return 0;
+  }
+
+  fd = usb_open();
+  if (fd < 0) {
+    printf("open camera vendor interface failed\n");
+    exit(-1);
+  }
+  do {
+    len = trace_read(fd, data, &lost);
+    if (len < 0)
+      break;
+    if (lost) {
+      printf("-- %u events overwritten on the device\n", lost);
+      have_seq = 0;
+    }
+    trace_print(data, len);
+    if (out)
+      fwrite(data, 1, len, out);
+    fflush(stdout);
+    if (follow)
+      usleep(100000);
+  } while (follow);
+
+  if (out)
+    fclose(out);
+  free(data);
+  close(fd);
+  return len < 0 ? -1 : 0;
+}
@@ -0,0 +1,522 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#include <linux/usb/ch9.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+
+// Same as device descriptor and vendor_bulk.h of firmware
+#define XP_VID                0x04B4
+#define XP_PID                0x00F5
+#define VB_INTERFACE          2
+#define VB_EP_OUT             0x04
+#define VB_EP_IN              0x84
+#define VB_MAGIC              0x5842
+#define VB_HEADER_LEN         16
+#define VB_CMD_INFO           0x00
+#define VB_CMD_FLASH_READ     0x01
+#define VB_CMD_FLASH_WRITE    0x02
+#define VB_CMD_FLASH_ERASE    0x03
+#define VB_CMD_REG_DUMP       0x04
+#define VB_CMD_FW_BEGIN       0x05
+#define VB_CMD_FW_WRITE       0x06
+#define VB_CMD_FW_COMMIT      0x07
+#define VB_CMD_FW_STATUS      0x08
+#define VB_INFO_LEN           40
+#define FW_STATUS_LEN         12
+#define FW_SLOT_SIZE          0x20000
+#define FW_COMMIT_ACK         0x4252434B
+// FX3 ROM USB boot, a device with no valid flash image shows up with this id
+#define FX3_BOOT_PID          0x00F3
+#define FX3_RAM_WRITE         0xA0
+#define FX3_RAM_CHUNK         4096
+#define SPI_FLASH_SECTOR_SIZE 0x10000
+#define DEVICE_CALIB_ADDR     0x50000
+
+// set to 1 for a bit of debug output
+#if 1
+#define dbg printf
+#else
+#define dbg(fmt, ...)
+#endif
+
+static int pkt_size = 512;
+static unsigned int tag = 0;
+
+static void put_be32(unsigned char *p, unsigned int value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static unsigned int get_be32(const unsigned char *p) {
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// SPI flash driver model, old: 8 MHz, one page per command and a 10 ms sleep after every page,
+// new: 25 MHz, one fast read command per transfer and page programs polled on WIP
+#define OLD_SPI_HZ            8000000.0
+#define NEW_SPI_HZ            25000000.0
+#define FLASH_PAGE            256
+#define PAGE_SLEEP_MS         10.0
+#define PAGE_PROGRAM_MS       0.7    // typical tPP of SPI NOR flash
+
+/**
+ *  @brief      print modeled flash throughput of the old and new firmware SPI driver.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void print_flash_model(void) {
+  // write enable + read status before every page, 4 byte command, page data
+  double old_page_ms = (1 + 3 + 4 + FLASH_PAGE) * 8 * 1000.0 / OLD_SPI_HZ + PAGE_SLEEP_MS;
+  double new_read_ms = FLASH_PAGE * 8 * 1000.0 / NEW_SPI_HZ;
+  double new_write_ms = (1 + 4 + FLASH_PAGE + 3) * 8 * 1000.0 / NEW_SPI_HZ + PAGE_PROGRAM_MS;
+
+  printf("model      read MB/s  write MB/s\n");
+  printf("old        %9.3f  %10.3f\n", FLASH_PAGE / old_page_ms / 1000.0,
+         FLASH_PAGE / old_page_ms / 1000.0);
+  printf("new        %9.3f  %10.3f\n", FLASH_PAGE / new_read_ms / 1000.0,
+         FLASH_PAGE / new_write_ms / 1000.0);
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ *  @brief      bulk transfer on the vendor interface.
+ *  @param[in]  fd: usbfs device.
+ *  @param[in]  ep: VB_EP_OUT or VB_EP_IN.
+ *  @param[in,out]  data, len: buffer.
+ *  @param[in]  timeout: ms.
+ *  @return     transferred bytes, negative on error.
+ */
+int bulk(int fd, int ep, unsigned char *data, int len, int timeout) {
+  struct usbdevfs_bulktransfer xfer = {
+    .ep      = ep,
+    .len     = len,
+    .timeout = timeout,
+    .data    = data,
+  };
+  int ret = ioctl(fd, USBDEVFS_BULK, &xfer);
+
+  if (ret < 0)
+    dbg("bulk ep 0x%x len %d failed: %s\n\r", ep, len, strerror(errno));
+  return ret;
+}
+
+/**
+ *  @brief      send a command and receive its status.
+ *  @param[in]  fd: usbfs device.
+ *  @param[in]  cmd, dev, addr, len: command fields.
+ *  @param[in]  out, out_len: FLASH_WRITE data, NULL otherwise.
+ *  @param[in]  timeout: status timeout in ms.
+ *  @return     status len (bytes of data following), negative on error.
+ */
+int vb_cmd(int fd, int cmd, int dev, unsigned int addr, unsigned int len,
+           unsigned char *out, int out_len, int timeout) {
+  unsigned char header[VB_HEADER_LEN] = {0};
+  unsigned char status[VB_HEADER_LEN];
+
+  header[0] = VB_MAGIC >> 8;
+  header[1] = VB_MAGIC & 0xFF;
+  header[2] = cmd;
+  header[3] = dev;
+  put_be32(&header[4], addr);
+  put_be32(&header[8], len);
+  put_be32(&header[12], ++tag);
+  if (bulk(fd, VB_EP_OUT, header, VB_HEADER_LEN, 1000) != VB_HEADER_LEN)
+    return -1;
+  if (out) {
+    if (bulk(fd, VB_EP_OUT, out, out_len, 5000) != out_len)
+      return -1;
+    // a data phase of a multiple of max packet size ends with a zero length packet
+    if (out_len % pkt_size == 0 && bulk(fd, VB_EP_OUT, out, 0, 1000) != 0)
+      return -1;
+  }
+  if (bulk(fd, VB_EP_IN, status, VB_HEADER_LEN, timeout) != VB_HEADER_LEN)
+    return -1;
+  if (get_be32(&status[12]) != tag) {
+    printf("status tag %u does not match command %u\n", get_be32(&status[12]), tag);
+    return -1;
+  }
+  if (status[3] != 0) {
+    printf("cmd 0x%x failed, status %d\n", cmd, status[3]);
+    return -1;
+  }
+  return get_be32(&status[8]);
+}
+
+/**
+ *  @brief      receive a data phase.
+ *  @param[in]  fd: usbfs device.
+ *  @param[out] data: at least len + pkt_size bytes, room for the trailing zero length packet.
+ *  @param[in]  len: expected bytes.
+ *  @return     0 if all data is received.
+ */
+int vb_recv(int fd, unsigned char *data, int len) {
+  int ret = bulk(fd, VB_EP_IN, data, len + pkt_size, 5000);
+
+  if (ret != len) {
+    printf("data phase short: %d of %d bytes\n", ret, len);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ *  @brief      find a device on usbfs and claim one of its interfaces.
+ *  @param[in]  pid: product id, vendor id is XP_VID.
+ *  @param[in]  intf: interface to claim, negative for none.
+ *  @return     usbfs fd, negative if not found.
+ */
+int usb_open(int pid, int intf) {
+  struct usb_device_descriptor desc;
+  char path[600];
+  DIR *bus_dir, *dev_dir;
+  struct dirent *bus, *dev;
+  int fd = -1;
+
+  bus_dir = opendir("/dev/bus/usb");
+  if (!bus_dir)
+    return -1;
+  while (fd < 0 && (bus = readdir(bus_dir)) != NULL) {
+    if (bus->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "/dev/bus/usb/%s", bus->d_name);
+    dev_dir = opendir(path);
+    if (!dev_dir)
+      continue;
+    while (fd < 0 && (dev = readdir(dev_dir)) != NULL) {
+      if (dev->d_name[0] == '.')
+        continue;
+      snprintf(path, sizeof(path), "/dev/bus/usb/%s/%s", bus->d_name, dev->d_name);
+      fd = open(path, O_RDWR);
+      if (fd < 0)
+        continue;
+      if (read(fd, &desc, sizeof(desc)) != sizeof(desc) ||
+          desc.idVendor != XP_VID || desc.idProduct != pid) {
+        close(fd);
+        fd = -1;
+        continue;
+      }
+      dbg("found %04x:%04x at %s, usb %x.%02x\n\r", XP_VID, pid, path, desc.bcdUSB >> 8,
+          desc.bcdUSB & 0xFF);
+      pkt_size = desc.bcdUSB >= 0x0300 ? 1024 : 512;
+    }
+    closedir(dev_dir);
+  }
+  closedir(bus_dir);
+  if (fd >= 0 && intf >= 0 && ioctl(fd, USBDEVFS_CLAIMINTERFACE, &intf) < 0) {
+    dbg("claim interface failed: %s\n\r", strerror(errno));
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+/**
+ *  @brief      CRC32 (IEEE 802.3) as checked by the firmware, same as zlib crc32.
+ *  @param[in]  data, len: buffer.
+ *  @return     CRC32.
+ */
+unsigned int crc32(const unsigned char *data, unsigned int len) {
+  unsigned int crc = 0xFFFFFFFF;
+  int bit;
+
+  while (len--) {
+    crc ^= *data++;
+    for (bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+  }
+  return ~crc;
+}
+
+static unsigned int get_le32(const unsigned char *p) {
+  return ((unsigned int)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+/**
+ *  @brief      check an FX3 boot image (.img of elf2img) and find its entry point.
+ *  @param[in]  img, len: image.
+ *  @param[out] entry: program entry, may be NULL.
+ *  @return     0 if the image is complete and its checksum matches.
+ */
+int fx3_image_check(const unsigned char *img, unsigned int len, unsigned int *entry) {
+  unsigned int offset = 4, words, sum = 0;
+
+  if (len < 16 || img[0] != 'C' || img[1] != 'Y' || img[3] != 0xB0)
+    return -1;
+  while (offset + 12 <= len) {
+    words = get_le32(&img[offset]);
+    offset += 8;
+    if (words == 0) {
+      if (entry)
+        *entry = get_le32(&img[offset - 4]);
+      return offset + 4 == len && get_le32(&img[offset]) == sum ? 0 : -1;
+    }
+    if (words > (len - offset) / 4)
+      return -1;
+    for (; words; words--, offset += 4)
+      sum += get_le32(&img[offset]);
+  }
+  return -1;
+}
+
+/**
+ *  @brief      stage an image, let the firmware verify and copy it into the boot slot.
+ *  @param[in]  fd: usbfs device.
+ *  @param[in]  img, len: FX3 image.
+ *  @return     0 if the device accepted the image and is rebooting into it.
+ */
+int fw_update(int fd, unsigned char *img, unsigned int len) {
+  unsigned int crc = crc32(img, len);
+  double start = now_ms();
+
+  if (fx3_image_check(img, len, NULL) || len > FW_SLOT_SIZE) {
+    printf("not an FX3 image or larger than %d KB\n", FW_SLOT_SIZE / 1024);
+    return -1;
+  }
+  printf("image %u bytes, crc32 0x%08x\n", len, crc);
+  // erase of the staging slot, then the copy into the boot slot take a few seconds each
+  if (vb_cmd(fd, VB_CMD_FW_BEGIN, 0, crc, len, NULL, 0, 15000) < 0)
+    return -1;
+  printf("staging slot erased, %.1f ms\n", now_ms() - start);
+  if (vb_cmd(fd, VB_CMD_FW_WRITE, 0, 0, len, img, len, 10000) < 0)
+    return -1;
+  printf("image staged, %.1f ms\n", now_ms() - start);
+  if (vb_cmd(fd, VB_CMD_FW_COMMIT, 0, FW_COMMIT_ACK, 0, NULL, 0, 20000) < 0)
+    return -1;
+  printf("image verified and committed in %.1f ms, device is rebooting\n", now_ms() - start);
+  return 0;
+}
+
+/**
+ *  @brief      load an image into RAM of a device in FX3 ROM USB boot and start it. The
+ *              firmware then finishes a firmware update cut short by a power loss.
+ *  @param[in]  img, len: FX3 image.
+ *  @return     0 if the image is started.
+ */
+int fw_recover(unsigned char *img, unsigned int len) {
+  struct usbdevfs_ctrltransfer ctrl = {
+    .bRequestType = 0x40,
+    .bRequest     = FX3_RAM_WRITE,
+    .timeout      = 5000,
+  };
+  unsigned int offset = 4, words, addr, entry, count;
+  int fd;
+
+  if (fx3_image_check(img, len, &entry)) {
+    printf("not an FX3 image\n");
+    return -1;
+  }
+  fd = usb_open(FX3_BOOT_PID, -1);
+  if (fd < 0) {
+    printf("no FX3 in USB boot mode found\n");
+    return -1;
+  }
+  for (;;) {
+    words = get_le32(&img[offset]);
+    addr = get_le32(&img[offset + 4]);
+    offset += 8;
+    if (words == 0)
+      break;
+    for (; words; words -= count / 4, addr += count, offset += count) {
+      count = words * 4 > FX3_RAM_CHUNK ? FX3_RAM_CHUNK : words * 4;
+      ctrl.wValue  = addr & 0xFFFF;
+      ctrl.wIndex  = addr >> 16;
+      ctrl.wLength = count;
+      ctrl.data    = &img[offset];
+      if (ioctl(fd, USBDEVFS_CONTROL, &ctrl) != (int)count) {
+        printf("RAM write at 0x%08x failed: %s\n", addr, strerror(errno));
+        close(fd);
+        return -1;
+      }
+    }
+  }
+  // zero length write to the entry point starts the image, the device drops off the bus
+  ctrl.wValue  = entry & 0xFFFF;
+  ctrl.wIndex  = entry >> 16;
+  ctrl.wLength = 0;
+  ctrl.data    = NULL;
+  ioctl(fd, USBDEVFS_CONTROL, &ctrl);
+  close(fd);
+  printf("image started at 0x%08x\n", entry);
+  return 0;
+}
+
+/**
+ *  @brief      main.
+ *  @param[in]  argc: cmd num.
+ *  @param[in]  argv: info | read [addr] [len] [file] | write addr file | dump dev first num
+ *              | bench | update img ack | status | recover img.
+ *  @return     NULL.
+ */
+int main(int argc, char** argv) {
+  const char *op = argc > 1 ? argv[1] : "read";
+  unsigned char *data, *check;
+  unsigned int addr, len, i;
+  double start, ms;
+  FILE *fp;
+  int fd, ret = 0, dev;
+
+  data = malloc(0x80000 + 1024);
+  if (!strcmp(op, "recover") && argc > 2) {
+    fp = fopen(argv[2], "rb");
+    if (!fp) {
+      printf("open %s failed\n", argv[2]);
+      exit(-1);
+    }
+    len = fread(data, 1, 0x80000, fp);
+    fclose(fp);
+    ret = fw_recover(data, len);
+    free(data);
+    return ret;
+  }
+  fd = usb_open(XP_PID, VB_INTERFACE);
+  if (fd < 0) {
+    dbg("open camera vendor interface failed\n\r");
+    exit(-1);
+  }
+
+  if (!strcmp(op, "info")) {
+    if (vb_cmd(fd, VB_CMD_INFO, 0, 0, 0, NULL, 0, 1000) != VB_INFO_LEN ||
+        vb_recv(fd, data, VB_INFO_LEN)) {
+      ret = -1;
+    } else {
+      data[VB_INFO_LEN - 1] = 0;
+      printf("protocol %d, sensor type %d, buffer %d, flash %u KB, firmware %s\n", data[0],
+             data[1], (data[2] << 8) | data[3], get_be32(&data[4]) / 1024, (char *)&data[8]);
+    }
+  } else if (!strcmp(op, "read")) {
+    addr = argc > 2 ? strtoul(argv[2], NULL, 0) : DEVICE_CALIB_ADDR;
+    len = argc > 3 ? strtoul(argv[3], NULL, 0) : SPI_FLASH_SECTOR_SIZE;
+    if (len > 0x80000)
+      len = 0x80000;
+    start = now_ms();
+    if (vb_cmd(fd, VB_CMD_FLASH_READ, 0, addr, len, NULL, 0, 1000) != (int)len ||
+        vb_recv(fd, data, len)) {
+      ret = -1;
+    } else {
+      ms = now_ms() - start;
+      printf("read %u bytes at 0x%x in %.1f ms, %.3f MB/s\n", len, addr, ms, len / ms / 1000.0);
+      if (argc > 4 && (fp = fopen(argv[4], "wb")) != NULL) {
+        fwrite(data, 1, len, fp);
+        fclose(fp);
+      }
+    }
+  } else if (!strcmp(op, "bench")) {
+    // whole flash read, non destructive; use write on a scratch sector for the write rate
+    print_flash_model();
+    start = now_ms();
+    if (vb_cmd(fd, VB_CMD_FLASH_READ, 0, 0, 0x80000, NULL, 0, 1000) != 0x80000 ||
+        vb_recv(fd, data, 0x80000)) {
+      ret = -1;
+    } else {
+      ms = now_ms() - start;
+      printf("measured   %9.3f  (512 KB in %.1f ms)\n", 0x80000 / ms / 1000.0, ms);
+    }
+  } else if (!strcmp(op, "write") && argc > 3) {
+    addr = strtoul(argv[2], NULL, 0);
+    fp = fopen(argv[3], "rb");
+    if (!fp) {
+      printf("open %s failed\n", argv[3]);
+      exit(-1);
+    }
+    len = fread(data, 1, 0x80000, fp);
+    fclose(fp);
+    start = now_ms();
+    // erase takes up to a few seconds per sector
+    if (vb_cmd(fd, VB_CMD_FLASH_ERASE, 0, addr, len, NULL, 0,
+               (len / SPI_FLASH_SECTOR_SIZE + 1) * 5000) < 0 ||
+        vb_cmd(fd, VB_CMD_FLASH_WRITE, 0, addr, len, data, len, 5000) < 0) {
+      ret = -1;
+    } else {
+      ms = now_ms() - start;
+      printf("erased and wrote %u bytes at 0x%x in %.1f ms, %.3f MB/s\n", len, addr, ms,
+             len / ms / 1000.0);
+      // read back and compare
+      check = malloc(len + 1024);
+      if (vb_cmd(fd, VB_CMD_FLASH_READ, 0, addr, len, NULL, 0, 1000) != (int)len ||
+          vb_recv(fd, check, len) || memcmp(check, data, len)) {
+        printf("read back verify failed\n");
+        ret = -1;
+      } else {
+        printf("read back verify ok\n");
+      }
+      free(check);
+    }
+  } else if (!strcmp(op, "dump") && argc > 4) {
+    dev = atoi(argv[2]);
+    addr = strtoul(argv[3], NULL, 0);
+    len = atoi(argv[4]);
+    start = now_ms();
+    if (vb_cmd(fd, VB_CMD_REG_DUMP, dev, addr, len, NULL, 0, 5000) != (int)len * 2 ||
+        vb_recv(fd, data, len * 2)) {
+      ret = -1;
+    } else {
+      ms = now_ms() - start;
+      for (i = 0; i < len; i++)
+        printf("0x%04x  0x%04x\n", addr + i, (data[i * 2] << 8) | data[i * 2 + 1]);
+      printf("%u registers in %.1f ms\n", len, ms);
+    }
+  } else if (!strcmp(op, "update") && argc > 2 && (argc < 4 || strcmp(argv[3], "ack"))) {
+    // single boot slot, a power loss during the copy needs "recover img" over USB boot
+    printf("the update rewrites the only boot slot, a power loss while it is copied leaves\n"
+           "the device in USB boot until \"recover img\" is run, and there is no rollback.\n"
+           "run \"update img ack\" to accept this\n");
+    ret = -1;
+  } else if (!strcmp(op, "update") && argc > 2) {
+    fp = fopen(argv[2], "rb");
+    if (!fp) {
+      printf("open %s failed\n", argv[2]);
+      exit(-1);
+    }
+    len = fread(data, 1, 0x80000, fp);
+    fclose(fp);
+    ret = fw_update(fd, data, len);
+  } else if (!strcmp(op, "status")) {
+    if (vb_cmd(fd, VB_CMD_FW_STATUS, 0, 0, 0, NULL, 0, 1000) != FW_STATUS_LEN ||
+        vb_recv(fd, data, FW_STATUS_LEN)) {
+      ret = -1;
+    } else {
+      printf("update state %d (0 idle, 1 staging, 2 copy, 3 done), size %u, crc32 0x%08x\n",
+             data[0], get_be32(&data[4]), get_be32(&data[8]));
+    }
+  } else {
+    printf("usage: %s info | read [addr] [len] [file] | write addr file | dump dev first num"
+           " | bench | update img ack | status | recover img\n", argv[0]);
+  }
+
+  free(data);
+  close(fd);
+  return ret;
+}
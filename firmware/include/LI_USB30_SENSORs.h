@@ -32,7 +32,7 @@
 #ifdef MULTI_RESOLUTION_SUPPORT_U30
 // Resolution supportted,Manually change Descriptor size:TOTAL_SIZE_DESCRIPTOR and
 // TOTAL_SIZE_CS_DESCRIPTOR,also ADD or SUBSTRUCT the details for frame descriptor in cyfxuvcdscr.c
-#define RES_NUM                   1
+#define RES_NUM                   2  // full window and 2x2 binned window
 #define SUPPORTED_FRAMERATE_NUM   4  // 60,30,15,10FPS
 #endif
 /* Configuration Descriptor Type */
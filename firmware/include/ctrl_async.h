@@ -0,0 +1,84 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_CTRL_ASYNC_H_
+#define FIRMWARE_INCLUDE_CTRL_ASYNC_H_
+
+/* Queued control requests.
+ *
+ * UVC_USBSetup_CB only copies each class request setup packet into its own slot and wakes the
+ * EP0 thread, which handles the newest slot only and counts the older ones as dropped: a new
+ * SETUP aborts any control transfer still open on the host, so the data or status stage of an
+ * older request can no longer complete and answering it would stall the newer one. A request
+ * arriving while another one is handled still never overwrites the packet being handled.
+ * Handlers with slow work, flash erase and programming, finish the control transfer at once
+ * and hand the work to the control worker thread with ctrl_async_submit(). Jobs run in order
+ * and are numbered, the host follows them through the async status XU, and the worker sends a
+ * UVC control change status packet for that XU on the status interrupt endpoint whenever one
+ * is done. Other controls report their own changes the same way through ctrl_status_send().
+ * async status (CY_FX_UVC_XU_CTRL_ASYNC_RW)
+ * ---------------------------------------------------------------------------
+ * |  byte  |   0 - 1   |   2 - 3   |   4    |    5    |   6    |    7    |
+ * ---------------------------------------------------------------------------
+ * |  data  | submitted | completed | queued | last op | status | errors  |
+ * ---------------------------------------------------------------------------
+ * |  byte  |      8 - 15       |      16 - 23      |  24 - 27  |  28 - 31  |
+ * ---------------------------------------------------------------------------
+ * |  data  |  EP0 latency      |  job latency      | requests  | dropped   |
+ * ---------------------------------------------------------------------------
+ * submitted and completed are job sequence numbers, status is the enum CTRL_JOB_STATUS of the
+ * last completed job, errors counts failed jobs (saturating). A latency is p50, p90, p99 and
+ * max in ms, 2 bytes each: EP0 from the setup packet to the end of its handler, job from
+ * submit to done. requests counts setup packets, dropped those replaced by a newer setup
+ * packet before the EP0 thread took them.
+ * Everything is MSB first. SET_CUR with byte 0 = 1 clears counters and latencies.
+ */
+#define CTRL_SETUP_SLOTS      4       // power of 2
+#define CTRL_JOB_SLOTS        8       // power of 2
+#define CTRL_JOB_DATA         256     // one flash page
+#define CTRL_LATENCY_BUCKETS  16      // bucket i > 0 holds [2^(i-1), 2^i) ms
+#define CTRL_ASYNC_LEN        32
+#define CTRL_STATUS_VALUE_MAX 11      // bValue bytes of a status packet, 16 byte DMA buffer
+
+enum CTRL_JOB_STATUS {
+  CTRL_JOB_NONE    = 0,
+  CTRL_JOB_OK      = 1,
+  CTRL_JOB_ERROR   = 2
+};
+enum CTRL_OP {
+  CTRL_OP_CALIB_WRITE  = 1,   // one calib_struct_t packet, erases sector 5 for packet 0
+  CTRL_OP_DEVICE_INFO  = 2,   // device info record
+  CTRL_OP_DEVICE_ERASE = 3,   // erase the device info sector
+  CTRL_OP_KV_SET       = 4,   // key, len, value
+  CTRL_OP_KV_XU        = 5    // kv extension unit request, see kv_store.h
+};
+
+// job run by the control worker, returns CyTrue if it succeeded
+typedef CyBool_t (*ctrl_job_fn)(uint8_t *data, uint16_t len);
+
+/* function declaration */
+void ctrl_async_init(void);
+void ctrl_setup_put(uint32_t setupdat0, uint32_t setupdat1);
+CyBool_t ctrl_setup_get(uint32_t *setupdat0, uint32_t *setupdat1, uint32_t *time);
+void ctrl_setup_done(uint32_t time);
+CyBool_t ctrl_async_full(void);
+CyBool_t ctrl_async_submit(uint8_t op, ctrl_job_fn fn, const uint8_t *data, uint16_t len);
+void ctrl_async_status(uint8_t *buffer);
+void ctrl_async_clear(void);
+void ctrl_status_send(uint16_t selector, const uint8_t *value, uint8_t len);
+void Ctrl_Worker_Thread_Entry(uint32_t input);
+
+#endif  // FIRMWARE_INCLUDE_CTRL_ASYNC_H_
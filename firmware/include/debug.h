@@ -40,6 +40,47 @@ extern int debug_level;
 #define INFO_COLOR  FC_YELLOW"INFO=> "FC_WHITE
 #define ERR_COLOR   FC_RED"ERR=> "FC_WHITE
 
+#ifdef SENSOR_LOG_TOKEN
+/* Tokenized logging (make LOG_TOKEN=1). Level, file, line and format string of each call go
+ * into .log_fmt, which log_token.ld keeps out of the image, and the call only records the
+ * string offset and its arguments in the trace ring (trace.h). The build dumps .log_fmt to
+ * cyfxuvc.logdict, host_bin/trace_test -d rebuilds the messages from it. %s arguments are
+ * device addresses, the host can only show their value.
+ * dictionary entry: "level|file|line|format\0", 4 byte aligned, token = offset / 4
+ */
+#include "trace.h"  //NOLINT
+
+#define __LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define __LOG_NARGS(args...) __LOG_NARGS_(0, ##args, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define __LOG_STR_(x) #x
+#define __LOG_STR(x) __LOG_STR_(x)
+#define __TOKEN(level, format, args...) \
+do { \
+  static const char __log_fmt[] __attribute__((section(".log_fmt"), aligned(4), used)) = \
+      level "|" __FILE__ "|" __LOG_STR(__LINE__) "|" format; \
+  trace_log((uint32_t)__log_fmt >> 2, __LOG_NARGS(args), ##args); \
+} while (0)
+
+#ifndef SENSOR_RELEASE
+#define sensor_dbg(format, args...) \
+do { \
+if (unlikely(debug_level & DEBUG_DBG_LEVEL)) \
+  __TOKEN("D", format, ##args); \
+} while (0)
+
+#define sensor_info(format, args...) \
+do { \
+if (unlikely(debug_level & DEBUG_INFO_LEVEL)) \
+  __TOKEN("I", format, ##args); \
+} while (0)
+#else
+#define sensor_dbg(format, args...)
+#define sensor_info(format, args...)
+#endif
+
+#define sensor_err(format, args...) __TOKEN("E", format, ##args)
+#define sensor_printf(format, args...) __TOKEN("P", format, ##args)
+#else
 #ifndef SENSOR_RELEASE
 #define sensor_dbg(format, args...) \
 do { \
@@ -64,6 +105,7 @@ do { \
   CyU3PDebugPrint(2, "%s[%d]: ", __func__, __LINE__);\
   CyU3PDebugPrint(2, format, ##args); \
 } while (0)
+#endif  // SENSOR_LOG_TOKEN
 
 static inline void dump_buf(char *info, uint8_t *buf, uint32_t len) {
   int i;
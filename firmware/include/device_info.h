@@ -0,0 +1,54 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_DEVICE_INFO_H_
+#define FIRMWARE_INCLUDE_DEVICE_INFO_H_
+
+/* Device information record in the first page of sector 4, read once at boot into RAM.
+ * ----------------------------------------------------------------
+ * |  byte  |  0 - 1  |    2    |  3  |  4 - 5  |    6 - 7    |  8 - |
+ * ----------------------------------------------------------------
+ * |  data  |  magic  | version | rsv | tlv len | crc16 (LSB) | tlv  |
+ * ----------------------------------------------------------------
+ * tlv len (MSB first) bytes of (tag, len, value) entries follow, crc16 covers them.
+ * Readers skip tags they do not know and writers keep them, so new tags need no new
+ * firmware or host tool. A page without magic is the old flash_struct_t, its Sensor_ID
+ * is taken as DEVINFO_TAG_SERIAL.
+ */
+#define DEVINFO_MAGIC         0x4449  // "DI"
+#define DEVINFO_VERSION       1
+#define DEVINFO_HEADER_LEN    8
+#define DEVINFO_LEN           256     // header and tlv, one flash page
+#define DEVINFO_TLV_MAX       (DEVINFO_LEN - DEVINFO_HEADER_LEN)
+
+enum DEVINFO_TAG {
+  DEVINFO_TAG_SERIAL        = 0x01,  // ASCII, also the USB serial number
+  DEVINFO_TAG_BOARD_REV     = 0x02,  // ASCII, e.g. "XPIAC 1V3"
+  DEVINFO_TAG_SENSOR_LEFT   = 0x03,  // left image sensor serial, ASCII
+  DEVINFO_TAG_SENSOR_RIGHT  = 0x04,  // right image sensor serial, ASCII
+  DEVINFO_TAG_CALIB_VERSION = 0x05,  // 2 bytes MSB first
+  DEVINFO_TAG_CALIB_HASH    = 0x06,  // CRC32 or digest of the calibration file
+  DEVINFO_TAG_MFG_DATE      = 0x07   // year (2, MSB first), month, day
+};
+
+/* function declaration */
+void device_info_load(void);
+const uint8_t *device_info_get(uint8_t tag, uint8_t *len);
+void device_info_record(uint8_t *record);
+CyBool_t device_info_write(const uint8_t *record);
+CyBool_t device_info_set(uint8_t tag, const uint8_t *value, uint8_t len);
+
+#endif  // FIRMWARE_INCLUDE_DEVICE_INFO_H_
@@ -0,0 +1,55 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_DMA_METER_H_
+#define FIRMWARE_INCLUDE_DMA_METER_H_
+
+/* Occupancy meter of the video DMA channel, to tell a slow host from a slow sensor side.
+ * Per frame it records the bytes committed, the frame end to frame end interval, the most
+ * buffers committed and not yet consumed (in flight), the time all CY_FX_UVC_STREAM_BUF_TOTAL
+ * buffers of both GPIF threads were in flight, when the GPIF has no buffer to fill, and the
+ * peak consumer gap, the longest a committed buffer waited for the USB consumer event after
+ * the one before.
+ * meter (CY_FX_UVC_XU_DMA_METER_RW GET_CUR)
+ * ---------------------------------------------------------------------------------
+ * |  byte  | 0 - 3  |  4 - 7  |   8 - 11    |    12     |   13    |   14    | 15  |
+ * ---------------------------------------------------------------------------------
+ * |  data  | frames | full us | peak gap us | in flight | buffers | samples | rsv |
+ * ---------------------------------------------------------------------------------
+ * followed by METER_SAMPLES frame samples, oldest first, the first samples of them valid
+ * ------------------------------------------------------------------------------
+ * |  byte  | 0 - 3 | 4 - 7 |   8 - 11    | 12 - 15 |   16 - 17   |    18     | 19  |
+ * ------------------------------------------------------------------------------
+ * |  data  | frame | bytes | interval us | full us | peak gap us | in flight | rsv |
+ * ------------------------------------------------------------------------------
+ * The header has the sum of full us and the maxima of the other fields since the last clear.
+ * Everything is MSB first, totals count since the last clear, interval is 0 for the first
+ * frame of a stream. SET_CUR byte 0 = 1 clears the meter.
+ */
+#define METER_SAMPLES         16
+#define METER_HEADER_LEN      16
+#define METER_SAMPLE_LEN      20
+#define METER_XU_LEN          (METER_HEADER_LEN + METER_SAMPLES * METER_SAMPLE_LEN)
+
+/* function declaration */
+void meter_start(void);
+void meter_commit(uint16_t bytes, uint8_t inflight, uint32_t ticks);
+void meter_consume(uint32_t commit_ticks, uint32_t ticks);
+void meter_frame(uint32_t frame);
+void meter_read(uint8_t *buffer);
+void meter_clear(void);
+
+#endif  // FIRMWARE_INCLUDE_DMA_METER_H_
@@ -24,7 +24,8 @@
 #define FIRMWARE_INCLUDE_EXTENSION_UNIT_H_
 
 // Variable Declare
-// Flash only store sensor Device ID, limit to 32 byte.
+// Old layout of sector 4 and payload of the flash XU, Device ID limited to 32 bytes.
+// Sector 4 now holds the device info record of device_info.h.
 struct flash_struct_t {
   uint8_t Sensor_ID[32];
   uint8_t tmp[223];
@@ -42,6 +43,50 @@ typedef struct {
   uint8_t check_sum[2];              // check sum from header[0] to data[PAYLOAD_LEN-1],
                                      // LSB first, MSB last
 } calib_struct_t;
+// State of the calibration RAM copy
+enum CALIB_CACHE_STATE {
+  CALIB_CACHE_EMPTY = 0,     // no calibration in flash
+  CALIB_CACHE_VALID = 1,
+  CALIB_CACHE_ERROR = 2      // CRC or flash error, reads fall back to flash
+};
+#define CALIB_INFO_LEN  8
+// Flags of the calibration cache info
+enum CALIB_INFO_FLAG {
+  CALIB_FLAG_COMPRESSED      = 0x01,  // stored compressed, read only
+  CALIB_FLAG_READ_COMPRESSED = 0x02   // packets are served as stored, not inflated
+};
+// Compressed calibration file, the packet payloads hold this header and an LZ4 block
+// (lz4_stream.h) in place of the file.
+// ---------------------------------------------------------------------
+// |  byte  | 0 - 3 |    4 - 7    |     8 - 11    |   12 - 13   | 14 - 15 |
+// ---------------------------------------------------------------------
+// |  data  | magic | size (MSB)  | lz4 len (MSB) | crc16 (LSB) |   rsv   |
+// ---------------------------------------------------------------------
+// size and crc16 are those of the file, which is served inflated unless the host asks for
+// CALIB_FLAG_READ_COMPRESSED or it does not fit CALIB_INFLATE_MAX.
+#define CALIB_LZ_MAGIC        0x434C5A34  // "CLZ4"
+#define CALIB_LZ_HEADER_LEN   16
+#define CALIB_INFLATE_MAX     (255 * PAYLOAD_LEN)
+
+// Batched register access, (device, op, address, value) entries executed in order
+#define REG_BATCH_ENTRY_LEN   6
+#define REG_BATCH_MAX         40
+#define REG_BATCH_LEN         (2 + REG_BATCH_MAX * REG_BATCH_ENTRY_LEN)
+enum REG_BATCH_DEV {
+  REG_DEV_SENSOR       = 0,  // both eyes, reads come from the left eye
+  REG_DEV_SENSOR_LEFT  = 1,
+  REG_DEV_SENSOR_RIGHT = 2,
+  REG_DEV_IMU          = 3,
+  REG_DEV_LED          = 4   // tlc59116 of XPIRL2, tlc59108 of XPIRL3
+};
+enum REG_BATCH_OP {
+  REG_OP_READ  = 0,
+  REG_OP_WRITE = 1,
+  REG_OP_DELAY = 2           // sleep value ms, lets a list wait for settings to apply
+};
+#define REG_OP_ERROR          0x80  // set in op of a failed entry
+// longest REG_OP_DELAY, a full list of them stays well inside the host control timeout
+#define REG_DELAY_MAX_MS      50
 
 /* function declaration */
 void EU_Rqts_imu_rw(uint8_t bRequest);
@@ -53,8 +98,26 @@ extern void EU_Rqts_hard_version(uint8_t bRequest);
 extern void EU_Rqts_firmware_flag(uint8_t bRequest);
 extern void EU_Rqts_IR_control(uint8_t bRequest);
 extern void EU_Rqts_flash_RW(uint8_t bRequest);
+extern void EU_Rqts_device_info(uint8_t bRequest);
 extern void EU_Rqts_debug_RW(uint8_t bRequest);
+extern void EU_Rqts_calib_RW(uint8_t bRequest);
+extern void EU_Rqts_calib_info(uint8_t bRequest);
+extern void calib_cache_load(void);
+extern void EU_Rqts_kv_RW(uint8_t bRequest);
+extern void EU_Rqts_ctrl_async(uint8_t bRequest);
+extern void EU_Rqts_profile(uint8_t bRequest);
+extern void EU_Rqts_hist(uint8_t bRequest);
+extern void EU_Rqts_dma_meter(uint8_t bRequest);
+extern uint16_t flash_crc16(const uint8_t *data, uint16_t len);
+extern uint16_t flash_crc16_update(uint16_t crc, const uint8_t *data, uint16_t len);
+extern void EU_Rqts_hdr_RW(uint8_t bRequest);
+extern void EU_Rqts_trigger_RW(uint8_t bRequest);
+extern void EU_Rqts_roi_RW(uint8_t bRequest);
+extern void EU_Rqts_test_pattern_RW(uint8_t bRequest);
+extern void EU_Rqts_reg_batch_RW(uint8_t bRequest);
+extern int reg_batch_exec(uint8_t *entry);
 extern CyU3PReturnStatus_t CyFxFlashProgEraseSector(CyBool_t isErase, uint8_t sector, uint8_t *wip);
+extern CyU3PReturnStatus_t CyFxFlashProgEraseSectorWait(uint8_t sector);
 extern CyU3PReturnStatus_t CyFxFlashProgSpiInit(uint16_t pageLen);
 CyU3PReturnStatus_t CyFxFlashProgSpiTransfer(uint16_t  pageAddress, uint16_t  byteCount,
                                              uint8_t  *buffer, CyBool_t  isRead);
@@ -68,7 +131,25 @@ extern volatile char last_imu[IMU_BURST_LEN];
  * IMU_LOOP_SAMPLE, It is helpful for sensor lowpower.
  * */
 #define IMU_LOOP_SAMPLE
+/*
+ * IMU idle mode. Without a stream and without an IMU burst read for IMU_IDLE_MS the data
+ * thread stops the loop sample and puts the ICM-20608 into low power accel mode with wake on
+ * motion, so nothing polls I2C and the FX3 can suspend. A stream start or an IMU burst read
+ * restores full rate sampling, the first read returns the last sample from before the idle.
+ * Motion does too, and is reported as a control change status packet of the IMU burst XU
+ * (CY_FX_UVC_XU_REG_BURST) on the status interrupt endpoint, bValue is the CyU3PGetTime()
+ * of the wake in ms, MSB first.
+ * */
+#define IMU_IDLE_MS           2000
+#define IMU_WOM_THRESH_MG     64      // 4 mg steps
+#define IMU_WOM_TIME_MS       1       // the ICM-20608 has no motion duration, kept for the API
+#define IMU_WOM_LPA_HZ        10      // accel sampling in low power accel mode
+#define SPI_FLASH_SIZE        (0x80000)
+#define SPI_FLASH_SECTOR_SIZE (0x10000)
+#define SPI_FLASH_PAGE_SIZE   (0x100)
 #define  DEVICE_MSG_ADDR      (0x40000 / 0x100)
 #define DEVICE_CALIB_ADDR     (0x50000 / 0x100)
+/* Held around every flash access, recursive so a caller can keep it over several transfers. */
+extern CyU3PMutex glSpiLock;
 
 #endif  // FIRMWARE_INCLUDE_EXTENSION_UNIT_H_
@@ -0,0 +1,71 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_FW_UPDATE_H_
+#define FIRMWARE_INCLUDE_FW_UPDATE_H_
+
+/* Firmware update over the vendor bulk interface.
+ *
+ * The FX3 boot ROM only loads the image at flash address 0, so the new image is staged in
+ * sectors 2 - 3 first and copied into the boot slot (sectors 0 - 1) once it is verified:
+ *  FW_BEGIN   erase the staging slot, addr is the CRC32 and len the size of the image.
+ *  FW_WRITE   program image bytes, addr is the page aligned offset in the image.
+ *  FW_COMMIT  addr must be FW_COMMIT_ACK. Check CRC32 and FX3 checksum of the staged image,
+ *             copy it into the boot slot and reset into it after the status is sent.
+ *  FW_STATUS  return the update journal.
+ * An image that fails the check never touches the boot slot. The copy writes the first page,
+ * holding the "CY" signature, last, so the ROM either finds no image or the complete new one.
+ * The journal lives in the kv store and is set to COPY before the boot slot is erased. A copy
+ * cut short by a reset is finished from the untouched staging slot at the next start up.
+ * The update is not fail safe, there is a single boot slot and no rollback:
+ *  - the old image stops booting with the first erase of the boot slot and nothing boots from
+ *    flash until the signature page is written, up to a second per erased sector plus the
+ *    page programs. A power loss in this window leaves the ROM in USB boot, the host has to
+ *    load a RAM image of this firmware (vendor_bulk_test recover), which resumes the copy.
+ *  - an image that passes the checks but hangs at start up stays in the boot slot and is
+ *    replaced the same way.
+ * FW_COMMIT is refused unless the host passes FW_COMMIT_ACK to acknowledge this. Only the
+ * sectors the new image takes are erased to keep the window short.
+ * journal (FW_STATUS data)
+ * ------------------------------------------
+ * |  byte  |   0   | 1 - 3 | 4 - 7 | 8 - 11 |
+ * ------------------------------------------
+ * |  data  | state |  rsv  |  size |  crc32 |
+ * ------------------------------------------
+ */
+#define FW_BOOT_ADDR          (0x00000)
+#define FW_STAGING_ADDR       (0x20000)
+#define FW_SLOT_SIZE          (0x20000)
+#define FW_STATUS_LEN         12
+#define FW_COMMIT_ACK         (0x4252434B)  // "BRCK", host accepts the brick window
+// bytes per flash read while checking or copying an image, a multiple of the page size
+#define FW_CHUNK              (0x400)
+
+enum FW_UPDATE_STATE {
+  FW_STATE_IDLE    = 0,
+  FW_STATE_STAGING = 1,    // staging slot erased, image being written
+  FW_STATE_COPY    = 2,    // staged image verified, boot slot being rewritten
+  FW_STATE_DONE    = 3
+};
+
+/* function declaration */
+uint8_t fw_update_begin(uint32_t size, uint32_t crc);
+CyBool_t fw_update_write_ok(uint32_t offset, uint32_t len);
+uint8_t fw_update_commit(uint32_t ack);
+void fw_update_status(uint8_t *buffer);
+void fw_update_resume(void);
+
+#endif  // FIRMWARE_INCLUDE_FW_UPDATE_H_
@@ -17,6 +17,7 @@
 #ifndef FIRMWARE_INCLUDE_FX3_BSP_H_
 #define FIRMWARE_INCLUDE_FX3_BSP_H_
 
+#include <cyu3os.h>
 
 /* macro declaration */
 #define CAMERA_RST_GPIO        17  // CTL[0]
@@ -25,16 +26,16 @@
 #define CAMERA_OE_GPIO         20  // CTL[3]
 #define CAMERA_STANDBY_GPIO    21  // CTL[4]
 #define CAMERA_EXPOSURE_GPIO   23  // CTL[6]
-/* warning: not use two pin Now. */
-#define IMU_INT_GPIO           24  // CTL[7]
+#define IMU_INT_GPIO           24  // CTL[7], wake on motion of the idle IMU
+/* warning: not use this pin Now. */
 #define IMU_G_FSYNC_GPIO       25  // CTL[8]
 
 #define SENSOR_LED_GPIO        45  // GPIO45
 #define CAMERA_SADR_GPIO       50  // I2S-CLK
 #define CAMPWR_CONTROL_GPIO    52  // I2S-WS
 
-#define UNUSED_GPIO1           34  // DQ17
-#define UNUSED_GPIO2           35  // DQ18
+#define PROF_TIMER_GPIO        34  // DQ17, complex GPIO timer of the thread profiler
+#define TIMESTAMP_GPIO         35  // DQ18, free running complex GPIO timer for fx3_ticks()
 #define UNUSED_GPIO3           36  // DQ19
 #define UNUSED_GPIO4           37  // DQ20
 #define UNUSED_GPIO5           38  // DQ21
@@ -67,8 +68,43 @@ enum SENSOR_POWER_MODE {
   SENSOR_ACTIVE   = 0,
   SENSOR_STANDBY  = 1
 };
+/* Snapshot trigger on CAMERA_EXPOSURE_GPIO, shared by all devices on one sync bus */
+enum TRIGGER_MODE {
+  TRIGGER_OFF       = 0,  // sensors free run, pin driven low
+  TRIGGER_MASTER    = 1,  // this device drives the exposure pulse
+  TRIGGER_EXTERNAL  = 2,  // pin is an input, pulse comes from a master or an external source
+  TRIGGER_LOW_POWER = 3   // master, sensors in standby between frame end and the next pulse
+};
+/* GPIO fast clock: SYS_CLK(403.2MHz) / fastClkDiv(2), complex GPIO timers count at this rate */
+#define GPIO_FAST_CLK_HZ       (201600000)
+// fx3_ticks() difference in us, the 32 bit tick count wraps every 21.3 s
+#define TICKS_TO_US(ticks)     ((uint32_t)((uint64_t)(ticks) * 1000000 / GPIO_FAST_CLK_HZ))
+#define TRIGGER_MIN_WINDOW_US  (10)
+/* Units count trigger pulses in the same sequence. A master leaves the pin low for
+ * TRIGGER_SYNC_GAP before its first pulse, and every unit restarts its sequence at 1 on a pulse
+ * that follows more than 1.5 periods of silence. Arm the followers first, then the master; a
+ * follower armed while the master runs keeps sequence 0 until the master is set again. The
+ * first master cycle, threshold plus sync gap plus phase, has to fit the 32 bit timer. */
+#define TRIGGER_SYNC_GAP(period) (2 * (period))
+#define TRIGGER_MAX_PERIOD_US  (5000000)
+#define TRIGGER_TICKS_WRAP_MS  (21000)  // fx3_ticks() differences are valid below this
+/* TRIGGER_LOW_POWER: standby is released this long before the next pulse, the achieved lead
+ * is in HIST_SENSOR_WAKE. A frame gap shorter than the wake lead and the minimum sleep is
+ * not worth the standby GPIO toggles and the frame stays awake. */
+#define LOW_POWER_WAKE_US      (2000)
+#define LOW_POWER_MIN_SLEEP_US (3000)
+
+struct trigger_ctl_t {
+  uint8_t mode;
+  uint32_t period_us;  // pulse period, one frame per pulse
+  uint32_t window_us;  // pulse width, also the exposure time of every frame
+  uint32_t phase_us;   // delay of the first pulse after the sync gap, master only
+};
 /* variable declaration*/
 extern int hardware_version_num;
+extern struct trigger_ctl_t trigger_ctrl;
+extern volatile uint32_t trigger_seq;
+extern CyU3PMutex glSensorLock;
 char* Baidu_ProductDscr[16];
 
 /* function declaration */
@@ -80,6 +116,7 @@ extern void fx3_IO_matrix_config(void);
 extern void CyFxAppErrorHandler(CyU3PReturnStatus_t apiRetStatus);
 extern int hadrware_version_detect(void);
 extern void v034_set_unified_addr(void);
+extern void v034_set_split_addr(void);
 extern void v034_power_on(void);
 extern void v034_power_off(void);
 extern void sensor_set_power_mode(enum SENSOR_POWER_MODE state);
@@ -89,4 +126,11 @@ extern void tlc_power_ON(void);
 extern void tlc_power_OFF(void);
 extern void IR_LED_ON(void);
 extern void IR_LED_OFF(void);
+extern CyU3PReturnStatus_t fx3_trigger_config(struct trigger_ctl_t *ctrl);
+extern void fx3_timestamp_init(void);
+extern uint32_t fx3_ticks(void);
+extern void sensor_sleep_init(void);
+extern void sensor_sleep_frame_end(void);
+extern void sensor_sleep_stop(void);
+extern void fx3_imu_int_enable(CyBool_t enable);
 #endif  // FIRMWARE_INCLUDE_FX3_BSP_H_
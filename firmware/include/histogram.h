@@ -0,0 +1,62 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#ifndef FIRMWARE_INCLUDE_HISTOGRAM_H_
+#define FIRMWARE_INCLUDE_HISTOGRAM_H_
+
+/* Fixed bucket latency histograms of the video and IMU paths, timed with fx3_ticks().
+ *  FRAME_INTERVAL  frame valid end to the next one, in CyFxGpifCB
+ *  FV_TO_COMMIT    frame valid end to the last buffer of that frame committed
+ *  BUF_LATENCY     buffer committed to the USB consumer event of that buffer
+ *  IMU_INTERVAL    IMU sample to the next one in the Data handle thread
+ *  SENSOR_WAKE     standby released to the trigger pulse in TRIGGER_LOW_POWER
+ *  SUSPEND_ENTRY   USB suspend event to CyU3PSysEnterSuspendMode
+ *  RESUME_FRAME    wake up from suspend to the end of the first frame after it, the last
+ *                  bucket also holds resumes the host did not stream after right away
+ * Bucket i holds [i * width, (i + 1) * width) us, the last one also everything above.
+ * histogram (CY_FX_UVC_XU_HIST_RW GET_CUR)
+ * --------------------------------------------------------------------------
+ * |  byte  |  0  |    1    |   2 - 3  |  4 - 7 |  8 - 11  |  12 - 15 |  16 -  |
+ * --------------------------------------------------------------------------
+ * |  data  |  id | buckets | width us |  count |  min us  |  max us  | counts |
+ * --------------------------------------------------------------------------
+ * counts are HIST_BUCKETS 4 byte bucket counts, everything is MSB first.
+ * SET_CUR byte 0 selects the histogram GET_CUR returns, byte 1 = 1 clears it, or all of
+ * them for id HIST_ALL.
+ */
+#define HIST_BUCKETS          64
+#define HIST_HEADER_LEN       16
+#define HIST_XU_LEN           (HIST_HEADER_LEN + HIST_BUCKETS * 4)
+#define HIST_ALL              0xFF
+
+enum HIST_ID {
+  HIST_FRAME_INTERVAL = 0,    // 4 ms buckets, up to 256 ms for 5 fps and dropped frames
+  HIST_FV_TO_COMMIT   = 1,    // 100 us buckets
+  HIST_BUF_LATENCY    = 2,    // 100 us buckets
+  HIST_IMU_INTERVAL   = 3,    // 100 us buckets
+  HIST_SENSOR_WAKE    = 4,    // 100 us buckets
+  HIST_SUSPEND_ENTRY  = 5,    // 100 us buckets
+  HIST_RESUME_FRAME   = 6,    // 10 ms buckets
+  HIST_COUNT
+};
+
+/* function declaration */
+void hist_add(uint8_t id, uint32_t us);
+void hist_read(uint8_t id, uint8_t *buffer);
+void hist_clear(uint8_t id);
+
+#endif  // FIRMWARE_INCLUDE_HISTOGRAM_H_
@@ -0,0 +1,89 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_KV_STORE_H_
+#define FIRMWARE_INCLUDE_KV_STORE_H_
+
+/* Log structured key-value store in flash sectors 6 and 7.
+ *
+ * One sector is active, records are appended to it and the newest record of a key wins.
+ * When it is full, the live records are copied into the other (erased) sector and its header
+ * is written last, so a power loss during the copy leaves the old sector in charge.
+ * The two sectors take turns, which spreads the erases evenly over both.
+ * sector header
+ * -------------------------------------------
+ * |  byte  |  0 - 3  |   4 - 5   |  6 - 7   |
+ * -------------------------------------------
+ * |  data  |  magic  |  sequence |  crc16   |
+ * -------------------------------------------
+ * record
+ * -----------------------------------------------------
+ * |  byte  |  0  |  1  |     2 - 3     |   4 - 4+len   |
+ * -----------------------------------------------------
+ * |  data  | key | len | crc16 (LSB)   |     value     |
+ * -----------------------------------------------------
+ * crc16 of a record covers key, len and value. len 0 deletes the key, key 0xFF is free space.
+ */
+#define KV_SECTOR_A           6
+#define KV_SECTOR_B           7
+#define KV_MAGIC              0x58504B56  // "XPKV"
+#define KV_HEADER_LEN         8
+#define KV_RECORD_HEADER_LEN  4
+#define KV_KEY_MAX            32
+#define KV_VALUE_MAX          64
+
+enum KV_KEY {
+  KV_KEY_FIRMWARE_FLAG    = 0x01,  // struct firmware_ctl_t, 4 bytes MSB first
+  KV_KEY_IR_CTRL          = 0x02,  // struct IR_ctl_t, 4 bytes MSB first
+  KV_KEY_EXPOSURE_PROFILE = 0x03,  // layout owned by the host
+  KV_KEY_IMU_CONFIG       = 0x04,  // layout owned by the host
+  KV_KEY_FW_UPDATE        = 0x05,  // firmware update journal, see fw_update.h
+  KV_KEY_HOST             = 0x10   // 0x10 - 0x1F are free for host tools
+};
+enum KV_STATUS {
+  KV_OK        = 0,
+  KV_NOT_FOUND = 1,
+  KV_BAD_ARG   = 2,
+  KV_IO_ERROR  = 3,
+  KV_PENDING   = 4    // request queued on the control worker
+};
+
+/* Key-value extension unit
+ * -----------------------------------------------------
+ * |  byte  |  0  |  1  |  2  |    3   |  4 - 4+len    |
+ * -----------------------------------------------------
+ * |  data  | op  | key | len | status |    value      |
+ * -----------------------------------------------------
+ * SET_CUR queues op (enum KV_OP) on the control worker, GET_CUR returns the request with
+ * status and, for KV_OP_GET, len and value filled in. Status stays KV_PENDING until the op
+ * is done, a set that compacts the store takes seconds. Send the next request after that.
+ * Set and delete take the keys owned by the host only, exposure profile, IMU config and
+ * 0x10 - 0x1F, any other key returns KV_BAD_ARG.
+ */
+enum KV_OP {
+  KV_OP_GET    = 0,
+  KV_OP_SET    = 1,
+  KV_OP_DELETE = 2
+};
+#define KV_XU_LEN             (4 + KV_VALUE_MAX)
+
+/* function declaration */
+void kv_init(void);
+uint8_t kv_get(uint8_t key, uint8_t *value, uint8_t *len);
+uint8_t kv_set(uint8_t key, const uint8_t *value, uint8_t len);
+uint8_t kv_delete(uint8_t key);
+
+#endif  // FIRMWARE_INCLUDE_KV_STORE_H_
@@ -0,0 +1,59 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_LZ4_STREAM_H_
+#define FIRMWARE_INCLUDE_LZ4_STREAM_H_
+
+/* Streaming decoder of the LZ4 block format, used for compressed calibration files.
+ *
+ * A block is a list of sequences, each literals followed by a match copied from the output
+ * already produced:
+ * ------------------------------------------------------------------------------
+ * |  data  | token | [lit len] | literals | offset (LSB) | [match len] |
+ * ------------------------------------------------------------------------------
+ * |  byte  |   1   |    0 -    |  lit len |      2       |     0 -     |
+ * ------------------------------------------------------------------------------
+ * token is literal length << 4 | match length - 4, a nibble of 15 is followed by bytes added
+ * to it until one is not 255. The last sequence has no offset or match. The decoder only keeps the
+ * last LZ4_WINDOW output bytes, so the encoder (host_bin/calib_file_test.c) has to keep match
+ * offsets within LZ4_WINDOW, which standard LZ4 decoders do not care about.
+ * Output is produced in pieces of any size, the input is read one byte at a time through a
+ * callback so it does not have to be contiguous in RAM.
+ */
+#define LZ4_WINDOW            4096   // power of 2
+#define LZ4_MIN_MATCH         4
+
+typedef uint8_t (*lz4_input_t)(uint32_t pos);
+
+typedef struct {
+  lz4_input_t input;
+  uint32_t in_pos;
+  uint32_t in_end;
+  uint32_t out_pos;             // bytes produced since lz4_stream_init
+  uint32_t lit_left;            // literals left of the current sequence
+  uint32_t match_left;          // match bytes left of the current sequence
+  uint16_t match_offset;
+  uint8_t match_nibble;         // match length nibble of the token
+  CyBool_t match_pending;       // offset of the current sequence not read yet
+  CyBool_t error;               // malformed block, nothing more is produced
+  uint8_t window[LZ4_WINDOW];
+} lz4_stream_t;
+
+/* function declaration */
+void lz4_stream_init(lz4_stream_t *s, lz4_input_t input, uint32_t in_pos, uint32_t in_len);
+uint32_t lz4_stream_read(lz4_stream_t *s, uint8_t *out, uint32_t len);
+
+#endif  // FIRMWARE_INCLUDE_LZ4_STREAM_H_
@@ -26,10 +26,21 @@
 #define R_AR0141_ADDR_WR  0x30
 #define R_AR0141_ADDR_RD  0x31
 
+struct roi_t;
 extern CyU3PReturnStatus_t AR0141_RegisterWrite(uint8_t HighAddr, uint8_t LowAddr,
                                                 uint8_t HighData, uint8_t LowData);
 extern uint16_t AR0141_RegisterRead(uint8_t HighAddr, uint8_t LowAddr);
+extern CyU3PReturnStatus_t AR0141_SensorRead2B(uint8_t SlaveAddr, uint8_t HighAddr,
+                                               uint8_t LowAddr, uint8_t *buf);
+extern CyU3PReturnStatus_t AR0141_SensorWrite2B(uint8_t SlaveAddr, uint8_t HighAddr,
+                                                uint8_t LowAddr, uint8_t HighData, uint8_t LowData);
 extern void AR0141_sensor_init(void);
 extern void AR0141_stream_start(uint8_t SlaveAddr);
 extern void AR0141_stream_stop(uint8_t SlaveAddr);
+extern uint8_t AR0141_set_timing(uint8_t fps);
+extern void AR0141_roi_default(struct roi_t *roi);
+extern int AR0141_set_roi(struct roi_t *roi);
+extern void AR0141_set_subsample(uint8_t enable, const struct roi_t *roi, uint8_t fps);
+extern void AR0141_set_test_pattern(uint8_t pattern, uint16_t value);
+extern uint8_t ar0141_fps;
 #endif  // FIRMWARE_INCLUDE_SENSOR_AR0141_H_
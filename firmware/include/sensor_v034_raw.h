@@ -40,7 +40,42 @@ typedef unsigned int  uint;
 #define V034_MANUAL_EXPOSURE_MODE      1
 
 #define IMGS_CHIP_ID                   (0x1324)
+
+/* CONTROL_MODE_REG(0x07) bit 15 selects the register context */
+#define V034_CONTEXT_A                 0
+#define V034_CONTEXT_B                 1
+#define V034_CONTEXT_SELECT_B          (0x8000)
+/* Frames between a context write at frame end and the first frame read out in it */
+#define V034_HDR_CONTEXT_LATENCY       1
+/* Metadata value of hdr context when HDR mode is off */
+#define V034_HDR_OFF                   0xFF
+
+/* CONTROL_MODE_REG(0x07) bits 4:3 select the sensor operating mode */
+#define V034_OPERATING_MODE_MASK       (0x0018)
+#define V034_OPERATING_MODE_MASTER     (0x0008)
+#define V034_OPERATING_MODE_SNAPSHOT   (0x0018)
+
+/* READ_MODE row bin [1:0] and column bin [3:2] */
+#define V034_READ_MODE_BIN_MASK        (0x000F)
+#define V034_READ_MODE_BIN2            (0x0005)
+
+/* TEST_DATA enable [13], gray shade [12:11], use test data [10], test data [9:0] */
+#define V034_TEST_PATTERN_ENABLE       (0x2000)
+#define V034_TEST_SHADE_DIAGONAL       (0x1800)
+#define V034_TEST_USE_DATA             (0x0400)
+#define V034_TEST_DATA_MASK            (0x03FF)
+
+/* HDR alternating exposure: context A is short exposure, context B is long exposure */
+struct v034_hdr_t {
+  uint8_t enable;
+  uint16_t short_exposure;  // rows, COARSE_SHUTTER_WIDTH_TOTAL_CONTEXTA
+  uint16_t long_exposure;   // rows, COARSE_SHUTTER_WIDTH_TOTAL_CONTEXTB
+  uint32_t frame_index;     // context switches since stream start
+};
+
+struct roi_t;
 extern uint16_t MT9V034_Parallel[];
+extern struct v034_hdr_t v034_hdr;
 /*****************************************************************************
 **                                          function declaration
 ******************************************************************************/
@@ -65,6 +100,16 @@ void dump_v034_registers(uint8_t SlaveAddr);
 uint16_t V034_RegisterRead(uint8_t HighAddr, uint8_t LowAddr);
 void update_v034_flip_left(void);
 void update_v034_flip_right(void);
+void V034_hdr_config(uint8_t enable, uint16_t short_exposure, uint16_t long_exposure);
+void V034_hdr_stream_start(void);
+void V034_hdr_frame_end(void);
+uint8_t V034_hdr_frame_context(void);
+uint32_t V034_snapshot_min_period_us(uint32_t exposure_us);
+void V034_set_snapshot_mode(uint8_t enable, uint32_t exposure_us);
+void V034_roi_default(struct roi_t *roi);
+int V034_set_roi(struct roi_t *roi);
+void V034_set_binning(uint8_t enable, const struct roi_t *roi, uint8_t fps);
+void V034_set_test_pattern(uint8_t pattern, uint16_t value);
 
 /* Function    : V034_SensorGetBrightness
    Description : Get the current brightness setting from the MT9M114 sensor.
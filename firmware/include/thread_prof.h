@@ -0,0 +1,59 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#ifndef FIRMWARE_INCLUDE_THREAD_PROF_H_
+#define FIRMWARE_INCLUDE_THREAD_PROF_H_
+
+/* Thread profiler.
+ *
+ * A complex GPIO timer on PROF_TIMER_GPIO interrupts PROF_SAMPLE_HZ times a second and the
+ * interrupt counts the thread it interrupted, no thread is idle or another interrupt. The
+ * rate is prime to the 1 ms OS tick so the samples do not lock onto it. run max is the
+ * longest stretch of samples in a row on one thread, the longest the other threads, the
+ * Data handle thread sampling the IMU among them, had to wait. Stacks are filled with
+ * PROF_STACK_FILL before the threads are created, stack used is the depth below which the
+ * fill is untouched.
+ * profile (CY_FX_UVC_XU_PROFILE_RW)
+ * ------------------------------------------------------------------------
+ * |  byte  |   0 - 1   |    2    |  3  |   4 - 7   |   8 - 11  |  12 - 15  |
+ * ------------------------------------------------------------------------
+ * |  data  | sample Hz | threads | rsv |  samples  |    idle   |   other   |
+ * ------------------------------------------------------------------------
+ * then per thread, PROF_THREAD_LEN bytes each in the order they were added
+ * ----------------------------------------------------------------
+ * |  byte  |  0 - 3  |   4 - 5  |    6 - 7   |    8 - 9   | 10 - 11 |
+ * ----------------------------------------------------------------
+ * |  data  | samples |  run max | stack size | stack used |   rsv   |
+ * ----------------------------------------------------------------
+ * other are threads of the FX3 library (USB, DMA, serial drivers). Everything is MSB first.
+ * SET_CUR with byte 0 = 1 clears the sample counters, stack watermarks are kept.
+ */
+#define PROF_SAMPLE_HZ        997
+#define PROF_THREADS          6
+#define PROF_STACK_FILL       0xEF
+#define PROF_HEADER_LEN       16
+#define PROF_THREAD_LEN       12
+#define PROF_LEN              (PROF_HEADER_LEN + PROF_THREADS * PROF_THREAD_LEN)
+
+/* function declaration */
+void prof_thread_add(CyU3PThread *thread, void *stack, uint32_t size);
+void prof_init(void);
+void prof_sample(void);
+void prof_status(uint8_t *buffer);
+void prof_clear(void);
+
+#endif  // FIRMWARE_INCLUDE_THREAD_PROF_H_
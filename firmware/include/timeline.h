@@ -0,0 +1,67 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_TIMELINE_H_
+#define FIRMWARE_INCLUDE_TIMELINE_H_
+
+/* Per frame timeline of the video path, built with make TIMELINE=1 (SENSOR_TIMELINE).
+ * Each point stores fx3_ticks() of the last time it was passed in the current frame, the
+ * frame end moves the record into a RAM ring drained with VB_CMD_TIMELINE_READ and shown
+ * by host_bin/timeline_test. Without SENSOR_TIMELINE the TIMELINE_* macros are empty and
+ * VB_CMD_TIMELINE_READ answers VB_STATUS_BAD_CMD.
+ * record (TIMELINE_READ data, TIMELINE_RECORD_LEN bytes each, oldest first)
+ * --------------------------------------------------------
+ * |  byte  |  0 - 3  |  4 - 5  |  6 - 7  |  8 - 31          |
+ * --------------------------------------------------------
+ * |  data  |  frame  | buffers |   rsv   | ticks of TL_POINT |
+ * --------------------------------------------------------
+ * All fields are MSB first, ticks run at GPIO_FAST_CLK_HZ and 0 is a point not passed.
+ */
+#define TIMELINE_RECORDS      64      // power of 2
+#define TIMELINE_HEADER_LEN   8
+#define TIMELINE_RECORD_LEN   (TIMELINE_HEADER_LEN + TL_POINTS * 4)
+
+/* In the order of a normal frame, keep in sync with host_bin/timeline_test.c. */
+enum TL_POINT {
+  TL_FIRST_COMMIT  = 0,    // first buffer of the frame committed by the UVC thread
+  TL_FRAME_VALID   = 1,    // frame valid end, CyFxGpifCB
+  TL_WRAPUP        = 2,    // partial last buffer wrapped up, CyFxUvcAppCommitEOF
+  TL_LAST_COMMIT   = 3,    // last buffer of the frame committed
+  TL_LAST_CONSUMED = 4,    // USB consumer event of the last buffer, CyFxUvcApplnDmaCallback
+  TL_FRAME_DONE    = 5,    // DMA channel reset and GPIF restarted for the next frame
+  TL_POINTS
+};
+
+#ifdef SENSOR_TIMELINE
+#define TIMELINE_MARK(point)  timeline_mark(point)
+#define TIMELINE_COMMIT()     timeline_commit()
+#define TIMELINE_END(frame)   timeline_end(frame)
+#define TIMELINE_CLEAR()      timeline_clear()
+#else
+#define TIMELINE_MARK(point)  do {} while (0)
+#define TIMELINE_COMMIT()     do {} while (0)
+#define TIMELINE_END(frame)   do {} while (0)
+#define TIMELINE_CLEAR()      do {} while (0)
+#endif
+
+/* function declaration */
+void timeline_mark(uint8_t point);
+void timeline_commit(void);
+void timeline_end(uint32_t frame);
+void timeline_clear(void);
+uint16_t timeline_read(uint8_t *buffer, uint16_t max, uint32_t *lost);
+
+#endif  // FIRMWARE_INCLUDE_TIMELINE_H_
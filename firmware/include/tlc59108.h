@@ -46,6 +46,10 @@
 #define TLC59108_ALLCALLADR 0x11
 #define TLC59108_IREF       0x12
 #define TLC59108_EFLAG      0x13
+// control register auto increment over all registers, for burst access
+#define TLC59108_AI_ALL     0x80
+// Mode1 - LEDOUT1, the state kept over a suspend
+#define TLC59108_SNAPSHOT_LEN  (TLC59108_LEDOUT1 + 1)
 
 // Function Declare
 void tlc59108_init(void);
@@ -60,5 +64,7 @@ void tlc59108_LIMA_open(uint8_t pwm_value);
 void tlc59108_LIMA_ON(void);
 void tlc59108_heptagon_open(uint8_t PWM_value);
 void tlc59108_dump_register(void);
+void tlc59108_suspend(void);
+void tlc59108_resume(void);
 void xpril3_proc_ir_ctl(struct IR_ctl_t* IR_ctrl);
 #endif  // FIRMWARE_INCLUDE_TLC59108_H_
@@ -0,0 +1,65 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#ifndef FIRMWARE_INCLUDE_TRACE_H_
+#define FIRMWARE_INCLUDE_TRACE_H_
+
+#include <stdint.h>  //NOLINT
+
+/* Binary trace ring in RAM for events on the frame and USB paths, where a UART print would
+ * stall the caller for milliseconds. An event is a few word stores with interrupts off, so it
+ * is safe from threads, DMA and GPIF callbacks. The ring is drained with VB_CMD_TRACE_READ
+ * and decoded on the host (host_bin/trace_test), the oldest events are overwritten when the
+ * host does not drain in time.
+ * event (TRACE_READ data, TRACE_EVENT_LEN bytes each, oldest first)
+ * ---------------------------------------------------
+ * |  byte  |  0 - 3  |  4 - 5  |  6 - 7  |  8 - 11  |  12 - 15  |
+ * ---------------------------------------------------
+ * |  data  | time ms |   id    |   seq   |   arg0   |   arg1    |
+ * ---------------------------------------------------
+ * All fields are MSB first, seq counts every event so the host sees the overwritten ones.
+ */
+#define TRACE_EVENTS          256     // power of 2
+#define TRACE_EVENT_LEN       16
+
+/* Event ids, keep in sync with the name table of host_bin/trace_test.c. */
+enum TRACE_EVT {
+  TRACE_BOOT            = 0x0001,  // arg0 sensor_type
+  TRACE_FRAME_END       = 0x0010,  // arg0 frame count, arg1 ms since the last frame
+  TRACE_IR_IMAGE        = 0x0011,  // arg0 frame count
+  TRACE_COMMIT_ERROR    = 0x0012,  // arg0 error code, arg1 buffer count
+  TRACE_COMMIT_EOF_FAIL = 0x0013,  // arg0 GPIF state
+  TRACE_WRAPUP_FAIL     = 0x0014,  // arg0 error code, arg1 socket
+  TRACE_STREAM_START    = 0x0015,
+  TRACE_STREAM_ABORT    = 0x0016,  // arg0 frame count
+  TRACE_WAKE_LATE       = 0x0017,  // arg0 trigger seq, TRIGGER_LOW_POWER pulse came in standby
+  TRACE_IMU_IDLE        = 0x0018,  // arg0 ms since the last stream, IMU read or motion
+  TRACE_IMU_WAKE        = 0x0019,  // arg0 1 on motion, 0 on stream or IMU read, arg1 idle ms
+  TRACE_EP_UNDERRUN     = 0x0020,  // arg0 endpoint, arg1 underrun count
+  TRACE_USB_EVENT       = 0x0021,  // arg0 CyU3PUsbEventType_t, arg1 event data
+  TRACE_LOG_ARGS        = 0x7FFF,  // arguments 3 and up of the TRACE_LOG event before it
+  TRACE_LOG             = 0x8000   // | token, tokenized sensor_* call, arg0 - arg1 arguments
+};
+#define TRACE_LOG_TOKEN_MAX   0x7FFF
+#define TRACE_LOG_ARGS_MAX    8       // arguments of a sensor_* call, see __LOG_NARGS
+
+/* function declaration */
+void trace(uint16_t id, uint32_t arg0, uint32_t arg1);
+void trace_log(uint32_t token, uint8_t nargs, ...);
+uint16_t trace_read(uint8_t *buffer, uint16_t max, uint32_t *lost);
+
+#endif  // FIRMWARE_INCLUDE_TRACE_H_
@@ -62,7 +62,68 @@ enum  SensorType {
   XPIRL3 = 6,
   XPIRL3_A = 7
 };
+/* Frame metadata is embedded at the tail of the first 1280 bytes of every frame, behind the IMU
+   burst area, so it is never overwritten by IMU data and fits the first line of all boards.
+   ------------------------------------------------------------------------------------
+   |Byte location| magic | version | hdr context | frame count | trigger seq | read mode | rsvd |
+   ------------------------------------------------------------------------------------
+   |   Byte num  |   2   |    1    |      1      |  4 (LSB)    |   4 (LSB)   |     1     |  3   |
+   ------------------------------------------------------------------------------------
+   hdr context: 0 -> V034 context A(short exposure), 1 -> context B(long exposure), 0xFF -> off.
+   trigger seq: snapshot trigger pulse of the frame, counted from the first pulse of the master
+                so all units of a sync group agree, 0 when trigger is off or not synced yet.
+   read mode: enum READ_MODE of both eyes.
+ */
+#define FRAME_META_LEN          16
+#define FRAME_META_OFFSET       (640 * 2 - FRAME_META_LEN)
+#define FRAME_META_VERSION      3
+struct frame_meta_t {
+  uint8_t magic[2];         // 'M', 'D'
+  uint8_t version;
+  uint8_t hdr_context;
+  uint8_t frame_count[4];
+  uint8_t trigger_seq[4];
+  uint8_t read_mode;
+  uint8_t reserved[3];
+};
+
+/* Sensor readout window. Both eyes share one line on the 16 bit bus, so the window size is common
+   to both sensors and only the start position can differ per eye.
+ */
+#define ROI_LEFT                0
+#define ROI_RIGHT               1
+#define ROI_MODE_STEREO         0  // right eye uses the left eye window
+#define ROI_MODE_PER_EYE        1
+// the 2x2 binned frame must still hold the IMU and metadata area
+#define ROI_MIN_WIDTH           128
+#define ROI_MIN_HEIGHT          32
+struct roi_t {
+  uint8_t mode;
+  uint16_t width;
+  uint16_t height;
+  uint16_t col_start[2];
+  uint16_t row_start[2];
+  uint8_t fps;              // highest frame rate of the window, derived by the sensor driver
+  uint8_t bin_fps;          // highest frame rate of the 2x2 binned window
+};
+/* Sensor read mode of a stream, selected by the frame index the host commits */
+enum READ_MODE {
+  READ_MODE_NORMAL = 0,
+  READ_MODE_BIN2   = 1,     // MT9V034 2x2 binning
+  READ_MODE_SKIP2  = 2      // AR0141 2x2 skipping, the bayer pattern is kept
+};
+#define FRAME_INDEX_FULL        1
+#define FRAME_INDEX_BINNED      2
+/* Sensor test pattern, every frame is identical so the host can check each byte */
+enum TEST_PATTERN {
+  TEST_PATTERN_OFF      = 0,
+  TEST_PATTERN_FLAT     = 1,  // every pixel holds the test value
+  TEST_PATTERN_GRADIENT = 2   // MT9V034 diagonal shade, AR0141 color bars
+};
+
 extern enum SensorType sensor_type;
+extern struct roi_t sensor_roi;
+extern uint8_t stream_read_mode;
 extern CyU3PEvent    glFxUVCEvent;
 extern struct firmware_ctl_t firmware_ctrl_flag;
 extern volatile CyBool_t IR_image_trigger;
@@ -87,6 +148,14 @@ extern volatile CyBool_t IR_image_trigger;
 #define UVC_APP_EP0_THREAD_PRIORITY    (8)
 // Priority for the Data handle request thread is 10.
 #define UVC_APP_DATA_THREAD_PRIORITY   (8)
+// Stack size for the vendor bulk thread is 2 KB.
+#define VENDOR_BULK_THREAD_STACK       (0x0800)
+// Priority for the vendor bulk thread is 10, flash transfers must not hold off video and EP0.
+#define VENDOR_BULK_THREAD_PRIORITY    (10)
+// Stack size for the control worker thread is 2 KB.
+#define CTRL_WORKER_THREAD_STACK       (0x0800)
+// Priority for the control worker thread is 10, it runs the slow flash work of EP0 requests.
+#define CTRL_WORKER_THREAD_PRIORITY    (10)
 
 /* DMA socket selection for UVC data transfer. */
 // USB Consumer socket 3 is used for video data.
@@ -101,15 +170,23 @@ extern volatile CyBool_t IR_image_trigger;
 #define CY_FX_EP_BULK_VIDEO             (CY_FX_EP_VIDEO_CONS_SOCKET | CY_FX_EP_IN_TYPE)
 // EP 2 IN
 #define CY_FX_EP_CONTROL_STATUS         (CY_FX_EP_CONTROL_STATUS_SOCKET | CY_FX_EP_IN_TYPE)
-// EP 2 OUT
+// EP 4 OUT, vendor bulk commands and data
 #define CY_FX_EP_PRODUCER               0x04
-// EP 2 IN
+// EP 4 IN, vendor bulk status and data
 #define CY_FX_EP_CONSUMER               0x84
 // EP 1 INTR
 #define CY_FX_EP_INTERRUPT              0x81
 #define CY_FX_EP_PRODUCER1_SOCKET        CY_U3P_UIB_SOCKET_PROD_4
 #define CY_FX_EP_CONSUMER2_SOCKET        CY_U3P_UIB_SOCKET_CONS_4
 
+/* Video path bandwidth budget, sensor timing is checked against it */
+// Max GPIF II interface clock in Hz
+#define CY_FX_GPIF_MAX_PCLK             (100000000)
+// GPIF II commits lines to 16 byte aligned DMA buffers, line length in bytes must keep it
+#define CY_FX_GPIF_LINE_ALIGN           (16)
+// Sustained USB 3.0 bulk video throughput in bytes per second with manual DMA and 16 KB buffers
+#define CY_FX_UVC_USB3_BANDWIDTH        (200000000)
+
 /* UVC Video Streaming Endpoint Packet Size */
 #define CY_FX_EP_BULK_VIDEO_PKT_SIZE    (0x400)         // 1024 Bytes
 
@@ -125,6 +202,12 @@ extern volatile CyBool_t IR_image_trigger;
 /* Number of DMA buffers per GPIF DMA thread. */
 #define CY_FX_UVC_STREAM_BUF_COUNT      (4)
 
+/* Number of GPIF DMA threads (producer sockets) of the video channel. */
+#define CY_FX_UVC_STREAM_SCK_COUNT      (2)
+
+/* DMA buffers of the video channel, all producer sockets. */
+#define CY_FX_UVC_STREAM_BUF_TOTAL      (CY_FX_UVC_STREAM_BUF_COUNT * CY_FX_UVC_STREAM_SCK_COUNT)
+
 /* Low Byte - UVC Video Streaming Endpoint Packet Size */
 #define CY_FX_EP_BULK_VIDEO_PKT_SIZE_L  (uint8_t)(CY_FX_EP_BULK_VIDEO_PKT_SIZE & 0x00FF)
 
@@ -161,6 +244,18 @@ extern volatile CyBool_t IR_image_trigger;
 #define CY_FX_UVC_GPIO0_INTR_CB_EVENT_FLAG      (1 << 4)
 #define CY_FX_UVC_GPIO1_INTR_CB_EVENT_FLAG      (1 << 5)
 #define CY_FX_UVC_DEBUG_INTR_CB_EVENT_FLAG      (1 << 6)
+/* Re-enumerate event. Descriptors have changed, e.g. a new ROI frame size, the device must
+   disconnect and connect again so that the host reads them.
+ */
+#define CY_FX_UVC_REENUM_EVENT_FLAG             (1 << 7)
+/* Control job event. A control request handed work to the control worker thread, see
+   ctrl_async.h.
+ */
+#define CY_FX_UVC_CTRL_JOB_EVENT                (1 << 8)
+/* IMU motion event. The IMU, idle in wake on motion mode, detected motion, see IMU_IDLE_MS in
+   extension_unit.h.
+ */
+#define CY_FX_UVC_IMU_MOTION_EVENT              (1 << 9)
 
 /*
    The following constants are taken from the USB and USB Video Class (UVC) specifications.
@@ -288,6 +383,20 @@ extern volatile CyBool_t IR_image_trigger;
 #define CY_FX_UVC_XU_SPLAH_RW                               (uint16_t)(0x1200)
 #define CY_FX_UVC_XU_DEBUG_RW                               (uint16_t)(0x1300)
 #define CY_FX_UVC_XU_CALIB_RW                               (uint16_t)(0x1400)
+#define CY_FX_UVC_XU_HDR_RW                                 (uint16_t)(0x1500)
+#define CY_FX_UVC_XU_TRIGGER_RW                             (uint16_t)(0x1600)
+#define CY_FX_UVC_XU_ROI_RW                                 (uint16_t)(0x1700)
+#define CY_FX_UVC_XU_TEST_PATTERN_RW                        (uint16_t)(0x1800)
+#define CY_FX_UVC_XU_REG_BATCH_RW                           (uint16_t)(0x1900)
+#define CY_FX_UVC_XU_CALIB_INFO_RW                          (uint16_t)(0x1a00)
+#define CY_FX_UVC_XU_KV_RW                                  (uint16_t)(0x1b00)
+#define CY_FX_UVC_XU_DEVICE_INFO_RW                         (uint16_t)(0x1c00)
+#define CY_FX_UVC_XU_CTRL_ASYNC_RW                          (uint16_t)(0x1d00)
+#define CY_FX_UVC_XU_PROFILE_RW                             (uint16_t)(0x1e00)
+#define CY_FX_UVC_XU_HIST_RW                                (uint16_t)(0x1f00)
+#define CY_FX_UVC_XU_DMA_METER_RW                           (uint16_t)(0x2000)
 
 extern void CyFxAppErrorHandler(CyU3PReturnStatus_t apiRetStatus);
+extern void CyFxUVCUpdateProbeCtrl(void);
+extern void imu_keep_awake(void);
 #endif  // FIRMWARE_INCLUDE_UVC_H_
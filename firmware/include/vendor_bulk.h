@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef FIRMWARE_INCLUDE_VENDOR_BULK_H_
+#define FIRMWARE_INCLUDE_VENDOR_BULK_H_
+
+/* Vendor bulk interface (interface 2, EP 4 OUT / EP 4 IN) for transfers too large for EP0.
+ *
+ * The host sends a 16 byte command on EP 4 OUT, the device answers with a 16 byte status
+ * on EP 4 IN, followed by status len bytes of data for INFO, FLASH_READ and REG_DUMP.
+ * FLASH_WRITE data follows the command on EP 4 OUT, the status is sent after programming.
+ * A data phase ends with a short packet, or a zero length packet if its length is a
+ * multiple of the max packet size (512 bytes on USB 2.0, 1024 bytes on USB 3.0).
+ * ------------------------------------------------------------------
+ * |  byte   |  0 - 1  |  2  |    3   |  4 - 7  |  8 - 11  |  12 - 15 |
+ * ------------------------------------------------------------------
+ * | command |  magic  | cmd |  dev   |  addr   |   len    |   tag    |
+ * ------------------------------------------------------------------
+ * | status  |  magic  | cmd | status |  addr   |   len    |   tag    |
+ * ------------------------------------------------------------------
+ * All fields are MSB first, tag is returned as is to match replies with commands.
+ * FLASH_*: addr is a byte address, page aligned for read/write and sector aligned for erase.
+ * REG_DUMP: dev is a REG_BATCH_DEV, addr the first register and len the register count,
+ *           the data is 2 bytes (MSB first) per register.
+ * FW_*: firmware update, see fw_update.h.
+ * TRACE_READ: drain up to len bytes of trace events, see trace.h. The status addr is the
+ *           number of events overwritten since the last read.
+ * TIMELINE_READ: drain up to len bytes of frame timeline records, see timeline.h, the status
+ *           addr is the number of records overwritten. Only in make TIMELINE=1 builds.
+ */
+#define VB_MAGIC              0x5842  // "XB"
+#define VB_HEADER_LEN         16
+#define VB_PROTOCOL_VERSION   1
+
+enum VB_CMD {
+  VB_CMD_INFO          = 0x00,
+  VB_CMD_FLASH_READ    = 0x01,
+  VB_CMD_FLASH_WRITE   = 0x02,
+  VB_CMD_FLASH_ERASE   = 0x03,
+  VB_CMD_REG_DUMP      = 0x04,
+  VB_CMD_FW_BEGIN      = 0x05,
+  VB_CMD_FW_WRITE      = 0x06,
+  VB_CMD_FW_COMMIT     = 0x07,
+  VB_CMD_FW_STATUS     = 0x08,
+  VB_CMD_TRACE_READ    = 0x09,
+  VB_CMD_TIMELINE_READ = 0x0A
+};
+enum VB_STATUS {
+  VB_STATUS_OK       = 0x00,
+  VB_STATUS_BAD_CMD  = 0x01,
+  VB_STATUS_BAD_ARG  = 0x02,
+  VB_STATUS_IO_ERROR = 0x03,
+  VB_STATUS_VERIFY   = 0x04
+};
+
+/* INFO data
+ * ------------------------------------------------------------------------
+ * |  byte  |    0     |      1      |  2 - 3   |    4 - 7   |   8 - 39   |
+ * ------------------------------------------------------------------------
+ * |  data  | protocol | sensor_type | buf size | flash size |  version   |
+ * ------------------------------------------------------------------------
+ */
+#define VB_INFO_LEN           40
+
+// DMA buffers of the vendor bulk channels, multiple of both 512 and 1024 byte packets
+#define VENDOR_BULK_BUF_SIZE  (0x1000)
+#define VENDOR_BULK_BUF_COUNT (2)
+#define VENDOR_BULK_PKT_SIZE  (0x400)
+// USB 3.0 burst length of the vendor bulk endpoints
+#define VENDOR_BULK_BURST     (4)
+// Max wait for the host to send or fetch one DMA buffer in ms
+#define VENDOR_BULK_TIMEOUT   (1000)
+#define VB_REG_DUMP_MAX       (1024)
+
+/* function declaration */
+void vendor_bulk_init(void);
+void vendor_bulk_reset(void);
+void Vendor_Bulk_Thread_Entry(uint32_t input);
+
+#endif  // FIRMWARE_INCLUDE_VENDOR_BULK_H_
@@ -0,0 +1,382 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <cyu3os.h>
+#include <cyu3error.h>
+#include <cyu3utils.h>
+#include "include/debug.h"
+#include "include/uvc.h"
+#include "include/extension_unit.h"
+#include "include/kv_store.h"
+
+#define KV_FREE_KEY     0xFF
+#define KV_WINDOW_PAGES 2   // a record of KV_VALUE_MAX bytes spans at most two pages
+
+/* RAM index of the active sector, rebuilt by kv_init and after every compaction.
+ * offset[key] is the sector offset of the newest record of key, 0 if it has none. */
+static struct {
+  uint8_t sector;
+  uint16_t seq;
+  uint32_t tail;            // first free byte of the active sector
+  uint16_t offset[KV_KEY_MAX];
+  CyBool_t dirty;           // a torn record ends the log, compact before the next append
+  CyBool_t ready;
+} kv;
+
+/* Page window for scans and reads, and one for programming. Both belong to glSpiLock. */
+static uint8_t kv_window[KV_WINDOW_PAGES * SPI_FLASH_PAGE_SIZE];
+static int32_t kv_window_page = -1;
+static uint8_t kv_prog[KV_WINDOW_PAGES * SPI_FLASH_PAGE_SIZE];
+
+/**
+ *  @brief      copy bytes of a kv sector, through the page window.
+ *  @param[in]  sector  flash sector.
+ *  @param[in]  offset  byte offset in the sector.
+ *  @param[out] data    destination.
+ *  @param[in]  len     bytes, at most SPI_FLASH_PAGE_SIZE.
+ *  @return     CY_U3P_SUCCESS if successful.
+ */
+static CyU3PReturnStatus_t kv_read(uint8_t sector, uint32_t offset, uint8_t *data, uint16_t len) {
+  int32_t page = (sector * SPI_FLASH_SECTOR_SIZE + offset) / SPI_FLASH_PAGE_SIZE;
+  uint32_t end = (sector * SPI_FLASH_SECTOR_SIZE + offset + len + SPI_FLASH_PAGE_SIZE - 1) /
+                 SPI_FLASH_PAGE_SIZE;
+  CyU3PReturnStatus_t status;
+
+  if (kv_window_page < 0 || page < kv_window_page || end > kv_window_page + KV_WINDOW_PAGES) {
+    kv_window_page = -1;
+    status = CyFxFlashProgSpiTransfer(page, sizeof(kv_window), kv_window, CyTrue);
+    if (status != CY_U3P_SUCCESS)
+      return status;
+    kv_window_page = page;
+  }
+  CyU3PMemCopy(data, &kv_window[(page - kv_window_page) * SPI_FLASH_PAGE_SIZE +
+                                offset % SPI_FLASH_PAGE_SIZE], len);
+  return CY_U3P_SUCCESS;
+}
+
+/**
+ *  @brief      program bytes into erased space of a kv sector.
+ *  @param[in]  sector  flash sector.
+ *  @param[in]  offset  byte offset in the sector.
+ *  @param[in]  data    source.
+ *  @param[in]  len     bytes, at most SPI_FLASH_PAGE_SIZE.
+ *  @return     CY_U3P_SUCCESS if successful.
+ */
+static CyU3PReturnStatus_t kv_program(uint8_t sector, uint32_t offset, const uint8_t *data,
+                                      uint16_t len) {
+  uint16_t page = (sector * SPI_FLASH_SECTOR_SIZE + offset) / SPI_FLASH_PAGE_SIZE;
+  uint16_t pages = (offset % SPI_FLASH_PAGE_SIZE + len + SPI_FLASH_PAGE_SIZE - 1) /
+                   SPI_FLASH_PAGE_SIZE;
+
+  /* Programming 0xFF leaves a NOR cell as it is, so the rest of the pages stays untouched. */
+  CyU3PMemSet(kv_prog, 0xFF, pages * SPI_FLASH_PAGE_SIZE);
+  CyU3PMemCopy(&kv_prog[offset % SPI_FLASH_PAGE_SIZE], (uint8_t *)data, len);
+  kv_window_page = -1;
+  return CyFxFlashProgSpiTransfer(page, pages * SPI_FLASH_PAGE_SIZE, kv_prog, CyFalse);
+}
+
+/**
+ *  @brief      read and check the header of a kv sector.
+ *  @param[in]  sector  flash sector.
+ *  @param[out] seq     sequence number of the sector.
+ *  @return     CyTrue if the sector holds a store.
+ */
+static CyBool_t kv_header_valid(uint8_t sector, uint16_t *seq) {
+  uint8_t header[KV_HEADER_LEN];
+  uint16_t crc;
+
+  if (kv_read(sector, 0, header, KV_HEADER_LEN) != CY_U3P_SUCCESS)
+    return CyFalse;
+  crc = flash_crc16(header, KV_HEADER_LEN - 2);
+  if (header[0] != (KV_MAGIC >> 24) || header[1] != ((KV_MAGIC >> 16) & 0xFF) ||
+      header[2] != ((KV_MAGIC >> 8) & 0xFF) || header[3] != (KV_MAGIC & 0xFF) ||
+      header[6] != (crc & 0xFF) || header[7] != (crc >> 8))
+    return CyFalse;
+  *seq = header[4] << 8 | header[5];
+  return CyTrue;
+}
+
+/**
+ *  @brief      write the header that makes an erased sector the active one.
+ *  @param[in]  sector  flash sector.
+ *  @param[in]  seq     sequence number, one above the previous active sector.
+ *  @return     CY_U3P_SUCCESS if successful.
+ */
+static CyU3PReturnStatus_t kv_header_write(uint8_t sector, uint16_t seq) {
+  uint8_t header[KV_HEADER_LEN];
+  uint16_t crc;
+
+  header[0] = KV_MAGIC >> 24;
+  header[1] = (KV_MAGIC >> 16) & 0xFF;
+  header[2] = (KV_MAGIC >> 8) & 0xFF;
+  header[3] = KV_MAGIC & 0xFF;
+  header[4] = seq >> 8;
+  header[5] = seq & 0xFF;
+  crc = flash_crc16(header, KV_HEADER_LEN - 2);
+  header[6] = crc & 0xFF;
+  header[7] = crc >> 8;
+  return kv_program(sector, 0, header, KV_HEADER_LEN);
+}
+
+/**
+ *  @brief      read one record of the active sector and check it.
+ *  @param[in]  sector  flash sector.
+ *  @param[in]  offset  byte offset of the record.
+ *  @param[out] record  KV_RECORD_HEADER_LEN + KV_VALUE_MAX bytes.
+ *  @return     KV_OK, KV_NOT_FOUND for free space or KV_IO_ERROR for a broken record.
+ */
+static uint8_t kv_record_read(uint8_t sector, uint32_t offset, uint8_t *record) {
+  uint16_t crc;
+
+  if (offset + KV_RECORD_HEADER_LEN > SPI_FLASH_SECTOR_SIZE)
+    return KV_NOT_FOUND;
+  if (kv_read(sector, offset, record, KV_RECORD_HEADER_LEN) != CY_U3P_SUCCESS)
+    return KV_IO_ERROR;
+  if (record[0] == KV_FREE_KEY)
+    return KV_NOT_FOUND;
+  if (record[0] >= KV_KEY_MAX || record[1] > KV_VALUE_MAX ||
+      offset + KV_RECORD_HEADER_LEN + record[1] > SPI_FLASH_SECTOR_SIZE)
+    return KV_IO_ERROR;
+  if (record[1] && kv_read(sector, offset + KV_RECORD_HEADER_LEN, &record[KV_RECORD_HEADER_LEN],
+                           record[1]) != CY_U3P_SUCCESS)
+    return KV_IO_ERROR;
+  /* CRC covers key and len, then the value, skipping the CRC field itself. */
+  crc = record[2] | record[3] << 8;
+  record[2] = record[0];
+  record[3] = record[1];
+  if (flash_crc16(&record[2], record[1] + 2) != crc)
+    return KV_IO_ERROR;
+  record[2] = crc & 0xFF;
+  record[3] = crc >> 8;
+  return KV_OK;
+}
+
+/**
+ *  @brief      rebuild the RAM index from the log of the active sector.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+static void kv_scan(void) {
+  uint8_t record[KV_RECORD_HEADER_LEN + KV_VALUE_MAX];
+  uint32_t offset = KV_HEADER_LEN;
+  uint8_t status;
+
+  CyU3PMemSet((uint8_t *)kv.offset, 0, sizeof(kv.offset));
+  kv.dirty = CyFalse;
+  while ((status = kv_record_read(kv.sector, offset, record)) == KV_OK) {
+    kv.offset[record[0]] = record[1] ? offset : 0;
+    offset += KV_RECORD_HEADER_LEN + record[1];
+  }
+  if (status == KV_IO_ERROR) {
+    sensor_err("kv: broken record at 0x%x of sector %d\r\n", offset, kv.sector);
+    kv.dirty = CyTrue;
+  }
+  kv.tail = offset;
+}
+
+/**
+ *  @brief      copy the live records into the spare sector and make it the active one.
+ *  @param[out] NULL.
+ *  @return     KV_STATUS.
+ */
+static uint8_t kv_compact(void) {
+  uint8_t record[KV_RECORD_HEADER_LEN + KV_VALUE_MAX];
+  uint16_t offset[KV_KEY_MAX];
+  uint8_t spare = kv.sector == KV_SECTOR_A ? KV_SECTOR_B : KV_SECTOR_A;
+  uint32_t tail = KV_HEADER_LEN;
+  uint8_t key, len;
+
+  sensor_info("kv: compact sector %d into %d\r\n", kv.sector, spare);
+  if (CyFxFlashProgEraseSectorWait(spare) != CY_U3P_SUCCESS)
+    return KV_IO_ERROR;
+  kv_window_page = -1;
+  for (key = 0; key < KV_KEY_MAX; key++) {
+    offset[key] = 0;
+    if (!kv.offset[key])
+      continue;
+    /* A record that went bad since the scan is dropped rather than copied. */
+    if (kv_record_read(kv.sector, kv.offset[key], record) != KV_OK)
+      continue;
+    len = KV_RECORD_HEADER_LEN + record[1];
+    if (kv_program(spare, tail, record, len) != CY_U3P_SUCCESS)
+      return KV_IO_ERROR;
+    offset[key] = tail;
+    tail += len;
+  }
+  /* The header goes last, until then the old sector stays active. */
+  if (kv_header_write(spare, kv.seq + 1) != CY_U3P_SUCCESS)
+    return KV_IO_ERROR;
+  kv.sector = spare;
+  kv.seq++;
+  kv.tail = tail;
+  kv.dirty = CyFalse;
+  CyU3PMemCopy((uint8_t *)kv.offset, (uint8_t *)offset, sizeof(offset));
+  return KV_OK;
+}
+
+/**
+ *  @brief      append a record to the active sector, compacting first if needed.
+ *  @param[in]  key     key.
+ *  @param[in]  value   value.
+ *  @param[in]  len     value length, 0 deletes the key.
+ *  @return     KV_STATUS.
+ */
+static uint8_t kv_append(uint8_t key, const uint8_t *value, uint8_t len) {
+  uint8_t record[KV_RECORD_HEADER_LEN + KV_VALUE_MAX];
+  uint16_t crc;
+  uint8_t status;
+
+  if (kv.dirty || kv.tail + KV_RECORD_HEADER_LEN + len > SPI_FLASH_SECTOR_SIZE) {
+    status = kv_compact();
+    if (status != KV_OK)
+      return status;
+    if (kv.tail + KV_RECORD_HEADER_LEN + len > SPI_FLASH_SECTOR_SIZE)
+      return KV_IO_ERROR;
+  }
+  record[2] = key;
+  record[3] = len;
+  if (len)
+    CyU3PMemCopy(&record[KV_RECORD_HEADER_LEN], (uint8_t *)value, len);
+  crc = flash_crc16(&record[2], len + 2);
+  record[0] = key;
+  record[1] = len;
+  record[2] = crc & 0xFF;
+  record[3] = crc >> 8;
+  if (kv_program(kv.sector, kv.tail, record, KV_RECORD_HEADER_LEN + len) != CY_U3P_SUCCESS) {
+    /* Whatever got programmed ends the log now, move on to the spare sector next time. */
+    kv.dirty = CyTrue;
+    return KV_IO_ERROR;
+  }
+  kv.offset[key] = len ? kv.tail : 0;
+  kv.tail += KV_RECORD_HEADER_LEN + len;
+  return KV_OK;
+}
+
+/**
+ *  @brief      find the active sector and index its records, formats sector 6 on first use.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void kv_init(void) {
+  uint16_t seq_a, seq_b;
+  CyBool_t valid_a, valid_b;
+
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  kv.ready = CyFalse;
+  kv_window_page = -1;
+  valid_a = kv_header_valid(KV_SECTOR_A, &seq_a);
+  valid_b = kv_header_valid(KV_SECTOR_B, &seq_b);
+  if (valid_a && valid_b) {
+    // Both are valid after a compaction, the newer one won, sequence numbers may wrap
+    kv.sector = (int16_t)(seq_b - seq_a) > 0 ? KV_SECTOR_B : KV_SECTOR_A;
+    kv.seq = kv.sector == KV_SECTOR_A ? seq_a : seq_b;
+  } else if (valid_a || valid_b) {
+    kv.sector = valid_a ? KV_SECTOR_A : KV_SECTOR_B;
+    kv.seq = valid_a ? seq_a : seq_b;
+  } else {
+    sensor_info("kv: no store found, format sector %d\r\n", KV_SECTOR_A);
+    kv.sector = KV_SECTOR_A;
+    kv.seq = 0;
+    if (CyFxFlashProgEraseSectorWait(KV_SECTOR_A) != CY_U3P_SUCCESS ||
+        kv_header_write(KV_SECTOR_A, 0) != CY_U3P_SUCCESS) {
+      sensor_err("kv: format failed\r\n");
+      CyU3PMutexPut(&glSpiLock);
+      return;
+    }
+  }
+  kv_scan();
+  kv.ready = CyTrue;
+  sensor_info("kv: sector %d seq %d, %d bytes used\r\n", kv.sector, kv.seq, kv.tail);
+  CyU3PMutexPut(&glSpiLock);
+}
+
+/**
+ *  @brief      read the value of a key.
+ *  @param[in]  key     key.
+ *  @param[out] value   KV_VALUE_MAX bytes.
+ *  @param[out] len     value length.
+ *  @return     KV_STATUS.
+ */
+uint8_t kv_get(uint8_t key, uint8_t *value, uint8_t *len) {
+  uint8_t record[KV_RECORD_HEADER_LEN + KV_VALUE_MAX];
+  uint8_t status;
+
+  if (key >= KV_KEY_MAX)
+    return KV_BAD_ARG;
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  if (!kv.ready)
+    status = KV_IO_ERROR;
+  else if (!kv.offset[key])
+    status = KV_NOT_FOUND;
+  else
+    status = kv_record_read(kv.sector, kv.offset[key], record);
+  CyU3PMutexPut(&glSpiLock);
+  if (status != KV_OK)
+    return status;
+  *len = record[1];
+  CyU3PMemCopy(value, &record[KV_RECORD_HEADER_LEN], record[1]);
+  return KV_OK;
+}
+
+/**
+ *  @brief      store the value of a key, nothing is written if it did not change.
+ *  @param[in]  key     key.
+ *  @param[in]  value   value.
+ *  @param[in]  len     1 to KV_VALUE_MAX bytes.
+ *  @return     KV_STATUS.
+ */
+uint8_t kv_set(uint8_t key, const uint8_t *value, uint8_t len) {
+  uint8_t record[KV_RECORD_HEADER_LEN + KV_VALUE_MAX];
+  uint8_t status;
+
+  if (key >= KV_KEY_MAX || len == 0 || len > KV_VALUE_MAX)
+    return KV_BAD_ARG;
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  if (!kv.ready) {
+    status = KV_IO_ERROR;
+  } else if (kv.offset[key] && kv_record_read(kv.sector, kv.offset[key], record) == KV_OK &&
+             record[1] == len &&
+             !CyU3PMemCmp(&record[KV_RECORD_HEADER_LEN], (uint8_t *)value, len)) {
+    status = KV_OK;
+  } else {
+    status = kv_append(key, value, len);
+  }
+  CyU3PMutexPut(&glSpiLock);
+  if (status != KV_OK)
+    sensor_err("kv: set key %d failed: %d\r\n", key, status);
+  return status;
+}
+
+/**
+ *  @brief      delete a key.
+ *  @param[in]  key     key.
+ *  @return     KV_STATUS.
+ */
+uint8_t kv_delete(uint8_t key) {
+  uint8_t status;
+
+  if (key >= KV_KEY_MAX)
+    return KV_BAD_ARG;
+  CyU3PMutexGet(&glSpiLock, CYU3P_WAIT_FOREVER);
+  if (!kv.ready)
+    status = KV_IO_ERROR;
+  else if (!kv.offset[key])
+    status = KV_NOT_FOUND;
+  else
+    status = kv_append(key, NULL, 0);
+  CyU3PMutexPut(&glSpiLock);
+  return status;
+}
@@ -0,0 +1,116 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <cyu3types.h>
+#include "include/lz4_stream.h"
+
+/**
+ *  @brief      start decoding a block.
+ *  @param[out] s       decoder.
+ *  @param[in]  input   returns the input byte at pos.
+ *  @param[in]  in_pos  first byte of the block.
+ *  @param[in]  in_len  block length.
+ *  @return     NULL.
+ */
+void lz4_stream_init(lz4_stream_t *s, lz4_input_t input, uint32_t in_pos, uint32_t in_len) {
+  s->input = input;
+  s->in_pos = in_pos;
+  s->in_end = in_pos + in_len;
+  s->out_pos = 0;
+  s->lit_left = 0;
+  s->match_left = 0;
+  s->match_offset = 0;
+  s->match_nibble = 0;
+  s->match_pending = CyFalse;
+  s->error = CyFalse;
+}
+
+/**
+ *  @brief      read the rest of a length, a nibble of 15 goes on in the next bytes.
+ *  @param[in]  s       decoder.
+ *  @param[in]  len     length nibble.
+ *  @return     length, error is set if the block ends in the middle.
+ */
+static uint32_t lz4_length(lz4_stream_t *s, uint32_t len) {
+  uint8_t b;
+
+  if (len != 15)
+    return len;
+  do {
+    if (s->in_pos >= s->in_end) {
+      s->error = CyTrue;
+      return 0;
+    }
+    b = s->input(s->in_pos++);
+    len += b;
+  } while (b == 255);
+  return len;
+}
+
+/**
+ *  @brief      produce the next output bytes of the block.
+ *  @param[in]  s       decoder.
+ *  @param[out] out     len bytes, NULL to skip them.
+ *  @param[in]  len     bytes wanted.
+ *  @return     bytes produced, less than len at the end of the block or on error.
+ */
+uint32_t lz4_stream_read(lz4_stream_t *s, uint8_t *out, uint32_t len) {
+  uint32_t n = 0;
+  uint8_t b, token;
+
+  while (n < len && !s->error) {
+    if (s->lit_left) {
+      // literals were checked against in_end with the token
+      b = s->input(s->in_pos++);
+      s->lit_left--;
+    } else if (s->match_left) {
+      b = s->window[(s->out_pos - s->match_offset) & (LZ4_WINDOW - 1)];
+      s->match_left--;
+    } else if (s->match_pending) {
+      s->match_pending = CyFalse;
+      if (s->in_pos == s->in_end)
+        break;
+      if (s->in_end - s->in_pos < 2) {
+        s->error = CyTrue;
+        break;
+      }
+      s->match_offset = s->input(s->in_pos) | (s->input(s->in_pos + 1) << 8);
+      s->in_pos += 2;
+      if (s->match_offset == 0 || s->match_offset > LZ4_WINDOW || s->match_offset > s->out_pos) {
+        s->error = CyTrue;
+        break;
+      }
+      s->match_left = lz4_length(s, s->match_nibble) + LZ4_MIN_MATCH;
+      continue;
+    } else {
+      if (s->in_pos >= s->in_end)
+        break;
+      token = s->input(s->in_pos++);
+      s->lit_left = lz4_length(s, token >> 4);
+      if (s->lit_left > s->in_end - s->in_pos)
+        s->error = CyTrue;
+      s->match_nibble = token & 0x0F;
+      s->match_pending = CyTrue;
+      continue;
+    }
+    s->window[s->out_pos & (LZ4_WINDOW - 1)] = b;
+    s->out_pos++;
+    if (out != NULL)
+      out[n] = b;
+    n++;
+  }
+  return n;
+}
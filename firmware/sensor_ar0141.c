@@ -26,20 +26,30 @@
 #include "include/sensor_v034_raw.h"
 #include "include/debug.h"
 #include "include/fx3_bsp.h"
+#include "include/uvc.h"
 // AR0141 register address map
 // Frame rate Fps = 1/Tframe
 // Tframe = 1 /(CLK_PIX) * [frame_length_lines * line_length_pck + extra_delay]
 // Minimumframe_length_lines = (y_addr_end - y_addr_start + 1) /
 //                             ((y_odd_inc + 1) / 2) + min_vertical_blanking
-// TODO(zhoury): max frame rate is 23Hz at 27MHz
-#define CLK_PIX            27000000
-#define FRAME_FPS          25
-#define FRAME_LENGTH_LINES 750    // defalut: 750(0x02EE)  0x00E2=226 0x05DC=1500
-#define EXTRA_DELAY        0
-#define LINE_LENGTH_PCK    ((CLK_PIX / FRAME_FPS -  EXTRA_DELAY)/ FRAME_LENGTH_LINES)
-
-// Exposure/Integration register
-#define COARSE_INTEGRATION_TIME       300  // default:16(0X0010)
+// CLK_PIX = EXTCLK / pre_pll_clk_div * pll_multiplier / (vt_sys_clk_div * vt_pix_clk_div)
+// CLK_OP = EXTCLK / pre_pll_clk_div * pll_multiplier / (op_sys_clk_div * op_pix_clk_div)
+#define AR0141_EXTCLK                 27000000
+#define AR0141_MAX_CLK_PIX            74250000
+// sensor stretches shorter lines: max frame rate was 23Hz at 27MHz with 750 lines
+#define AR0141_MIN_LINE_LENGTH_PCK    1566
+#define AR0141_MIN_V_BLANK            30
+/* TEST_PATTERN_MODE values */
+#define AR0141_TEST_PATTERN_OFF       0
+#define AR0141_TEST_PATTERN_SOLID     1
+#define AR0141_TEST_PATTERN_BARS      2
+#define AR0141_MIN_FRAME_LENGTH_LINES (AR0141_IMG_HEIGHT + AR0141_MIN_V_BLANK)  // 750(0x02EE)
+#define AR0141_FRAME_FPS              30
+#define EXTRA_DELAY                   0
+
+// Exposure/Integration register, coarse integration rows are derived from the time
+#define INTEGRATION_TIME_US           16000
+#define COARSE_INTEGRATION_TIME       300  // replaced by AR0141_set_timing, default:16(0X0010)
 #define FINE_INTEGRATION_TIME         0       // default:0
 
 #define FLASH_CONTROL         0x0038
@@ -289,11 +299,13 @@ uint16_t AR0141_Parallel_seq[] = {
 
 uint16_t AR0141_Parallel_init[] = {
   0x301A, 0x10D8,  // RESET_REGISTER = 4312
-  0x302A, 0x0009,  // VT_PIX_CLK_DIV = 6       default: 6    Range: 4-16
+  // PLL and frame timing are patched from ar0141_timing_profiles[] by AR0141_set_timing(),
+  // the values below are the 23 fps profile
+  0x302A, 0x0009,  // VT_PIX_CLK_DIV = 9       default: 6    Range: 4-16
   0x302C, 0x0001,  // VT_SYS_CLK_DIV = 1       Range: 1,2,4,6,8,10,11,12,14,16
   0x302E, 0x0003,  // PRE_PLL_CLK_DIV = 3      default: 4 Range: 1-64
   0x3030, 0x001B,  // PLL_MULTIPLIER = 27      default: 66 Range: 32-384
-  0x3036, 0x000C,  // OP_PIX_CLK_DIV = 12
+  0x3036, 0x000C,  // OP_PIX_CLK_DIV = 12      bits per pixel of DATA_FORMAT_BITS
   0x3038, 0x0002,  // OP_SYS_CLK_DIV = 2
 
   0x31AC, 0x0C0C,  // DATA_FORMAT_BITS = 3084
@@ -304,8 +316,8 @@ uint16_t AR0141_Parallel_init[] = {
   0x3004, AR0141_X_ADDR_START,  // X_ADDR_START  default: 18(0x0012)
   0x3006, AR0141_Y_ADDR_END,    // Y_ADDR_END    defalut: 791(0x0317)  0x01DF=479 0x02CF=719
   0x3008, AR0141_X_ADDR_END,    // X_ADDR_END    defalut: 1305(0x0519) 0x027F=639 0x04FF=1279
-  0x300A, FRAME_LENGTH_LINES,  // FRAME_LENGTH_LINES
-  0x300C, LINE_LENGTH_PCK,  // LINE_LENGTH_PCK
+  0x300A, AR0141_MIN_FRAME_LENGTH_LINES,  // FRAME_LENGTH_LINES
+  0x300C, AR0141_MIN_LINE_LENGTH_PCK,     // LINE_LENGTH_PCK
   0x3042, EXTRA_DELAY,  // EXTRA_DELAY
 
   0x3012, COARSE_INTEGRATION_TIME,  // COARSE_INTEGRATION_TIME
@@ -341,6 +353,28 @@ uint16_t AR0141_Parallel_init[] = {
   0x301A, 0x10D8   // RESET_REGISTER = 4316
 };
 
+/* PLL profiles, frame length and line length are derived from the frame rate. The output
+ * clock CLK_OP = VCO / (op_sys_clk_div * op_pix_clk_div) must not run ahead of CLK_PIX, and
+ * op_pix_clk_div is the 12 bits per pixel of DATA_FORMAT_BITS. */
+struct ar0141_timing_t {
+  uint8_t fps;
+  uint16_t pre_pll_clk_div;
+  uint16_t pll_multiplier;
+  uint16_t vt_sys_clk_div;
+  uint16_t vt_pix_clk_div;
+  uint16_t op_sys_clk_div;
+  uint16_t op_pix_clk_div;
+};
+
+// sorted by fps, highest first
+static const struct ar0141_timing_t ar0141_timing_profiles[] = {
+  {60, 3, 66, 1, 8, 2, 12},   // VCO 594MHz, CLK_PIX 74.25MHz, CLK_OP 24.75MHz
+  {45, 3, 54, 1, 8, 2, 12},   // VCO 486MHz, CLK_PIX 60.75MHz, CLK_OP 20.25MHz
+  {30, 3, 54, 1, 12, 2, 12},  // VCO 486MHz, CLK_PIX 40.5MHz, CLK_OP 20.25MHz
+  {23, 3, 27, 1, 9, 2, 12},   // VCO 243MHz, CLK_PIX 27MHz, CLK_OP 10.125MHz, the original setting
+};
+uint8_t ar0141_fps = 0;
+
 CyU3PReturnStatus_t AR0141_SensorRead2B(uint8_t SlaveAddr, uint8_t HighAddr,
                                       uint8_t LowAddr, uint8_t *buf) {
   CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
@@ -356,12 +390,14 @@ CyU3PReturnStatus_t AR0141_SensorRead2B(uint8_t SlaveAddr, uint8_t HighAddr,
   preamble.buffer[2] = LowAddr;
   preamble.buffer[3] = SlaveAddr;
   preamble.ctrlMask  = 0x0004;
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
   apiRetStatus = CyU3PI2cReceiveBytes(&preamble, buf, 2, 0);
   if (apiRetStatus == CY_U3P_SUCCESS) {
     V034_delay(800);
   } else {
     sensor_err("R2B I2C read error\r\n");
   }
+  CyU3PMutexPut(&glSensorLock);
   return apiRetStatus;
 }
 
@@ -382,6 +418,7 @@ CyU3PReturnStatus_t AR0141_SensorWrite2B(uint8_t SlaveAddr, uint8_t HighAddr,
   preamble.ctrlMask = 0x0000;
   Buf[0] = HighData;
   Buf[1] = LowData;
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
   apiRetStatus = CyU3PI2cTransmitBytes(&preamble, Buf, 2, 0);
   if (apiRetStatus == CY_U3P_SUCCESS) {
     V034_delay(800);  /* known issue for SDK I2C */
@@ -389,6 +426,7 @@ CyU3PReturnStatus_t AR0141_SensorWrite2B(uint8_t SlaveAddr, uint8_t HighAddr,
     sensor_err("W2B I2C write error, reg addr: 0x%x, reg value: 0x%x\r\n", HighAddr << 8 | LowAddr,
               HighData << 8 | LowData);
   }
+  CyU3PMutexPut(&glSensorLock);
   return apiRetStatus;
 }
 
@@ -561,7 +599,321 @@ void AR0141_stream_stop(uint8_t SlaveAddr) {
   AR0141_SensorWrite2B(SlaveAddr, AddrH, AddrL, ValH, ValL);
 }
 
+/**
+ *  @brief      update a register value of AR0141 init table.
+ *  @param[in]  addr    register address.
+ *  @param[in]  value   register value.
+ *  @return     NULL.
+ */
+static void AR0141_update_init_reg(uint16_t addr, uint16_t value) {
+  int j;
+
+  for (j = 0; j < sizeof(AR0141_Parallel_init) / sizeof(uint16_t); j = j + 2) {
+    if (AR0141_Parallel_init[j] == addr) {
+      AR0141_Parallel_init[j + 1] = value;
+    }
+  }
+}
+
+/**
+ *  @brief      get a register value of AR0141 init table.
+ *  @param[in]  addr    register address.
+ *  @return     register value, 0 if the register is not in the table.
+ */
+static uint16_t AR0141_init_reg(uint16_t addr) {
+  int j;
+
+  for (j = 0; j < sizeof(AR0141_Parallel_init) / sizeof(uint16_t); j = j + 2) {
+    if (AR0141_Parallel_init[j] == addr)
+      return AR0141_Parallel_init[j + 1];
+  }
+  return 0;
+}
+
+/**
+ *  @brief      get CLK_PIX of the PLL profile selected by AR0141_set_timing.
+ *  @param[out] NULL.
+ *  @return     CLK_PIX in Hz, 0 if no profile is selected.
+ */
+static uint32_t AR0141_clk_pix(void) {
+  const struct ar0141_timing_t *profile;
+  int i;
+
+  for (i = 0; i < sizeof(ar0141_timing_profiles) / sizeof(ar0141_timing_profiles[0]); i++) {
+    profile = &ar0141_timing_profiles[i];
+    if (profile->fps == ar0141_fps)
+      return AR0141_EXTCLK / profile->pre_pll_clk_div * profile->pll_multiplier /
+             (profile->vt_sys_clk_div * profile->vt_pix_clk_div);
+  }
+  return 0;
+}
+
+/**
+ *  @brief      get the frame rate of a window read out with 2x2 skipping.
+ *  @param[in]  clk_pix     CLK_PIX in Hz.
+ *  @param[in]  height      window height before skipping.
+ *  @return     frame rate, clamped to 255.
+ */
+static uint8_t AR0141_skip_fps(uint32_t clk_pix, uint16_t height) {
+  uint32_t fps = clk_pix / (AR0141_MIN_LINE_LENGTH_PCK * (height / 2 + AR0141_MIN_V_BLANK));
+
+  return fps > 0xFF ? 0xFF : fps;
+}
+
+/**
+ *  @brief      derive frame timing of a PLL profile and check it against the sensor,
+ *              GPIF and USB 3.0 bandwidth limits of 1280x720 stereo.
+ *  @param[in]  profile               PLL profile.
+ *  @param[out] frame_length_lines    FRAME_LENGTH_LINES value.
+ *  @param[out] line_length_pck       LINE_LENGTH_PCK value.
+ *  @return     0 if successful.
+ */
+static int AR0141_timing_calc(const struct ar0141_timing_t *profile,
+                              uint32_t *frame_length_lines, uint32_t *line_length_pck) {
+  uint32_t clk_pix, clk_op;
+  uint32_t line_bytes_per_sec;
+
+  clk_pix = AR0141_EXTCLK / profile->pre_pll_clk_div * profile->pll_multiplier /
+            (profile->vt_sys_clk_div * profile->vt_pix_clk_div);
+  if (clk_pix > AR0141_MAX_CLK_PIX || clk_pix > CY_FX_GPIF_MAX_PCLK) {
+    sensor_err("%d fps: CLK_PIX %d is over range\r\n", profile->fps, clk_pix);
+    return -1;
+  }
+  clk_op = AR0141_EXTCLK / profile->pre_pll_clk_div * profile->pll_multiplier /
+           (profile->op_sys_clk_div * profile->op_pix_clk_div);
+  if (clk_op > clk_pix) {
+    sensor_err("%d fps: CLK_OP %d is above CLK_PIX %d\r\n", profile->fps, clk_op, clk_pix);
+    return -1;
+  }
+  // keep the shortest line for the least rolling shutter skew, stretch blanking for frame rate
+  *line_length_pck = AR0141_MIN_LINE_LENGTH_PCK;
+  *frame_length_lines = (clk_pix / profile->fps - EXTRA_DELAY) / *line_length_pck;
+  if (*frame_length_lines < AR0141_MIN_FRAME_LENGTH_LINES) {
+    *frame_length_lines = AR0141_MIN_FRAME_LENGTH_LINES;
+    *line_length_pck = (clk_pix / profile->fps - EXTRA_DELAY) / *frame_length_lines;
+    if (*line_length_pck < AR0141_MIN_LINE_LENGTH_PCK) {
+      sensor_err("%d fps: line length %d is too short at CLK_PIX %d\r\n",
+                 profile->fps, *line_length_pck, clk_pix);
+      return -1;
+    }
+  }
+  if (*frame_length_lines > 0xFFFF || *line_length_pck > 0xFFFF) {
+    sensor_err("%d fps: frame timing is over range\r\n", profile->fps);
+    return -1;
+  }
+  // left and right pixels share one 16 bit bus cycle, DMA buffers must drain at line rate
+  line_bytes_per_sec = clk_pix / *line_length_pck * AR0141_IMG_WIDTH * 2;
+  if (line_bytes_per_sec > CY_FX_UVC_USB3_BANDWIDTH) {
+    sensor_err("%d fps: %d bytes/s is over usb3.0 bandwidth\r\n", profile->fps, line_bytes_per_sec);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ *  @brief      select the fastest valid PLL profile not above fps and patch init table.
+ *  @param[in]  fps     target frame rate.
+ *  @return     frame rate selected, 0 if no profile is valid.
+ */
+uint8_t AR0141_set_timing(uint8_t fps) {
+  int i;
+  uint32_t frame_length_lines;
+  uint32_t line_length_pck;
+  uint32_t coarse_integration;
+  const struct ar0141_timing_t *profile;
+
+  for (i = 0; i < sizeof(ar0141_timing_profiles) / sizeof(ar0141_timing_profiles[0]); i++) {
+    profile = &ar0141_timing_profiles[i];
+    if (profile->fps > fps)
+      continue;
+    if (AR0141_timing_calc(profile, &frame_length_lines, &line_length_pck))
+      continue;
+    coarse_integration = (uint32_t)INTEGRATION_TIME_US *
+                         (AR0141_EXTCLK / 1000000) * profile->pll_multiplier /
+                         (profile->pre_pll_clk_div * profile->vt_sys_clk_div *
+                          profile->vt_pix_clk_div) / line_length_pck;
+    if (coarse_integration > frame_length_lines - 1)
+      coarse_integration = frame_length_lines - 1;
+    AR0141_update_init_reg(0x302A, profile->vt_pix_clk_div);
+    AR0141_update_init_reg(0x302C, profile->vt_sys_clk_div);
+    AR0141_update_init_reg(0x302E, profile->pre_pll_clk_div);
+    AR0141_update_init_reg(0x3030, profile->pll_multiplier);
+    AR0141_update_init_reg(0x3036, profile->op_pix_clk_div);
+    AR0141_update_init_reg(0x3038, profile->op_sys_clk_div);
+    AR0141_update_init_reg(0x300A, frame_length_lines);
+    AR0141_update_init_reg(0x300C, line_length_pck);
+    AR0141_update_init_reg(0x3012, coarse_integration);
+    ar0141_fps = profile->fps;
+    sensor_info("AR0141 %d fps, frame_length_lines: %d, line_length_pck: %d, integration: %d\r\n",
+                profile->fps, frame_length_lines, line_length_pck, coarse_integration);
+    return ar0141_fps;
+  }
+  sensor_err("no AR0141 timing profile for %d fps\r\n", fps);
+  return 0;
+}
+
+/**
+ *  @brief      get the compile time window of both sensors.
+ *  @param[out] roi     sensor window.
+ *  @return     NULL.
+ */
+void AR0141_roi_default(struct roi_t *roi) {
+  roi->mode = ROI_MODE_STEREO;
+  roi->width = AR0141_IMG_WIDTH;
+  roi->height = AR0141_IMG_HEIGHT;
+  roi->col_start[ROI_LEFT] = roi->col_start[ROI_RIGHT] = AR0141_X_ADDR_START;
+  roi->row_start[ROI_LEFT] = roi->row_start[ROI_RIGHT] = AR0141_Y_ADDR_START;
+  // 0: timing of AR0141_Parallel_init, descriptors keep their frame intervals
+  roi->fps = 0;
+  roi->bin_fps = AR0141_skip_fps(AR0141_clk_pix(), roi->height);
+}
+
+/**
+ *  @brief      write window of one sensor.
+ *  @param[in]  SlaveAddr   sensor address in split address mode.
+ *  @param[in]  roi         sensor window.
+ *  @param[in]  eye         ROI_LEFT or ROI_RIGHT.
+ *  @return     NULL.
+ */
+static void AR0141_set_window(uint8_t SlaveAddr, const struct roi_t *roi, int eye) {
+  uint16_t y_start = roi->row_start[eye];
+  uint16_t x_start = roi->col_start[eye];
+  uint16_t y_end = y_start + roi->height - 1;
+  uint16_t x_end = x_start + roi->width - 1;
+
+  AR0141_SensorWrite2B(SlaveAddr, 0x30, 0x02, y_start >> 8, y_start & 0xff);
+  AR0141_SensorWrite2B(SlaveAddr, 0x30, 0x04, x_start >> 8, x_start & 0xff);
+  AR0141_SensorWrite2B(SlaveAddr, 0x30, 0x06, y_end >> 8, y_end & 0xff);
+  AR0141_SensorWrite2B(SlaveAddr, 0x30, 0x08, x_end >> 8, x_end & 0xff);
+}
+
+/**
+ *  @brief      set the readout window of both sensors with the shortest frame length
+ *              at the current PLL profile.
+ *  @param[in]  roi     sensor window, fps is filled with the frame rate of the window.
+ *  @return     0 if successful, -1 if the window is not valid.
+ */
+int AR0141_set_roi(struct roi_t *roi) {
+  uint32_t clk_pix, line_length_pck, frame_length_lines, line_bytes_per_sec, fps;
+  uint32_t coarse_integration;
+  int eye;
+
+  for (eye = ROI_LEFT; eye <= ROI_RIGHT; eye++) {
+    // odd start would swap the color order of the bayer pattern
+    if ((roi->col_start[eye] & 0x01) || (roi->row_start[eye] & 0x01) ||
+        roi->col_start[eye] + roi->width > AR0141_WINDOW_X_MAX ||
+        roi->row_start[eye] + roi->height > AR0141_WINDOW_Y_MAX) {
+      sensor_err("AR0141 window %dx%d at (%d, %d) is not valid\r\n", roi->width,
+                 roi->height, roi->col_start[eye], roi->row_start[eye]);
+      return -1;
+    }
+  }
+  clk_pix = AR0141_clk_pix();
+  if (clk_pix == 0) {
+    sensor_err("no AR0141 timing profile selected\r\n");
+    return -1;
+  }
+  line_length_pck = AR0141_MIN_LINE_LENGTH_PCK;
+  frame_length_lines = roi->height + AR0141_MIN_V_BLANK;
+  line_bytes_per_sec = clk_pix / line_length_pck * roi->width * 2;
+  if (line_bytes_per_sec > CY_FX_UVC_USB3_BANDWIDTH) {
+    sensor_err("AR0141 window: %d bytes/s is over usb3.0 bandwidth\r\n", line_bytes_per_sec);
+    return -1;
+  }
+  fps = clk_pix / (line_length_pck * frame_length_lines);
+  roi->fps = fps > 0xFF ? 0xFF : fps;
+  roi->bin_fps = AR0141_skip_fps(clk_pix, roi->height);
+  coarse_integration = (uint32_t)INTEGRATION_TIME_US * (clk_pix / 1000000) / line_length_pck;
+  if (coarse_integration > frame_length_lines - 1)
+    coarse_integration = frame_length_lines - 1;
+
+  AR0141_RegisterWrite(0x30, 0x0A, frame_length_lines >> 8, frame_length_lines & 0xff);
+  AR0141_RegisterWrite(0x30, 0x0C, line_length_pck >> 8, line_length_pck & 0xff);
+  AR0141_RegisterWrite(0x30, 0x12, coarse_integration >> 8, coarse_integration & 0xff);
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
+  v034_set_split_addr();
+  AR0141_set_window(L_AR0141_ADDR_WR, roi, ROI_LEFT);
+  AR0141_set_window(R_AR0141_ADDR_WR, roi, ROI_RIGHT);
+  v034_set_unified_addr();
+  CyU3PMutexPut(&glSensorLock);
+
+  AR0141_update_init_reg(0x3002, roi->row_start[ROI_LEFT]);
+  AR0141_update_init_reg(0x3004, roi->col_start[ROI_LEFT]);
+  AR0141_update_init_reg(0x3006, roi->row_start[ROI_LEFT] + roi->height - 1);
+  AR0141_update_init_reg(0x3008, roi->col_start[ROI_LEFT] + roi->width - 1);
+  AR0141_update_init_reg(0x300A, frame_length_lines);
+  AR0141_update_init_reg(0x300C, line_length_pck);
+  AR0141_update_init_reg(0x3012, coarse_integration);
+  sensor_info("AR0141 window %dx%d, left (%d, %d), right (%d, %d), %d fps, skipped %d fps\r\n",
+              roi->width, roi->height, roi->col_start[ROI_LEFT], roi->row_start[ROI_LEFT],
+              roi->col_start[ROI_RIGHT], roi->row_start[ROI_RIGHT], roi->fps, roi->bin_fps);
+  return 0;
+}
+
+/**
+ *  @brief      switch both sensors between the full window and 2x2 skipping of the window.
+ *              AR0141 has no binning in the sensor core, odd increment 3 reads every other
+ *              2x2 bayer quad so the color order of the output is kept.
+ *  @param[in]  enable  1: 2x2 skipping, 0: full resolution.
+ *  @param[in]  roi     sensor window.
+ *  @param[in]  fps     skipped frame rate committed by the host, 0 or above bin_fps runs at
+ *                      bin_fps. FRAME_LENGTH_LINES stretches the frame to the committed rate.
+ *  @return     NULL.
+ */
+void AR0141_set_subsample(uint8_t enable, const struct roi_t *roi, uint8_t fps) {
+  uint16_t odd_inc = enable ? 3 : 1;
+  uint16_t frame_length_lines, coarse_integration;
+  uint32_t lines;
+
+  if (enable) {
+    frame_length_lines = roi->height / 2 + AR0141_MIN_V_BLANK;
+    if (fps && fps < roi->bin_fps) {
+      lines = AR0141_clk_pix() / ((uint32_t)fps * AR0141_init_reg(0x300C));
+      if (lines > 0xFFFF)
+        lines = 0xFFFF;
+      if (lines > frame_length_lines)
+        frame_length_lines = lines;
+    }
+  } else {
+    frame_length_lines = AR0141_init_reg(0x300A);
+  }
+  coarse_integration = AR0141_init_reg(0x3012);
+  if (coarse_integration > frame_length_lines - 1)
+    coarse_integration = frame_length_lines - 1;
+
+  AR0141_RegisterWrite(0x30, 0xA2, odd_inc >> 8, odd_inc & 0xff);
+  AR0141_RegisterWrite(0x30, 0xA6, odd_inc >> 8, odd_inc & 0xff);
+  AR0141_RegisterWrite(0x30, 0x0A, frame_length_lines >> 8, frame_length_lines & 0xff);
+  AR0141_RegisterWrite(0x30, 0x12, coarse_integration >> 8, coarse_integration & 0xff);
+  sensor_info("AR0141 %s, frame_length_lines: %d\r\n",
+              enable ? "2x2 skipping" : "full resolution", frame_length_lines);
+}
+
+/**
+ *  @brief      replace the pixel data of both sensors by a test pattern.
+ *  @param[in]  pattern     enum TEST_PATTERN.
+ *  @param[in]  value       12 bit value of all color channels of TEST_PATTERN_FLAT.
+ *  @return     NULL.
+ */
+void AR0141_set_test_pattern(uint8_t pattern, uint16_t value) {
+  uint16_t mode = AR0141_TEST_PATTERN_OFF;
+  uint8_t reg;
+
+  if (pattern == TEST_PATTERN_FLAT) {
+    mode = AR0141_TEST_PATTERN_SOLID;
+    value &= 0x0FFF;
+    // TEST_DATA_RED, TEST_DATA_GREENR, TEST_DATA_BLUE, TEST_DATA_GREENB
+    for (reg = 0x72; reg <= 0x78; reg += 2)
+      AR0141_RegisterWrite(0x30, reg, value >> 8, value & 0xff);
+  } else if (pattern == TEST_PATTERN_GRADIENT) {
+    mode = AR0141_TEST_PATTERN_BARS;
+  }
+  AR0141_RegisterWrite(0x30, 0x70, mode >> 8, mode & 0xff);
+  sensor_info("AR0141 test pattern mode: %d\r\n", mode);
+}
+
 void AR0141_sensor_init(void) {
   sensor_dbg("sensor AR0141 register init \r\n");
+  AR0141_set_timing(AR0141_FRAME_FPS);
   AR0141_SetRegs();
 }
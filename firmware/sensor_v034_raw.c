@@ -57,12 +57,14 @@ CyU3PReturnStatus_t V034_SensorWrite2B(uint8_t SlaveAddr, uint8_t HighAddr,
   preamble.ctrlMask = 0x0000;
   Buf[0] = HighData;
   Buf[1] = LowData;
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
   apiRetStatus = CyU3PI2cTransmitBytes(&preamble, Buf, 2, 0);
   if (apiRetStatus == CY_U3P_SUCCESS) {
     V034_delay(800);  /* known issue for SDK I2C */
   } else {
     sensor_err("W2B I2C write error\r\n");
   }
+  CyU3PMutexPut(&glSensorLock);
   return apiRetStatus;
 }
 
@@ -84,12 +86,14 @@ CyU3PReturnStatus_t V034_SensorWrite(uint8_t SlaveAddr, uint8_t HighAddr,
   preamble.buffer[0] = SlaveAddr; /* Slave address: Write operation */
   preamble.length = 2;
   preamble.ctrlMask = 0x0000;
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
   apiRetStatus = CyU3PI2cTransmitBytes(&preamble, buf, count, 0);
   if (apiRetStatus == CY_U3P_SUCCESS) {
     V034_delay(800);    /* known issue for SDK I2C */
   } else {
     sensor_err("W I2C write error\r\n");
   }
+  CyU3PMutexPut(&glSensorLock);
   return apiRetStatus;
 }
 
@@ -125,12 +129,14 @@ CyU3PReturnStatus_t V034_SensorRead2B(uint8_t SlaveAddr, uint8_t HighAddr,
   preamble.buffer[0] = SlaveAddr - 1;  /* Slave address: Write operation */
   preamble.length = 3;
   preamble.ctrlMask = 0x0002;  // After the second byte,need to restart the I2C communication
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
   apiRetStatus = CyU3PI2cReceiveBytes(&preamble, buf, 2, 0);
   if (apiRetStatus == CY_U3P_SUCCESS) {
     V034_delay(800);
   } else {
     sensor_err("R2B I2C read error\r\n");
   }
+  CyU3PMutexPut(&glSensorLock);
   return apiRetStatus;
 }
 
@@ -154,12 +160,14 @@ CyU3PReturnStatus_t V034_SensorRead(uint8_t SlaveAddr, uint8_t HighAddr,
   preamble.buffer[0] = SlaveAddr - 1;  /* Slave address: Write operation */
   preamble.length = 3;
   preamble.ctrlMask = 0x0002;
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
   apiRetStatus = CyU3PI2cReceiveBytes(&preamble, buf, count, 0);
   if (apiRetStatus == CY_U3P_SUCCESS) {
     V034_delay(800);
   } else {
     sensor_err("R I2C read error\r\n");
   }
+  CyU3PMutexPut(&glSensorLock);
   return apiRetStatus;
 }
 
@@ -221,6 +229,8 @@ uint16_t MT9V034_Parallel[] = {
       0x1A, 0x0428,   // RESERVED_CORE_1A
       // close LED_out when exposure
       0x1B, 0x0001,   // LED_OUT_CONTROL
+      // the camera connector only carries 8 data lines (CMOS_D0~D7) per eye and both eyes fill
+      // the 16 bit GPIF bus, so the pixel stays 8 bits, 10 bit pixels need a wider bus
       0x1C, 0x0302,   // DATA_COMPRESSION
       0x1D, 0x0040,   // RESERVED_CORE_1D
       0x1E, 0x0000,   // RESERVED_CORE_1E
@@ -334,12 +344,13 @@ uint16_t MT9V034_Parallel[] = {
       0xC6, 0x0000,   // NTSC_FV_CONTROL
       0xC7, 0x4416,   // NTSC_HBLANK
       0xC8, 0x4421,   // NTSC_VBLANK
-      0xC9, 0x0002,   // COL_WINDOW_START_CONTEXTB_REG
-      0xCA, 0x0004,   // ROW_WINDOW_START_CONTEXTB_REG
-      0xCB, 0x01E0,   // ROW_WINDOW_SIZE_CONTEXTB_REG
-      0xCC, 0x02EE,   // COL_WINDOW_SIZE_CONTEXTB_REG
-      0xCD, 0x0100,   // HORZ_BLANK_CONTEXTB_REG
-      0xCE, 0x0100,   // VERT_BLANK_CONTEXTB_REG
+      // context B keeps the context A window and blanking, so HDR mode can switch per frame
+      0xC9, XP_START_COL,   // COL_WINDOW_START_CONTEXTB_REG
+      0xCA, 0x0004,         // ROW_WINDOW_START_CONTEXTB_REG
+      0xCB, XP_IMG_HEIGHT,  // ROW_WINDOW_SIZE_CONTEXTB_REG
+      0xCC, XP_IMG_WIDTH,   // COL_WINDOW_SIZE_CONTEXTB_REG
+      0xCD, XP_H_BLANK,     // HORZ_BLANK_CONTEXTB_REG
+      0xCE, XP_V_BLANK,     // VERT_BLANK_CONTEXTB_REG
       0xCF, 0x0190,   // COARSE_SHUTTER_WIDTH_1_CONTEXTB
 
       0xD0, 0x01BD,   // COARSE_SHUTTER_WIDTH_2_CONTEXTB
@@ -354,6 +365,41 @@ uint16_t MT9V034_Parallel[] = {
       0xD9, 0x0001,   // MONITOR_MODE_CONTROL
     };
 
+/* Longest exposure that still fits in one frame period, in rows */
+#define V034_HDR_MAX_EXPOSURE (XP_IMG_HEIGHT + XP_V_BLANK)
+
+struct v034_hdr_t v034_hdr = {0, 0x01C2, 0x01C2, 0};
+/* AE mode from before HDR or snapshot mode forced manual exposure, 0 while none of them does */
+static uint8_t v034_saved_ae_mode = 0;
+
+/**
+ *  @brief      switch to manual exposure for HDR or snapshot mode, the AE mode before the first
+ *              of them is kept for V034_release_manual_exposure.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+static void V034_force_manual_exposure(void) {
+  if (!v034_saved_ae_mode)
+    v034_saved_ae_mode = V034_SensorGetAEMode();
+  V034_SensorSetAEMode(V034_MANUAL_EXPOSURE_MODE);
+}
+
+/**
+ *  @brief      restore the AE mode kept by V034_force_manual_exposure once neither HDR nor
+ *              snapshot mode needs manual exposure.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+static void V034_release_manual_exposure(void) {
+  uint16_t control_mode = MT9V034_Parallel[(0x07 - 1) * 2 + 1];
+
+  if (!v034_saved_ae_mode || v034_hdr.enable ||
+      (control_mode & V034_OPERATING_MODE_MASK) == V034_OPERATING_MODE_SNAPSHOT)
+    return;
+  V034_SensorSetAEMode(v034_saved_ae_mode);
+  v034_saved_ae_mode = 0;
+}
+
 void V034_stream_start(uint8_t SlaveAddr) {
   uint16_t Stream_Start_Addr  = 0xD9;
   uint16_t Stream_Start_Value = 0x00;
@@ -467,6 +513,411 @@ void update_v034_flip_right(void) {
     break;
   }
 }
+/**
+ *  @brief      configure HDR alternating exposure of both sensors.
+ *  @param[in]  enable          1: alternate context A/B every frame, 0: stay in context A.
+ *  @param[in]  short_exposure  context A exposure in rows.
+ *  @param[in]  long_exposure   context B exposure in rows.
+ *  @return     NULL.
+ */
+void V034_hdr_config(uint8_t enable, uint16_t short_exposure, uint16_t long_exposure) {
+  uint16_t control_mode = MT9V034_Parallel[(0x07 - 1) * 2 + 1];
+  uint16_t gain;
+
+  if (short_exposure < 1)
+    short_exposure = 1;
+  if (short_exposure > V034_HDR_MAX_EXPOSURE)
+    short_exposure = V034_HDR_MAX_EXPOSURE;
+  if (long_exposure < 1)
+    long_exposure = 1;
+  if (long_exposure > V034_HDR_MAX_EXPOSURE)
+    long_exposure = V034_HDR_MAX_EXPOSURE;
+
+  // stop switching before touching the context registers
+  v034_hdr.enable = 0;
+  v034_hdr.short_exposure = short_exposure;
+  v034_hdr.long_exposure = long_exposure;
+  v034_hdr.frame_index = 0;
+  // both sensors share the unified address, so every write below hits the two eyes together
+  V034_RegisterWrite(0x00, 0x07, control_mode >> 8, control_mode & 0xff);
+  if (enable) {
+    // AEC would overwrite context A exposure every frame
+    V034_force_manual_exposure();
+    V034_RegisterWrite(0x00, 0x0B, short_exposure >> 8, short_exposure & 0xff);
+    V034_RegisterWrite(0x00, 0xD2, long_exposure >> 8, long_exposure & 0xff);
+    // only the exposure differs between contexts
+    gain = V034_RegisterRead(0x00, 0x35);
+    V034_RegisterWrite(0x00, 0x36, gain >> 8, gain & 0xff);
+  }
+  v034_hdr.enable = enable;
+  if (!enable)
+    V034_release_manual_exposure();
+  sensor_info("v034 hdr %s, short: %d rows, long: %d rows\r\n", enable ? "on" : "off",
+              short_exposure, long_exposure);
+}
+
+/**
+ *  @brief      restart HDR context sequence from context A at stream start.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void V034_hdr_stream_start(void) {
+  uint16_t control_mode = MT9V034_Parallel[(0x07 - 1) * 2 + 1];
+
+  if (!v034_hdr.enable)
+    return;
+  v034_hdr.frame_index = 0;
+  V034_RegisterWrite(0x00, 0x07, control_mode >> 8, control_mode & 0xff);
+}
+
+/**
+ *  @brief      switch both sensors to the other context, called once per frame in vblank.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void V034_hdr_frame_end(void) {
+  uint16_t control_mode = MT9V034_Parallel[(0x07 - 1) * 2 + 1];
+
+  if (!v034_hdr.enable)
+    return;
+  v034_hdr.frame_index++;
+  if (v034_hdr.frame_index & 0x01)
+    control_mode |= V034_CONTEXT_SELECT_B;
+  V034_RegisterWrite(0x00, 0x07, control_mode >> 8, control_mode & 0xff);
+}
+
+/**
+ *  @brief      get the context of the frame being streamed now.
+ *  @param[out] NULL.
+ *  @return     V034_CONTEXT_A, V034_CONTEXT_B or V034_HDR_OFF.
+ */
+uint8_t V034_hdr_frame_context(void) {
+  uint32_t write_index;
+
+  if (!v034_hdr.enable)
+    return V034_HDR_OFF;
+  if (v034_hdr.frame_index < V034_HDR_CONTEXT_LATENCY)
+    return V034_CONTEXT_A;
+  // V034_hdr_frame_end writes context (frame_index & 1), it is read out
+  // V034_HDR_CONTEXT_LATENCY frames later, so the frame streamed now carries the context of
+  // the write V034_HDR_CONTEXT_LATENCY - 1 frame ends ago
+  write_index = v034_hdr.frame_index - (V034_HDR_CONTEXT_LATENCY - 1);
+  return write_index & 0x01;
+}
+
+/* rows after the exposure ends until the snapshot readout is done */
+#define V034_SNAPSHOT_READOUT_ROWS (XP_IMG_HEIGHT + 4)
+#define V034_SNAPSHOT_MAX_EXPOSURE (0x7FFF)
+
+/**
+ *  @brief      get the shortest trigger period the sensors can follow in snapshot mode.
+ *  @param[in]  exposure_us     exposure window of every frame.
+ *  @return     minimum trigger period in us.
+ */
+uint32_t V034_snapshot_min_period_us(uint32_t exposure_us) {
+  return exposure_us + V034_SNAPSHOT_READOUT_ROWS * (XP_ROW_TIME * 1000000 / XP_OSC_FREQ + 1);
+}
+
+/**
+ *  @brief      switch both sensors between master (free run) and snapshot (triggered) mode.
+ *  @param[in]  enable          1: expose on every EXPOSURE pin pulse, 0: free run.
+ *  @param[in]  exposure_us     exposure window in snapshot mode.
+ *  @return     NULL.
+ */
+void V034_set_snapshot_mode(uint8_t enable, uint32_t exposure_us) {
+  uint16_t control_mode = MT9V034_Parallel[(0x07 - 1) * 2 + 1];
+  uint32_t rows;
+
+  control_mode &= ~V034_OPERATING_MODE_MASK;
+  control_mode |= enable ? V034_OPERATING_MODE_SNAPSHOT : V034_OPERATING_MODE_MASTER;
+  // keep the table in sync, HDR context switching rewrites 0x07 from it
+  MT9V034_Parallel[(0x07 - 1) * 2 + 1] = control_mode;
+  v034_hdr.frame_index = 0;
+  V034_RegisterWrite(0x00, 0x07, control_mode >> 8, control_mode & 0xff);
+
+  // HDR mode owns the exposure of both contexts
+  if (enable && !v034_hdr.enable) {
+    rows = (uint64_t)exposure_us * (XP_OSC_FREQ / 1000000) / XP_ROW_TIME;
+    if (rows < 1)
+      rows = 1;
+    if (rows > V034_SNAPSHOT_MAX_EXPOSURE)
+      rows = V034_SNAPSHOT_MAX_EXPOSURE;
+    V034_force_manual_exposure();
+    V034_RegisterWrite(0x00, 0x0B, rows >> 8, rows & 0xff);
+  } else if (!enable) {
+    V034_release_manual_exposure();
+  }
+  sensor_info("v034 %s mode\r\n", enable ? "snapshot" : "master");
+}
+
+/* MT9V034 pixel array and minimum blanking of a window */
+#define V034_COL_START_MIN         1
+#define V034_ROW_START_MIN         4
+#define V034_ARRAY_WIDTH           752
+#define V034_ARRAY_HEIGHT          480
+#define V034_MIN_H_BLANK           61
+#define V034_MIN_H_BLANK_BIN2      71
+#define V034_MIN_ROW_TIME          660
+#define V034_MIN_V_BLANK           4
+#define V034_MAX_V_BLANK           32288
+
+/**
+ *  @brief      update a register value of MT9V034 init table.
+ *  @param[in]  addr    register address.
+ *  @param[in]  value   register value.
+ *  @return     NULL.
+ */
+static void V034_update_table(uint16_t addr, uint16_t value) {
+  int j;
+
+  for (j = 0; j < sizeof(MT9V034_Parallel) / sizeof(uint16_t); j = j + 2) {
+    if (MT9V034_Parallel[j] == addr) {
+      MT9V034_Parallel[j + 1] = value;
+    }
+  }
+}
+
+/**
+ *  @brief      get a register value of MT9V034 init table.
+ *  @param[in]  addr    register address.
+ *  @return     register value, 0 if the register is not in the table.
+ */
+static uint16_t V034_table_value(uint16_t addr) {
+  int j;
+
+  for (j = 0; j < sizeof(MT9V034_Parallel) / sizeof(uint16_t); j = j + 2) {
+    if (MT9V034_Parallel[j] == addr)
+      return MT9V034_Parallel[j + 1];
+  }
+  return 0;
+}
+
+/**
+ *  @brief      get the shortest blanking of a window and the frame rate it runs at.
+ *  @param[in]  out_width   pixels per output line, after binning.
+ *  @param[in]  out_height  output lines, after binning.
+ *  @param[in]  bin         1: no binning, 2: 2x2 binning.
+ *  @param[out] h_blank     horizontal blanking in pixel clocks.
+ *  @param[out] v_blank     vertical blanking in rows.
+ *  @return     frame rate, clamped to 255.
+ */
+static uint8_t V034_min_blanking(uint16_t out_width, uint16_t out_height, uint8_t bin,
+                                 uint16_t *h_blank, uint16_t *v_blank) {
+  uint32_t fps;
+
+  *h_blank = bin == 2 ? V034_MIN_H_BLANK_BIN2 : V034_MIN_H_BLANK;
+  if (out_width + *h_blank < V034_MIN_ROW_TIME)
+    *h_blank = V034_MIN_ROW_TIME - out_width;
+  *v_blank = V034_MIN_V_BLANK;
+  fps = XP_OSC_FREQ / ((out_width + *h_blank) * (out_height + *v_blank));
+  return fps > 0xFF ? 0xFF : fps;
+}
+
+/**
+ *  @brief      get the compile time window of both sensors.
+ *  @param[out] roi     sensor window.
+ *  @return     NULL.
+ */
+void V034_roi_default(struct roi_t *roi) {
+  uint16_t h_blank, v_blank;
+
+  roi->mode = ROI_MODE_STEREO;
+  roi->width = XP_IMG_WIDTH;
+  roi->height = XP_IMG_HEIGHT;
+  roi->col_start[ROI_LEFT] = roi->col_start[ROI_RIGHT] = XP_START_COL;
+  roi->row_start[ROI_LEFT] = roi->row_start[ROI_RIGHT] = V034_ROW_START_MIN;
+  // 0: timing of MT9V034_Parallel, descriptors keep their frame intervals
+  roi->fps = 0;
+  roi->bin_fps = V034_min_blanking(roi->width / 2, roi->height / 2, 2, &h_blank, &v_blank);
+}
+
+/**
+ *  @brief      write window start of one sensor, both contexts.
+ *  @param[in]  SlaveAddr   sensor address in split address mode.
+ *  @param[in]  col_start   first column.
+ *  @param[in]  row_start   first row.
+ *  @return     NULL.
+ */
+static void V034_set_window_start(uint8_t SlaveAddr, uint16_t col_start, uint16_t row_start) {
+  V034_SensorWrite2B(SlaveAddr, 0x00, 0x01, col_start >> 8, col_start & 0xff);
+  V034_SensorWrite2B(SlaveAddr, 0x00, 0x02, row_start >> 8, row_start & 0xff);
+  V034_SensorWrite2B(SlaveAddr, 0x00, 0xC9, col_start >> 8, col_start & 0xff);
+  V034_SensorWrite2B(SlaveAddr, 0x00, 0xCA, row_start >> 8, row_start & 0xff);
+}
+
+/**
+ *  @brief      keep AEC and the manual exposure of both contexts inside the frame, an exposure
+ *              longer than the frame stretches it.
+ *  @param[in]  frame_rows  window height and vertical blanking.
+ *  @return     NULL.
+ */
+static void V034_cap_exposure(uint16_t frame_rows) {
+  uint8_t reg[2] = {0x0B, 0xD2};  // COARSE_SHUTTER_WIDTH_TOTAL of context A and B
+  uint16_t exposure;
+  int i;
+
+  V034_RegisterWrite(0x00, 0xAD, frame_rows >> 8, frame_rows & 0xff);
+  for (i = 0; i < 2; i++) {
+    exposure = V034_RegisterRead(0x00, reg[i]);
+    if (exposure > frame_rows)
+      V034_RegisterWrite(0x00, reg[i], frame_rows >> 8, frame_rows & 0xff);
+  }
+}
+
+/**
+ *  @brief      set the readout window of both sensors with the shortest blanking.
+ *  @param[in,out]  roi     sensor window, fps is filled with the frame rate of the window.
+ *  @return     0 if successful, -1 if the window is not valid.
+ */
+int V034_set_roi(struct roi_t *roi) {
+  uint32_t row_time, frame_rows, line_bytes_per_sec;
+  uint16_t h_blank, v_blank, bin_h_blank, bin_v_blank;
+  int eye;
+
+  for (eye = ROI_LEFT; eye <= ROI_RIGHT; eye++) {
+    if (roi->col_start[eye] < V034_COL_START_MIN ||
+        roi->col_start[eye] + roi->width > V034_COL_START_MIN + V034_ARRAY_WIDTH ||
+        roi->row_start[eye] < V034_ROW_START_MIN ||
+        roi->row_start[eye] + roi->height > V034_ROW_START_MIN + V034_ARRAY_HEIGHT) {
+      sensor_err("v034 window %dx%d at (%d, %d) is out of the pixel array\r\n", roi->width,
+                 roi->height, roi->col_start[eye], roi->row_start[eye]);
+      return -1;
+    }
+  }
+  roi->fps = V034_min_blanking(roi->width, roi->height, 1, &h_blank, &v_blank);
+  row_time = roi->width + h_blank;
+  frame_rows = roi->height + v_blank;
+  // left and right pixels share one 16 bit bus cycle
+  line_bytes_per_sec = XP_OSC_FREQ / row_time * roi->width * 2;
+  if (line_bytes_per_sec > CY_FX_UVC_USB3_BANDWIDTH) {
+    sensor_err("v034 window: %d bytes/s is over usb3.0 bandwidth\r\n", line_bytes_per_sec);
+    return -1;
+  }
+  // binned lines are half as long, they never need more bandwidth than the full window
+  roi->bin_fps = V034_min_blanking(roi->width / 2, roi->height / 2, 2, &bin_h_blank, &bin_v_blank);
+
+  // window size and blanking are common, write both sensors at the unified address
+  V034_RegisterWrite(0x00, 0x03, roi->height >> 8, roi->height & 0xff);
+  V034_RegisterWrite(0x00, 0x04, roi->width >> 8, roi->width & 0xff);
+  V034_RegisterWrite(0x00, 0x05, h_blank >> 8, h_blank & 0xff);
+  V034_RegisterWrite(0x00, 0x06, v_blank >> 8, v_blank & 0xff);
+  V034_RegisterWrite(0x00, 0xCB, roi->height >> 8, roi->height & 0xff);
+  V034_RegisterWrite(0x00, 0xCC, roi->width >> 8, roi->width & 0xff);
+  V034_RegisterWrite(0x00, 0xCD, h_blank >> 8, h_blank & 0xff);
+  V034_RegisterWrite(0x00, 0xCE, v_blank >> 8, v_blank & 0xff);
+  V034_cap_exposure(frame_rows);
+
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
+  v034_set_split_addr();
+  V034_set_window_start(L_SENSOR_ADDR_WR, roi->col_start[ROI_LEFT], roi->row_start[ROI_LEFT]);
+  V034_set_window_start(R_SENSOR_ADDR_WR, roi->col_start[ROI_RIGHT], roi->row_start[ROI_RIGHT]);
+  v034_set_unified_addr();
+  CyU3PMutexPut(&glSensorLock);
+
+  MT9V034_Parallel[(0x01 - 1) * 2 + 1] = roi->col_start[ROI_LEFT];
+  MT9V034_Parallel[(0x02 - 1) * 2 + 1] = roi->row_start[ROI_LEFT];
+  MT9V034_Parallel[(0x03 - 1) * 2 + 1] = roi->height;
+  MT9V034_Parallel[(0x04 - 1) * 2 + 1] = roi->width;
+  MT9V034_Parallel[(0x05 - 1) * 2 + 1] = h_blank;
+  MT9V034_Parallel[(0x06 - 1) * 2 + 1] = v_blank;
+  V034_update_table(0xC9, roi->col_start[ROI_LEFT]);
+  V034_update_table(0xCA, roi->row_start[ROI_LEFT]);
+  V034_update_table(0xCB, roi->height);
+  V034_update_table(0xCC, roi->width);
+  V034_update_table(0xCD, h_blank);
+  V034_update_table(0xCE, v_blank);
+  V034_update_table(0xAD, frame_rows);
+  sensor_info("v034 window %dx%d, left (%d, %d), right (%d, %d), %d fps, binned %d fps\r\n",
+              roi->width, roi->height, roi->col_start[ROI_LEFT], roi->row_start[ROI_LEFT],
+              roi->col_start[ROI_RIGHT], roi->row_start[ROI_RIGHT], roi->fps, roi->bin_fps);
+  return 0;
+}
+
+/**
+ *  @brief      set the read mode bits of one sensor, both contexts, flip bits are kept.
+ *  @param[in]  eye     ROI_LEFT or ROI_RIGHT, sensors must be in split address mode.
+ *  @param[in]  bits    V034_READ_MODE_BIN_MASK bits to set.
+ *  @return     NULL.
+ */
+static void V034_set_read_mode(int eye, uint16_t bits) {
+  uint8_t addr_wr = eye == ROI_LEFT ? L_SENSOR_ADDR_WR : R_SENSOR_ADDR_WR;
+  uint8_t addr_rd = eye == ROI_LEFT ? L_SENSOR_ADDR_RD : R_SENSOR_ADDR_RD;
+  uint8_t reg[2] = {0x0D, 0x0E};  // READ_MODE of context A and B
+  uint8_t buf[2];
+  uint16_t read_mode;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    V034_SensorRead2B(addr_rd, 0x00, reg[i], buf);
+    read_mode = (buf[0] << 8) | buf[1];
+    read_mode = (read_mode & ~V034_READ_MODE_BIN_MASK) | bits;
+    V034_SensorWrite2B(addr_wr, 0x00, reg[i], read_mode >> 8, read_mode & 0xff);
+  }
+}
+
+/**
+ *  @brief      switch both sensors between the full window and 2x2 binning of the window.
+ *  @param[in]  enable  1: 2x2 binning, 0: full resolution.
+ *  @param[in]  roi     sensor window.
+ *  @param[in]  fps     binned frame rate committed by the host, 0 or above bin_fps runs at
+ *                      bin_fps. Vertical blanking stretches the frame to the committed rate.
+ *  @return     NULL.
+ */
+void V034_set_binning(uint8_t enable, const struct roi_t *roi, uint8_t fps) {
+  uint16_t h_blank, v_blank, frame_rows;
+  uint32_t rows;
+  int eye;
+
+  if (enable) {
+    V034_min_blanking(roi->width / 2, roi->height / 2, 2, &h_blank, &v_blank);
+    if (fps && fps < roi->bin_fps) {
+      rows = XP_OSC_FREQ / ((uint32_t)fps * (roi->width / 2 + h_blank));
+      if (rows > roi->height / 2 + V034_MAX_V_BLANK)
+        rows = roi->height / 2 + V034_MAX_V_BLANK;
+      if (rows > roi->height / 2 + v_blank)
+        v_blank = rows - roi->height / 2;
+    }
+    frame_rows = roi->height / 2 + v_blank;
+  } else {
+    h_blank = MT9V034_Parallel[(0x05 - 1) * 2 + 1];
+    v_blank = MT9V034_Parallel[(0x06 - 1) * 2 + 1];
+    frame_rows = V034_table_value(0xAD);
+  }
+  // read mode holds the flip bits, they differ between eyes
+  CyU3PMutexGet(&glSensorLock, CYU3P_WAIT_FOREVER);
+  v034_set_split_addr();
+  for (eye = ROI_LEFT; eye <= ROI_RIGHT; eye++)
+    V034_set_read_mode(eye, enable ? V034_READ_MODE_BIN2 : 0);
+  v034_set_unified_addr();
+  CyU3PMutexPut(&glSensorLock);
+
+  // window registers keep the full window, only blanking follows the output size
+  V034_RegisterWrite(0x00, 0x05, h_blank >> 8, h_blank & 0xff);
+  V034_RegisterWrite(0x00, 0x06, v_blank >> 8, v_blank & 0xff);
+  V034_RegisterWrite(0x00, 0xCD, h_blank >> 8, h_blank & 0xff);
+  V034_RegisterWrite(0x00, 0xCE, v_blank >> 8, v_blank & 0xff);
+  V034_cap_exposure(frame_rows);
+  sensor_info("v034 %s, blanking: %d pixels, %d rows\r\n",
+              enable ? "2x2 binning" : "full resolution", h_blank, v_blank);
+}
+
+/**
+ *  @brief      replace the pixel data of both sensors by a test pattern.
+ *  @param[in]  pattern     enum TEST_PATTERN.
+ *  @param[in]  value       10 bit pixel value of TEST_PATTERN_FLAT.
+ *  @return     NULL.
+ */
+void V034_set_test_pattern(uint8_t pattern, uint16_t value) {
+  uint16_t test_data = 0;
+
+  if (pattern == TEST_PATTERN_FLAT)
+    test_data = V034_TEST_PATTERN_ENABLE | V034_TEST_USE_DATA | (value & V034_TEST_DATA_MASK);
+  else if (pattern == TEST_PATTERN_GRADIENT)
+    test_data = V034_TEST_PATTERN_ENABLE | V034_TEST_SHADE_DIAGONAL;
+  V034_RegisterWrite(0x00, 0x7F, test_data >> 8, test_data & 0xff);
+  sensor_info("v034 test pattern: %d, test data: 0x%x\r\n", pattern, test_data);
+}
+
 static void V034_ChipID_Check(uint8_t SlaveAddr) {
   uint16_t ChipID;
 
@@ -0,0 +1,157 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#include <cyu3os.h>
+#include <cyu3gpio.h>
+#include <cyu3error.h>
+#include <cyu3utils.h>
+#include "include/debug.h"
+#include "include/fx3_bsp.h"
+#include "include/thread_prof.h"
+#include "include/byte_order.h"
+
+static struct {
+  CyU3PThread *thread;
+  uint8_t *stack;
+  uint32_t size;
+  uint32_t samples;
+  uint16_t run_max;
+} prof_thread[PROF_THREADS];
+static uint8_t prof_count = 0;
+static uint32_t prof_samples = 0, prof_idle = 0, prof_other = 0;
+static CyU3PThread *prof_last = NULL;
+static uint16_t prof_run = 0;
+
+/**
+ *  @brief      fill the stack of a thread and profile it, call before the thread is created.
+ *  @param[in]  thread  thread.
+ *  @param[in]  stack   stack memory.
+ *  @param[in]  size    stack size passed to CyU3PThreadCreate.
+ *  @return     NULL.
+ */
+void prof_thread_add(CyU3PThread *thread, void *stack, uint32_t size) {
+  if (prof_count == PROF_THREADS)
+    return;
+  CyU3PMemSet((uint8_t *)stack, PROF_STACK_FILL, size);
+  prof_thread[prof_count].thread = thread;
+  prof_thread[prof_count].stack = (uint8_t *)stack;
+  prof_thread[prof_count].size = size;
+  prof_count++;
+}
+
+/**
+ *  @brief      start the sampling timer, the GPIO module has to be initialized.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void prof_init(void) {
+  CyU3PGpioComplexConfig_t gpioComplexConfig;
+  CyU3PReturnStatus_t apiRetStatus;
+
+  // timer only, the pin is left undriven
+  gpioComplexConfig.outValue    = CyFalse;
+  gpioComplexConfig.driveLowEn  = CyFalse;
+  gpioComplexConfig.driveHighEn = CyFalse;
+  gpioComplexConfig.inputEn     = CyFalse;
+  gpioComplexConfig.pinMode     = CY_U3P_GPIO_MODE_STATIC;
+  gpioComplexConfig.intrMode    = CY_U3P_GPIO_INTR_TIMER_ZERO;
+  gpioComplexConfig.timerMode   = CY_U3P_GPIO_TIMER_HIGH_FREQ;
+  gpioComplexConfig.timer       = 0;
+  gpioComplexConfig.period      = GPIO_FAST_CLK_HZ / PROF_SAMPLE_HZ;
+  gpioComplexConfig.threshold   = 0;
+  apiRetStatus = CyU3PDeviceGpioOverride(PROF_TIMER_GPIO, CyFalse) |
+                 CyU3PGpioSetComplexConfig(PROF_TIMER_GPIO, &gpioComplexConfig);
+  if (apiRetStatus != CY_U3P_SUCCESS)
+    sensor_err("profiler timer config error, Error Code = 0x%x\r\n", apiRetStatus);
+}
+
+/**
+ *  @brief      count the interrupted thread, called from the GPIO interrupt.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void prof_sample(void) {
+  CyU3PThread *thread = CyU3PThreadIdentify();
+  uint8_t i;
+
+  prof_samples++;
+  if (thread == prof_last) {
+    if (prof_run < 0xFFFF)
+      prof_run++;
+  } else {
+    prof_last = thread;
+    prof_run = 1;
+  }
+  if (thread == NULL) {
+    prof_idle++;
+    return;
+  }
+  for (i = 0; i < prof_count; i++) {
+    if (prof_thread[i].thread == thread) {
+      prof_thread[i].samples++;
+      if (prof_run > prof_thread[i].run_max)
+        prof_thread[i].run_max = prof_run;
+      return;
+    }
+  }
+  prof_other++;
+}
+
+/**
+ *  @brief      profile as laid out in thread_prof.h.
+ *  @param[out] buffer  PROF_LEN bytes.
+ *  @return     NULL.
+ */
+void prof_status(uint8_t *buffer) {
+  uint8_t *p = &buffer[PROF_HEADER_LEN];
+  uint32_t unused;
+  uint8_t i;
+
+  CyU3PMemSet(buffer, 0, PROF_LEN);
+  put_be16(&buffer[0], PROF_SAMPLE_HZ);
+  buffer[2] = prof_count;
+  put_be32(&buffer[4], prof_samples);
+  put_be32(&buffer[8], prof_idle);
+  put_be32(&buffer[12], prof_other);
+  for (i = 0; i < prof_count; i++, p += PROF_THREAD_LEN) {
+    // stacks grow down, the untouched fill is at the low end
+    for (unused = 0; unused < prof_thread[i].size; unused++) {
+      if (prof_thread[i].stack[unused] != PROF_STACK_FILL)
+        break;
+    }
+    put_be32(&p[0], prof_thread[i].samples);
+    put_be16(&p[4], prof_thread[i].run_max);
+    put_be16(&p[6], prof_thread[i].size);
+    put_be16(&p[8], prof_thread[i].size - unused);
+  }
+}
+
+/**
+ *  @brief      clear the sample counters.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void prof_clear(void) {
+  uint8_t i;
+
+  // the sampling interrupt only increments, a count it bumps in between is lost
+  prof_samples = prof_idle = prof_other = 0;
+  for (i = 0; i < prof_count; i++) {
+    prof_thread[i].samples = 0;
+    prof_thread[i].run_max = 0;
+  }
+}
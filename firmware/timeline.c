@@ -0,0 +1,140 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#ifdef SENSOR_TIMELINE
+
+#include <cyu3os.h>
+#include <cyu3vic.h>
+#include <cyu3utils.h>
+#include "include/fx3_bsp.h"
+#include "include/timeline.h"
+#include "include/byte_order.h"
+
+struct timeline_record {
+  uint32_t frame;
+  uint16_t buffers;
+  uint32_t ticks[TL_POINTS];
+};
+
+/* Points are single word stores, so the GPIF and DMA callbacks need no lock for them. */
+static volatile struct timeline_record tl_cur;
+static struct timeline_record tl_ring[TIMELINE_RECORDS];
+/* Free running counts, head - tail records are in the ring. */
+static uint32_t tl_head = 0, tl_tail = 0;
+static uint32_t tl_lost = 0;
+
+/**
+ *  @brief      time a point of the current frame, a later pass overwrites an earlier one.
+ *  @param[in]  point   TL_POINT.
+ *  @return     NULL.
+ */
+void timeline_mark(uint8_t point) {
+  // a tick count of 0 would read as not passed
+  tl_cur.ticks[point] = fx3_ticks() | 1;
+}
+
+/**
+ *  @brief      count a committed buffer, the first one of a frame is TL_FIRST_COMMIT and
+ *              each one moves TL_LAST_COMMIT.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void timeline_commit(void) {
+  uint32_t ticks = fx3_ticks() | 1;
+
+  if (!tl_cur.ticks[TL_FIRST_COMMIT])
+    tl_cur.ticks[TL_FIRST_COMMIT] = ticks;
+  tl_cur.ticks[TL_LAST_COMMIT] = ticks;
+  tl_cur.buffers++;
+}
+
+/**
+ *  @brief      close the current frame and move its record into the ring, the oldest
+ *              record is dropped when the ring is full.
+ *  @param[in]  frame   frame count.
+ *  @return     NULL.
+ */
+void timeline_end(uint32_t frame) {
+  uint32_t mask;
+  uint16_t slot;
+
+  timeline_mark(TL_FRAME_DONE);
+  mask = CyU3PVicDisableAllInterrupts();
+  if (tl_head - tl_tail == TIMELINE_RECORDS) {
+    tl_tail++;
+    tl_lost++;
+  }
+  slot = tl_head & (TIMELINE_RECORDS - 1);
+  CyU3PMemCopy((uint8_t *)&tl_ring[slot], (uint8_t *)&tl_cur, sizeof(tl_cur));
+  tl_ring[slot].frame = frame;
+  tl_head++;
+  CyU3PMemSet((uint8_t *)&tl_cur, 0, sizeof(tl_cur));
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      drop the points of an unfinished frame, at stream start.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void timeline_clear(void) {
+  uint32_t mask = CyU3PVicDisableAllInterrupts();
+
+  CyU3PMemSet((uint8_t *)&tl_cur, 0, sizeof(tl_cur));
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      take the oldest records out of the ring, packed as in timeline.h.
+ *  @param[out] buffer  max * TIMELINE_RECORD_LEN bytes.
+ *  @param[in]  max     max records.
+ *  @param[out] lost    records overwritten since the last read.
+ *  @return     records copied.
+ */
+uint16_t timeline_read(uint8_t *buffer, uint16_t max, uint32_t *lost) {
+  uint32_t mask;
+  uint16_t count = 0, slot;
+  uint8_t i;
+
+  mask = CyU3PVicDisableAllInterrupts();
+  *lost = tl_lost;
+  tl_lost = 0;
+  CyU3PVicEnableInterrupts(mask);
+  /* Records are only added by the UVC thread, one lock per record like trace_read. */
+  while (count < max) {
+    mask = CyU3PVicDisableAllInterrupts();
+    if (tl_tail == tl_head) {
+      CyU3PVicEnableInterrupts(mask);
+      break;
+    }
+    slot = tl_tail & (TIMELINE_RECORDS - 1);
+    put_be32(buffer, tl_ring[slot].frame);
+    buffer[4] = tl_ring[slot].buffers >> 8;
+    buffer[5] = tl_ring[slot].buffers & 0xFF;
+    buffer[6] = 0;
+    buffer[7] = 0;
+    for (i = 0; i < TL_POINTS; i++)
+      put_be32(&buffer[TIMELINE_HEADER_LEN + i * 4], tl_ring[slot].ticks[i]);
+    tl_tail++;
+    CyU3PVicEnableInterrupts(mask);
+    buffer += TIMELINE_RECORD_LEN;
+    count++;
+  }
+  return count;
+}
+
+#endif  // SENSOR_TIMELINE
@@ -38,6 +38,39 @@ void tlc59108_init(void) {
   tlc59108_reg_write(TLC59108_LEDOUT1, 0xAA);
 }
 
+/* Registers read before the driver is powered off for a suspend. */
+static uint8_t tlc59108_snapshot[TLC59108_SNAPSHOT_LEN];
+static CyBool_t tlc59108_saved = CyFalse;
+
+/**
+ *  @brief      save the LED state in RAM, the driver loses it when powered off for a suspend.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void tlc59108_suspend(void) {
+  // a retried suspend finds the driver powered off already
+  if (tlc59108_saved)
+    return;
+  Sensors_I2C_ReadReg(TLC59108_ADDR, TLC59108_AI_ALL | TLC59108_Mode1, TLC59108_SNAPSHOT_LEN,
+                      tlc59108_snapshot);
+  tlc59108_saved = CyTrue;
+}
+
+/**
+ *  @brief      write the saved LED state back in one burst, tlc59108_init without a snapshot.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void tlc59108_resume(void) {
+  if (!tlc59108_saved) {
+    tlc59108_init();
+    return;
+  }
+  Sensors_I2C_WriteReg(TLC59108_ADDR, TLC59108_AI_ALL | TLC59108_Mode1, TLC59108_SNAPSHOT_LEN,
+                       tlc59108_snapshot);
+  tlc59108_saved = CyFalse;
+}
+
 /**
  *  @brief      tlc59108 register read.
  *  @param[out] NULL.
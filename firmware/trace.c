@@ -0,0 +1,128 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+
+#include <stdarg.h>
+#include <cyu3os.h>
+#include <cyu3vic.h>
+#include <cyu3utils.h>
+#include "include/trace.h"
+#include "include/byte_order.h"
+
+static struct {
+  uint32_t time;
+  uint16_t id;
+  uint16_t seq;
+  uint32_t arg0;
+  uint32_t arg1;
+} trace_ring[TRACE_EVENTS];
+/* Free running counts, head - tail events are in the ring. */
+static uint32_t trace_head = 0, trace_tail = 0;
+static uint32_t trace_lost = 0;
+
+/* Caller holds the interrupt lock. */
+static void trace_put(uint16_t id, uint32_t arg0, uint32_t arg1) {
+  uint16_t slot = trace_head & (TRACE_EVENTS - 1);
+
+  if (trace_head - trace_tail == TRACE_EVENTS) {
+    trace_tail++;
+    trace_lost++;
+  }
+  trace_ring[slot].time = CyU3PGetTime();
+  trace_ring[slot].id = id;
+  trace_ring[slot].seq = trace_head;
+  trace_ring[slot].arg0 = arg0;
+  trace_ring[slot].arg1 = arg1;
+  trace_head++;
+}
+
+/**
+ *  @brief      record one event, the oldest one is dropped when the ring is full.
+ *  @param[in]  id      TRACE_EVT.
+ *  @param[in]  arg0    first argument.
+ *  @param[in]  arg1    second argument.
+ *  @return     NULL.
+ */
+void trace(uint16_t id, uint32_t arg0, uint32_t arg1) {
+  uint32_t mask = CyU3PVicDisableAllInterrupts();
+
+  trace_put(id, arg0, arg1);
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      record a tokenized log call, arguments past the second one follow in
+ *              TRACE_LOG_ARGS events, all under one lock so they stay together.
+ *  @param[in]  token   .log_fmt offset / 4, see debug.h.
+ *  @param[in]  nargs   number of 32 bit arguments.
+ *  @return     NULL.
+ */
+void trace_log(uint32_t token, uint8_t nargs, ...) {
+  uint32_t arg[TRACE_LOG_ARGS_MAX] = {0};
+  uint32_t mask;
+  uint8_t i;
+  va_list ap;
+
+  if (nargs > TRACE_LOG_ARGS_MAX)
+    nargs = TRACE_LOG_ARGS_MAX;
+  va_start(ap, nargs);
+  for (i = 0; i < nargs; i++)
+    arg[i] = va_arg(ap, uint32_t);
+  va_end(ap);
+  mask = CyU3PVicDisableAllInterrupts();
+  trace_put(TRACE_LOG | (token & TRACE_LOG_TOKEN_MAX), arg[0], arg[1]);
+  for (i = 2; i < nargs; i += 2)
+    trace_put(TRACE_LOG_ARGS, arg[i], arg[i + 1]);
+  CyU3PVicEnableInterrupts(mask);
+}
+
+/**
+ *  @brief      take the oldest events out of the ring, packed as in trace.h.
+ *  @param[out] buffer  max * TRACE_EVENT_LEN bytes.
+ *  @param[in]  max     max events.
+ *  @param[out] lost    events overwritten since the last read.
+ *  @return     events copied.
+ */
+uint16_t trace_read(uint8_t *buffer, uint16_t max, uint32_t *lost) {
+  uint32_t mask;
+  uint16_t count = 0, slot;
+
+  mask = CyU3PVicDisableAllInterrupts();
+  *lost = trace_lost;
+  trace_lost = 0;
+  CyU3PVicEnableInterrupts(mask);
+  /* One event per interrupt lock, the writers never wait for a whole drain. */
+  while (count < max) {
+    mask = CyU3PVicDisableAllInterrupts();
+    if (trace_tail == trace_head) {
+      CyU3PVicEnableInterrupts(mask);
+      break;
+    }
+    slot = trace_tail & (TRACE_EVENTS - 1);
+    put_be32(buffer, trace_ring[slot].time);
+    buffer[4] = trace_ring[slot].id >> 8;
+    buffer[5] = trace_ring[slot].id & 0xFF;
+    buffer[6] = trace_ring[slot].seq >> 8;
+    buffer[7] = trace_ring[slot].seq & 0xFF;
+    put_be32(&buffer[8], trace_ring[slot].arg0);
+    put_be32(&buffer[12], trace_ring[slot].arg1);
+    trace_tail++;
+    CyU3PVicEnableInterrupts(mask);
+    buffer += TRACE_EVENT_LEN;
+    count++;
+  }
+  return count;
+}
@@ -48,6 +48,16 @@
 #include "include/tlc59116.h"
 #include "include/tlc59108.h"
 #include "include/sensor_ar0141.h"
+#include "include/vendor_bulk.h"
+#include "include/kv_store.h"
+#include "include/fw_update.h"
+#include "include/device_info.h"
+#include "include/ctrl_async.h"
+#include "include/trace.h"
+#include "include/thread_prof.h"
+#include "include/histogram.h"
+#include "include/timeline.h"
+#include "include/dma_meter.h"
 
 /* debug_level :control debug log messages print level
  * 0 bit set: show debug level log
@@ -63,13 +73,22 @@ static int res_switch = 0;
 static CyU3PThread   uvcAppThread;                      /* UVC video streaming thread. */
 static CyU3PThread   uvcAppEP0Thread;                   /* UVC control request handling thread. */
 static CyU3PThread   Datahandle_Thread;                 /* IMU or other Data handle thread. */
+static CyU3PThread   vendorBulkThread;                  /* Vendor bulk command thread. */
+static CyU3PThread   ctrlWorkerThread;                  /* Slow work of control requests. */
 CyU3PEvent    glFxUVCEvent;                             /* Event group used to signal threads. */
 CyU3PDmaMultiChannel glChHandleUVCStream;               /* DMA multi-channel handle. */
 static CyBool_t glSuspendEnbl    = CyFalse;             /* Whether Suspend Mode is requested. */
 static CyBool_t glTriggerSuspend = CyFalse;             /* Initiate suspend entry . */
 static uint8_t  glWakeUpSrc      = 0;                   /* Wakeup source from Low Power State */
 static uint8_t  glWakeUpPol      = 0;                   /* Wakeup polarity from Low Power State */
-/* Current UVC control request fields. See USB specification for definition */
+/* fx3_ticks() of the USB suspend event and of the wake up, 0 when none is pending. The bus has
+ * to stay suspended SUSPEND_DELAY_US before the FX3 follows, a resume right after the event
+ * then costs no suspend cycle. */
+#define SUSPEND_DELAY_US  (2000)
+static volatile uint32_t suspendTicks = 0, resumeTicks = 0;
+/* The LED driver is powered off for a suspend and waits for tlc_restore. */
+static CyBool_t tlcPoweredOff = CyFalse;
+/* UVC control request the EP0 thread is handling. See USB specification for definition */
 uint8_t  bmReqType, bRequest;
 uint16_t wValue, wIndex, wLength;
 /* Whether USB connection is active */
@@ -94,17 +113,32 @@ static volatile CyBool_t gpif_initialized = CyFalse;
 /* Count of buffers received and committed during the current video frame. */
 static volatile uint16_t prodCount = 0, consCount = 0;
 static volatile uint16_t underrunCnt = 0;
+/* fx3_ticks() of the latency histograms: frame valid end, last commit after it and commit
+ * of each buffer in flight, indexed by its prodCount. fvTicks 0 means no frame yet. */
+#define BUF_TICKS_SLOTS  16     // power of 2, at least the DMA buffers of both sockets
+static volatile uint32_t fvTicks = 0, fvCommitTicks = 0;
+static volatile CyBool_t fvCommitted = CyFalse;
+static volatile uint32_t bufTicks[BUF_TICKS_SLOTS];
 
 /* IMU Header are prefixed at the top of each frame as timestamp */
 volatile char glIMUHeader[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
                                  'A', 'B', 'C', 'D', 'E', 'F'};
 
-#define IMU_POOL_LEN     640 * 2 - 4 - 17
+#define IMU_POOL_LEN     640 * 2 - 4 - 17 - FRAME_META_LEN
 static volatile CyBool_t addIMU = CyFalse;
 static volatile CyBool_t readyIMU = CyFalse;
+/* IMU idle mode, see IMU_IDLE_MS. CyU3PGetTime() of the last stream, IMU read or motion. */
+static volatile uint32_t imuActiveTime = 0;
+static CyBool_t imuIdle = CyFalse;
 static uint8_t IMU_pool_buf[IMU_POOL_LEN] =  {0};
 struct __kfifo  IMU_kfifo;
 volatile CyBool_t IR_image_trigger = CyFalse;
+/* Count of frames sent since stream start, reported in frame metadata */
+static volatile uint32_t frame_count = 0;
+/* Sensor readout window, frame size of the descriptors and the stream follows it */
+struct roi_t sensor_roi;
+/* Read mode of the committed frame index, enum READ_MODE */
+uint8_t stream_read_mode = READ_MODE_NORMAL;
 
 /* UVC Probe Control Settings for a USB 3.0 connection. */
 uint8_t glProbeCtrl[CY_FX_UVC_MAX_PROBE_SETTING] = {
@@ -180,6 +214,7 @@ uint8_t volatile glUVCHeader[CY_FX_UVC_MAX_HEADER] = {
  *****************************************************************************/
 static void usb_set_desc(void);
 static void CyFxPowerManage(void);
+static void tlc_restore(void);
 /**
  *  @brief      Add the IMU packet header to the top of the specified DMA buffer.
  *  @param[in]  buffer_p    Buffer pointer.
@@ -188,12 +223,12 @@ static void CyFxPowerManage(void);
 void CyFxUVCAddHeader_IMU(uint8_t *buffer_p) {
   uint32_t imu_fifo_len = 0;
   uint32_t imu_num = 0;
+  addIMU = CyFalse;
   if (!readyIMU) {
     CyU3PMemCopy(buffer_p, (uint8_t *)glIMUHeader, sizeof (glIMUHeader));
     return;
   }
 
-  addIMU = CyFalse;
   /* IMU Burst from image data byte operation
   ------------------------------------------------------------------------------------------
   |Byte location|image timestamp|IMU flag|IMU num|Single IMU Data 0| ... |Single IMU Data N|
@@ -225,12 +260,83 @@ void CyFxUVCAddHeader_IMU(uint8_t *buffer_p) {
   } else if  ((sensor_type == XPIRL2 || sensor_type == XPIRL3) && IR_image_trigger == CyTrue) {
     *(buffer_p + 0) = 'I';
     *(buffer_p + 1) = 'R';
-    sensor_err("IR image\r\n");
+    trace(TRACE_IR_IMAGE, frame_count, 0);
     IR_image_trigger = CyFalse;
   }
   return;
 }
 
+/**
+ *  @brief      Add the frame metadata to the first DMA buffer of a frame.
+ *  @param[in]  buffer_p    Buffer pointer.
+ *  @return     no return.
+ */
+void CyFxUVCAddFrameMeta(uint8_t *buffer_p) {
+  struct frame_meta_t meta;
+  uint32_t seq;
+
+  CyU3PMemSet((uint8_t *)(&meta), 0, sizeof (meta));
+  meta.magic[0] = 'M';
+  meta.magic[1] = 'D';
+  meta.version = FRAME_META_VERSION;
+  if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A)
+    meta.hdr_context = V034_HDR_OFF;
+  else
+    meta.hdr_context = V034_hdr_frame_context();
+  meta.frame_count[0] = frame_count >> 0;
+  meta.frame_count[1] = frame_count >> 8;
+  meta.frame_count[2] = frame_count >> 16;
+  meta.frame_count[3] = frame_count >> 24;
+  // readout follows the exposure, so the last pulse is the one that triggered this frame
+  seq = trigger_seq;
+  meta.trigger_seq[0] = seq >> 0;
+  meta.trigger_seq[1] = seq >> 8;
+  meta.trigger_seq[2] = seq >> 16;
+  meta.trigger_seq[3] = seq >> 24;
+  meta.read_mode = stream_read_mode;
+  CyU3PMemCopy(buffer_p + FRAME_META_OFFSET, (uint8_t *)(&meta), FRAME_META_LEN);
+}
+
+/**
+ *  @brief      Update frame size and interval of a probe control to its frame index.
+ *  @param[in]  probe       probe control settings.
+ *  @param[in]  fps         frame rate, 0 keeps the interval the host selected.
+ *  @return     no return.
+ */
+static void CyFxUVCUpdateProbeFrame(uint8_t *probe, uint8_t fps) {
+  uint32_t frame_size = (uint32_t)sensor_roi.width * sensor_roi.height * 2;
+  uint32_t interval;
+
+  if (probe[3] == FRAME_INDEX_BINNED)
+    frame_size = (uint32_t)(sensor_roi.width / 2) * (sensor_roi.height / 2) * 2;
+  /* Max video frame size in bytes */
+  probe[18] = frame_size & 0xFF;
+  probe[19] = (frame_size >> 8) & 0xFF;
+  probe[20] = (frame_size >> 16) & 0xFF;
+  probe[21] = (frame_size >> 24) & 0xFF;
+  if (fps) {
+    interval = 10000000 / fps;
+    probe[4] = interval & 0xFF;
+    probe[5] = (interval >> 8) & 0xFF;
+    probe[6] = (interval >> 16) & 0xFF;
+    probe[7] = (interval >> 24) & 0xFF;
+  }
+}
+
+/**
+ *  @brief      Update the probe control settings to the sensor window.
+ *  @param[in]  NULL.
+ *  @return     no return.
+ */
+void CyFxUVCUpdateProbeCtrl(void) {
+  /* Frame interval of usb3.0 follows the window, usb2.0 stays at 15 fps */
+  if (glProbeCtrl[3] == FRAME_INDEX_BINNED)
+    CyFxUVCUpdateProbeFrame(glProbeCtrl, sensor_roi.bin_fps);
+  else
+    CyFxUVCUpdateProbeFrame(glProbeCtrl, sensor_roi.fps);
+  CyFxUVCUpdateProbeFrame(glProbeCtrl20, 0);
+}
+
 /**
  *  @brief      Add the UVC packet header to the top of the specified DMA buffer.
  *  @param[in]  buffer_p    Buffer pointer.
@@ -274,6 +380,7 @@ static void UVC_USBEvent_CB(CyU3PUsbEventType_t evtype, uint16_t evdata) {
   /* USB Connect event */
   case CY_U3P_USB_EVENT_CONNECT:
     sensor_dbg("USB %s connect event detected\r\n", evdata == 1 ? "3.0" : "2.0");
+    trace(TRACE_USB_EVENT, evtype, evdata);
     break;
 
   /* USB Set Configuration event. evData provides the configuration number selected by the host */
@@ -285,20 +392,24 @@ static void UVC_USBEvent_CB(CyU3PUsbEventType_t evtype, uint16_t evdata) {
   /* USB Reset event. evData indicates whether 3.0 or 2.0 connection*/
   case CY_U3P_USB_EVENT_RESET:
     sensor_dbg("USB %s Reset Detect\r\n", evdata == 1 ? "3.0" : "2.0");
+    trace(TRACE_USB_EVENT, evtype, evdata);
     CyU3PGpifDisable(CyTrue);
     gpif_initialized = 0;
     streamingStarted = CyFalse;
     CyFxUVCApplnAbortHandler();
+    vendor_bulk_reset();
     glSuspendEnbl = CyFalse;
     break;
 
   /* USB Suspend event for both USB 2.0 and 3.0 connections. evData is not used */
   case CY_U3P_USB_EVENT_SUSPEND:
     sensor_dbg("USB SUSPEND event detected\r\n");
+    trace(TRACE_USB_EVENT, evtype, evdata);
     CyU3PGpifDisable(CyTrue);
     gpif_initialized = 0;
     streamingStarted = CyFalse;
     CyFxUVCApplnAbortHandler();
+    suspendTicks = fx3_ticks() | 1;
     glSuspendEnbl = CyTrue;
     break;
 
@@ -306,16 +417,19 @@ static void UVC_USBEvent_CB(CyU3PUsbEventType_t evtype, uint16_t evdata) {
   case CY_U3P_USB_EVENT_RESUME:
     glSuspendEnbl = CyFalse;
     sensor_dbg("USB RESUME event detected\r\n");
+    trace(TRACE_USB_EVENT, evtype, evdata);
     break;
 
   /* USB Disconnect event. The evData is not used */
   case CY_U3P_USB_EVENT_DISCONNECT:
     sensor_dbg("USB disconnect event detected\r\n");
+    trace(TRACE_USB_EVENT, evtype, evdata);
     CyU3PGpifDisable(CyTrue);
     gpif_initialized = 0;
     isUsbConnected   = CyFalse;
     streamingStarted = CyFalse;
     CyFxUVCApplnAbortHandler();
+    vendor_bulk_reset();
     if (glIsApplnActive) {
       /* enable USB LPM to receive a USB connect or reset event every time*/
       CyU3PUsbLPMEnable();
@@ -327,7 +441,7 @@ static void UVC_USBEvent_CB(CyU3PUsbEventType_t evtype, uint16_t evdata) {
    * The event data will provide the endpoint number. */
   case CY_U3P_USB_EVENT_EP_UNDERRUN:
     underrunCnt++;
-    sensor_err("EP Underrun on %d, totalcnt:%d\r\n", evdata, underrunCnt);
+    trace(TRACE_EP_UNDERRUN, evdata, underrunCnt);
     break;
 
   /* USB Set Interface event. The evData parameter provides the interface number and the selected
@@ -363,22 +477,26 @@ static void UVC_USBEvent_CB(CyU3PUsbEventType_t evtype, uint16_t evdata) {
 static CyBool_t UVC_USBSetup_CB(uint32_t setupdat0, uint32_t setupdat1) {
   CyBool_t uvcHandleReq = CyFalse;
   CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
+  /* Not bmReqType and friends, those belong to the EP0 thread, which may still be handling an
+   * earlier request. */
+  uint8_t  setupReqType, setupReq;
+  uint16_t setupValue, setupIndex;
 
   /* Obtain Request Type and Request */
-  bmReqType = (uint8_t)(setupdat0 & CY_FX_USB_SETUP_REQ_TYPE_MASK);
-  bRequest  = (uint8_t)((setupdat0 & CY_FX_USB_SETUP_REQ_MASK) >> 8);
-  wValue    = (uint16_t)((setupdat0 & CY_FX_USB_SETUP_VALUE_MASK) >> 16);
-  wIndex    = (uint16_t)(setupdat1 & CY_FX_USB_SETUP_INDEX_MASK);
-  wLength   = (uint16_t)((setupdat1 & CY_FX_USB_SETUP_LENGTH_MASK) >> 16);
+  setupReqType = (uint8_t)(setupdat0 & CY_FX_USB_SETUP_REQ_TYPE_MASK);
+  setupReq     = (uint8_t)((setupdat0 & CY_FX_USB_SETUP_REQ_MASK) >> 8);
+  setupValue   = (uint16_t)((setupdat0 & CY_FX_USB_SETUP_VALUE_MASK) >> 16);
+  setupIndex   = (uint16_t)(setupdat1 & CY_FX_USB_SETUP_INDEX_MASK);
 
   /* Check for UVC Class Requests */
-  switch (bmReqType) {
+  switch (setupReqType) {
   case CY_FX_USB_UVC_GET_REQ_TYPE:
   case CY_FX_USB_UVC_SET_REQ_TYPE:
-    /* UVC Specific requests are handled in the EP0 thread. */
-    switch (wIndex & 0xFF) {
+    /* UVC Specific requests are queued for the EP0 thread, which answers the latest one. */
+    switch (setupIndex & 0xFF) {
     case CY_FX_UVC_CONTROL_INTERFACE: {
       uvcHandleReq = CyTrue;
+      ctrl_setup_put(setupdat0, setupdat1);
       status = CyU3PEventSet(&glFxUVCEvent, CY_FX_UVC_VIDEO_CONTROL_REQUEST_EVENT,
                               CYU3P_EVENT_OR);
       if (status != CY_U3P_SUCCESS) {
@@ -390,6 +508,7 @@ static CyBool_t UVC_USBSetup_CB(uint32_t setupdat0, uint32_t setupdat1) {
 
     case CY_FX_UVC_STREAM_INTERFACE: {
       uvcHandleReq = CyTrue;
+      ctrl_setup_put(setupdat0, setupdat1);
       status = CyU3PEventSet(&glFxUVCEvent, CY_FX_UVC_VIDEO_STREAM_REQUEST_EVENT,
                               CYU3P_EVENT_OR);
       if (status != CY_U3P_SUCCESS) {
@@ -406,10 +525,10 @@ static CyBool_t UVC_USBSetup_CB(uint32_t setupdat0, uint32_t setupdat1) {
     break;
 
   case CY_FX_USB_SET_INTF_REQ_TYPE:
-    if (bRequest == CY_FX_USB_SET_INTERFACE_REQ) {
+    if (setupReq == CY_FX_USB_SET_INTERFACE_REQ) {
       /* MAC OS sends Set Interface Alternate Setting 0 command after
        * stopping to stream. This application needs to stop streaming. */
-      if ((wIndex == CY_FX_UVC_STREAM_INTERFACE) && (wValue == 0)) {
+      if ((setupIndex == CY_FX_UVC_STREAM_INTERFACE) && (setupValue == 0)) {
         /* Stop GPIF state machine to stop data transfers through FX3 */
         sensor_dbg("Alternate setting 0..\r\n");
         CyU3PGpifDisable(CyTrue);
@@ -438,8 +557,8 @@ static CyBool_t UVC_USBSetup_CB(uint32_t setupdat0, uint32_t setupdat1) {
     break;
 
   case CY_U3P_USB_TARGET_ENDPT:
-    if (bRequest == CY_U3P_USB_SC_CLEAR_FEATURE) {
-      if (wIndex == CY_FX_EP_BULK_VIDEO) {
+    if (setupReq == CY_U3P_USB_SC_CLEAR_FEATURE) {
+      if (setupIndex == CY_FX_EP_BULK_VIDEO) {
         /* Windows OS sends Clear Feature Request after it stops streaming,
          * however MAC OS sends clear feature request right after it sends a
          * Commit -> SET_CUR request. Hence, stop streaming only of streaming
@@ -477,6 +596,12 @@ static CyBool_t UVC_USBSetup_CB(uint32_t setupdat0, uint32_t setupdat1) {
           uvcHandleReq = CyTrue;
           CyU3PUsbAckSetup();
         }
+      } else if (setupIndex == CY_FX_EP_PRODUCER || setupIndex == CY_FX_EP_CONSUMER) {
+        /* Host gave up on a vendor bulk command, drop its leftovers. */
+        vendor_bulk_reset();
+        CyU3PUsbStall(setupIndex, CyFalse, CyTrue);
+        uvcHandleReq = CyTrue;
+        CyU3PUsbAckSetup();
       }
     }
     break;
@@ -493,7 +618,13 @@ static CyBool_t UVC_USBSetup_CB(uint32_t setupdat0, uint32_t setupdat1) {
 void CyFxUvcApplnDmaCallback(CyU3PDmaMultiChannel *multiChHandle, CyU3PDmaCbType_t type,
                               CyU3PDmaCBInput_t *input) {
   if (type == CY_U3P_DMA_CB_CONS_EVENT) {
+    uint32_t now = fx3_ticks(), commit = bufTicks[consCount & (BUF_TICKS_SLOTS - 1)];
+
+    hist_add(HIST_BUF_LATENCY, TICKS_TO_US(now - commit));
+    meter_consume(commit, now);
     consCount++;
+    if (hitFV && consCount == prodCount)
+      TIMELINE_MARK(TL_LAST_CONSUMED);
     streamingStarted = CyTrue;
   }
 }
@@ -537,9 +668,10 @@ static uint8_t CyFxUvcAppCommitEOF(CyU3PDmaMultiChannel *handle, uint8_t stateId
      * function to succeed one more time with less than full producer buffer count */
     apiRetStatus = CyU3PDmaMultiChannelSetWrapUp(handle, socket);
     if (apiRetStatus != CY_U3P_SUCCESS) {
-      sensor_err("Channel Set WrapUp failed, Error code = %d\r\n", apiRetStatus);
+      trace(TRACE_WRAPUP_FAIL, apiRetStatus, socket);
       CyFxAppErrorHandler(apiRetStatus);
     }
+    TIMELINE_MARK(TL_WRAPUP);
   }
 
   return 0;
@@ -549,10 +681,16 @@ static uint8_t CyFxUvcAppCommitEOF(CyU3PDmaMultiChannel *handle, uint8_t stateId
 void CyFxGpifCB(CyU3PGpifEventType event, uint8_t currentState) {
   if (event == CYU3P_GPIF_EVT_SM_INTERRUPT) {
     // sensor_dbg("CYU3P_GPIF_EVT_SM_INTERRUPT...\r\n");
+    uint32_t now = fx3_ticks();
+
+    if (fvTicks)
+      hist_add(HIST_FRAME_INTERVAL, TICKS_TO_US(now - fvTicks));
+    fvTicks = now;
+    TIMELINE_MARK(TL_FRAME_VALID);
     hitFV = CyTrue;
     // sensor_info("a frame Transfer prodCount:%d consCount:%d\r\n", prodCount, consCount);
     if (CyFxUvcAppCommitEOF(&glChHandleUVCStream, currentState) != CY_U3P_SUCCESS)
-      sensor_err("Commit EOF failed!\n");
+      trace(TRACE_COMMIT_EOF_FAIL, currentState, 0);
   }
 }
 
@@ -613,6 +751,27 @@ static void CyFxUvcAppPibCallback(CyU3PPibIntrType cbType, uint16_t cbArg) {
 }
 #endif
 
+/* Load the settings a host stored in the key-value store over the defaults set in main. */
+static void CyFxUVCRestoreSettings(void) {
+  uint8_t value[KV_VALUE_MAX];
+  uint8_t len;
+  uint32_t tmp;
+
+  if (kv_get(KV_KEY_FIRMWARE_FLAG, value, &len) == KV_OK && len == 4) {
+    tmp = value[0] << 24 | value[1] << 16 | value[2] << 8 | value[3];
+    CyU3PMemCopy((uint8_t *)(&firmware_ctrl_flag), (uint8_t *)(&tmp), sizeof(firmware_ctrl_flag));
+    debug_level = firmware_ctrl_flag.log_dbg | firmware_ctrl_flag.log_info << 1 \
+                | firmware_ctrl_flag.log_dump << 2;
+    sensor_info("restore firmware_ctrl_flag: 0x%x\r\n", firmware_ctrl_flag);
+  }
+  if ((sensor_type == XPIRL2 || sensor_type == XPIRL3) &&
+      kv_get(KV_KEY_IR_CTRL, value, &len) == KV_OK && len == 4) {
+    tmp = value[0] << 24 | value[1] << 16 | value[2] << 8 | value[3];
+    CyU3PMemCopy((uint8_t *)(&XPIRLx_IR_ctrl), (uint8_t *)(&tmp), sizeof(XPIRLx_IR_ctrl));
+    sensor_info("restore IR control: 0x%x\r\n", XPIRLx_IR_ctrl);
+  }
+}
+
 /* This function initializes the USB Module, creates event group,
    sets the enumeration descriptors, configures the Endpoints and
    configures the DMA module for the UVC Application */
@@ -639,6 +798,9 @@ static void CyFxUVCApplnInit(void) {
 
   /* Initialize FX3 GPIO module. */
   fx3_gpio_module_init();
+  prof_init();
+  fx3_timestamp_init();
+  sensor_sleep_init();
 
   /* Initialize the P-port. */
   pibclock.clkDiv      = 2;
@@ -671,6 +833,11 @@ static void CyFxUVCApplnInit(void) {
   if (status != CY_U3P_SUCCESS) {
     return;
   }
+  calib_cache_load();
+  kv_init();
+  fw_update_resume();
+  device_info_load();
+  CyFxUVCRestoreSettings();
   // Initialize the INV sensor
   status = icm_init();
   if (status != CY_U3P_SUCCESS) {
@@ -692,6 +859,11 @@ static void CyFxUVCApplnInit(void) {
     /* Initialize v034/v024 senosr */
     V034_sensor_init();
   }
+  if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A)
+    AR0141_roi_default(&sensor_roi);
+  else
+    V034_roi_default(&sensor_roi);
+  CyFxUVCUpdateProbeCtrl();
   CyU3PThreadSleep(10);
   // MT9V024/034 AR0141's standby mode(ACTIVE HIGH)
   sensor_set_power_mode(SENSOR_STANDBY);
@@ -734,10 +906,9 @@ static void CyFxUVCApplnInit(void) {
     CyFxAppErrorHandler(apiRetStatus);
   }
 
-  /* Configure the status interrupt endpoint.
-     Note: This endpoint is not being used by the application as of now. This can be used in case
-     UVC device needs to notify the host about any error conditions. A MANUAL_OUT DMA channel
-     can be associated with this endpoint and used to send these data packets.
+  /* Configure the status interrupt endpoint. The control worker sends UVC status packets on it
+     when a queued control job is done, see ctrl_async.h, the data thread when the idle IMU
+     woke on motion.
   */
   endPointConfig.enable   = 1;
   endPointConfig.epType   = CY_U3P_USB_EP_INTR;
@@ -752,10 +923,12 @@ static void CyFxUVCApplnInit(void) {
     CyFxAppErrorHandler(apiRetStatus);
   }
 
+  ctrl_async_init();
+
   /* Create a DMA Manual channel for sending the video data to the USB host. */
   dmaMultiConfig.size           = CY_FX_UVC_STREAM_BUF_SIZE;
   dmaMultiConfig.count          = CY_FX_UVC_STREAM_BUF_COUNT;
-  dmaMultiConfig.validSckCount  = 2;
+  dmaMultiConfig.validSckCount  = CY_FX_UVC_STREAM_SCK_COUNT;
   dmaMultiConfig.prodSckId[0]   = (CyU3PDmaSocketId_t)CY_U3P_PIB_SOCKET_0;
   dmaMultiConfig.prodSckId[1]   = (CyU3PDmaSocketId_t)CY_U3P_PIB_SOCKET_1;
   dmaMultiConfig.consSckId[0]   = (CyU3PDmaSocketId_t)(CY_U3P_UIB_SOCKET_CONS_0
@@ -775,6 +948,9 @@ static void CyFxUVCApplnInit(void) {
     CyFxAppErrorHandler(apiRetStatus);
   }
 
+  /* Endpoints and DMA channels of the vendor bulk interface. */
+  vendor_bulk_init();
+
   /* Enable USB connection from the FX3 device, preferably at USB 3.0 speed. */
   apiRetStatus = CyU3PConnectState(CyTrue, CyTrue);
   if (apiRetStatus != CY_U3P_SUCCESS) {
@@ -794,9 +970,9 @@ static void usb_set_desc(void) {
 
   /* Configuration descriptors. */
   CyU3PUsbSetDesc(CY_U3P_USB_SET_HS_CONFIG_DESCR, 0, (uint8_t *)CyFxUSBHSConfigDscr);
-  update_HS_config_dscr(sensor_type);
+  update_HS_config_dscr();
   CyU3PUsbSetDesc(CY_U3P_USB_SET_FS_CONFIG_DESCR, 0, (uint8_t *)CyFxUSBFSConfigDscr);
-  update_SS_config_dscr(sensor_type);
+  update_SS_config_dscr();
   CyU3PUsbSetDesc(CY_U3P_USB_SET_SS_CONFIG_DESCR, 0, (uint8_t *)CyFxUSBSSConfigDscr);
 
   /* String Descriptors */
@@ -847,7 +1023,7 @@ void UVC_AppThread_Entry(uint32_t input) {
 #endif
   uint32_t current_time = 0;
   uint32_t last_time = 0;
-  uint32_t cols;
+  uint32_t cols = 0;
   uint32_t line_start = 0;
   uint16_t line_num = 0;
   /* Initialize the Uart Debug Module */
@@ -858,6 +1034,7 @@ void UVC_AppThread_Entry(uint32_t input) {
   CyFxUVCApplnInit();
 
   sensor_dbg("start uvc app thread\r\n");
+  trace(TRACE_BOOT, sensor_type, 0);
   sensor_info("check firmware_ctrl_flag:0x%x\r\n", firmware_ctrl_flag);
 /*
    This thread continually checks whether video streaming is enabled, and commits video data if so.
@@ -874,11 +1051,6 @@ void UVC_AppThread_Entry(uint32_t input) {
    This sequence ensures that we do not get stuck in a loop where we are trying to send data instead
    of handling the abort request.
  */
-  if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
-    cols = 1280;
-  } else {
-    cols = 640;
-  }
   int m = 0;
   for (;;) {
     /* Waiting for the Video Stream Event */
@@ -890,9 +1062,18 @@ void UVC_AppThread_Entry(uint32_t input) {
                                                      CYU3P_NO_WAIT);
       if (apiRetStatus == CY_U3P_SUCCESS) {
         // sensor_dbg("CY_FX_UVC_STREAM_EVENT got buffer\r\n");
+        if (prodCount == 0) {
+          CyFxUVCAddFrameMeta(produced_buffer.buffer);
+          // the window and read mode only change while the stream is stopped
+          cols = sensor_roi.width;
+          if (stream_read_mode != READ_MODE_NORMAL)
+            cols = sensor_roi.width / 2;
+        }
+        // the IMU burst goes into the first buffer of a frame only, a small window fits a frame
+        // into one short buffer and ROI_MIN_WIDTH and ROI_MIN_HEIGHT keep it above 1280 bytes
+        if (addIMU && prodCount == 0)
+          CyFxUVCAddHeader_IMU(produced_buffer.buffer);
         if (produced_buffer.count == CY_FX_UVC_BUF_FULL_SIZE) {
-          if (addIMU)
-            CyFxUVCAddHeader_IMU(produced_buffer.buffer);
           CyFxUVCAddHeader(produced_buffer.buffer - CY_FX_UVC_MAX_HEADER, CY_FX_UVC_HEADER_FRAME);
         } else {
           /*
@@ -904,7 +1085,8 @@ void UVC_AppThread_Entry(uint32_t input) {
         }
         for (;;) {
           m = line_start - CY_FX_UVC_BUF_FULL_SIZE * prodCount;
-          if (line_num > 5) {
+          // short binned lines must not stamp into the IMU and metadata area
+          if (line_num > 5 && line_start >= FRAME_META_OFFSET + FRAME_META_LEN) {
             *(produced_buffer.buffer + m)  = line_num & 0xFF;
           }
           line_num++;
@@ -919,14 +1101,25 @@ void UVC_AppThread_Entry(uint32_t input) {
                        produced_buffer.count + CY_FX_UVC_MAX_HEADER, 0);
         if (apiRetStatus != CY_U3P_SUCCESS) {
           prodCount--;
-          sensor_err("Error in multichannelcommitbuffer: Code = %d, size = %x, dmaDone %x\r\n",
-                    apiRetStatus, produced_buffer.count, prodCount - consCount);
+          trace(TRACE_COMMIT_ERROR, apiRetStatus, produced_buffer.count);
+        } else {
+          TIMELINE_COMMIT();
+          bufTicks[(prodCount - 1) & (BUF_TICKS_SLOTS - 1)] = fx3_ticks();
+          meter_commit(produced_buffer.count + CY_FX_UVC_MAX_HEADER, prodCount - consCount,
+                       bufTicks[(prodCount - 1) & (BUF_TICKS_SLOTS - 1)]);
+          if (hitFV) {
+            fvCommitTicks = bufTicks[(prodCount - 1) & (BUF_TICKS_SLOTS - 1)];
+            fvCommitted = CyTrue;
+          }
         }
       }
 
       /* If we have the end of frame signal and all of the committed data has been read by the USB host;
                we can reset the DMA channel and prepare for the next video frame. */
       if ((hitFV) && (prodCount == consCount)) {
+        // a frame of whole buffers is committed before frame valid ends, no wait then
+        hist_add(HIST_FV_TO_COMMIT, fvCommitted ? TICKS_TO_US(fvCommitTicks - fvTicks) : 0);
+        fvCommitted = CyFalse;
         prodCount = 0;
         consCount = 0;
         line_start = 0;
@@ -936,9 +1129,19 @@ void UVC_AppThread_Entry(uint32_t input) {
 #ifdef BACKFLOW_DETECT
         back_flow_detected = 0;
 #endif
+        frame_count++;
+        meter_frame(frame_count);
+        if (resumeTicks) {
+          hist_add(HIST_RESUME_FRAME, TICKS_TO_US(fx3_ticks() - resumeTicks));
+          resumeTicks = 0;
+        }
+        /* switch HDR context in vblank, before the GPIF is armed for the next frame */
+        if (v034_hdr.enable)
+          V034_hdr_frame_end();
+        /* one trace event per frame, gated so the frames do not push other events out */
         if (firmware_ctrl_flag.print_frame_rate) {
           current_time = CyU3PGetTime();
-          sensor_info("a frame Transfer time:%d ms\r\n", (current_time - last_time));
+          trace(TRACE_FRAME_END, frame_count, current_time - last_time);
           last_time = current_time;
         }
         // sensor_dbg("<hitFV && (prodCount == consCount)>\r\n");
@@ -961,6 +1164,8 @@ void UVC_AppThread_Entry(uint32_t input) {
         /* Jump to the start state of the GPIF state machine. 257 is used as an
                    arbitrary invalid state (> 255) number. */
         CyU3PGpifSMSwitch(257, 0, 257, 0, 2);
+        TIMELINE_END(frame_count);
+        sensor_sleep_frame_end();
       }
     } else {
       // Sid. Force the two counters in sync
@@ -976,6 +1181,8 @@ void UVC_AppThread_Entry(uint32_t input) {
 
         IMU_kfifo.kfifo_flag &= ~KFIFO_IS_START;
         sensor_dbg("got CY_FX_UVC_STREAM_ABORT_EVENT \r\n");
+        trace(TRACE_STREAM_ABORT, frame_count, 0);
+        sensor_sleep_stop();
         if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
           AR0141_stream_stop(AR0141_ADDR_WR);
           if (sensor_type == XPIRL2)
@@ -1005,6 +1212,12 @@ void UVC_AppThread_Entry(uint32_t input) {
         CyU3PEventGet(&glFxUVCEvent, CY_FX_UVC_STREAM_EVENT, CYU3P_EVENT_AND, &flag,
                       CYU3P_WAIT_FOREVER);
         sensor_dbg("got CY_FX_UVC_STREAM_EVENT idle?\r\n");
+        trace(TRACE_STREAM_START, 0, 0);
+        // the first frame interval starts at the first frame
+        fvTicks = 0;
+        fvCommitted = CyFalse;
+        TIMELINE_CLEAR();
+        meter_start();
         /* Set DMA Channel transfer size, first producer socket */
         apiRetStatus = CyU3PDmaMultiChannelSetXfer(&glChHandleUVCStream, 0, 0);
         /* apiRetStatus will be CY_U3P_ERROR_ALREADY_STARTED occasionally. It is known bug but
@@ -1348,6 +1561,42 @@ static void Handle_ExtensionUnit_Rqts(void) {
   case CY_FX_UVC_XU_CALIB_RW:
     EU_Rqts_calib_RW(bRequest);
     break;
+  case CY_FX_UVC_XU_HDR_RW:
+    EU_Rqts_hdr_RW(bRequest);
+    break;
+  case CY_FX_UVC_XU_TRIGGER_RW:
+    EU_Rqts_trigger_RW(bRequest);
+    break;
+  case CY_FX_UVC_XU_ROI_RW:
+    EU_Rqts_roi_RW(bRequest);
+    break;
+  case CY_FX_UVC_XU_TEST_PATTERN_RW:
+    EU_Rqts_test_pattern_RW(bRequest);
+    break;
+  case CY_FX_UVC_XU_REG_BATCH_RW:
+    EU_Rqts_reg_batch_RW(bRequest);
+    break;
+  case CY_FX_UVC_XU_CALIB_INFO_RW:
+    EU_Rqts_calib_info(bRequest);
+    break;
+  case CY_FX_UVC_XU_KV_RW:
+    EU_Rqts_kv_RW(bRequest);
+    break;
+  case CY_FX_UVC_XU_DEVICE_INFO_RW:
+    EU_Rqts_device_info(bRequest);
+    break;
+  case CY_FX_UVC_XU_CTRL_ASYNC_RW:
+    EU_Rqts_ctrl_async(bRequest);
+    break;
+  case CY_FX_UVC_XU_PROFILE_RW:
+    EU_Rqts_profile(bRequest);
+    break;
+  case CY_FX_UVC_XU_HIST_RW:
+    EU_Rqts_hist(bRequest);
+    break;
+  case CY_FX_UVC_XU_DMA_METER_RW:
+    EU_Rqts_dma_meter(bRequest);
+    break;
   default:
     sensor_err("invalid extension cmd: 0x%x\r\n", wValue);
     CyU3PUsbStall(0, CyTrue, CyFalse);
@@ -1363,6 +1612,8 @@ static void Handle_VideoStreaming_Rqts(void) {
   uint16_t status = 0;
   uint16_t readCount;
   uint8_t Ep0Buffer[32];
+  uint8_t binned, bin_fps = 0;
+  uint32_t interval;
 
   switch (wValue) {
   case CY_FX_UVC_PROBE_CTRL:
@@ -1407,7 +1658,12 @@ static void Handle_VideoStreaming_Rqts(void) {
           glProbeCtrl[5] = glCommitCtrl[5];
           glProbeCtrl[6] = glCommitCtrl[6];
           glProbeCtrl[7] = glCommitCtrl[7];
+        } else {
+          glProbeCtrl20[2] = glCommitCtrl[2];
+          glProbeCtrl20[3] = glCommitCtrl[3];
         }
+        /* Frame size follows the frame index the host probes */
+        CyFxUVCUpdateProbeCtrl();
       }
       break;
     default:
@@ -1456,11 +1712,32 @@ static void Handle_VideoStreaming_Rqts(void) {
         res_switch++;
         sensor_set_power_mode(SENSOR_ACTIVE);
         CyU3PThreadSleep(10);
+        binned = (glCommitCtrl[3] == FRAME_INDEX_BINNED);
+        // binned window runs at the committed interval, blanking stretches the frame
+        interval = glCommitCtrl[4] | glCommitCtrl[5] << 8 |
+                   glCommitCtrl[6] << 16 | (uint32_t)glCommitCtrl[7] << 24;
+        if (interval) {
+          interval = (10000000 + interval / 2) / interval;
+          bin_fps = interval > 0xFF ? 0xFF : interval;
+        }
         if (sensor_type == XPIRL2 || sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
+          AR0141_set_subsample(binned, &sensor_roi, bin_fps);
+          stream_read_mode = binned ? READ_MODE_SKIP2 : READ_MODE_NORMAL;
           AR0141_stream_start(AR0141_ADDR_WR);
+          // Lights are closed on every stream stop, bring back a stored IR mode
+          if (XPIRLx_IR_ctrl.Set_infrared_mode || XPIRLx_IR_ctrl.Set_structured_mode) {
+            if (sensor_type == XPIRL2)
+              xpril2_proc_ir_ctl(&XPIRLx_IR_ctrl);
+            else if (sensor_type == XPIRL3)
+              xpril3_proc_ir_ctl(&XPIRLx_IR_ctrl);
+          }
         } else {
+          V034_set_binning(binned, &sensor_roi, bin_fps);
+          stream_read_mode = binned ? READ_MODE_BIN2 : READ_MODE_NORMAL;
+          V034_hdr_stream_start();
           V034_stream_start(SENSOR_ADDR_WR);
         }
+        frame_count = 0;
         status = kfifo_init(&IMU_kfifo, (void *)IMU_pool_buf, IMU_POOL_LEN);
         if (status)
           sensor_err("IMU kfifo init error!\r\n");
@@ -1492,6 +1769,7 @@ static void Handle_VideoStreaming_Rqts(void) {
 void UVC_EP0Thread_Entry(uint32_t input) {
   uint32_t eventMask = CY_FX_UVC_VIDEO_CONTROL_REQUEST_EVENT | CY_FX_UVC_VIDEO_STREAM_REQUEST_EVENT;
   uint32_t eventFlag;
+  uint32_t setupdat0, setupdat1, setupTime;
 
   sensor_dbg("UVC control request proceeding thread\r\n");
   for (;;) {
@@ -1507,57 +1785,143 @@ void UVC_EP0Thread_Entry(uint32_t input) {
         }
       }
 
-      if (eventFlag & CY_FX_UVC_VIDEO_CONTROL_REQUEST_EVENT) {
-        switch ((wIndex >> 8)) {
-        case CY_FX_UVC_PROCESSING_UNIT_ID:
-          // sensor_dbg("UVC Handle Processing Unit Rqts\r\n");
-          Handle_ProcessingUnit_Rqts();
-          break;
-
-        case CY_FX_UVC_CAMERA_TERMINAL_ID:
-          // sensro_dbg("CY_FX_UVC_CAMERA_TERMINAL_ID\r\n");
-          Handle_CameraTerminal_Rqts();
-          break;
-
-        case CY_FX_UVC_INTERFACE_CTRL:
-          sensor_dbg("<CY_FX_UVC_INTERFACE_CTRL>\r\n");
-          Handle_InterfaceCtrl_Rqts();
-          break;
-
-        case CY_FX_UVC_EXTENSION_UNIT_ID:
-          // sensor_dbg("<CY_FX_UVC_EXTENSION_UNIT_ID>\r\n");
-          Handle_ExtensionUnit_Rqts();
-          break;
-
-        default:
-          /* Unsupported request. Fail by stalling the control endpoint. */
-          sensor_err("<<Unsupported request>>\r\n");
-          CyU3PUsbStall(0, CyTrue, CyFalse);
-          break;
-        }
-      }
+      /* Only the latest setup packet is pending on the host, older ones are dropped. */
+      while (ctrl_setup_get(&setupdat0, &setupdat1, &setupTime)) {
+        bmReqType = (uint8_t)(setupdat0 & CY_FX_USB_SETUP_REQ_TYPE_MASK);
+        bRequest  = (uint8_t)((setupdat0 & CY_FX_USB_SETUP_REQ_MASK) >> 8);
+        wValue    = (uint16_t)((setupdat0 & CY_FX_USB_SETUP_VALUE_MASK) >> 16);
+        wIndex    = (uint16_t)(setupdat1 & CY_FX_USB_SETUP_INDEX_MASK);
+        wLength   = (uint16_t)((setupdat1 & CY_FX_USB_SETUP_LENGTH_MASK) >> 16);
+
+        if ((wIndex & 0xFF) == CY_FX_UVC_CONTROL_INTERFACE) {
+          switch ((wIndex >> 8)) {
+          case CY_FX_UVC_PROCESSING_UNIT_ID:
+            // sensor_dbg("UVC Handle Processing Unit Rqts\r\n");
+            Handle_ProcessingUnit_Rqts();
+            break;
+
+          case CY_FX_UVC_CAMERA_TERMINAL_ID:
+            // sensro_dbg("CY_FX_UVC_CAMERA_TERMINAL_ID\r\n");
+            Handle_CameraTerminal_Rqts();
+            break;
 
-      if (eventFlag & CY_FX_UVC_VIDEO_STREAM_REQUEST_EVENT) {
-        if (wIndex != CY_FX_UVC_STREAM_INTERFACE) {
-          sensor_err("<stream_error>\r\n");
-          CyU3PUsbStall(0, CyTrue, CyFalse);
+          case CY_FX_UVC_INTERFACE_CTRL:
+            sensor_dbg("<CY_FX_UVC_INTERFACE_CTRL>\r\n");
+            Handle_InterfaceCtrl_Rqts();
+            break;
+
+          case CY_FX_UVC_EXTENSION_UNIT_ID:
+            // sensor_dbg("<CY_FX_UVC_EXTENSION_UNIT_ID>\r\n");
+            Handle_ExtensionUnit_Rqts();
+            break;
+
+          default:
+            /* Unsupported request. Fail by stalling the control endpoint. */
+            sensor_err("<<Unsupported request>>\r\n");
+            CyU3PUsbStall(0, CyTrue, CyFalse);
+            break;
+          }
         } else {
-          sensor_dbg("<stream_request:>\r\n");
-          Handle_VideoStreaming_Rqts();
+          if (wIndex != CY_FX_UVC_STREAM_INTERFACE) {
+            sensor_err("<stream_error>\r\n");
+            CyU3PUsbStall(0, CyTrue, CyFalse);
+          } else {
+            sensor_dbg("<stream_request:>\r\n");
+            Handle_VideoStreaming_Rqts();
+          }
         }
+        ctrl_setup_done(setupTime);
       }
     }
     /* Allow other ready threads to run. */
     CyU3PThreadRelinquish();
   }
 }
+/**
+ *  @brief      keep the IMU out of idle mode, or bring it back, for a host reading it.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void imu_keep_awake(void) {
+  imuActiveTime = CyU3PGetTime();
+}
+
+/**
+ *  @brief      stop the loop sample and put the IMU into low power accel mode with wake on
+ *              motion, called by the data thread.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+static void imu_idle_enter(void) {
+  if (imuIdle || !readyIMU)
+    return;
+  if (icm_lp_motion_interrupt(IMU_WOM_THRESH_MG, IMU_WOM_TIME_MS, IMU_WOM_LPA_HZ)) {
+    sensor_err("IMU wake on motion failed\r\n");
+    // try again after IMU_IDLE_MS
+    imuActiveTime = CyU3PGetTime();
+    return;
+  }
+  // drop edges of data ready pulses before the mode change
+  CyU3PEventSet(&glFxUVCEvent, ~(CY_FX_UVC_IMU_MOTION_EVENT), CYU3P_EVENT_AND);
+  fx3_imu_int_enable(CyTrue);
+  imuIdle = CyTrue;
+  trace(TRACE_IMU_IDLE, CyU3PGetTime() - imuActiveTime, 0);
+}
+
+/**
+ *  @brief      restore full rate sampling of the IMU, a wake on motion is reported to the host
+ *              by a control change status packet of the IMU burst XU.
+ *  @param[in]  motion  CyTrue if the IMU woke on motion.
+ *  @return     NULL.
+ */
+static void imu_idle_exit(CyBool_t motion) {
+  uint32_t t = CyU3PGetTime();
+  uint8_t value[4];
+
+  fx3_imu_int_enable(CyFalse);
+  if (icm_lp_motion_interrupt(0, 0, 0))
+    sensor_err("IMU full rate restore failed\r\n");
+  imuIdle = CyFalse;
+  trace(TRACE_IMU_WAKE, motion, t - imuActiveTime);
+  imuActiveTime = t;
+  if (motion) {
+    value[0] = t >> 24;
+    value[1] = t >> 16;
+    value[2] = t >> 8;
+    value[3] = t >> 0;
+    ctrl_status_send(CY_FX_UVC_XU_REG_BURST, value, sizeof(value));
+  }
+}
+
+/**
+ *  @brief      move the IMU in or out of idle mode, called by the data thread.
+ *  @param[out] NULL.
+ *  @return     CyTrue if the IMU is idle and must not be sampled.
+ */
+static CyBool_t imu_idle_update(void) {
+  uint32_t flag;
+
+  if (CyU3PEventGet(&glFxUVCEvent, CY_FX_UVC_STREAM_EVENT, CYU3P_EVENT_AND, &flag,
+                    CYU3P_NO_WAIT) == CY_U3P_SUCCESS)
+    imuActiveTime = CyU3PGetTime();
+  if (!imuIdle) {
+    if (CyU3PGetTime() - imuActiveTime >= IMU_IDLE_MS)
+      imu_idle_enter();
+  } else if (CyU3PEventGet(&glFxUVCEvent, CY_FX_UVC_IMU_MOTION_EVENT, CYU3P_EVENT_AND_CLEAR,
+                           &flag, CYU3P_NO_WAIT) == CY_U3P_SUCCESS) {
+    imu_idle_exit(CyTrue);
+  } else if (CyU3PGetTime() - imuActiveTime < IMU_IDLE_MS) {
+    imu_idle_exit(CyFalse);
+  }
+  return imuIdle;
+}
+
 /*
  * Entry function for the Data handle thread.
  */
 void Data_handle_Thread_Entry(uint32_t input) {
   CyU3PReturnStatus_t status = CY_U3P_SUCCESS;
-  int count = 0;
-  uint32_t flag;
+  uint32_t flag, imuTicks = 0;
   sensor_dbg("start Data handle thread!\r\n");
   for (;;) {
     // Only XPIRL2 use this control method to turn on/off LIMA light As it's not a good method.
@@ -1574,12 +1938,28 @@ void Data_handle_Thread_Entry(uint32_t input) {
         CYU3P_EVENT_AND_CLEAR, &flag, CYU3P_NO_WAIT) == CY_U3P_SUCCESS) {
         sensor_err("detect interrupt signal\r\n");
     }
-    if (glIsApplnActive && readyIMU == CyTrue) {
+    if (CyU3PEventGet(&glFxUVCEvent, CY_FX_UVC_REENUM_EVENT_FLAG, \
+        CYU3P_EVENT_AND_CLEAR, &flag, CYU3P_NO_WAIT) == CY_U3P_SUCCESS) {
+        // let the status stage of the control request that changed the descriptors finish
+        CyU3PThreadSleep(100);
+        sensor_info("re-enumerate for new descriptors\r\n");
+        CyU3PConnectState(CyFalse, CyTrue);
+        CyU3PThreadSleep(100);
+        CyU3PConnectState(CyTrue, CyTrue);
+        CyU3PUsbLPMDisable();
+    }
+    if (glIsApplnActive && readyIMU == CyTrue && !imu_idle_update()) {
 #ifdef IMU_LOOP_SAMPLE
       uint8_t raw_IMU_data[14];
       status = icm_get_sensor_reg(raw_IMU_data, 0);
       if (status != CY_U3P_SUCCESS) {
           sensor_err("get icm data err\r\n");
+      } else {
+        uint32_t now = fx3_ticks();
+
+        if (imuTicks)
+          hist_add(HIST_IMU_INTERVAL, TICKS_TO_US(now - imuTicks));
+        imuTicks = now;
       }
       int i = 0;
       for (i = 0; i < 6; ++i) {
@@ -1606,23 +1986,30 @@ void Data_handle_Thread_Entry(uint32_t input) {
 #endif
     }
 
-    // bus keep standby more than 1s
-    if (glSuspendEnbl && count > 1000) {
+    // bus kept suspended for SUSPEND_DELAY_US
+    if (glSuspendEnbl && suspendTicks &&
+        TICKS_TO_US(fx3_ticks() - suspendTicks) >= SUSPEND_DELAY_US) {
       glWakeUpSrc      = CY_U3P_SYS_USB_BUS_ACTVTY_WAKEUP_SRC;
       glWakeUpPol      = CY_U3P_SYS_USB_BUS_ACTVTY_WAKEUP_SRC;
       glTriggerSuspend =  CyTrue;
-      count = 0;
+      // the FX3 can not wake on the IMU interrupt, the IMU waits in low power anyway
+      imu_idle_enter();
       // As hardware design error, tl59116 of XPIRL2 can't power down when cypress sleep, which will
       // make hepatgon can't turn on randomly.
-      if (sensor_type == XPIRL3 || sensor_type == XPIRL3_A)
+      if (sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
+        tlc59108_suspend();
         tlc_power_OFF();
+        tlcPoweredOff = CyTrue;
+      }
     }
     CyFxPowerManage();
+    // a resume or reset before a failed suspend entry was retried left the LED driver off
+    if (!glSuspendEnbl)
+      tlc_restore();
     /* Allow other ready threads to run before proceeding. */
     CyU3PThreadRelinquish();
 
     CyU3PThreadSleep(1);
-    count++;
   }
 }
 
@@ -1643,11 +2030,17 @@ void CyFxPowerManage(void) {
     apiRetStatus = CyU3PSysCheckSuspendParams(glWakeUpSrc, glWakeUpPol);
     if (apiRetStatus != CY_U3P_SUCCESS) {
         sensor_err("Suspend Param Verify Failed %d\r\n", apiRetStatus);
+        // try again after SUSPEND_DELAY_US while the bus stays suspended
+        suspendTicks = fx3_ticks() | 1;
     } else {
+      hist_add(HIST_SUSPEND_ENTRY, TICKS_TO_US(fx3_ticks() - suspendTicks));
       apiRetStatus = CyU3PSysEnterSuspendMode(glWakeUpSrc, glWakeUpPol, &waketype);
       if (apiRetStatus != CY_U3P_SUCCESS) {
         sensor_dbg("Enter Suspend returned %d\r\n", apiRetStatus);
+        suspendTicks = fx3_ticks() | 1;
       } else {
+        suspendTicks = 0;
+        resumeTicks = fx3_ticks() | 1;
         if (waketype != glWakeUpSrc) {
           sensor_dbg("Invalid Wakeup Source %d\r\n", waketype);
         }
@@ -1658,30 +2051,49 @@ void CyFxPowerManage(void) {
 
         sensor_dbg("Suspend Wakeup Success wakeup source %d\r\n", waketype);
       }
-      // TODO(zhoury) resume XPIRL3 and XPIRL3_A
-      if (sensor_type == XPIRL3 || sensor_type == XPIRL3_A) {
-        tlc_power_ON();
-        CyU3PThreadSleep(10);
-        tlc59108_init();
-      }
+      tlc_restore();
     }
   }
 }
+
+/**
+ *  @brief      power the LED driver back on after a suspend and write its saved state back.
+ *              The sensors stay powered and keep their registers, only the LED driver lost it.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+static void tlc_restore(void) {
+  if (!tlcPoweredOff)
+    return;
+  tlc_power_ON();
+  CyU3PThreadSleep(10);
+  tlc59108_resume();
+  tlcPoweredOff = CyFalse;
+}
 /*
  * This function is called by the FX3 framework once the ThreadX RTOS has started up.
  * The application specific threads and other OS resources are created and initialized here.
  */
 void CyFxApplicationDefine(void) {
-  void *ptr1, *ptr2, *ptr3;
+  void *ptr1, *ptr2, *ptr3, *ptr4, *ptr5;
   uint32_t retThrdCreate;
 
   /* Allocate the memory for the thread stacks. */
   ptr1 = CyU3PMemAlloc(UVC_APP_THREAD_STACK);
   ptr2 = CyU3PMemAlloc(UVC_APP_THREAD_STACK);
   ptr3 = CyU3PMemAlloc(UVC_APP_THREAD_STACK);
-  if ((ptr1 == 0) || (ptr2 == 0) || (ptr3 == 0))
+  ptr4 = CyU3PMemAlloc(VENDOR_BULK_THREAD_STACK);
+  ptr5 = CyU3PMemAlloc(CTRL_WORKER_THREAD_STACK);
+  if ((ptr1 == 0) || (ptr2 == 0) || (ptr3 == 0) || (ptr4 == 0) || (ptr5 == 0))
     goto fatalErrorHandler;
 
+  /* Fill the stacks for the profiler watermark, the order is the one of the profile XU. */
+  prof_thread_add(&uvcAppThread, ptr1, UVC_APP_THREAD_STACK);
+  prof_thread_add(&uvcAppEP0Thread, ptr2, UVC_APP_EP0_THREAD_STACK);
+  prof_thread_add(&Datahandle_Thread, ptr3, UVC_APP_EP0_THREAD_STACK);
+  prof_thread_add(&vendorBulkThread, ptr4, VENDOR_BULK_THREAD_STACK);
+  prof_thread_add(&ctrlWorkerThread, ptr5, CTRL_WORKER_THREAD_STACK);
+
   /* Create the UVC application thread. */
   retThrdCreate = CyU3PThreadCreate(&uvcAppThread,
                                      "UVC App Thread",
@@ -1726,6 +2138,34 @@ void CyFxApplicationDefine(void) {
     goto fatalErrorHandler;
   }
 
+  retThrdCreate = CyU3PThreadCreate(&vendorBulkThread,
+                                     "Vendor bulk Thread",
+                                     Vendor_Bulk_Thread_Entry,
+                                     0,
+                                     ptr4,
+                                     VENDOR_BULK_THREAD_STACK,
+                                     VENDOR_BULK_THREAD_PRIORITY,
+                                     VENDOR_BULK_THREAD_PRIORITY,
+                                     CYU3P_NO_TIME_SLICE,
+                                     CYU3P_AUTO_START);
+  if (retThrdCreate != 0) {
+    goto fatalErrorHandler;
+  }
+
+  retThrdCreate = CyU3PThreadCreate(&ctrlWorkerThread,
+                                     "Control worker Thread",
+                                     Ctrl_Worker_Thread_Entry,
+                                     0,
+                                     ptr5,
+                                     CTRL_WORKER_THREAD_STACK,
+                                     CTRL_WORKER_THREAD_PRIORITY,
+                                     CTRL_WORKER_THREAD_PRIORITY,
+                                     CYU3P_NO_TIME_SLICE,
+                                     CYU3P_AUTO_START);
+  if (retThrdCreate != 0) {
+    goto fatalErrorHandler;
+  }
+
   return;
 
 fatalErrorHandler:
@@ -0,0 +1,484 @@
+/******************************************************************************
+ * Copyright 2017-2018 Baidu Robotic Vision Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include <cyu3system.h>
+#include <cyu3os.h>
+#include <cyu3usb.h>
+#include <cyu3dma.h>
+#include <cyu3error.h>
+#include "include/debug.h"
+#include "include/uvc.h"
+#include "include/extension_unit.h"
+#include "include/xp_sensor_firmware_version.h"
+#include "include/vendor_bulk.h"
+#include "include/kv_store.h"
+#include "include/fw_update.h"
+#include "include/device_info.h"
+#include "include/trace.h"
+#include "include/timeline.h"
+#include "include/byte_order.h"
+
+static CyU3PDmaChannel glVendorOutHandle;  /* EP 4 OUT to CPU channel handle */
+static CyU3PDmaChannel glVendorInHandle;   /* CPU to EP 4 IN channel handle */
+static uint8_t reg_dump[VB_REG_DUMP_MAX * 2];
+static uint8_t trace_dump[TRACE_EVENTS * TRACE_EVENT_LEN];
+#ifdef SENSOR_TIMELINE
+static uint8_t timeline_dump[TIMELINE_RECORDS * TIMELINE_RECORD_LEN];
+#endif
+
+/**
+ *  @brief      max packet size of the vendor bulk endpoints at the current speed.
+ *  @param[out] NULL.
+ *  @return     packet size in bytes.
+ */
+static uint16_t vendor_bulk_pkt_size(void) {
+  return CyU3PUsbGetSpeed() == CY_U3P_SUPER_SPEED ? VENDOR_BULK_PKT_SIZE : 512;
+}
+
+/**
+ *  @brief      configure EP 4 OUT/IN and create the DMA channels to and from the CPU.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void vendor_bulk_init(void) {
+  CyU3PEpConfig_t endPointConfig;
+  CyU3PDmaChannelConfig_t dmaConfig;
+  CyU3PReturnStatus_t apiRetStatus;
+
+  CyU3PMemSet((uint8_t *)&endPointConfig, 0, sizeof(endPointConfig));
+  endPointConfig.enable   = 1;
+  endPointConfig.epType   = CY_U3P_USB_EP_BULK;
+  endPointConfig.pcktSize = VENDOR_BULK_PKT_SIZE;
+  endPointConfig.burstLen = VENDOR_BULK_BURST;
+  endPointConfig.isoPkts  = 0;
+  endPointConfig.streams  = 0;
+  apiRetStatus = CyU3PSetEpConfig(CY_FX_EP_PRODUCER, &endPointConfig);
+  if (apiRetStatus == CY_U3P_SUCCESS)
+    apiRetStatus = CyU3PSetEpConfig(CY_FX_EP_CONSUMER, &endPointConfig);
+  if (apiRetStatus != CY_U3P_SUCCESS) {
+    sensor_err("vendor bulk endpoint config failed, Error Code = %d\r\n", apiRetStatus);
+    CyFxAppErrorHandler(apiRetStatus);
+  }
+
+  CyU3PMemSet((uint8_t *)&dmaConfig, 0, sizeof(dmaConfig));
+  dmaConfig.size           = VENDOR_BULK_BUF_SIZE;
+  dmaConfig.count          = VENDOR_BULK_BUF_COUNT;
+  dmaConfig.prodAvailCount = 0;
+  dmaConfig.dmaMode        = CY_U3P_DMA_MODE_BYTE;
+  dmaConfig.prodHeader     = 0;
+  dmaConfig.prodFooter     = 0;
+  dmaConfig.consHeader     = 0;
+  dmaConfig.notification   = 0;
+  dmaConfig.cb             = NULL;
+
+  /* Commands and data from the host. */
+  dmaConfig.prodSckId = CY_FX_EP_PRODUCER1_SOCKET;
+  dmaConfig.consSckId = CY_U3P_CPU_SOCKET_CONS;
+  apiRetStatus = CyU3PDmaChannelCreate(&glVendorOutHandle, CY_U3P_DMA_TYPE_MANUAL_IN, &dmaConfig);
+  if (apiRetStatus != CY_U3P_SUCCESS) {
+    sensor_err("vendor bulk OUT channel creation failed, Error Code = %d\r\n", apiRetStatus);
+    CyFxAppErrorHandler(apiRetStatus);
+  }
+
+  /* Status and data to the host. */
+  dmaConfig.prodSckId = CY_U3P_CPU_SOCKET_PROD;
+  dmaConfig.consSckId = CY_FX_EP_CONSUMER2_SOCKET;
+  apiRetStatus = CyU3PDmaChannelCreate(&glVendorInHandle, CY_U3P_DMA_TYPE_MANUAL_OUT, &dmaConfig);
+  if (apiRetStatus != CY_U3P_SUCCESS) {
+    sensor_err("vendor bulk IN channel creation failed, Error Code = %d\r\n", apiRetStatus);
+    CyFxAppErrorHandler(apiRetStatus);
+  }
+
+  CyU3PDmaChannelSetXfer(&glVendorOutHandle, 0);
+  CyU3PDmaChannelSetXfer(&glVendorInHandle, 0);
+}
+
+/**
+ *  @brief      drop whatever is queued on the vendor bulk pipes, on USB reset or clear feature.
+ *  @param[out] NULL.
+ *  @return     NULL.
+ */
+void vendor_bulk_reset(void) {
+  CyU3PUsbSetEpNak(CY_FX_EP_PRODUCER, CyTrue);
+  CyU3PUsbSetEpNak(CY_FX_EP_CONSUMER, CyTrue);
+  CyU3PBusyWait(100);
+
+  CyU3PDmaChannelReset(&glVendorOutHandle);
+  CyU3PDmaChannelReset(&glVendorInHandle);
+  CyU3PUsbFlushEp(CY_FX_EP_PRODUCER);
+  CyU3PUsbFlushEp(CY_FX_EP_CONSUMER);
+  CyU3PDmaChannelSetXfer(&glVendorOutHandle, 0);
+  CyU3PDmaChannelSetXfer(&glVendorInHandle, 0);
+
+  CyU3PUsbSetEpNak(CY_FX_EP_PRODUCER, CyFalse);
+  CyU3PUsbSetEpNak(CY_FX_EP_CONSUMER, CyFalse);
+  CyU3PBusyWait(100);
+}
+
+/**
+ *  @brief      send the status header of a command.
+ *  @param[in]  cmd       command header, magic, cmd, addr and tag are echoed.
+ *  @param[in]  status    VB_STATUS.
+ *  @param[in]  len       bytes of data following the status.
+ *  @return     CY_U3P_SUCCESS if the status is queued.
+ */
+static CyU3PReturnStatus_t vendor_bulk_send_status(const uint8_t *cmd, uint8_t status,
+                                                   uint32_t len) {
+  CyU3PDmaBuffer_t buf;
+  CyU3PReturnStatus_t apiRetStatus;
+
+  apiRetStatus = CyU3PDmaChannelGetBuffer(&glVendorInHandle, &buf, VENDOR_BULK_TIMEOUT);
+  if (apiRetStatus != CY_U3P_SUCCESS)
+    return apiRetStatus;
+  CyU3PMemCopy(buf.buffer, (uint8_t *)cmd, VB_HEADER_LEN);
+  buf.buffer[3] = status;
+  put_be32(&buf.buffer[8], len);
+  return CyU3PDmaChannelCommitBuffer(&glVendorInHandle, VB_HEADER_LEN, 0);
+}
+
+/**
+ *  @brief      send a data phase, each DMA buffer is filled in place by fill.
+ *  @param[in]  addr      source address passed to fill for the first buffer.
+ *  @param[in]  len       total bytes.
+ *  @param[in]  fill      fills count bytes from addr into buffer.
+ *  @return     CY_U3P_SUCCESS if all data is queued.
+ */
+static CyU3PReturnStatus_t vendor_bulk_send_data(uint32_t addr, uint32_t len,
+    CyU3PReturnStatus_t (*fill)(uint32_t addr, uint16_t count, uint8_t *buffer)) {
+  CyU3PDmaBuffer_t buf;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+  uint32_t offset = 0;
+  uint16_t count;
+
+  while (offset < len) {
+    apiRetStatus = CyU3PDmaChannelGetBuffer(&glVendorInHandle, &buf, VENDOR_BULK_TIMEOUT);
+    if (apiRetStatus != CY_U3P_SUCCESS)
+      return apiRetStatus;
+    count = (len - offset) > VENDOR_BULK_BUF_SIZE ? VENDOR_BULK_BUF_SIZE : (len - offset);
+    apiRetStatus = fill(addr + offset, count, buf.buffer);
+    if (apiRetStatus != CY_U3P_SUCCESS) {
+      /* A short packet ends the data phase early, the host sees the missing bytes. */
+      CyU3PDmaChannelCommitBuffer(&glVendorInHandle, 0, 0);
+      return apiRetStatus;
+    }
+    apiRetStatus = CyU3PDmaChannelCommitBuffer(&glVendorInHandle, count, 0);
+    if (apiRetStatus != CY_U3P_SUCCESS)
+      return apiRetStatus;
+    offset += count;
+  }
+  if ((len % vendor_bulk_pkt_size()) == 0) {
+    apiRetStatus = CyU3PDmaChannelGetBuffer(&glVendorInHandle, &buf, VENDOR_BULK_TIMEOUT);
+    if (apiRetStatus == CY_U3P_SUCCESS)
+      apiRetStatus = CyU3PDmaChannelCommitBuffer(&glVendorInHandle, 0, 0);
+  }
+  return apiRetStatus;
+}
+
+static CyU3PReturnStatus_t fill_flash(uint32_t addr, uint16_t count, uint8_t *buffer) {
+  return CyFxFlashProgSpiTransfer(addr / SPI_FLASH_PAGE_SIZE, count, buffer, CyTrue);
+}
+
+static CyU3PReturnStatus_t fill_reg_dump(uint32_t offset, uint16_t count, uint8_t *buffer) {
+  CyU3PMemCopy(buffer, &reg_dump[offset], count);
+  return CY_U3P_SUCCESS;
+}
+
+static CyU3PReturnStatus_t fill_trace(uint32_t offset, uint16_t count, uint8_t *buffer) {
+  CyU3PMemCopy(buffer, &trace_dump[offset], count);
+  return CY_U3P_SUCCESS;
+}
+
+#ifdef SENSOR_TIMELINE
+static CyU3PReturnStatus_t fill_timeline(uint32_t offset, uint16_t count, uint8_t *buffer) {
+  CyU3PMemCopy(buffer, &timeline_dump[offset], count);
+  return CY_U3P_SUCCESS;
+}
+#endif
+
+static CyU3PReturnStatus_t fill_fw_status(uint32_t offset, uint16_t count, uint8_t *buffer) {
+  fw_update_status(buffer);
+  return CY_U3P_SUCCESS;
+}
+
+static CyU3PReturnStatus_t fill_info(uint32_t offset, uint16_t count, uint8_t *buffer) {
+  CyU3PMemSet(buffer, 0, VB_INFO_LEN);
+  buffer[0] = VB_PROTOCOL_VERSION;
+  buffer[1] = sensor_type;
+  buffer[2] = VENDOR_BULK_BUF_SIZE >> 8;
+  buffer[3] = VENDOR_BULK_BUF_SIZE & 0xFF;
+  put_be32(&buffer[4], SPI_FLASH_SIZE);
+  CyU3PMemCopy(&buffer[8], (uint8_t *)FIRMWARE_VERSION,
+               sizeof(FIRMWARE_VERSION) < 32 ? sizeof(FIRMWARE_VERSION) : 32);
+  return CY_U3P_SUCCESS;
+}
+
+/**
+ *  @brief      receive the FLASH_WRITE data phase and program it page by page.
+ *  @param[in]  addr      page aligned flash byte address.
+ *  @param[in]  len       bytes announced by the command.
+ *  @param[in]  status    VB_STATUS of the argument check, data is drained but not written if
+ *                        it is not VB_STATUS_OK.
+ *  @return     VB_STATUS.
+ */
+static uint8_t vendor_bulk_recv_flash(uint32_t addr, uint32_t len, uint8_t status) {
+  CyU3PDmaBuffer_t buf;
+  uint32_t received = 0;
+  uint16_t pad;
+  CyBool_t last;
+
+  do {
+    if (CyU3PDmaChannelGetBuffer(&glVendorOutHandle, &buf, VENDOR_BULK_TIMEOUT) !=
+        CY_U3P_SUCCESS) {
+      sensor_err("vendor bulk: flash data timeout at %d of %d bytes\r\n", received, len);
+      return VB_STATUS_IO_ERROR;
+    }
+    if (status == VB_STATUS_OK && buf.count > 0) {
+      if (received + buf.count > len) {
+        status = VB_STATUS_BAD_ARG;
+      } else {
+        /* Only the last buffer can be short, fill the rest of its page with erased bytes. */
+        pad = (SPI_FLASH_PAGE_SIZE - (buf.count % SPI_FLASH_PAGE_SIZE)) % SPI_FLASH_PAGE_SIZE;
+        CyU3PMemSet(buf.buffer + buf.count, 0xFF, pad);
+        if (CyFxFlashProgSpiTransfer((addr + received) / SPI_FLASH_PAGE_SIZE, buf.count,
+                                     buf.buffer, CyFalse) != CY_U3P_SUCCESS)
+          status = VB_STATUS_IO_ERROR;
+      }
+    }
+    received += buf.count;
+    last = (buf.count < VENDOR_BULK_BUF_SIZE);
+    CyU3PDmaChannelDiscardBuffer(&glVendorOutHandle);
+  } while (!last);
+
+  if (status == VB_STATUS_OK && received != len)
+    status = VB_STATUS_BAD_ARG;
+  return status;
+}
+
+/**
+ *  @brief      erase the flash sectors covering [addr, addr + len).
+ *  @param[in]  addr      sector aligned flash byte address.
+ *  @param[in]  len       bytes to erase.
+ *  @return     VB_STATUS.
+ */
+static uint8_t vendor_bulk_erase_flash(uint32_t addr, uint32_t len) {
+  uint8_t sector = addr / SPI_FLASH_SECTOR_SIZE;
+  uint8_t end = (addr + len + SPI_FLASH_SECTOR_SIZE - 1) / SPI_FLASH_SECTOR_SIZE;
+
+  for (; sector < end; sector++) {
+    sensor_dbg("vendor bulk: erase sector %d\r\n", sector);
+    if (CyFxFlashProgEraseSectorWait(sector) != CY_U3P_SUCCESS)
+      return VB_STATUS_IO_ERROR;
+  }
+  return VB_STATUS_OK;
+}
+
+/**
+ *  @brief      read a register range into reg_dump, MSB first.
+ *  @param[in]  dev       REG_BATCH_DEV.
+ *  @param[in]  first     first register.
+ *  @param[in]  num       register count.
+ *  @return     VB_STATUS.
+ */
+static uint8_t vendor_bulk_reg_dump(uint8_t dev, uint16_t first, uint16_t num) {
+  uint8_t entry[REG_BATCH_ENTRY_LEN];
+  uint8_t status = VB_STATUS_OK;
+  uint16_t i;
+
+  for (i = 0; i < num; i++) {
+    entry[0] = dev;
+    entry[1] = REG_OP_READ;
+    entry[2] = (first + i) >> 8;
+    entry[3] = (first + i) & 0xFF;
+    entry[4] = 0;
+    entry[5] = 0;
+    if (reg_batch_exec(entry))
+      status = VB_STATUS_IO_ERROR;
+    reg_dump[i * 2] = entry[4];
+    reg_dump[i * 2 + 1] = entry[5];
+  }
+  return status;
+}
+
+/**
+ *  @brief      reload device info, calibration and kv index if [addr, addr + len) touched them.
+ *  @param[in]  addr      flash byte address.
+ *  @param[in]  len       bytes.
+ *  @return     NULL.
+ */
+static void vendor_bulk_flash_changed(uint32_t addr, uint32_t len) {
+  uint32_t msg = DEVICE_MSG_ADDR * SPI_FLASH_PAGE_SIZE;
+  uint32_t calib = DEVICE_CALIB_ADDR * SPI_FLASH_PAGE_SIZE;
+
+  if (len && addr < msg + SPI_FLASH_SECTOR_SIZE && addr + len > msg)
+    device_info_load();
+  if (len && addr < calib + SPI_FLASH_SECTOR_SIZE && addr + len > calib)
+    calib_cache_load();
+  if (len && addr + len > KV_SECTOR_A * SPI_FLASH_SECTOR_SIZE)
+    kv_init();
+}
+
+/**
+ *  @brief      execute one vendor bulk command and send its reply.
+ *  @param[in]  cmd       command header.
+ *  @return     NULL.
+ */
+static void vendor_bulk_exec(const uint8_t *cmd) {
+  uint32_t addr = get_be32(&cmd[4]);
+  uint32_t len = get_be32(&cmd[8]);
+  uint8_t status = VB_STATUS_OK;
+  CyU3PReturnStatus_t apiRetStatus = CY_U3P_SUCCESS;
+
+  switch (cmd[2]) {
+  case VB_CMD_INFO:
+    apiRetStatus = vendor_bulk_send_status(cmd, VB_STATUS_OK, VB_INFO_LEN);
+    if (apiRetStatus == CY_U3P_SUCCESS)
+      apiRetStatus = vendor_bulk_send_data(0, VB_INFO_LEN, fill_info);
+    break;
+
+  case VB_CMD_FLASH_READ:
+    if ((addr % SPI_FLASH_PAGE_SIZE) || addr > SPI_FLASH_SIZE || len > SPI_FLASH_SIZE - addr) {
+      apiRetStatus = vendor_bulk_send_status(cmd, VB_STATUS_BAD_ARG, 0);
+      break;
+    }
+    apiRetStatus = vendor_bulk_send_status(cmd, VB_STATUS_OK, len);
+    if (apiRetStatus == CY_U3P_SUCCESS)
+      apiRetStatus = vendor_bulk_send_data(addr, len, fill_flash);
+    break;
+
+  case VB_CMD_FLASH_WRITE:
+    if ((addr % SPI_FLASH_PAGE_SIZE) || addr > SPI_FLASH_SIZE || len > SPI_FLASH_SIZE - addr)
+      status = VB_STATUS_BAD_ARG;
+    status = vendor_bulk_recv_flash(addr, len, status);
+    if (status == VB_STATUS_OK)
+      vendor_bulk_flash_changed(addr, len);
+    apiRetStatus = vendor_bulk_send_status(cmd, status, 0);
+    break;
+
+  case VB_CMD_FLASH_ERASE:
+    if ((addr % SPI_FLASH_SECTOR_SIZE) || addr > SPI_FLASH_SIZE || len > SPI_FLASH_SIZE - addr)
+      status = VB_STATUS_BAD_ARG;
+    else
+      status = vendor_bulk_erase_flash(addr, len);
+    if (status == VB_STATUS_OK)
+      vendor_bulk_flash_changed(addr, len);
+    apiRetStatus = vendor_bulk_send_status(cmd, status, 0);
+    break;
+
+  case VB_CMD_REG_DUMP:
+    if (len > VB_REG_DUMP_MAX || addr > 0x10000 - len) {
+      apiRetStatus = vendor_bulk_send_status(cmd, VB_STATUS_BAD_ARG, 0);
+      break;
+    }
+    status = vendor_bulk_reg_dump(cmd[3], addr, len);
+    apiRetStatus = vendor_bulk_send_status(cmd, status, len * 2);
+    if (apiRetStatus == CY_U3P_SUCCESS)
+      apiRetStatus = vendor_bulk_send_data(0, len * 2, fill_reg_dump);
+    break;
+
+  case VB_CMD_FW_BEGIN:
+    status = fw_update_begin(len, addr);
+    apiRetStatus = vendor_bulk_send_status(cmd, status, 0);
+    break;
+
+  case VB_CMD_FW_WRITE:
+    if (!fw_update_write_ok(addr, len))
+      status = VB_STATUS_BAD_ARG;
+    status = vendor_bulk_recv_flash(FW_STAGING_ADDR + addr, len, status);
+    apiRetStatus = vendor_bulk_send_status(cmd, status, 0);
+    break;
+
+  case VB_CMD_FW_COMMIT:
+    status = fw_update_commit(addr);
+    apiRetStatus = vendor_bulk_send_status(cmd, status, 0);
+    if (status == VB_STATUS_OK) {
+      /* Give the status time to reach the host, then boot the new image. */
+      CyU3PThreadSleep(100);
+      CyU3PDeviceReset(CyFalse);
+    }
+    break;
+
+  case VB_CMD_FW_STATUS:
+    apiRetStatus = vendor_bulk_send_status(cmd, VB_STATUS_OK, FW_STATUS_LEN);
+    if (apiRetStatus == CY_U3P_SUCCESS)
+      apiRetStatus = vendor_bulk_send_data(0, FW_STATUS_LEN, fill_fw_status);
+    break;
+
+  case VB_CMD_TRACE_READ: {
+    uint8_t reply[VB_HEADER_LEN];
+    uint32_t lost;
+
+    if (len > sizeof(trace_dump))
+      len = sizeof(trace_dump);
+    len = trace_read(trace_dump, len / TRACE_EVENT_LEN, &lost) * TRACE_EVENT_LEN;
+    CyU3PMemCopy(reply, (uint8_t *)cmd, VB_HEADER_LEN);
+    put_be32(&reply[4], lost);
+    apiRetStatus = vendor_bulk_send_status(reply, VB_STATUS_OK, len);
+    if (apiRetStatus == CY_U3P_SUCCESS && len)
+      apiRetStatus = vendor_bulk_send_data(0, len, fill_trace);
+    break;
+  }
+
+#ifdef SENSOR_TIMELINE
+  case VB_CMD_TIMELINE_READ: {
+    uint8_t reply[VB_HEADER_LEN];
+    uint32_t lost;
+
+    if (len > sizeof(timeline_dump))
+      len = sizeof(timeline_dump);
+    len = timeline_read(timeline_dump, len / TIMELINE_RECORD_LEN, &lost) * TIMELINE_RECORD_LEN;
+    CyU3PMemCopy(reply, (uint8_t *)cmd, VB_HEADER_LEN);
+    put_be32(&reply[4], lost);
+    apiRetStatus = vendor_bulk_send_status(reply, VB_STATUS_OK, len);
+    if (apiRetStatus == CY_U3P_SUCCESS && len)
+      apiRetStatus = vendor_bulk_send_data(0, len, fill_timeline);
+    break;
+  }
+#endif
+
+  default:
+    sensor_err("unknown vendor bulk cmd: 0x%x\r\n", cmd[2]);
+    apiRetStatus = vendor_bulk_send_status(cmd, VB_STATUS_BAD_CMD, 0);
+    break;
+  }
+  if (apiRetStatus != CY_U3P_SUCCESS)
+    sensor_err("vendor bulk cmd 0x%x reply failed, Error Code = %d\r\n", cmd[2], apiRetStatus);
+}
+
+/**
+ *  @brief      vendor bulk thread, waits for commands on EP 4 OUT.
+ *  @param[in]  input     thread input, unused.
+ *  @return     NULL.
+ */
+void Vendor_Bulk_Thread_Entry(uint32_t input) {
+  CyU3PDmaBuffer_t buf;
+  uint8_t cmd[VB_HEADER_LEN];
+
+  for (;;) {
+    if (CyU3PDmaChannelGetBuffer(&glVendorOutHandle, &buf, CYU3P_WAIT_FOREVER) !=
+        CY_U3P_SUCCESS) {
+      /* Channel was reset under us, wait for the next command. */
+      CyU3PThreadSleep(10);
+      continue;
+    }
+    if (buf.count != VB_HEADER_LEN || ((buf.buffer[0] << 8) | buf.buffer[1]) != VB_MAGIC) {
+      sensor_err("vendor bulk: bad command, %d bytes\r\n", buf.count);
+      CyU3PDmaChannelDiscardBuffer(&glVendorOutHandle);
+      continue;
+    }
+    CyU3PMemCopy(cmd, buf.buffer, VB_HEADER_LEN);
+    CyU3PDmaChannelDiscardBuffer(&glVendorOutHandle);
+    vendor_bulk_exec(cmd);
+  }
+}